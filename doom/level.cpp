@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
 #include "common.hpp"
 #include "logger.hpp"
 #include "level.hpp"
@@ -42,6 +43,97 @@ char *strupr ( char *ptr )
 
 #endif
 
+//----------------------------------------------------------------------------
+//  VertexHash: the (x,y) coordinates are packed into 32 bits and hashed to
+//    find a slot.  Collisions are resolved by probing the following slots.
+//    The table is kept at most half full.
+//----------------------------------------------------------------------------
+
+VertexHash::VertexHash ( int size ) :
+    m_Table ( NULL ),
+    m_Bits ( 4 ),
+    m_Count ( 0 )
+{
+    FUNCTION_ENTRY ( this, "VertexHash ctor", true );
+
+    while (( 1 << m_Bits ) < 2 * size ) m_Bits++;
+
+    m_Table = new int [ 1 << m_Bits ];
+    memset ( m_Table, -1, sizeof ( int ) * ( 1 << m_Bits ));
+}
+
+VertexHash::~VertexHash ()
+{
+    FUNCTION_ENTRY ( this, "VertexHash dtor", true );
+
+    delete [] m_Table;
+}
+
+int VertexHash::Slot ( int x, int y ) const
+{
+    UINT32 key  = ( UINT16 ) x | (( UINT32 ) ( UINT16 ) y << 16 );
+    UINT32 hash = ( UINT32 ) ( key * 0x9E3779B1UL );
+
+    return ( int ) ( hash >> ( 32 - m_Bits ));
+}
+
+void VertexHash::Grow ( const wVertex *vertex )
+{
+    FUNCTION_ENTRY ( this, "VertexHash::Grow", true );
+
+    int *oldTable = m_Table;
+    int  oldSize  = 1 << m_Bits;
+
+    m_Bits++;
+    m_Table = new int [ 1 << m_Bits ];
+    memset ( m_Table, -1, sizeof ( int ) * ( 1 << m_Bits ));
+
+    int mask = ( 1 << m_Bits ) - 1;
+    for ( int i = 0; i < oldSize; i++ ) {
+        int index = oldTable [i];
+        if ( index == -1 ) continue;
+        int slot = Slot ( vertex [index].x, vertex [index].y );
+        while ( m_Table [slot] != -1 ) slot = ( slot + 1 ) & mask;
+        m_Table [slot] = index;
+    }
+
+    delete [] oldTable;
+}
+
+//----------------------------------------------------------------------------
+//  Return the lowest index of a vertex at (x,y), or -1 if there isn't one.
+//----------------------------------------------------------------------------
+
+int VertexHash::Find ( const wVertex *vertex, int x, int y ) const
+{
+    FUNCTION_ENTRY ( this, "VertexHash::Find", true );
+
+    int found = -1;
+    int mask  = ( 1 << m_Bits ) - 1;
+    for ( int slot = Slot ( x, y ); m_Table [slot] != -1; slot = ( slot + 1 ) & mask ) {
+        int index = m_Table [slot];
+        if (( vertex [index].x == x ) && ( vertex [index].y == y )) {
+            if (( found == -1 ) || ( index < found )) found = index;
+        }
+    }
+
+    return found;
+}
+
+void VertexHash::Insert ( const wVertex *vertex, int index )
+{
+    FUNCTION_ENTRY ( this, "VertexHash::Insert", true );
+
+    if ( 2 * ( m_Count + 1 ) > ( 1 << m_Bits )) Grow ( vertex );
+
+    int mask = ( 1 << m_Bits ) - 1;
+    int slot = Slot ( vertex [index].x, vertex [index].y );
+    while ( m_Table [slot] != -1 ) slot = ( slot + 1 ) & mask;
+    m_Table [slot] = index;
+
+    m_Count++;
+}
+
 DoomLevel::sLevelLump::sLevelLump () :
     changed ( false ),
     byteOrder ( BYTE_ORDER ),
@@ -58,6 +150,7 @@ DoomLevel::DoomLevel ( const char *_name, WAD *_wad, bool bLoadData ) :
     m_Title ( NULL ),
     m_Music ( NULL ),
     m_Cluster ( 0 ),
+    m_NodeFormat ( NODES_VANILLA ),
     m_ThingData ( NULL ),
     m_LineDefData ( NULL )
 {
@@ -74,6 +167,15 @@ DoomLevel::DoomLevel ( const char *_name, WAD *_wad, bool bLoadData ) :
         m_Name[i] = ( char ) toupper ( _name[i] );
     }
 
+    // Names that don't fit after "GL_" use GL_LEVEL (the real name is in the lump)
+    memset ( m_GLName, 0, sizeof ( m_GLName ));
+    if ( strlen ( _name ) <= 5 ) {
+        memcpy ( m_GLName, "GL_", 3 );
+        memcpy ( m_GLName + 3, m_Name, 5 );
+    } else {
+        memcpy ( m_GLName, "GL_LEVEL", 8 );
+    }
+
     m_Map.elementSize       = 1;
     m_Thing.elementSize     = 1;
     m_LineDef.elementSize   = 1;
@@ -86,6 +188,11 @@ DoomLevel::DoomLevel ( const char *_name, WAD *_wad, bool bLoadData ) :
     m_Reject.elementSize    = 1;
     m_BlockMap.elementSize  = 1;
     m_Behavior.elementSize  = 1;
+    m_GLMap.elementSize     = 1;
+    m_GLVert.elementSize    = 1;
+    m_GLSegs.elementSize    = 1;
+    m_GLSSect.elementSize   = 1;
+    m_GLNodes.elementSize   = 1;
 
     if ( bLoadData == true ) Load ();
 
@@ -152,7 +259,8 @@ bool DoomLevel::IsValid ( bool checkBSP, bool print ) const
 
     delete [] used;
 
-    if ( checkBSP == true ) {
+    // Extended NODES are written by NewExtendedNodes and aren't decoded here
+    if (( checkBSP == true ) && ( m_NodeFormat == NODES_VANILLA )) {
 
         // Sanity check for SEGS
         const wSegs *segs = GetSegs ();
@@ -250,6 +358,7 @@ bool DoomLevel::IsDirty () const
     if ( m_Reject.changed == true ) return true;
     if ( m_BlockMap.changed == true ) return true;
     if ( m_Behavior.changed == true ) return true;
+    if ( m_GLMap.changed == true ) return true;
 
     return false;
 }
@@ -283,6 +392,11 @@ void DoomLevel::CleanUp ()
     CleanUpEntry ( &m_Reject );
     CleanUpEntry ( &m_BlockMap );
     CleanUpEntry ( &m_Behavior );
+    CleanUpEntry ( &m_GLMap );
+    CleanUpEntry ( &m_GLVert );
+    CleanUpEntry ( &m_GLSegs );
+    CleanUpEntry ( &m_GLSSect );
+    CleanUpEntry ( &m_GLNodes );
 
     delete [] m_ThingData;
     delete [] m_LineDefData;
@@ -397,7 +511,7 @@ void DoomLevel::AdjustByteOrderSegs ( int byteOrder )
 {
     FUNCTION_ENTRY ( this, "DoomLevel::AdjustByteOrderSegs", true );
 
-    if ( m_Segs.byteOrder != byteOrder ) {
+    if (( m_Segs.byteOrder != byteOrder ) && ( m_NodeFormat == NODES_VANILLA )) {
         wSegs *segs = ( wSegs * ) m_Segs.rawData;
         for ( int i = 0; i < m_Segs.elementCount; i++ ) {
             segs [i].start   = SWAP_ENDIAN_16 ( segs [i].start );
@@ -416,7 +530,7 @@ void DoomLevel::AdjustByteOrderSubSector ( int byteOrder )
 {
     FUNCTION_ENTRY ( this, "DoomLevel::AdjustByteOrderSubSector", true );
 
-    if ( m_SubSector.byteOrder != byteOrder ) {
+    if (( m_SubSector.byteOrder != byteOrder ) && ( m_NodeFormat == NODES_VANILLA )) {
         wSSector *ssector = ( wSSector * ) m_SubSector.rawData;
         for ( int i = 0; i < m_SubSector.elementCount; i++ ) {
             ssector [i].num   = SWAP_ENDIAN_16 ( ssector [i].num );
@@ -431,7 +545,7 @@ void DoomLevel::AdjustByteOrderNode ( int byteOrder )
 {
     FUNCTION_ENTRY ( this, "DoomLevel::AdjustByteOrderNode", true );
 
-    if ( m_Node.byteOrder != byteOrder ) {
+    if (( m_Node.byteOrder != byteOrder ) && ( m_NodeFormat == NODES_VANILLA )) {
         // The entire structure is composed of 16-bit entries
         UINT16 *ptr = ( UINT16 * ) m_Node.rawData;
         for ( int i = 0; i < ( int ) m_Node.dataSize / 2; i++ ) {
@@ -511,7 +625,7 @@ void DoomLevel::ReplaceVertices ( int *map, wVertex *newVertices, int count )
     m_LineDef.changed = true;
 
     wSegs *segs = ( wSegs * ) GetSegs ();
-    for ( int i = 0; i < SegCount (); i++ ) {
+    for ( int i = 0; ( m_NodeFormat == NODES_VANILLA ) && ( i < SegCount ()); i++ ) {
         segs [i].start = ( UINT16 ) map [ segs [i].start ];
         segs [i].end   = ( UINT16 ) map [ segs [i].end ];
     }
@@ -540,7 +654,7 @@ void DoomLevel::TrimVertices ()
     }
 
     wSegs *segs = ( wSegs * ) GetSegs ();
-    for ( int i = 0; i < SegCount (); i++ ) {
+    for ( int i = 0; ( m_NodeFormat == NODES_VANILLA ) && ( i < SegCount ()); i++ ) {
         used [ segs [i].start ] = 1;
         used [ segs [i].end ]   = 1;
     }
@@ -573,15 +687,16 @@ void DoomLevel::PackVertices ()
     memset ( used, 0, sizeof ( int ) * VertexCount ());
 
     int count = 0;
-    UINT32 *vert = ( UINT32 * ) m_Vertex.rawData;
+    const wVertex *vert = GetVertices ();
+    VertexHash hash ( VertexCount ());
 
-    for ( int i = 0, j; i < VertexCount (); i++ ) {
-        UINT32 currentVert = vert [i];
-        for ( j = 0; j < i; j++ ) {
-            if ( vert [j] == currentVert ) break;
+    for ( int i = 0; i < VertexCount (); i++ ) {
+        int j = hash.Find ( vert, vert [i].x, vert [i].y );
+        if ( j == -1 ) {
+            hash.Insert ( vert, j = i );
+            count++;
         }
         used [i] = j;
-        if ( i == j ) count++;
     }
 
     if ( VertexCount () == count ) {
@@ -839,6 +954,35 @@ void DoomLevel::DetermineType ()
     fprintf ( stderr, "Argh!!!\n" );
 }
 
+//----------------------------------------------------------------------------
+//  Extended NODES are identified by a signature at the start of the NODES
+//    lump.  They are kept as they were read, so the SEGS, SSECTORS & NODES
+//    are treated as empty by everything else.
+//----------------------------------------------------------------------------
+
+void DoomLevel::DetermineNodeFormat ()
+{
+    FUNCTION_ENTRY ( this, "DoomLevel::DetermineNodeFormat", true );
+
+    m_NodeFormat = NODES_VANILLA;
+
+    const char *data = ( const char * ) m_Node.rawData;
+
+    if (( m_Node.dataSize >= 8 ) && ( memcmp ( data, "xNd4\0\0\0\0", 8 ) == 0 )) {
+        m_NodeFormat = NODES_DEEPBSP;
+    } else if (( m_Node.dataSize >= 4 ) && ( memcmp ( data, "XNOD", 4 ) == 0 )) {
+        m_NodeFormat = NODES_XNOD;
+    } else if (( m_Node.dataSize >= 4 ) && ( memcmp ( data, "ZNOD", 4 ) == 0 )) {
+        m_NodeFormat = NODES_ZNOD;
+    }
+
+    if ( m_NodeFormat != NODES_VANILLA ) {
+        m_Segs.elementCount      = 0;
+        m_SubSector.elementCount = 0;
+        m_Node.elementCount      = 0;
+    }
+}
+
 bool DoomLevel::Load ()
 {
     FUNCTION_ENTRY ( this, "DoomLevel::Load", true );
@@ -866,6 +1010,8 @@ bool DoomLevel::Load ()
     valid &= ReadEntry ( &m_BlockMap,  "BLOCKMAP", start, end, false );
     valid &= ReadEntry ( &m_Behavior,  "BEHAVIOR", start, end, false );
 
+    DetermineNodeFormat ();
+
     if ( RejectSize () != 0 ) {
         int mask = ( 0xFF >> ( RejectSize () * 8 - SectorCount () * SectorCount ())) & 0xFF;
         (( UINT8 * ) m_Reject.rawData ) [ RejectSize () - 1 ] &= ( UINT8 ) mask;
@@ -983,6 +1129,14 @@ void DoomLevel::AddToWAD ( WAD *m_Wad )
         m_Wad->InsertAfter (( const wLumpName * ) "BEHAVIOR", m_Behavior.dataSize,  m_Behavior.rawData,  false );
     }
 
+    if ( m_GLMap.rawData != NULL ) {
+        m_Wad->InsertAfter (( const wLumpName * ) m_GLName,   m_GLMap.dataSize,     m_GLMap.rawData,     false );
+        m_Wad->InsertAfter (( const wLumpName * ) "GL_VERT",  m_GLVert.dataSize,    m_GLVert.rawData,    false );
+        m_Wad->InsertAfter (( const wLumpName * ) "GL_SEGS",  m_GLSegs.dataSize,    m_GLSegs.rawData,    false );
+        m_Wad->InsertAfter (( const wLumpName * ) "GL_SSECT", m_GLSSect.dataSize,   m_GLSSect.rawData,   false );
+        m_Wad->InsertAfter (( const wLumpName * ) "GL_NODES", m_GLNodes.dataSize,   m_GLNodes.rawData,   false );
+    }
+
     // Switch back to native byte ordering
     AdjustByteOrder ( BYTE_ORDER );
 }
@@ -1055,6 +1209,72 @@ bool DoomLevel::UpdateEntry ( sLevelLump *lump, const char *name, const char *fo
     return changed;
 }
 
+//----------------------------------------------------------------------------
+//  The GL lumps aren't part of the level itself - they follow the GL_<map>
+//    marker, which normally comes right after the level.
+//----------------------------------------------------------------------------
+
+bool DoomLevel::UpdateGLEntry ( sLevelLump *lump, const char *name, const char *follows )
+{
+    FUNCTION_ENTRY ( this, "DoomLevel::UpdateGLEntry", true );
+
+    lump->changed = false;
+
+    // Look the marker up again - inserting an entry can move the directory
+    const wadDirEntry *start = m_Wad->FindDir ( m_GLName, m_Wad->FindDir ( Name ()));
+    const wadDirEntry *end   = m_Wad->GetDir ( m_Wad->DirSize () - 1 );
+    if ( start + 4 < end ) end = start + 4;
+
+    const wadDirEntry *dir = m_Wad->FindDir ( name, start, end );
+    if ( dir != NULL ) {
+        return m_Wad->WriteEntry ( dir, lump->dataSize, lump->rawData, false );
+    }
+
+    const wadDirEntry *last = ( follows != NULL ) ? m_Wad->FindDir ( follows, start, end ) : NULL;
+
+    return m_Wad->InsertAfter (( const wLumpName * ) name, lump->dataSize, lump->rawData, false, last ? last : start );
+}
+
+static bool IsLevelLump ( const char *name )
+{
+    static const char *lumpName [] = {
+        "THINGS", "LINEDEFS", "SIDEDEFS", "VERTEXES", "SEGS", "SSECTORS",
+        "NODES", "SECTORS", "REJECT", "BLOCKMAP", "BEHAVIOR", NULL
+    };
+
+    for ( int i = 0; lumpName [i] != NULL; i++ ) {
+        if ( strncmp ( name, lumpName [i], MAX_LUMP_NAME ) == 0 ) return true;
+    }
+
+    return false;
+}
+
+bool DoomLevel::UpdateGLNodes ()
+{
+    FUNCTION_ENTRY ( this, "DoomLevel::UpdateGLNodes", true );
+
+    m_GLMap.changed = false;
+
+    bool changed = false;
+
+    const wadDirEntry *dir = m_Wad->FindDir ( m_GLName, m_Wad->FindDir ( Name ()));
+    if ( dir == NULL ) {
+        const wadDirEntry *last = m_Wad->FindDir ( Name ());
+        const wadDirEntry *end  = m_Wad->GetDir ( m_Wad->DirSize () - 1 );
+        while (( last < end ) && IsLevelLump ( last [1].name )) last++;
+        changed |= m_Wad->InsertAfter (( const wLumpName * ) m_GLName, m_GLMap.dataSize, m_GLMap.rawData, false, last );
+    } else {
+        changed |= m_Wad->WriteEntry ( dir, m_GLMap.dataSize, m_GLMap.rawData, false );
+    }
+
+    changed |= UpdateGLEntry ( &m_GLVert,  "GL_VERT",  NULL );
+    changed |= UpdateGLEntry ( &m_GLSegs,  "GL_SEGS",  "GL_VERT" );
+    changed |= UpdateGLEntry ( &m_GLSSect, "GL_SSECT", "GL_SEGS" );
+    changed |= UpdateGLEntry ( &m_GLNodes, "GL_NODES", "GL_SSECT" );
+
+    return changed;
+}
+
 bool DoomLevel::UpdateWAD ()
 {
     FUNCTION_ENTRY ( this, "DoomLevel::UpdateWAD", true );
@@ -1086,6 +1306,10 @@ bool DoomLevel::UpdateWAD ()
         changed |= UpdateEntry ( &m_Behavior,  "BEHAVIOR", "BLOCKMAP", false );
     }
 
+    if ( m_GLMap.changed == true ) {
+        changed |= UpdateGLNodes ();
+    }
+
     // Switch back to native byte ordering
     AdjustByteOrder ( BYTE_ORDER );
 
@@ -1105,6 +1329,19 @@ void DoomLevel::NewEntry ( sLevelLump *entry, int newCount, void *newData )
     entry->rawData      = newData;
 }
 
+void DoomLevel::NewRawEntry ( sLevelLump *entry, int newCount, UINT32 newSize, void *newData )
+{
+    FUNCTION_ENTRY ( this, "DoomLevel::NewRawEntry", true );
+
+    delete [] ( char * ) entry->rawData;
+
+    entry->byteOrder    = LITTLE_ENDIAN;
+    entry->changed      = true;
+    entry->elementCount = newCount;
+    entry->dataSize     = newSize;
+    entry->rawData      = newData;
+}
+
 void DoomLevel::NewThings ( int newCount, wThing *newData )
 {
     FUNCTION_ENTRY ( this, "DoomLevel::NewThings", true );
@@ -1170,9 +1407,199 @@ void DoomLevel::NewNodes ( int newCount, wNode *newData )
 {
     FUNCTION_ENTRY ( this, "DoomLevel::NewNodes", true );
 
+    m_NodeFormat = NODES_VANILLA;
+
     NewEntry ( &m_Node, newCount, newData );
 }
 
+//----------------------------------------------------------------------------
+//  The extended formats are written out in little endian order here, so
+//    AdjustByteOrder leaves them alone.
+//----------------------------------------------------------------------------
+
+static UINT8 *Put16 ( UINT8 *ptr, UINT32 value )
+{
+    ptr [0] = ( UINT8 ) value;
+    ptr [1] = ( UINT8 ) ( value >> 8 );
+
+    return ptr + 2;
+}
+
+static UINT8 *Put32 ( UINT8 *ptr, UINT32 value )
+{
+    ptr = Put16 ( ptr, value & 0xFFFF );
+
+    return Put16 ( ptr, value >> 16 );
+}
+
+static UINT8 *PutNode ( UINT8 *ptr, const wNodeEx *node )
+{
+    ptr = Put16 ( ptr, ( UINT16 ) node->x );
+    ptr = Put16 ( ptr, ( UINT16 ) node->y );
+    ptr = Put16 ( ptr, ( UINT16 ) node->dx );
+    ptr = Put16 ( ptr, ( UINT16 ) node->dy );
+    for ( int i = 0; i < 2; i++ ) {
+        ptr = Put16 ( ptr, ( UINT16 ) node->side [i].maxy );
+        ptr = Put16 ( ptr, ( UINT16 ) node->side [i].miny );
+        ptr = Put16 ( ptr, ( UINT16 ) node->side [i].minx );
+        ptr = Put16 ( ptr, ( UINT16 ) node->side [i].maxx );
+    }
+    ptr = Put32 ( ptr, node->child [0] );
+
+    return Put32 ( ptr, node->child [1] );
+}
+
+//----------------------------------------------------------------------------
+//  Replace the SEGS, SSECTORS & NODES with one of the extended formats.  The
+//    vertices passed in are numbered after those in VERTEXES and are only
+//    allowed by the ZDoom formats.  The SSECTORS must list the SEGs in order.
+//
+//    DeePBSP v4 - "xNd4\0\0\0\0" + NODES, SEGS & SSECTORS with 32-bit indices
+//    XNOD       - "XNOD" + vertices, SSECTORS, SEGS & NODES, all in NODES
+//    ZNOD       - "ZNOD" + the XNOD data compressed with zlib
+//----------------------------------------------------------------------------
+
+void DoomLevel::NewExtendedNodes ( int format, int noVertices, const wVertexEx *vertex, int noSegs, const wSegsEx *seg, int noSSectors, const wSSectorEx *ssector, int noNodes, const wNodeEx *node )
+{
+    FUNCTION_ENTRY ( this, "DoomLevel::NewExtendedNodes", true );
+
+    if ( format == NODES_DEEPBSP ) {
+
+        UINT8 *segData = new UINT8 [ 16 * noSegs ];
+        UINT8 *ptr = segData;
+        for ( int i = 0; i < noSegs; i++ ) {
+            ptr = Put32 ( ptr, seg [i].start );
+            ptr = Put32 ( ptr, seg [i].end );
+            ptr = Put16 ( ptr, seg [i].angle );
+            ptr = Put16 ( ptr, seg [i].lineDef );
+            ptr = Put16 ( ptr, seg [i].flip );
+            ptr = Put16 ( ptr, seg [i].offset );
+        }
+
+        UINT8 *ssectorData = new UINT8 [ 6 * noSSectors ];
+        ptr = ssectorData;
+        for ( int i = 0; i < noSSectors; i++ ) {
+            ptr = Put16 ( ptr, ssector [i].num );
+            ptr = Put32 ( ptr, ssector [i].first );
+        }
+
+        UINT8 *nodeData = new UINT8 [ 8 + 32 * noNodes ];
+        memcpy ( nodeData, "xNd4\0\0\0\0", 8 );
+        ptr = nodeData + 8;
+        for ( int i = 0; i < noNodes; i++ ) {
+            ptr = PutNode ( ptr, &node [i] );
+        }
+
+        NewRawEntry ( &m_Segs, noSegs, 16 * noSegs, segData );
+        NewRawEntry ( &m_SubSector, noSSectors, 6 * noSSectors, ssectorData );
+        NewRawEntry ( &m_Node, noNodes, 8 + 32 * noNodes, nodeData );
+
+        m_NodeFormat = format;
+
+        return;
+    }
+
+    UINT32 size = 4 + 8 + 8 * noVertices + 4 + 4 * noSSectors + 4 + 11 * noSegs + 4 + 32 * noNodes;
+
+    UINT8 *data = new UINT8 [ size ];
+    memcpy ( data, "XNOD", 4 );
+
+    UINT8 *ptr = data + 4;
+    ptr = Put32 ( ptr, VertexCount ());
+    ptr = Put32 ( ptr, noVertices );
+    for ( int i = 0; i < noVertices; i++ ) {
+        ptr = Put32 ( ptr, vertex [i].x );
+        ptr = Put32 ( ptr, vertex [i].y );
+    }
+    ptr = Put32 ( ptr, noSSectors );
+    for ( int i = 0; i < noSSectors; i++ ) {
+        ptr = Put32 ( ptr, ssector [i].num );
+    }
+    ptr = Put32 ( ptr, noSegs );
+    for ( int i = 0; i < noSegs; i++ ) {
+        ptr = Put32 ( ptr, seg [i].start );
+        ptr = Put32 ( ptr, seg [i].end );
+        ptr = Put16 ( ptr, seg [i].lineDef );
+        *ptr++ = ( UINT8 ) seg [i].flip;
+    }
+    ptr = Put32 ( ptr, noNodes );
+    for ( int i = 0; i < noNodes; i++ ) {
+        ptr = PutNode ( ptr, &node [i] );
+    }
+
+    if ( format == NODES_ZNOD ) {
+        uLongf packedSize = compressBound ( size - 4 );
+        UINT8 *packed = new UINT8 [ 4 + packedSize ];
+        memcpy ( packed, "ZNOD", 4 );
+        if ( compress2 ( packed + 4, &packedSize, data + 4, size - 4, Z_BEST_COMPRESSION ) == Z_OK ) {
+            delete [] data;
+            data = packed;
+            size = 4 + ( UINT32 ) packedSize;
+        } else {
+            fprintf ( stderr, "Unable to compress the NODES for %s - writing XNOD instead\n", Name ());
+            delete [] packed;
+            format = NODES_XNOD;
+        }
+    }
+
+    NewRawEntry ( &m_Segs, noSegs, 0, NULL );
+    NewRawEntry ( &m_SubSector, noSSectors, 0, NULL );
+    NewRawEntry ( &m_Node, noNodes, size, data );
+
+    m_NodeFormat = format;
+}
+
+//----------------------------------------------------------------------------
+//  Replace the GL nodes (v5).  SEG vertices with GL_VERTEX set refer to the
+//    vertices passed in (16.16 fixed point), the rest to VERTEXES.  The NODES
+//    and SSECTORS use the same layout as the ZDoom formats.
+//----------------------------------------------------------------------------
+
+void DoomLevel::NewGLNodes ( int noVertices, const wVertexEx *vertex, int noSegs, const wGLSegsEx *seg, int noSSectors, const wSSectorEx *ssector, int noNodes, const wNodeEx *node )
+{
+    FUNCTION_ENTRY ( this, "DoomLevel::NewGLNodes", true );
+
+    char *mapData = new char [ 64 ];
+    sprintf ( mapData, "LEVEL=%.8s\nBUILDER=ZenNode\n", Name ());
+
+    UINT8 *vertData = new UINT8 [ 4 + 8 * noVertices ];
+    memcpy ( vertData, "gNd5", 4 );
+    UINT8 *ptr = vertData + 4;
+    for ( int i = 0; i < noVertices; i++ ) {
+        ptr = Put32 ( ptr, vertex [i].x );
+        ptr = Put32 ( ptr, vertex [i].y );
+    }
+
+    UINT8 *segData = new UINT8 [ 16 * noSegs ];
+    ptr = segData;
+    for ( int i = 0; i < noSegs; i++ ) {
+        ptr = Put32 ( ptr, seg [i].start );
+        ptr = Put32 ( ptr, seg [i].end );
+        ptr = Put16 ( ptr, seg [i].lineDef );
+        ptr = Put16 ( ptr, seg [i].flip );
+        ptr = Put32 ( ptr, seg [i].partner );
+    }
+
+    UINT8 *ssectorData = new UINT8 [ 8 * noSSectors ];
+    ptr = ssectorData;
+    for ( int i = 0; i < noSSectors; i++ ) {
+        ptr = Put32 ( ptr, ssector [i].num );
+        ptr = Put32 ( ptr, ssector [i].first );
+    }
+
+    UINT8 *nodeData = new UINT8 [ 32 * noNodes ];
+    ptr = nodeData;
+    for ( int i = 0; i < noNodes; i++ ) {
+        ptr = PutNode ( ptr, &node [i] );
+    }
+
+    NewRawEntry ( &m_GLMap, 1, ( UINT32 ) strlen ( mapData ), mapData );
+    NewRawEntry ( &m_GLVert, noVertices, 4 + 8 * noVertices, vertData );
+    NewRawEntry ( &m_GLSegs, noSegs, 16 * noSegs, segData );
+    NewRawEntry ( &m_GLSSect, noSSectors, 8 * noSSectors, ssectorData );
+    NewRawEntry ( &m_GLNodes, noNodes, 32 * noNodes, nodeData );
+}
+
 void DoomLevel::NewReject ( int newSize, UINT8 *newData )
 {
     FUNCTION_ENTRY ( this, "DoomLevel::NewReject", true );
@@ -146,6 +146,53 @@ struct wNode {
     UINT16      child[2];               // Node or SSector (if high bit is set)
 };
 
+// Extended NODES formats - used when a map doesn't fit in the 16-bit lumps
+#define NODES_VANILLA           0
+#define NODES_DEEPBSP           1       // DeePBSP v4: 32-bit indices in SEGS/SSECTORS/NODES
+#define NODES_XNOD              2       // ZDoom: vertices, SSECTORS, SEGS & NODES all in NODES
+#define NODES_ZNOD              3       // ZDoom: zlib compressed XNOD
+
+#define NF_SUBSECTOR_EX         0x80000000UL
+
+// In memory versions of the extended structures (not the layout in the WAD)
+struct wVertexEx {
+    INT32       x, y;                   // 16.16 fixed point
+};
+
+struct wSegsEx {
+    UINT32      start;                  // from this vertex ...
+    UINT32      end;                    // ... to this vertex
+    UINT16      angle;                  // angle (0 = east, 16384 = north, ...)
+    UINT16      lineDef;                // linedef that this seg goes along
+    UINT16      flip;                   // true if not the same direction as linedef
+    UINT16      offset;                 // distance from starting point
+};
+
+struct wSSectorEx {
+    UINT32      num;                    // number of Segs in this Sub-Sector
+    UINT32      first;                  // first Seg
+};
+
+struct wNodeEx {
+    INT16       x, y;                   // starting point
+    INT16       dx, dy;                 // offset to ending point
+    wBound      side[2];
+    UINT32      child[2];               // Node or SSector (if NF_SUBSECTOR_EX is set)
+};
+
+// GL nodes (v5) - GL_VERT, GL_SEGS, GL_SSECT & GL_NODES follow a GL_<map> marker
+#define GL_VERTEX               0x80000000UL    // SEG vertex is an index into GL_VERT
+#define GL_NO_PARTNER           0xFFFFFFFFUL
+#define GL_MINISEG              0xFFFF          // lineDef of a SEG that isn't on a LINEDEF
+
+struct wGLSegsEx {
+    UINT32      start;                  // from this vertex ...
+    UINT32      end;                    // ... to this vertex
+    UINT16      lineDef;                // linedef that this seg goes along (or GL_MINISEG)
+    UINT16      flip;                   // true if not the same direction as linedef
+    UINT32      partner;                // seg on the other side of this one (or GL_NO_PARTNER)
+};
+
 struct wReject {
     UINT16      dummy;
 };
@@ -158,6 +205,27 @@ struct wBlockMap {
 //    UINT16    data [];
 };
 
+// Open-addressed hash of vertex coordinates used to weld duplicate vertices.
+//   Only indices into the caller's list of vertices are kept, so the list can
+//   grow (and be moved) without invalidating the hash.
+class VertexHash {
+
+    int        *m_Table;                // index of the vertex in each slot, -1 if empty
+    int         m_Bits;
+    int         m_Count;
+
+    int  Slot ( int x, int y ) const;
+    void Grow ( const wVertex * );
+
+public:
+
+    VertexHash ( int );
+    ~VertexHash ();
+
+    int  Find ( const wVertex *, int, int ) const;
+    void Insert ( const wVertex *, int );
+};
+
 class DoomLevel {
 
     struct sLevelLump {
@@ -178,6 +246,8 @@ class DoomLevel {
     const char *m_Title;
     const char *m_Music;
     int         m_Cluster;
+    int         m_NodeFormat;           // NODES_xxx used by SEGS, SSECTORS & NODES
+    wLumpName   m_GLName;               // GL_<map> marker for the GL nodes
 
     wThing     *m_ThingData;
     wLineDef   *m_LineDefData;
@@ -195,6 +265,12 @@ class DoomLevel {
     sLevelLump  m_BlockMap;
     sLevelLump  m_Behavior;
 
+    sLevelLump  m_GLMap;
+    sLevelLump  m_GLVert;
+    sLevelLump  m_GLSegs;
+    sLevelLump  m_GLSSect;
+    sLevelLump  m_GLNodes;
+
     static void ConvertRaw1ToThing ( int, wThing1 *, wThing * );
     static void ConvertRaw2ToThing ( int, wThing2 *, wThing * );
     static void ConvertThingToRaw1 ( int, wThing *, wThing1 * );
@@ -205,9 +281,8 @@ class DoomLevel {
     static void ConvertLineDefToRaw1 ( int, wLineDef *, wLineDef1 * );
     static void ConvertLineDefToRaw2 ( int, wLineDef *, wLineDef2 * );
 
-    void ReplaceVertices ( int *, wVertex *, int );
-
     void DetermineType ();
+    void DetermineNodeFormat ();
 
     bool Load ();
     bool LoadHexenInfo ();
@@ -219,9 +294,12 @@ class DoomLevel {
     void StoreLineDefs ();
 
     void NewEntry ( sLevelLump *, int, void * );
+    void NewRawEntry ( sLevelLump *, int, UINT32, void * );
 
     bool ReadEntry ( sLevelLump *, const char *, const wadDirEntry *, const wadDirEntry *, bool );
     bool UpdateEntry ( sLevelLump *, const char *, const char *, bool );
+    bool UpdateGLEntry ( sLevelLump *, const char *, const char * );
+    bool UpdateGLNodes ();
 
     void AdjustByteOrderMap ( int );
     void AdjustByteOrderThing ( int );
@@ -252,6 +330,7 @@ public:
     const char *Title () const                  { return m_Title ? m_Title : m_Name; }
     const char *Music () const                  { return m_Music ? m_Music : NULL; }
     int MapCluster () const                     { return m_Cluster; }
+    int NodeFormat () const                     { return m_NodeFormat; }
 
     int ThingCount () const                     { return m_Thing.elementCount; }
     int LineDefCount () const                   { return m_LineDef.elementCount; }
@@ -261,6 +340,7 @@ public:
     int SegCount () const                       { return m_Segs.elementCount; }
     int SubSectorCount () const                 { return m_SubSector.elementCount; }
     int NodeCount () const                      { return m_Node.elementCount; }
+    int GLSegCount () const                     { return m_GLSegs.elementCount; }
     int RejectSize () const                     { return m_Reject.dataSize; }
     int BlockMapSize () const                   { return m_BlockMap.dataSize; }
     int BehaviorSize () const                   { return m_Behavior.dataSize; }
@@ -285,6 +365,8 @@ public:
     void NewSegs ( int, wSegs * );
     void NewSubSectors ( int, wSSector * );
     void NewNodes ( int, wNode * );
+    void NewExtendedNodes ( int, int, const wVertexEx *, int, const wSegsEx *, int, const wSSectorEx *, int, const wNodeEx * );
+    void NewGLNodes ( int, const wVertexEx *, int, const wGLSegsEx *, int, const wSSectorEx *, int, const wNodeEx * );
     void NewReject ( int, UINT8 * );
     void NewBlockMap ( int, wBlockMap * );
     void NewBehavior ( int, char * );
@@ -294,6 +376,7 @@ public:
 
     void TrimVertices ();
     void PackVertices ();
+    void ReplaceVertices ( int *, wVertex *, int );
 
     void PackSideDefs ();
     void UnPackSideDefs ();
@@ -455,7 +455,7 @@ bool WAD::WriteEntry ( const wadDirEntry *entry, UINT32 newSize, void *newStuff,
     UINT8 *temp = ( UINT8 * ) newStuff;
     if ( owner == false ) {
         temp = new UINT8 [ newSize ];
-        memcpy ( temp, newStuff, newSize );
+        if ( newSize > 0 ) memcpy ( temp, newStuff, newSize );
     }
     if ( m_DirInfo [ index ].cacheData ) {
         delete m_DirInfo [ index ].cacheData;
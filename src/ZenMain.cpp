@@ -46,6 +46,7 @@
 #include "level.hpp"
 #include "console.hpp"
 #include "ZenNode.hpp"
+#include "threads.hpp"
 
 DBG_REGISTER ( __FILE__ );
 
@@ -74,6 +75,9 @@ struct sOptionsRMB {
 
 sOptionsRMB rmbOptionTable [MAX_WADS];
 
+// Names used by -no=xxx for NODE_ORDER_xxx
+static const char *orderName [] = { "POST", "HOT", "VEB" };
+
 #if defined ( __GNUC__ ) || defined ( __INTEL_COMPILER )
     extern char *strupr ( char * );
 #endif
@@ -82,6 +86,11 @@ void printHelp ()
 {
     FUNCTION_ENTRY ( NULL, "printHelp", true );
 
+    // Options are matched in upper case but typed in lower case
+    char order [8];
+    strcpy ( order, orderName [ config.Nodes.Order ] );
+    for ( int i = 0; order [i]; i++ ) order [i] = ( char ) tolower ( order [i] );
+
     fprintf ( stdout, "Usage: ZenNode {-options} filename[.wad] [level{+level}] {-o|x output[.wad]}\n" );
     fprintf ( stdout, "\n" );
     fprintf ( stdout, "     -x+ turn on option   -x- turn off option  %c = default\n", DEFAULT_CHAR );
@@ -89,14 +98,28 @@ void printHelp ()
     fprintf ( stdout, "     -b[c]              %c - Rebuild BLOCKMAP\n", config.BlockMap.Rebuild ? DEFAULT_CHAR : ' ' );
     fprintf ( stdout, "        c               %c   - Compress BLOCKMAP\n", config.BlockMap.Compress ? DEFAULT_CHAR : ' ' );
     fprintf ( stdout, "\n" );
-    fprintf ( stdout, "     -n[a=1,2,3|q|u|i]  %c - Rebuild NODES\n", config.Nodes.Rebuild ? DEFAULT_CHAR : ' ' );
+    fprintf ( stdout, "     -n[a=1-5|q|u|i]    %c - Rebuild NODES\n", config.Nodes.Rebuild ? DEFAULT_CHAR : ' ' );
     fprintf ( stdout, "        a                   - Partition Selection Algorithm\n" );
     fprintf ( stdout, "                        %c     1 = Minimize splits\n", ( config.Nodes.Method == 1 ) ? DEFAULT_CHAR : ' ' );
     fprintf ( stdout, "                        %c     2 = Minimize BSP depth\n", ( config.Nodes.Method == 2 ) ? DEFAULT_CHAR : ' ' );
     fprintf ( stdout, "                        %c     3 = Minimize time\n", ( config.Nodes.Method == 3 ) ? DEFAULT_CHAR : ' ');
+    fprintf ( stdout, "                        %c     4 = Fast (for very large maps)\n", ( config.Nodes.Method == 4 ) ? DEFAULT_CHAR : ' ');
+    fprintf ( stdout, "                        %c     5 = Minimize BSP depth weighted by area\n", ( config.Nodes.Method == 5 ) ? DEFAULT_CHAR : ' ');
     fprintf ( stdout, "        q               %c   - Don't display progress bar\n", config.Nodes.Quiet ? DEFAULT_CHAR : ' ' );
     fprintf ( stdout, "        u               %c   - Ensure all sub-sectors contain only 1 sector\n", config.Nodes.Unique ? DEFAULT_CHAR : ' ' );
     fprintf ( stdout, "        i               %c   - Ignore non-visible lineDefs\n", config.Nodes.ReduceLineDefs ? DEFAULT_CHAR : ' ' );
+    fprintf ( stdout, "        j=#                 - Number of threads to use (0 = one per processor) [%d]\n", config.Nodes.Threads );
+    fprintf ( stdout, "        m=#                 - MB of memory for cached side info (0 = no limit) [%d]\n", config.Nodes.SideCache );
+    fprintf ( stdout, "        t=#[s]              - Seconds allowed for each level (0 = no limit) [%g]\n", config.Nodes.TimeLimit / 1000.0 );
+    fprintf ( stdout, "        tune            %c   - Tune the partition weights for each level\n", config.Nodes.Tune ? DEFAULT_CHAR : ' ' );
+    fprintf ( stdout, "        b=#                 - Partition lines looked ahead at each node (1 = none) [%d]\n", config.Nodes.BeamWidth );
+    fprintf ( stdout, "        d=#                 - Levels each of them is looked ahead [%d]\n", config.Nodes.BeamDepth );
+    fprintf ( stdout, "        x=v|d|x|z           - NODES format: vanilla, DeePBSP v4, ZDoom XNOD or ZNOD [%c]\n", "vdxz" [ config.Nodes.Format ] );
+    fprintf ( stdout, "        x               %c   - Use ZNOD for levels too big for vanilla NODES\n", config.Nodes.Extend ? DEFAULT_CHAR : ' ' );
+    fprintf ( stdout, "        g               %c   - Build GL nodes (v5) as well\n", config.Nodes.GLNodes ? DEFAULT_CHAR : ' ' );
+    fprintf ( stdout, "        o=post|hot|veb      - NODES order: as built, hot paths first or van Emde Boas [%s]\n", order );
+    fprintf ( stdout, "        v               %c   - Number VERTEXES in the order the SEGS use them\n", config.Nodes.SortVertices ? DEFAULT_CHAR : ' ' );
+    fprintf ( stdout, "        k               %c   - Keep the parts of the existing NODES that haven't changed\n", config.Nodes.Reuse ? DEFAULT_CHAR : ' ' );
     fprintf ( stdout, "\n" );
     fprintf ( stdout, "     -r[zfgm]           %c - Rebuild REJECT resource\n", config.Reject.Rebuild ? DEFAULT_CHAR : ' ' );
     fprintf ( stdout, "        z               %c   - Insert empty REJECT resource\n", config.Reject.Empty  ? DEFAULT_CHAR : ' ' );
@@ -144,9 +167,62 @@ bool parseNODESArgs ( char *&ptr, bool setting )
             case '1' : config.Nodes.Method = 1;                 break;
             case '2' : config.Nodes.Method = 2;                 break;
             case '3' : config.Nodes.Method = 3;                 break;
+            case '4' : config.Nodes.Method = 4;                 break;
+            case '5' : config.Nodes.Method = 5;                 break;
+            case 'A' : if ( *ptr == '=' ) ptr++;
+                       if (( *ptr < '1' ) || ( *ptr > '5' )) return true;
+                       config.Nodes.Method = *ptr++ - '0';
+                       break;
             case 'Q' : config.Nodes.Quiet = setting;            break;
             case 'U' : config.Nodes.Unique = setting;           break;
             case 'I' : config.Nodes.ReduceLineDefs = setting;   break;
+            case 'J' : if ( *ptr == '=' ) ptr++;
+                       config.Nodes.Threads = setting ? ( int ) strtol ( ptr, &ptr, 10 ) : 1;
+                       break;
+            case 'M' : if ( *ptr == '=' ) ptr++;
+                       config.Nodes.SideCache = setting ? ( int ) strtol ( ptr, &ptr, 10 ) : 0;
+                       break;
+            case 'T' : if ( strncmp ( ptr, "UNE", 3 ) == 0 ) {
+                           config.Nodes.Tune = setting;
+                           ptr += 3;
+                           break;
+                       }
+                       if ( *ptr == '=' ) ptr++;
+                       config.Nodes.TimeLimit = setting ? ( int ) ( 1000.0 * strtod ( ptr, &ptr )) : 0;
+                       if ( *ptr == 'S' ) ptr++;
+                       break;
+            case 'X' : if ( *ptr != '=' ) {
+                           config.Nodes.Extend = setting;
+                           break;
+                       }
+                       ptr++;
+                       if (( *ptr == '\0' ) || ( strchr ( "VDXZ", *ptr ) == NULL )) return true;
+                       config.Nodes.Format = ( int ) ( strchr ( "VDXZ", *ptr++ ) - "VDXZ" );
+                       break;
+            case 'G' : config.Nodes.GLNodes = setting;          break;
+            case 'O' : if ( *ptr == '=' ) ptr++;
+                       if ( setting == false ) {
+                           config.Nodes.Order = NODE_ORDER_POST;
+                           break;
+                       }
+                       config.Nodes.Order = -1;
+                       for ( int i = 0; i < 3; i++ ) {
+                           if ( strncmp ( ptr, orderName [i], strlen ( orderName [i] )) == 0 ) config.Nodes.Order = i;
+                       }
+                       if ( config.Nodes.Order == -1 ) return true;
+                       ptr += strlen ( orderName [ config.Nodes.Order ] );
+                       break;
+            case 'V' : config.Nodes.SortVertices = setting;     break;
+            case 'K' : config.Nodes.Reuse = setting;            break;
+            case 'B' : if ( *ptr == '=' ) ptr++;
+                       config.Nodes.BeamWidth = setting ? ( int ) strtol ( ptr, &ptr, 10 ) : 1;
+                       if ( config.Nodes.BeamWidth < 1 ) return true;
+                       break;
+            case 'D' : if ( *ptr == '=' ) ptr++;
+                       config.Nodes.BeamDepth = setting ? ( int ) strtol ( ptr, &ptr, 10 ) : 1;
+                       if ( config.Nodes.BeamDepth < 1 ) return true;
+                       break;
+            case ',' : break;
             default  : return true;
         }
         config.Nodes.Rebuild = true;
@@ -673,7 +749,7 @@ void PrintTime ( UINT32 time )
     cprintf ( "%3ld.%03ld sec%s", time / 1000, time % 1000, ( time == 1000 ) ? "" : "s" );
 }
 
-bool ProcessLevel ( char *name, wadList *myList, UINT32 *ellapsed )
+bool ProcessLevel ( char *name, wadList *myList, UINT32 *ellapsed, BSPArena *arena )
 {
     FUNCTION_ENTRY ( NULL, "ProcessLevel", true );
 
@@ -737,15 +813,31 @@ bool ProcessLevel ( char *name, wadList *myList, UINT32 *ellapsed )
         sBSPOptions options;
         options.algorithm      = config.Nodes.Method;
         options.showProgress   = ! config.Nodes.Quiet;
+        options.quiet          = false;
         options.reduceLineDefs = config.Nodes.ReduceLineDefs;
         options.ignoreLineDef  = NULL;
         options.dontSplit      = NULL;
         options.keepUnique     = keep;
-
+        options.sideCacheSize  = config.Nodes.SideCache;
+        options.timeLimit      = config.Nodes.TimeLimit;
+        options.nodeFormat     = config.Nodes.Format;
+        options.extendNodes    = config.Nodes.Extend;
+        options.glNodes        = config.Nodes.GLNodes;
+        options.nodeOrder      = config.Nodes.Order;
+        options.sortVertices   = config.Nodes.SortVertices;
+        options.beamWidth      = config.Nodes.BeamWidth;
+        options.beamDepth      = config.Nodes.BeamDepth;
+        options.reuseNodes     = config.Nodes.Reuse;
+
+        GetMetricWeights ( &options );
         ReadCustomFile ( curLevel, myList, &options );
 
         UINT32 nodeTime = CurrentTime ();
-        CreateNODES ( curLevel, &options );
+        if ( config.Nodes.Tune ) {
+            TuneNODES ( curLevel, &options, arena );
+        } else {
+            CreateNODES ( curLevel, &options, arena );
+        }
         *ellapsed += nodeTime = CurrentTime () - nodeTime;
 
         if ( options.ignoreLineDef ) delete [] options.ignoreLineDef;
@@ -762,10 +854,45 @@ bool ProcessLevel ( char *name, wadList *myList, UINT32 *ellapsed )
         cprintf ( "SEGS - %5d/%-5d ", curLevel->SegCount (), oldSegCount );
         if ( oldSegCount ) cprintf ( "(%3d%%)", ( int ) ( 100.0 * curLevel->SegCount () / oldSegCount + 0.5 ));
         else cprintf ( "(****)" );
+        if ( curLevel->NodeFormat () != NODES_VANILLA ) {
+            static const char *formatName [] = { "", "DeePBSP", "XNOD", "ZNOD" };
+            cprintf ( "  %s", formatName [ curLevel->NodeFormat ()] );
+        }
+        if ( config.Nodes.GLNodes ) {
+            cprintf ( "  GL" );
+        }
 
         PrintTime ( nodeTime );
         cprintf ( "\r\n" );
         GetXY ( &dummyX, &startY );
+
+        if ( options.nodeOrder != NODE_ORDER_POST ) {
+            GotoXY ( startX, startY );
+            cprintf ( "NODES - %s order: %.2f cache lines per lookup (%.2f as built)\r\n", orderName [ options.nodeOrder ], options.cacheLines [1], options.cacheLines [0] );
+            GetXY ( &dummyX, &startY );
+        }
+
+        if ( options.reuseNodes ) {
+            GotoXY ( startX, startY );
+            if ( options.reusedNodes >= 0 ) {
+                cprintf ( "NODES - kept %d of %d old NODES (%d SEGS new or changed, %d gone)\r\n", options.reusedNodes, oldNodeCount, options.changedSegs, options.removedSegs );
+            } else {
+                cprintf ( "NODES - the old NODES couldn't be used - rebuilt from scratch\r\n" );
+            }
+            GetXY ( &dummyX, &startY );
+        }
+
+        if ( options.sortVertices ) {
+            GotoXY ( startX, startY );
+            cprintf ( "VERTEXES - %.2f cache lines per SSECTOR (%.2f as built)\r\n", options.vertexLines [1], options.vertexLines [0] );
+            GetXY ( &dummyX, &startY );
+        }
+
+        if ( config.Nodes.Tune && ( options.algorithm != 5 )) {
+            GotoXY ( startX, startY );
+            cprintf ( "NODES - tuned weights: X1=%ld X2=%ld X3=%ld X4=%ld (average depth %.2f)\r\n", options.weightX [0], options.weightX [1], options.weightX [2], options.weightX [3], options.avgDepth );
+            GetXY ( &dummyX, &startY );
+        }
     }
 
     if ( config.Reject.Rebuild ) {
@@ -918,6 +1045,18 @@ int main ( int argc, const char *argv [] )
     config.Nodes.Quiet          = isatty ( fileno ( stdout )) ? false : true;
     config.Nodes.Unique         = false;
     config.Nodes.ReduceLineDefs = false;
+    config.Nodes.Threads        = 1;
+    config.Nodes.SideCache      = 0;
+    config.Nodes.TimeLimit      = 0;
+    config.Nodes.Format         = NODES_VANILLA;
+    config.Nodes.Extend         = true;
+    config.Nodes.GLNodes        = false;
+    config.Nodes.Order          = NODE_ORDER_POST;
+    config.Nodes.SortVertices   = false;
+    config.Nodes.Tune           = false;
+    config.Nodes.BeamWidth      = 1;
+    config.Nodes.BeamDepth      = 2;
+    config.Nodes.Reuse          = false;
 
     config.Reject.Rebuild       = true;
     config.Reject.Empty         = false;
@@ -937,6 +1076,9 @@ int main ( int argc, const char *argv [] )
     int argIndex = 1;
     int totalLevels = 0, totalTime = 0, totalUpdates = 0;
 
+    // Levels are built one at a time, so they can all use the same arena
+    BSPArena arena;
+
     while ( KeyPressed ()) GetKey ();
 
     do {
@@ -945,6 +1087,8 @@ int main ( int argc, const char *argv [] )
         argIndex = parseArgs ( argIndex, argv );
         if ( argIndex >= argc ) break;
 
+        StartThreads ( config.Nodes.Threads );
+
         char wadFileName [ 256 ];
         wadList *myList = getInputFiles ( argv [argIndex++], wadFileName );
         if ( myList->IsEmpty () == false ) {
@@ -968,7 +1112,7 @@ int main ( int argc, const char *argv [] )
             do {
 
                 UINT32 ellapsedTime;
-                if ( ProcessLevel ( levelNames [noLevels++], myList, &ellapsedTime )) updateCount++;
+                if ( ProcessLevel ( levelNames [noLevels++], myList, &ellapsedTime, &arena )) updateCount++;
                 totalTime += ellapsedTime;
                 if ( KeyPressed () && ( GetKey () == 0x1B )) break;
 
@@ -1010,5 +1154,7 @@ int main ( int argc, const char *argv [] )
     PrintStats ( totalLevels, totalTime, totalUpdates );
     RestoreConsoleSettings ();
 
+    StopThreads ();
+
     return 0;
 }
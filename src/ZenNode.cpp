@@ -28,6 +28,8 @@
 #include "level.hpp"
 #include "ZenNode.hpp"
 #include "console.hpp"
+#include "threads.hpp"
+#include "whichside.hpp"
 
 DBG_REGISTER ( __FILE__ );
 
@@ -35,65 +37,47 @@ DBG_REGISTER ( __FILE__ );
 
 #define EPSILON                 0.0001
 
-// Emperical values derived from a test of numerous .WAD files
-#define FACTOR_VERTEX           1.0             //  1.662791 - ???
-#define FACTOR_SEGS             2.0             //  1.488095 - ???
-#define FACTOR_NODE             0.6             //  0.590830 - MAP01 - csweeper.wad
-
-static int       maxSegs;
-static int       maxVertices;
-
-static int       nodesLeft;
-static wNode    *nodePool;
-static int       nodeCount;                     // Number of NODES stored
+// Don't bother handing out candidate partitions to other threads for small lists
+#define MIN_PARALLEL_SEGS       256
+#define CANDIDATES_PER_THREAD   4
 
-static SEG      *tempSeg;
-static SEG      *segStart;
-static int       segCount;                      // Number of SEGS stored
+// Smallest subtree that will be handed to another thread
+#define MIN_SUBTREE_SEGS        128
 
-static int       ssectorsLeft;
-static wSSector *ssectorPool;
-static int       ssectorCount;                  // Number of SSECTORS stored
-
-static wVertex  *newVertices;
-static int       noVertices;
-
-//
-// Variables used by WhichSide to speed up side calculations
-//
-static char     *currentSide;
-static int       currentAlias;
+// Lists of SEGs shorter than this aren't grouped, and groups are split until they hold this many SEGs
+#define MIN_GROUP_SEGS          128
+#define GROUP_SIZE              16
 
-static int      *convexList;
-static int      *convexPtr;
-static int       sectorCount;
+// ALGORITHM 4 leaves smaller lists to ALGORITHM 3, and looks at this many lines in each direction
+#define MIN_FAST_SEGS           256
+#define FAST_CANDIDATES         8
 
-static int       showProgress;
-static UINT8    *usedSector;
-static bool     *keepUnique;
-static bool      uniqueSubsectors;
-static char     *lineUsed;
-static char     *lineChecked;
-static int       noAliases;
-static int      *lineDefAlias;
-static char    **sideInfo;
-static double    DY, DX, X, Y, H;
-static long      ANGLE;
+// Emperical values derived from a test of numerous .WAD files
+#define FACTOR_VERTEX           1.0             //  1.662791 - ???
 
-static sScoreInfo *score;
+//----------------------------------------------------------------------------
+//  Return the index of an unused SEG for the given task.  The pool is grown
+//    a chunk at a time, and each task takes a whole chunk for itself so
+//    subtrees being built by other threads never touch the same chunk.
+//----------------------------------------------------------------------------
 
-// metric = S ? ( L * R ) / ( X1 ? X1 * S / X2 : 1 ) - ( X3 * S + X4 ) * S : ( L * R );
-static long X1 = getenv ( "ZEN_X1" ) ? atol ( getenv ( "ZEN_X1" )) : 20;
-static long X2 = getenv ( "ZEN_X2" ) ? atol ( getenv ( "ZEN_X2" )) : 10;
-static long X3 = getenv ( "ZEN_X3" ) ? atol ( getenv ( "ZEN_X3" )) : 1;
-static long X4 = getenv ( "ZEN_X4" ) ? atol ( getenv ( "ZEN_X4" )) : 25;
+int BSPBuilder::NewSeg ( sBSPTask *task )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::NewSeg", true );
 
-static long Y1 = getenv ( "ZEN_Y1" ) ? atol ( getenv ( "ZEN_Y1" )) : 1;
-static long Y2 = getenv ( "ZEN_Y2" ) ? atol ( getenv ( "ZEN_Y2" )) : 7;
-static long Y3 = getenv ( "ZEN_Y3" ) ? atol ( getenv ( "ZEN_Y3" )) : 1;
-static long Y4 = getenv ( "ZEN_Y4" ) ? atol ( getenv ( "ZEN_Y4" )) : 0;
+    if ( task->nextSeg == task->lastSeg ) {
+        int chunk = AtomicAdd ( &m_NoSegChunks, 1 );
+        if ( chunk >= MAX_SEG_CHUNKS ) {
+            fprintf ( stderr, "\nError: Out of memory for SEGs!\n" );
+            exit ( -1 );
+        }
+        m_SegChunk [ chunk ] = new sSegChunk;
+        task->nextSeg = chunk << SEG_CHUNK_BITS;
+        task->lastSeg = task->nextSeg + SEG_CHUNK_SIZE;
+    }
 
-static SEG *(*PartitionFunction) ( SEG *, int );
+    return task->nextSeg++;
+}
 
 //----------------------------------------------------------------------------
 //  Create a list of SEGs from the *important* sidedefs.  A sidedef is
@@ -103,12 +87,12 @@ static SEG *(*PartitionFunction) ( SEG *, int );
 //     - It has at least one visible texture
 //----------------------------------------------------------------------------
 
-static SEG *CreateSegs ( DoomLevel *level, sBSPOptions *options )
+int *BSPBuilder::CreateSegs ( DoomLevel *level, sBSPOptions *options )
 {
-    FUNCTION_ENTRY ( NULL, "CreateSegs", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::CreateSegs", true );
 
     // Get a rough count of how many SideDefs we're starting with
-    segCount = maxSegs = 0;
+    int maxSegs = 0;
     const wLineDef *lineDef = level->GetLineDefs ();
     const wSideDef *sideDef = level->GetSideDefs ();
 
@@ -116,16 +100,18 @@ static SEG *CreateSegs ( DoomLevel *level, sBSPOptions *options )
         if ( lineDef [i].sideDef [0] != NO_SIDEDEF ) maxSegs++;
         if ( lineDef [i].sideDef [1] != NO_SIDEDEF ) maxSegs++;
     }
-    tempSeg  = new SEG [ maxSegs ];
-    maxSegs  = ( int ) ( maxSegs * FACTOR_SEGS );
-    segStart = new SEG [ maxSegs ];
-    memset ( segStart, 0, sizeof ( SEG ) * maxSegs );
+    m_SegChunk    = new sSegChunk * [ MAX_SEG_CHUNKS ];
+    m_NoSegChunks = ( maxSegs + SEG_CHUNK_MASK ) >> SEG_CHUNK_BITS;
+    for ( int i = 0; i < m_NoSegChunks; i++ ) {
+        m_SegChunk [i] = new sSegChunk;
+        memset ( m_SegChunk [i], 0, sizeof ( sSegChunk ));
+    }
 
-    SEG *seg = segStart;
+    int seg = 0;
     for ( int i = 0; i < level->LineDefCount (); i++, lineDef++ ) {
 
-        wVertex *vertS = &newVertices [ lineDef->start ];
-        wVertex *vertE = &newVertices [ lineDef->end ];
+        wVertex *vertS = &m_NewVertices [ lineDef->start ];
+        wVertex *vertE = &m_NewVertices [ lineDef->end ];
         long dx = vertE->x - vertS->x;
         long dy = vertE->y - vertS->y;
 
@@ -156,45 +142,56 @@ static SEG *CreateSegs ( DoomLevel *level, sBSPOptions *options )
         bool split = options->dontSplit ? options->dontSplit [i] : false;
 
         if ( sideRight ) {
-            seg->Data.start   = lineDef->start;
-            seg->Data.end     = lineDef->end;
-            seg->Data.angle   = angle;
-            seg->Data.lineDef = ( UINT16 ) i;
-            seg->Data.flip    = 0;
-            seg->LineDef      = lineDef;
-            seg->Sector       = sideRight->sector;
-            seg->DontSplit    = split;
-            seg->start.x      = vertS->x;
-            seg->start.y      = vertS->y;
-            seg->start.l      = 0.0;
-            seg->end.x        = vertE->x;
-            seg->end.y        = vertE->y;
-            seg->end.l        = 1.0;
+            SEG *data = Seg ( seg );
+            data->Data.start   = lineDef->start;
+            data->Data.end     = lineDef->end;
+            data->Data.angle   = angle;
+            data->Data.lineDef = ( UINT16 ) i;
+            data->Data.flip    = 0;
+            data->LineDef      = lineDef;
+            data->startL       = 0.0;
+            data->endL         = 1.0;
+            sSegInfo *info = Info ( seg );
+            info->LineDef      = i;
+            info->Sector       = sideRight->sector;
+            info->DontSplit    = split;
+            sSegCoords *coords = Coords ( seg );
+            coords->startX     = vertS->x;
+            coords->startY     = vertS->y;
+            coords->endX       = vertE->x;
+            coords->endY       = vertE->y;
             seg++;
         }
 
         if ( sideLeft ) {
-            seg->Data.start   = lineDef->end;
-            seg->Data.end     = lineDef->start;
-            seg->Data.angle   = ( BAM ) ( angle + BAM180 );
-            seg->Data.lineDef = ( UINT16 ) i;
-            seg->Data.flip    = 1;
-            seg->LineDef      = lineDef;
-            seg->Sector       = sideLeft->sector;
-            seg->DontSplit    = split;
-            seg->start.x      = vertE->x;
-            seg->start.y      = vertE->y;
-            seg->start.l      = 0.0;
-            seg->end.x        = vertS->x;
-            seg->end.y        = vertS->y;
-            seg->end.l        = 1.0;
+            SEG *data = Seg ( seg );
+            data->Data.start   = lineDef->end;
+            data->Data.end     = lineDef->start;
+            data->Data.angle   = ( BAM ) ( angle + BAM180 );
+            data->Data.lineDef = ( UINT16 ) i;
+            data->Data.flip    = 1;
+            data->LineDef      = lineDef;
+            data->startL       = 0.0;
+            data->endL         = 1.0;
+            sSegInfo *info = Info ( seg );
+            info->LineDef      = i;
+            info->Sector       = sideLeft->sector;
+            info->DontSplit    = split;
+            sSegCoords *coords = Coords ( seg );
+            coords->startX     = vertE->x;
+            coords->startY     = vertE->y;
+            coords->endX       = vertS->x;
+            coords->endY       = vertS->y;
             seg++;
         }
     }
 
-    segCount = seg - segStart;
+    m_SegCount = seg;
+
+    int *segs = new int [ m_SegCount ];
+    for ( int i = 0; i < m_SegCount; i++ ) segs [i] = i;
 
-    return segStart;
+    return segs;
 }
 
 //----------------------------------------------------------------------------
@@ -202,40 +199,56 @@ static SEG *CreateSegs ( DoomLevel *level, sBSPOptions *options )
 //    currently selected SEG to be used as a partition line.
 //----------------------------------------------------------------------------
 
-static void ComputeStaticVariables ( SEG *pSeg )
+void BSPBuilder::ComputeStaticVariables ( sPartition *part, int pSeg )
 {
-    FUNCTION_ENTRY ( NULL, "ComputeStaticVariables", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::ComputeStaticVariables", true );
+
+    sSegInfo *info = Info ( pSeg );
+    SEG *seg = Seg ( pSeg );
+
+    if ( info->final == false ) {
 
-    if ( pSeg->final == false ) {
+        part->currentAlias = info->Alias;
+        part->currentSide  = NULL;
 
-        currentAlias   = lineDefAlias [ pSeg->Data.lineDef ];
-        currentSide    = sideInfo ? sideInfo [ currentAlias ] : NULL;
+        wVertex *vertS = &m_NewVertices [ info->AliasFlip ? seg->Data.end : seg->Data.start ];
+        wVertex *vertE = &m_NewVertices [ info->AliasFlip ? seg->Data.start : seg->Data.end ];
+        part->X     = vertS->x;
+        part->Y     = vertS->y;
+        part->DX    = vertE->x - vertS->x;
+        part->DY    = vertE->y - vertS->y;
 
-        wVertex *vertS = &newVertices [ pSeg->AliasFlip ? pSeg->Data.end : pSeg->Data.start ];
-        wVertex *vertE = &newVertices [ pSeg->AliasFlip ? pSeg->Data.start : pSeg->Data.end ];
-        X     = vertS->x;
-        Y     = vertS->y;
-        DX    = vertE->x - vertS->x;
-        DY    = vertE->y - vertS->y;
+        part->exact = true;
 
     } else {
 
-        currentAlias = 0;
+        part->currentAlias = 0;
+        part->currentSide  = NULL;
 
-        X     = pSeg->start.x;
-        Y     = pSeg->start.y;
-        DX    = pSeg->end.x - pSeg->start.x;
-        DY    = pSeg->end.y - pSeg->start.y;
+        sSegCoords *coords = Coords ( pSeg );
+        part->X     = coords->startX;
+        part->Y     = coords->startY;
+        part->DX    = coords->endX - coords->startX;
+        part->DY    = coords->endY - coords->startY;
+
+        // Final SEGs have been rounded to the nearest vertex, but make sure
+        part->exact = ( part->X == lrint ( part->X )) && ( part->Y == lrint ( part->Y )) &&
+                      ( part->DX == lrint ( part->DX )) && ( part->DY == lrint ( part->DY ));
 
     }
 
-    H = ( DX * DX ) + ( DY * DY );
+    part->intX  = ( INT64 ) part->X;
+    part->intY  = ( INT64 ) part->Y;
+    part->intDX = ( INT64 ) part->DX;
+    part->intDY = ( INT64 ) part->DY;
+
+    part->H = ( part->DX * part->DX ) + ( part->DY * part->DY );
 
 #if defined ( DIAGNOSTIC )
-    if (((int) DX == 0 ) && ((int) DY == 0 )) fprintf ( stderr, "DX & DY are both 0!\n" );
+    if (((int) part->DX == 0 ) && ((int) part->DY == 0 )) fprintf ( stderr, "DX & DY are both 0!\n" );
 #endif
 
-    ANGLE = pSeg->Data.angle;
+    part->ANGLE = seg->Data.angle;
 }
 
 //----------------------------------------------------------------------------
@@ -243,53 +256,120 @@ static void ComputeStaticVariables ( SEG *pSeg )
 //    with the currently selected partition.
 //----------------------------------------------------------------------------
 
-static bool CoLinear ( SEG *seg )
+bool BSPBuilder::CoLinear ( const sPartition *part, int seg )
 {
-    FUNCTION_ENTRY ( NULL, "CoLinear", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::CoLinear", true );
+
+    double X = part->X, Y = part->Y, DX = part->DX, DY = part->DY;
+    long ANGLE = part->ANGLE;
 
     // If they're not at the same angle ( 180 ), bag it
-    if (( ANGLE & ANGLE_MASK ) != ( seg->Data.angle & ANGLE_MASK )) return false;
+    if (( ANGLE & ANGLE_MASK ) != ( Seg ( seg )->Data.angle & ANGLE_MASK )) return false;
+
+    sSegCoords *coords = Coords ( seg );
+
+    // An unsplit SEG still has integer coordinates, so the test can be exact
+    if (( part->exact == true ) && ( Info ( seg )->Split == false )) {
+        INT64 startX = ( INT64 ) coords->startX, startY = ( INT64 ) coords->startY;
+        return ( part->intDX * ( startY - part->intY ) == part->intDY * ( startX - part->intX )) ? true : false;
+    }
 
     // Do the math stuff
-    if ( DX == 0.0 ) return ( seg->start.x == X ) ? true : false;
-    if ( DY == 0.0 ) return ( seg->start.y == Y ) ? true : false;
+    if ( DX == 0.0 ) return ( coords->startX == X ) ? true : false;
+    if ( DY == 0.0 ) return ( coords->startY == Y ) ? true : false;
 
     // Rotate vertS about (X,Y) by  degrees to get y offset
     //   Y = Hsin()             1  0  0  cos()  -sin()  0 
     //   X = Hcos()    x y 1  0  1  0  sin()   cos()  0 
     //   H = (X+Y)^          -X -Y  1    0         0    1 
 
-    return ( DX * ( seg->start.y - Y ) == DY * ( seg->start.x - X )) ? true : false;
+    return ( DX * ( coords->startY - Y ) == DY * ( coords->startX - X )) ? true : false;
+}
+
+//----------------------------------------------------------------------------
+//  Grow a bounding rectangle to include the given SEG.
+//----------------------------------------------------------------------------
+
+static inline void AddBounds ( wBound *bound, const sSegCoords *coords )
+{
+    int startX = lrint ( coords->startX );
+    int endX   = lrint ( coords->endX );
+    int startY = lrint ( coords->startY );
+    int endY   = lrint ( coords->endY );
+
+    int loX = startX, hiX = startX;
+    if ( loX < endX ) hiX = endX; else loX = endX;
+    int loY = startY, hiY = startY;
+    if ( loY < endY ) hiY = endY; else loY = endY;
+
+    if ( loX < bound->minx ) bound->minx = ( INT16 ) loX;
+    if ( hiX > bound->maxx ) bound->maxx = ( INT16 ) hiX;
+    if ( loY < bound->miny ) bound->miny = ( INT16 ) loY;
+    if ( hiY > bound->maxy ) bound->maxy = ( INT16 ) hiY;
+}
+
+static inline void ClearBounds ( wBound *bound )
+{
+    bound->minx = bound->miny = SHRT_MAX;
+    bound->maxx = bound->maxy = SHRT_MIN;
+}
+
+static inline void AddBound ( wBound *bound, const wBound *other )
+{
+    if ( other->minx < bound->minx ) bound->minx = other->minx;
+    if ( other->maxx > bound->maxx ) bound->maxx = other->maxx;
+    if ( other->miny < bound->miny ) bound->miny = other->miny;
+    if ( other->maxy > bound->maxy ) bound->maxy = other->maxy;
 }
 
 //----------------------------------------------------------------------------
 //  Given a list of SEGs, determine the bounding rectangle.
 //----------------------------------------------------------------------------
 
-static void FindBounds ( wBound *bound, SEG *seg, int noSegs )
+void BSPBuilder::FindBounds ( wBound *bound, int *segs, int noSegs )
 {
-    FUNCTION_ENTRY ( NULL, "FindBounds", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::FindBounds", true );
 
-    bound->minx = bound->maxx = ( INT16 ) lrint ( seg->start.x );
-    bound->miny = bound->maxy = ( INT16 ) lrint ( seg->start.y );
+    ClearBounds ( bound );
 
     for ( int i = 0; i < noSegs; i++ ) {
+        AddBounds ( bound, Coords ( segs [i] ));
+    }
+}
 
-        int startX = lrint ( seg [i].start.x );
-        int endX   = lrint ( seg [i].end.x );
-        int startY = lrint ( seg [i].start.y );
-        int endY   = lrint ( seg [i].end.y );
+//----------------------------------------------------------------------------
+//  Classify a SEG with integer coordinates against an integer partition using
+//    exact 64-bit arithmetic (|y| < 2^34 for 16-bit maps).  Returns
+//    SIDE_UNKNOWN for a SEG that crosses the partition within a unit of one of
+//    its end points - _WhichSide has to decide if the crossing rounds onto it.
+//----------------------------------------------------------------------------
+
+static inline int ExactSide ( const sPartition *part, const sSegCoords *coords )
+{
+    INT64 X = part->intX, Y = part->intY, DX = part->intDX, DY = part->intDY;
 
-        int loX = startX, hiX = startX;
-        if ( loX < endX ) hiX = endX; else loX = endX;
-        int loY = startY, hiY = startY;
-        if ( loY < endY ) hiY = endY; else loY = endY;
+    INT64 startX = ( INT64 ) coords->startX, startY = ( INT64 ) coords->startY;
+    INT64 endX   = ( INT64 ) coords->endX,   endY   = ( INT64 ) coords->endY;
+
+    INT64 y1 = DX * ( startY - Y ) - DY * ( startX - X );
+    INT64 y2 = DX * ( endY - Y ) - DY * ( endX - X );
+
+    // If its co-linear, decide based on direction
+    if (( y1 == 0 ) && ( y2 == 0 )) {
+        INT64 x1 = DX * ( startX - X ) + DY * ( startY - Y );
+        INT64 x2 = DX * ( endX - X ) + DY * ( endY - Y );
+        return ( x1 <= x2 ) ? SIDE_RIGHT : SIDE_LEFT;
+    }
 
-        if ( loX < bound->minx ) bound->minx = ( INT16 ) loX;
-        if ( hiX > bound->maxx ) bound->maxx = ( INT16 ) hiX;
-        if ( loY < bound->miny ) bound->miny = ( INT16 ) loY;
-        if ( hiY > bound->maxy ) bound->maxy = ( INT16 ) hiY;
+    if ((( y1 < 0 ) && ( y2 > 0 )) || (( y1 > 0 ) && ( y2 < 0 ))) {
+        if (( DX != 0 ) && ( DY != 0 )) {
+            INT64 H = DX * DX + DY * DY;
+            if ((( y1 <= H ) && ( y1 >= -H )) || (( y2 <= H ) && ( y2 >= -H ))) return SIDE_UNKNOWN;
+        }
+        return SIDE_SPLIT;
     }
+
+    return (( y1 < 0 ) || ( y2 < 0 )) ? SIDE_RIGHT : SIDE_LEFT;
 }
 
 //----------------------------------------------------------------------------
@@ -304,36 +384,45 @@ static void FindBounds ( wBound *bound, SEG *seg, int noSegs )
 //       +1 - SEG is on the right of the partition
 //----------------------------------------------------------------------------
 
-static int _WhichSide ( SEG *seg )
+int BSPBuilder::_WhichSide ( const sPartition *part, int seg )
 {
-    FUNCTION_ENTRY ( NULL, "_WhichSide", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::_WhichSide", true );
+
+    const sSegCoords *coords = Coords ( seg );
+
+    // Only SEGs that have been split need floating point
+    if (( part->exact == true ) && ( Info ( seg )->Split == false )) {
+        int side = ExactSide ( part, coords );
+        if ( side != SIDE_UNKNOWN ) return side;
+    }
+
+    double X = part->X, Y = part->Y, DX = part->DX, DY = part->DY, H = part->H;
 
-    sVertex *vertS = &seg->start;
-    sVertex *vertE = &seg->end;
     double y1, y2;
 
     if ( DX == 0.0 ) {
         if ( DY > 0.0 ) {
-            y1 = ( lrint ( X ) - lrint ( vertS->x )),    y2 = ( lrint ( X ) - lrint ( vertE->x ));
+            y1 = ( lrint ( X ) - lrint ( coords->startX )),    y2 = ( lrint ( X ) - lrint ( coords->endX ));
         } else {
-            y1 = ( lrint ( vertS->x ) - lrint ( X )),    y2 = ( lrint ( vertE->x ) - lrint ( X ));
+            y1 = ( lrint ( coords->startX ) - lrint ( X )),    y2 = ( lrint ( coords->endX ) - lrint ( X ));
         }
     } else if ( DY == 0.0 ) {
         if ( DX > 0.0 ) {
-            y1 = ( lrint ( vertS->y ) - lrint ( Y )),    y2 = ( lrint ( vertE->y ) - lrint ( Y ));
+            y1 = ( lrint ( coords->startY ) - lrint ( Y )),    y2 = ( lrint ( coords->endY ) - lrint ( Y ));
         } else {
-            y1 = ( lrint ( Y ) - lrint ( vertS->y )),    y2 = ( lrint ( Y ) - lrint ( vertE->y ));
+            y1 = ( lrint ( Y ) - lrint ( coords->startY )),    y2 = ( lrint ( Y ) - lrint ( coords->endY ));
         }
     } else {
 
-        y1 = DX * ( vertS->y - Y ) - DY * ( vertS->x - X );
-        y2 = DX * ( vertE->y - Y ) - DY * ( vertE->x - X );
+        y1 = DX * ( coords->startY - Y ) - DY * ( coords->startX - X );
+        y2 = DX * ( coords->endY - Y ) - DY * ( coords->endX - X );
 
         if (( y1 * y2 != 0.0 ) && (( fabs ( y1 ) <= H ) || ( fabs ( y2 ) <= H ))) {
 
-            const wLineDef *lineDef = seg->LineDef;
-            wVertex *_vertS = &newVertices [ lineDef->start ];
-            wVertex *_vertE = &newVertices [ lineDef->end ];
+            const SEG *data = Seg ( seg );
+            const wLineDef *lineDef = data->LineDef;
+            wVertex *_vertS = &m_NewVertices [ lineDef->start ];
+            wVertex *_vertE = &m_NewVertices [ lineDef->end ];
 
             double dx = _vertE->x - _vertS->x;
             double dy = _vertE->y - _vertS->y;
@@ -344,16 +433,16 @@ static int _WhichSide ( SEG *seg )
                 double num = DX * ( _vertS->y - Y ) - DY * ( _vertS->x - X );
                 double l = num / det;
 
-                if ( seg->Data.flip != 0 ) l = 1.0 - l;
+                if ( data->Data.flip != 0 ) l = 1.0 - l;
 
-                if ( l < vertS->l ) { y1 = 0.0; goto xx; }
-                if ( l > vertE->l ) { y2 = 0.0; goto xx; }
+                if ( l < data->startL ) { y1 = 0.0; goto xx; }
+                if ( l > data->endL ) { y2 = 0.0; goto xx; }
 
                 long x = lrint ( _vertS->x + num * dx / det );
                 long y = lrint ( _vertS->y + num * dy / det );
 
-                if (( lrint ( vertS->x ) == x ) && ( lrint ( vertS->y ) == y )) y1 = 0.0;
-                if (( lrint ( vertE->x ) == x ) && ( lrint ( vertE->y ) == y )) y2 = 0.0;
+                if (( lrint ( coords->startX ) == x ) && ( lrint ( coords->startY ) == y )) y1 = 0.0;
+                if (( lrint ( coords->endX ) == x ) && ( lrint ( coords->endY ) == y )) y2 = 0.0;
             }
         }
     }
@@ -365,8 +454,8 @@ xx:
 
     // If its co-linear, decide based on direction
     if (( y1 == 0.0 ) && ( y2 == 0.0 )) {
-        double x1 = DX * ( vertS->x - X ) + DY * ( vertS->y - Y );
-        double x2 = DX * ( vertE->x - X ) + DY * ( vertE->y - Y );
+        double x1 = DX * ( coords->startX - X ) + DY * ( coords->startY - Y );
+        double x2 = DX * ( coords->endX - X ) + DY * ( coords->endY - Y );
         return ( x1 <= x2 ) ? SIDE_RIGHT : SIDE_LEFT;
     }
 
@@ -380,29 +469,50 @@ xx:
                            (( y2 >= 0.0 ) ? SIDE_LEFT  : SIDE_SPLIT );
 }
 
-static int WhichSide ( SEG *seg )
+//----------------------------------------------------------------------------
+//  Return the side of the partition the SEG lies on if it can be determined
+//    without doing any math, otherwise return SIDE_UNKNOWN.
+//----------------------------------------------------------------------------
+
+inline int BSPBuilder::KnownSide ( const sPartition *part, int seg )
 {
-    FUNCTION_ENTRY ( NULL, "WhichSide", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::KnownSide", true );
+
+    const sSegInfo *info = Info ( seg );
 
     // Treat split partition/seg differently
-    if (( seg->Split == true ) || ( currentAlias == 0 )) {
-        return _WhichSide ( seg );
+    if (( info->Split == true ) || ( part->currentAlias == 0 )) {
+        return SIDE_UNKNOWN;
     }
 
     // See if partition & seg lie on the same line
-    int alias = lineDefAlias [ seg->Data.lineDef ];
-    if ( alias == currentAlias ) {
-        return seg->AliasFlip ^ SIDE_RIGHT;
+    if ( info->Alias == part->currentAlias ) {
+        return info->AliasFlip ^ SIDE_RIGHT;
     }
 
     // See if we've already categorized the LINEDEF for this SEG
-    int side = currentSide [ seg->Data.lineDef ];
+    const UINT32 *row = part->currentSide;
+    if ( row == NULL ) return SIDE_UNKNOWN;
+
+    int side = GET_SIDE ( row, info->LineDef );
     if ( IS_LEFT_RIGHT ( side )) return side;
 
-    side = _WhichSide ( seg );
+    return SIDE_UNKNOWN;
+}
+
+int BSPBuilder::WhichSide ( const sPartition *part, int seg )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::WhichSide", true );
+
+    int side = KnownSide ( part, seg );
+    if ( side != SIDE_UNKNOWN ) return side;
 
-    if ( seg->Split == false ) {
-        currentSide [ seg->Data.lineDef ] = ( char ) side;
+    side = _WhichSide ( part, seg );
+
+    // Several threads may fill in the same entry, but always with the same value
+    const sSegInfo *info = Info ( seg );
+    if (( info->Split == false ) && ( part->currentSide != NULL ) && IS_LEFT_RIGHT ( side )) {
+        PUT_SIDE ( part->currentSide, info->LineDef, side );
     }
 
     return side;
@@ -410,12 +520,12 @@ static int WhichSide ( SEG *seg )
 
 #if defined ( DEBUG )
 
-    static int dbgWhichSide ( SEG *seg )
+    int BSPBuilder::dbgWhichSide ( const sPartition *part, int seg )
     {
-        FUNCTION_ENTRY ( NULL, "dbgWhichSide", true );
+        FUNCTION_ENTRY ( this, "BSPBuilder::dbgWhichSide", true );
 
-        int side = WhichSide ( seg );
-        if ( side != _WhichSide ( seg )) {
+        int side = WhichSide ( part, seg );
+        if ( side != _WhichSide ( part, seg )) {
             ERROR ( "WhichSide is wigging out!" );
         }
         return side;
@@ -426,1421 +536,5391 @@ static int WhichSide ( SEG *seg )
 #endif
 
 //----------------------------------------------------------------------------
-//  Create a list of aliases vs LINEDEFs that indicates which side of a given
-//    alias a LINEDEF is on.
+//  Classify a block of (up to SIDE_BLOCK) SEGs at once.  The endpoints of the
+//    SEGs that aren't already known are gathered up and handed to
+//    ClassifySides, which takes care of the ones that are clearly on one side
+//    of the partition.  Anything left over is handed to _WhichSide.  The side
+//    of each SEG is stored in side and the left/split/right totals are added
+//    to count.
 //----------------------------------------------------------------------------
 
-static void CreateSideInfo ( DoomLevel *level )
+void BSPBuilder::ClassifySegs ( const sPartition *part, const int *segs, int noSegs, signed char *side, int *count )
 {
-    FUNCTION_ENTRY ( NULL, "CreateSideInfo", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::ClassifySegs", true );
 
-    long size = ( sizeof ( char * ) + level->LineDefCount ()) * ( long ) noAliases;
-    char *temp = new char [ size ];
+    double sx [ SIDE_BLOCK ], sy [ SIDE_BLOCK ], ex [ SIDE_BLOCK ], ey [ SIDE_BLOCK ];
+    signed char newSide [ SIDE_BLOCK ];
+    int index [ SIDE_BLOCK ], noUnknown = 0;
+    int total [3] = { 0, 0, 0 };
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        int known = KnownSide ( part, segs [i] );
+        if ( known != SIDE_UNKNOWN ) {
+            side [i] = ( signed char ) known;
+            total [ known + 1 ]++;
+            continue;
+        }
+        const sSegCoords *coords = Coords ( segs [i] );
+        index [ noUnknown ] = i;
+        sx [ noUnknown ] = coords->startX;
+        sy [ noUnknown ] = coords->startY;
+        ex [ noUnknown ] = coords->endX;
+        ey [ noUnknown ] = coords->endY;
+        noUnknown++;
+    }
 
-    sideInfo = ( char ** ) temp;
-    memset ( temp, 0, sizeof ( char * ) * noAliases );
+    // Nothing left to classify - ClassifySides would only see unset entries
+    if ( noUnknown > 0 ) {
+        ClassifySides ( part, sx, sy, ex, ey, noUnknown, newSide );
+    }
 
-    temp += sizeof ( char * ) * noAliases;
-    memset ( temp, SIDE_UNKNOWN, level->LineDefCount () * noAliases );
+    for ( int j = 0; j < noUnknown; j++ ) {
+        int unknown = segs [ index [j]];
+        int value = ( newSide [j] != SIDE_UNKNOWN ) ? newSide [j] : _WhichSide ( part, unknown );
+        // Several threads may fill in the same entry, but always with the same value
+        const sSegInfo *info = Info ( unknown );
+        if (( info->Split == false ) && ( part->currentSide != NULL ) && IS_LEFT_RIGHT ( value )) {
+            PUT_SIDE ( part->currentSide, info->LineDef, value );
+        }
+        side [ index [j]] = ( signed char ) value;
+        total [ value + 1 ]++;
+    }
 
-    for ( int i = 0; i < noAliases; i++ ) {
-        sideInfo [i] = ( char * ) temp;
-        temp += level->LineDefCount ();
+#if defined ( DEBUG )
+    for ( int i = 0; i < noSegs; i++ ) {
+        if ( side [i] != _WhichSide ( part, segs [i] )) {
+            ERROR ( "ClassifySides is wigging out!" );
+        }
     }
+#endif
+
+    count [0] += total [0];
+    count [1] += total [1];
+    count [2] += total [2];
 }
 
 //----------------------------------------------------------------------------
-//  Return an index for a vertex at (x,y).  If an existing vertex exists,
-//    return it, otherwise, create a new one if room is left.
+//  Create a list of aliases vs LINEDEFs that indicates which side of a given
+//    alias a LINEDEF is on.  Each alias gets a row of 2-bit entries the first
+//    time it is used as a partition.  If a size limit was given, rows that
+//    haven't been used recently are recycled once the limit is reached.
 //----------------------------------------------------------------------------
 
-static int AddVertex ( int x, int y )
+void BSPBuilder::CreateSideInfo ( DoomLevel *level )
 {
-    FUNCTION_ENTRY ( NULL, "AddVertex", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::CreateSideInfo", true );
 
-    for ( int i = 0; i < noVertices; i++ ) {
-        if (( newVertices [i].x == x ) && ( newVertices [i].y == y )) return i;
-    }
+    m_SideWords = ( level->LineDefCount () + SIDES_PER_WORD - 1 ) / SIDES_PER_WORD;
+    m_SideRows  = 0;
+    m_SideClock = 0;
 
-    if ( noVertices == maxVertices ) {
-        maxVertices = ( 110 * maxVertices ) / 100 + 1;
-        newVertices = ( wVertex * ) realloc ( newVertices, sizeof ( wVertex ) * maxVertices );
+    m_MaxSideRows = 0;
+    if ( m_Options->sideCacheSize > 0 ) {
+        long rows = ( m_Options->sideCacheSize * 1048576L ) / ( sizeof ( UINT32 ) * m_SideWords );
+        if ( rows < m_NoAliases ) m_MaxSideRows = ( rows > 0 ) ? ( int ) rows : 1;
     }
 
-    newVertices [ noVertices ].x = ( UINT16 ) x;
-    newVertices [ noVertices ].y = ( UINT16 ) y;
+    m_SideInfo   = new UINT32 * [ m_NoAliases ];
+    m_SideUsers  = new int [ m_NoAliases ];
+    m_SideRecent = new UINT8 [ m_NoAliases ];
+    m_SideSlot   = m_MaxSideRows ? new int [ m_MaxSideRows ] : NULL;
+    m_SideLock   = NewLock ();
 
-    return noVertices++;
+    memset ( m_SideInfo, 0, sizeof ( UINT32 * ) * m_NoAliases );
+    memset ( m_SideUsers, 0, sizeof ( int ) * m_NoAliases );
+    memset ( m_SideRecent, 0, sizeof ( UINT8 ) * m_NoAliases );
 }
 
-//----------------------------------------------------------------------------
-//  Sort two SEGS so that the one with the lowest numbered LINEDEF is first.
-//----------------------------------------------------------------------------
-
-static int SortByLineDef ( const void *ptr1, const void *ptr2 )
+void BSPBuilder::FreeSideInfo ()
 {
-    FUNCTION_ENTRY ( NULL, "SortByLineDef", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::FreeSideInfo", true );
 
-    int dif1 = (( SEG * ) ptr1)->Sector - (( SEG * ) ptr2)->Sector;
-    if ( dif1 ) return dif1;
+    if ( m_SideInfo == NULL ) return;
 
-    int dif = (( SEG * ) ptr1)->Data.lineDef - (( SEG * ) ptr2)->Data.lineDef;
-    if ( dif ) return dif;
+    for ( int i = 0; i < m_NoAliases; i++ ) {
+        delete [] m_SideInfo [i];
+    }
 
-    return (( SEG * ) ptr1)->Data.flip - (( SEG * ) ptr2)->Data.flip;
+    delete [] m_SideInfo;
+    delete [] m_SideUsers;
+    delete [] m_SideRecent;
+    delete [] m_SideSlot;
+    FreeLock ( m_SideLock );
+
+    m_SideInfo   = NULL;
+    m_SideUsers  = NULL;
+    m_SideRecent = NULL;
+    m_SideSlot   = NULL;
+    m_SideLock   = NULL;
 }
 
 //----------------------------------------------------------------------------
-//  Create a SSECTOR and record the index of the 1st SEG and the total number
-//  of SEGs.
+//  Hand a row over to a new alias from one that isn't using it right now
+//    (m_SideLock must be held).  Each slot gets a second chance if it has
+//    been used since the last time the clock went by.
 //----------------------------------------------------------------------------
 
-static UINT16 CreateSSector ( SEG *segs, int noSegs )
+UINT32 *BSPBuilder::EvictSideInfo ( int newAlias )
 {
-    FUNCTION_ENTRY ( NULL, "CreateSSector", true );
-
-    if ( ssectorsLeft-- == 0 ) {
-        int delta     = ( 10 * ssectorCount ) / 100 + 1;
-        ssectorPool   = ( wSSector * ) realloc ( ssectorPool, sizeof ( wSSector ) * ( ssectorCount + delta ));
-        ssectorsLeft += delta;
+    FUNCTION_ENTRY ( this, "BSPBuilder::EvictSideInfo", true );
+
+    for ( int i = 0; i < 2 * m_SideRows; i++ ) {
+        int slot = m_SideClock;
+        if ( ++m_SideClock == m_SideRows ) m_SideClock = 0;
+        int alias = m_SideSlot [slot];
+        if ( m_SideUsers [alias] != 0 ) continue;
+        if ( m_SideRecent [alias] != 0 ) {
+            m_SideRecent [alias] = 0;
+            continue;
+        }
+        UINT32 *row = m_SideInfo [alias];
+        m_SideInfo [alias] = NULL;
+        m_SideSlot [slot] = newAlias;
+        return row;
     }
 
-    // Splits may have 'upset' the lineDef ordering - some special effects
-    //   assume the SEGS appear in the same order as the LINEDEFS
-    if ( noSegs > 1 ) {
-        qsort ( segs, noSegs, sizeof ( SEG ), SortByLineDef );
-    }
+    return NULL;
+}
 
-    int count = noSegs;
-    int first = segs - segStart;
+//----------------------------------------------------------------------------
+//  Look up the side info for a partition's alias before it is used, and let
+//    go of it afterwards.  If every row is in use the partition gets none,
+//    which only means that each SEG has to be checked the long way.
+//----------------------------------------------------------------------------
 
-#if defined ( DIAGNOSTIC )
-    bool errors = false;
-    for ( int i = 0; i < noSegs; i++ ) {
-        double dx = segs [i].end.x - segs [i].start.x;
-        double dy = segs [i].end.y - segs [i].start.y;
-        double h = ( dx * dx ) + ( dy * dy );
-        for ( int j = 0; j < noSegs; j++ ) {
-            double y1 = ( dx * ( segs [j].start.y - segs [i].start.y ) - dy * ( segs [j].start.x - segs [i].start.x )) / h;
-            double y2 = ( dx * ( segs [j].end.y - segs [i].start.y ) - dy * ( segs [j].end.x - segs [i].start.x )) / h;
-            if (( y1 > 0.5 ) || ( y2 > 0.5 )) errors = true;
+void BSPBuilder::AcquireSideInfo ( sPartition *part )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::AcquireSideInfo", true );
+
+    int alias = part->currentAlias;
+
+    part->currentSide = NULL;
+    if (( m_SideInfo == NULL ) || ( alias == 0 )) return;
+
+    // Without a limit rows are never taken away, so there's no need to count users
+    if ( m_MaxSideRows == 0 ) {
+        UINT32 *row = __atomic_load_n ( &m_SideInfo [alias], __ATOMIC_ACQUIRE );
+        if ( row != NULL ) {
+            part->currentSide = row;
+            return;
         }
     }
-    if ( errors == true ) {
-        fprintf ( stdout, "SSECTOR [%d]:\n", ssectorCount );
-        double minx = segs[0].start.x;
-        double miny = segs[0].start.y;
-        for ( int i = 0; i < noSegs; i++ ) {
-            if ( segs[i].start.x < minx ) minx = segs[i].start.x;
-            if ( segs[i].start.y < miny ) miny = segs[i].start.y;
-            if ( segs[i].end.x < minx ) minx = segs[i].end.x;
-            if ( segs[i].end.y < miny ) miny = segs[i].end.y;
-        }
-        for ( int i = 0; i < noSegs; i++ ) {
-            fprintf ( stdout, "  [%d] (%8.1f,%8.1f)-(%8.1f,%8.1f)  S:%5d  LD:%5d\n", i, segs[i].start.x - minx, segs[i].start.y - miny, segs[i].end.x - minx, segs[i].end.y - miny, segs[i].Sector, segs[i].Data.lineDef );
+
+    Lock ( m_SideLock );
+
+    UINT32 *row = m_SideInfo [alias];
+    if ( row == NULL ) {
+        if (( m_MaxSideRows == 0 ) || ( m_SideRows < m_MaxSideRows )) {
+            if ( m_SideSlot != NULL ) m_SideSlot [ m_SideRows ] = alias;
+            row = new UINT32 [ m_SideWords ];
+            m_SideRows++;
+        } else {
+            row = EvictSideInfo ( alias );
         }
-        for ( int i = 0; i < noSegs; i++ ) {
-            double dx = segs [i].end.x - segs [i].start.x;
-            double dy = segs [i].end.y - segs [i].start.y;
-            double h = ( dx * dx ) + ( dy * dy );
-            for ( int j = 0; j < noSegs; j++ ) {
-                double y1 = ( dx * ( segs [j].start.y - segs [i].start.y ) - dy * ( segs [j].start.x - segs [i].start.x )) / h;
-                double y2 = ( dx * ( segs [j].end.y - segs [i].start.y ) - dy * ( segs [j].end.x - segs [i].start.x )) / h;
-                if (( y1 > 0.5 ) || ( y2 > 0.5 )) fprintf ( stdout, "<< ERROR - seg[%d] is not to the right of seg[%d] (%9.2f,%9.2f) >>\n", j, i, y1, y2 );
-            }
+        if ( row != NULL ) {
+            memset ( row, 0, sizeof ( UINT32 ) * m_SideWords );
+            // Publish the row only once it is cleared, for readers that skip the lock
+            __atomic_store_n ( &m_SideInfo [alias], row, __ATOMIC_RELEASE );
         }
-        fprintf ( stdout, "\n" );
     }
-#endif
 
-    // Eliminate zero length SEGs and assign vertices
-    for ( int i = 0; i < noSegs; i++ ) {
-#if defined ( DEBUG ) 
-        if (( fabs ( segs->start.x - segs->end.x ) < EPSILON ) && ( fabs ( segs->start.y - segs->end.y ) < EPSILON )) {
-            fprintf ( stderr, "Eliminating 0 length SEG from list\n" );
-            memcpy ( segs, segs + 1, sizeof ( SEG ) * ( noSegs - i - 1 ));
-            count--;
-            continue;
-        }
-#endif
-        segs->Data.start = ( UINT16 ) AddVertex ( lrint ( segs->start.x ), lrint ( segs->start.y ));
-        segs->Data.end   = ( UINT16 ) AddVertex ( lrint ( segs->end.x ),   lrint ( segs->end.y ));
-        segs++;
-    }
-    if ( count == 0 ) {
-        WARNING ( "No valid SEGS left in list!" );
+    if ( row != NULL ) {
+        m_SideUsers [alias]++;
+        m_SideRecent [alias] = 1;
     }
 
-    wSSector *ssec = &ssectorPool [ssectorCount];
-    ssec->num   = ( UINT16 ) count;
-    ssec->first = ( UINT16 ) first;
+    Unlock ( m_SideLock );
 
-    return ( UINT16 ) ssectorCount++;
+    part->currentSide = row;
 }
 
-static int SortByAngle ( const void *ptr1, const void *ptr2 )
+void BSPBuilder::ReleaseSideInfo ( sPartition *part )
 {
-    FUNCTION_ENTRY ( NULL, "SortByAngle", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::ReleaseSideInfo", true );
 
-    int dif = ( ANGLE_MASK & (( SEG * ) ptr1)->Data.angle ) - ( ANGLE_MASK & (( SEG * ) ptr2)->Data.angle );
-    if ( dif ) return dif;
-    dif = (( SEG * ) ptr1)->Data.lineDef - (( SEG * ) ptr2)->Data.lineDef;
-    if ( dif ) return dif;
-    return (( SEG * ) ptr1)->Data.flip - (( SEG * ) ptr2)->Data.flip;
+    if ( part->currentSide == NULL ) return;
+
+    if ( m_MaxSideRows != 0 ) AtomicAdd ( &m_SideUsers [ part->currentAlias ], -1 );
+    part->currentSide = NULL;
 }
 
 //----------------------------------------------------------------------------
-//  Create a list of aliases.  These are all the unique lines within the map.
-//    Each linedef is assigned an alias.  All subsequent calculations are
-//    based on the aliases rather than the linedefs, since there are usually
-//    significantly fewer aliases than linedefs.
+//  Return an index for a vertex at (x,y).  If an existing vertex exists,
+//    return it, otherwise, create a new one if room is left.
 //----------------------------------------------------------------------------
 
-static int GetLineDefAliases ( DoomLevel *level, SEG *segs, int noSegs )
+int BSPBuilder::AddVertex ( int x, int y )
 {
-    FUNCTION_ENTRY ( NULL, "GetLineDefAliases", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::AddVertex", true );
+
+    int index = m_VertexHash->Find ( m_NewVertices, x, y );
+    if ( index != -1 ) return index;
+
+    // The list is handed over to the level when it's done, so it's grown with new
+    if ( m_NoVertices == m_MaxVertices ) {
+        m_MaxVertices = ( 110 * m_MaxVertices ) / 100 + 1;
+        wVertex *newVertices = new wVertex [ m_MaxVertices ];
+        memcpy ( newVertices, m_NewVertices, sizeof ( wVertex ) * m_NoVertices );
+        delete [] m_NewVertices;
+        m_NewVertices = newVertices;
+    }
 
-    // Reserve alias 0
-    int noAliases = 1;
+    m_NewVertices [ m_NoVertices ].x = ( UINT16 ) x;
+    m_NewVertices [ m_NoVertices ].y = ( UINT16 ) y;
 
-    lineDefAlias = new int [ level->LineDefCount () ];
-    memset ( lineDefAlias, -1, sizeof ( int ) * ( level->LineDefCount ()));
+    m_VertexHash->Insert ( m_NewVertices, m_NoVertices );
 
-    SEG **segAlias = new SEG * [ level->LineDefCount () + 2 ];
+    return m_NoVertices++;
+}
 
-    qsort ( segs, noSegs, sizeof ( SEG ), SortByAngle );
+static UINT32 AddFixedVertex ( wVertexEx **list, int *count, int *max, INT32 x, INT32 y )
+{
+    FUNCTION_ENTRY ( NULL, "AddFixedVertex", true );
 
-    int lowIndex  = 1;
-    int lastAngle = -1;
+    if ( *count == *max ) {
+        *max  = ( 110 * *max ) / 100 + 256;
+        *list = ( wVertexEx * ) realloc ( *list, sizeof ( wVertexEx ) * *max );
+    }
 
-    for ( int i = 0; i < noSegs; i++ ) {
+    ( *list ) [ *count ].x = x;
+    ( *list ) [ *count ].y = y;
 
-        // If the LINEDEF has been covered, skip this SEG
-        int *alias = &lineDefAlias [ segs [i].Data.lineDef ];
+    return FIXED_VERTEX | ( *count )++;
+}
 
-        if ( *alias == -1 ) {
+//----------------------------------------------------------------------------
+//  Return the vertex for one end of a SEG in a SSECTOR.  When fixed point is
+//    being used, split points that don't land on integer coordinates are
+//    kept in m_FixedVertex and marked with FIXED_VERTEX until they can be
+//    numbered by NumberFixedVertices.
+//----------------------------------------------------------------------------
 
-            ComputeStaticVariables ( &segs [i] );
+UINT32 BSPBuilder::AddSegVertex ( double x, double y )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::AddSegVertex", true );
 
-            // Compare against existing aliases with the same angle
-            int x = lowIndex;
-            while ( x < noAliases ) {
-                if ( CoLinear ( segAlias [x] )) break;
-                x++;
-            }
+    long intX = lrint ( x );
+    long intY = lrint ( y );
 
-            if ( x >= noAliases ) {
-                segAlias [ x = noAliases++ ] = &segs [i];
-                if ( lastAngle != ( ANGLE & ANGLE_MASK )) {
-                    lowIndex = x;
-                    lastAngle = ANGLE & ANGLE_MASK;
-                }
-            }
+    if (( m_FixedPoint == false ) || (( intX == x ) && ( intY == y ))) {
+        return AddVertex ( intX, intY );
+    }
 
-            *alias = x;
-        }
+    return AddFixedVertex ( &m_FixedVertex, &m_NoFixedVertices, &m_MaxFixedVertices, ( INT32 ) lrint ( x * 65536.0 ), ( INT32 ) lrint ( y * 65536.0 ));
+}
+
+//----------------------------------------------------------------------------
+//  Return the vertex for one end of a GL SEG.  Points that are already in
+//    VERTEXES are used as is, the rest are kept in m_GLVertex and marked with
+//    FIXED_VERTEX until they can be numbered by NumberGLVertices.
+//----------------------------------------------------------------------------
+
+UINT32 BSPBuilder::AddGLVertex ( double x, double y )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::AddGLVertex", true );
 
-        segs [i].AliasFlip = ( segs [i].Data.angle == segAlias [*alias]->Data.angle ) ? 0 : SIDE_FLIPPED;
+    INT32 fixedX = ( INT32 ) lrint ( x * 65536.0 );
+    INT32 fixedY = ( INT32 ) lrint ( y * 65536.0 );
+
+    if ((( fixedX | fixedY ) & 0xFFFF ) == 0 ) {
+        int index = m_VertexHash->Find ( m_NewVertices, ( int ) lrint ( x ), ( int ) lrint ( y ));
+        if ( index != -1 ) return index;
     }
 
-    delete [] segAlias;
+    return AddFixedVertex ( &m_GLVertex, &m_NoGLVertices, &m_MaxGLVertices, fixedX, fixedY );
+}
 
-    qsort ( segs, noSegs, sizeof ( SEG ), SortByLineDef );
+struct sFixedKey {
+    INT32     x, y;
+    int       index;
+};
 
-    return noAliases;
+static int SortByPosition ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "SortByPosition", true );
+
+    const sFixedKey *key1 = ( const sFixedKey * ) ptr1;
+    const sFixedKey *key2 = ( const sFixedKey * ) ptr2;
+
+    if ( key1->x != key2->x ) return ( key1->x < key2->x ) ? -1 : 1;
+    if ( key1->y != key2->y ) return ( key1->y < key2->y ) ? -1 : 1;
+
+    return key1->index - key2->index;
 }
 
-#if defined ( DEBUG )
+//----------------------------------------------------------------------------
+//  Merge duplicate fixed point vertices (both halves of a split SEG, and the
+//    SEGs on the other side of the LINEDEF, share the same split point).  The
+//    new position of each of the original vertices is stored in number.
+//----------------------------------------------------------------------------
 
-    static void DumpSegs ( SEG *seg, int noSegs )
-    {
-        FUNCTION_ENTRY ( NULL, "DumpSegs", true );
+static int MergeVertices ( BSPArena *arena, wVertexEx *vertex, int noVertices, int *number )
+{
+    FUNCTION_ENTRY ( NULL, "MergeVertices", true );
 
-        for ( int i = 0; i < noSegs; i++ ) {
-            sVertex *vertS = &seg->start;
-            sVertex *vertE = &seg->end;
-            int alias = lineDefAlias [ seg->Data.lineDef ];
-            WARNING (( lineUsed [ alias ] ? "*" : " " ) <<
-                      " lineDef: " << seg->Data.lineDef <<
-                      " (" << vertS->x << "," << vertS->y << ") -" <<
-                      " (" << vertE->x << "," << vertE->y << ")" );
-            seg++;
+    size_t mark = arena->Mark ();
+    sFixedKey *keys = ( sFixedKey * ) arena->Allocate ( sizeof ( sFixedKey ) * noVertices );
+    for ( int i = 0; i < noVertices; i++ ) {
+        keys [i].x     = vertex [i].x;
+        keys [i].y     = vertex [i].y;
+        keys [i].index = i;
+    }
+
+    qsort ( keys, noVertices, sizeof ( sFixedKey ), SortByPosition );
+
+    int count = 0;
+
+    for ( int i = 0; i < noVertices; i++ ) {
+        if (( i == 0 ) || ( keys [i].x != keys [i-1].x ) || ( keys [i].y != keys [i-1].y )) {
+            vertex [count].x = keys [i].x;
+            vertex [count].y = keys [i].y;
+            count++;
         }
+        number [ keys [i].index ] = count - 1;
     }
 
-#endif
+    arena->Release ( mark );
+
+    return count;
+}
 
 //----------------------------------------------------------------------------
-//
-//  Partition line:
-//    DXx - DYy + C = 0                DX  -DY  -C
-//  rSeg line:                                   =  
-//    dxx - dyy + c = 0                dx  -dy  -c
-//
+//  Number the fixed point vertices after the integer vertices.
 //----------------------------------------------------------------------------
 
-static void DivideSeg ( SEG *rSeg, SEG *lSeg )
+void BSPBuilder::NumberFixedVertices ()
 {
-    FUNCTION_ENTRY ( NULL, "DivideSeg", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::NumberFixedVertices", true );
 
-    const wLineDef *lineDef = rSeg->LineDef;
-    wVertex *vertS = &newVertices [ lineDef->start ];
-    wVertex *vertE = &newVertices [ lineDef->end ];
-
-    // Minimum precision required to avoid overflow/underflow:
-    //   dx, dy  - 16 bits required
-    //   c       - 33 bits required
-    //   det     - 32 bits required
-    //   x, y    - 50 bits required
+    if ( m_NoFixedVertices == 0 ) return;
 
-    double dx  = vertE->x - vertS->x;
-    double dy  = vertE->y - vertS->y;
-    double num = DX * ( vertS->y - Y ) - DY * ( vertS->x - X );
-    double det = dx * DY - dy * DX;
+    size_t mark = m_Arena->Mark ();
+    int *number = ( int * ) m_Arena->Allocate ( sizeof ( int ) * m_NoFixedVertices );
+    m_NoFixedVertices = MergeVertices ( m_Arena, m_FixedVertex, m_NoFixedVertices, number );
 
-    if ( det == 0.0 ) {
-        ERROR ( "SEG is parallel to partition line" );
+    for ( int i = 0; i < m_SegCount; i++ ) {
+        wSegsEx *seg = &m_FinalSegs [i];
+        if ( seg->start & FIXED_VERTEX ) seg->start = m_NoVertices + number [ seg->start & ~FIXED_VERTEX ];
+        if ( seg->end & FIXED_VERTEX ) seg->end = m_NoVertices + number [ seg->end & ~FIXED_VERTEX ];
     }
 
-    double l = num / det;
-    double x = vertS->x + num * dx / det;
-    double y = vertS->y + num * dy / det;
+    m_Arena->Release ( mark );
+}
 
-    if ( rSeg->final == true ) {
-        x = lrint ( x );
-        y = lrint ( y );
-#if defined ( DEBUG )
-        if ((( rSeg->start.x == x ) && ( rSeg->start.y == y )) ||
-            (( lSeg->start.x == x ) && ( lSeg->start.y == y ))) {
-            fprintf ( stderr, "\nNODES: End point duplicated in DivideSeg: LineDef #%d", rSeg->Data.lineDef );
-            fprintf ( stderr, "\n       Partition: from (%f,%f) to (%f,%f)", X, Y, X + DX, Y + DY );
-            fprintf ( stderr, "\n       LineDef: from (%d,%d) to (%d,%d) split at (%f,%f)", vertS->x, vertS->y, vertE->x, vertE->y, x, y );
-            fprintf ( stderr, "\n       SEG: from (%f,%f) to (%f,%f)", rSeg->start.x, rSeg->start.y, rSeg->end.x, rSeg->end.y );
-            fprintf ( stderr, "\n       dif: (%f,%f)  (%f,%f)", rSeg->start.x - x, rSeg->start.y - y, rSeg->end.x - x, rSeg->end.y - y );
-        }
-#endif
-    }
+//----------------------------------------------------------------------------
+//  Number the GL vertices - GL SEGs flag them with GL_VERTEX.
+//----------------------------------------------------------------------------
 
-    // Determine which sided of the partition line the start point is on
-    double sideS = DX * ( rSeg->start.y - Y ) - DY * ( rSeg->start.x - X );
+void BSPBuilder::NumberGLVertices ()
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::NumberGLVertices", true );
 
-    // Get the correct endpoint of the base LINEDEF for the offset calculation
-    if ( rSeg->Data.flip ) vertS = vertE;
-    if ( rSeg->Data.flip ) l = 1.0 - l;
+    if ( m_NoGLVertices == 0 ) return;
 
-    rSeg->Split = true;
-    lSeg->Split = true;
+    size_t mark = m_Arena->Mark ();
+    int *number = ( int * ) m_Arena->Allocate ( sizeof ( int ) * m_NoGLVertices );
+    m_NoGLVertices = MergeVertices ( m_Arena, m_GLVertex, m_NoGLVertices, number );
 
-    // Fill in the parts of lSeg & rSeg that have changed
-    if ( sideS < 0.0 ) {
-#if defined ( DEBUG )
-        if (( lrint ( x ) == lrint ( lSeg->start.x )) && ( lrint ( y ) == lrint ( lSeg->start.y ))) {
-            fprintf ( stderr, "DivideSeg: split didn't work (%10.3f,%10.3f) == L(%10.3f,%10.3f) - %d\n", x, y, lSeg->start.x, lSeg->start.y, currentAlias );
-        } else if (( l < lSeg->start.l ) || ( l > lSeg->end.l )) {
-            fprintf ( stderr, "DivideSeg: warning - split is outside line segment (%7.5f-%7.5f) %7.5f\n", lSeg->start.l, lSeg->end.l, l );
-        }
-#endif
-        rSeg->end.x       = x;
-        rSeg->end.y       = y;
-        rSeg->end.l       = l;
-        lSeg->start.x     = x;
-        lSeg->start.y     = y;
-        lSeg->start.l     = l;
-        lSeg->Data.offset = ( UINT16 ) ( hypot (( double ) ( x - vertS->x ), ( double ) ( y - vertS->y )) + 0.5 );
-    } else {
-#if defined ( DEBUG )
-        if (( lrint ( x ) == lrint ( rSeg->start.x )) && ( lrint ( y ) == lrint ( rSeg->start.y ))) {
-            fprintf ( stderr, "DivideSeg: split didn't work (%10.3f,%10.3f) == R(%10.3f,%10.3f) - %d\n", x, y, rSeg->start.x, rSeg->start.y, currentAlias  );
-        } else if (( l < lSeg->start.l ) || ( l > lSeg->end.l )) {
-            fprintf ( stderr, "DivideSeg: warning - split is outside line segment (%7.5f-%7.5f) %7.5f\n", lSeg->start.l, lSeg->end.l, l );
-        }
-#endif
-        lSeg->end.x       = x;
-        lSeg->end.y       = y;
-        lSeg->end.l       = l;
-        rSeg->start.x     = x;
-        rSeg->start.y     = y;
-        rSeg->start.l     = l;
-        rSeg->Data.offset = ( UINT16 ) ( hypot (( double ) ( x - vertS->x ), ( double ) ( y - vertS->y )) + 0.5 );
+    for ( int i = 0; i < m_GLSegCount; i++ ) {
+        wGLSegsEx *seg = &m_GLSegs [i];
+        if ( seg->start & FIXED_VERTEX ) seg->start = GL_VERTEX | number [ seg->start & ~FIXED_VERTEX ];
+        if ( seg->end & FIXED_VERTEX ) seg->end = GL_VERTEX | number [ seg->end & ~FIXED_VERTEX ];
     }
 
-#if defined ( DEBUG )
-    if ( _WhichSide ( rSeg ) != SIDE_RIGHT ) {
-        fprintf ( stderr, "DivideSeg: %s split invalid\n", "right" );
-    }
-    if ( _WhichSide ( lSeg ) != SIDE_LEFT ) {
-        fprintf ( stderr, "DivideSeg: %s split invalid\n", "left" );
-    }
-#endif
+    m_Arena->Release ( mark );
 }
 
 //----------------------------------------------------------------------------
-//  Split the list of SEGs in two and adjust each copy to the appropriate
-//    values.
+//  Lists of SEGs are sorted using a copy of the fields being compared, since
+//    qsort can't see the SEG pool.  Ties are broken by the original position
+//    in the list.
 //----------------------------------------------------------------------------
 
-static void SplitSegs ( SEG *segs, int noSplits )
+struct sSegKey {
+    int       key [3];
+    int       index;
+    int       seg;
+};
+
+static int SortByKey ( const void *ptr1, const void *ptr2 )
 {
-    FUNCTION_ENTRY ( NULL, "SplitSegs", true );
+    FUNCTION_ENTRY ( NULL, "SortByKey", true );
+
+    const sSegKey *key1 = ( const sSegKey * ) ptr1;
+    const sSegKey *key2 = ( const sSegKey * ) ptr2;
 
-    segCount += noSplits;
-    if ( segCount > maxSegs ) {
-        fprintf ( stderr, "\nError: Too many SEGs have been split!\n" );
-        exit ( -1 );
+    for ( int i = 0; i < 3; i++ ) {
+        int dif = key1->key [i] - key2->key [i];
+        if ( dif ) return dif;
     }
 
-    int count = segCount - ( segs - segStart ) - noSplits;
-    memmove ( segs + noSplits, segs, count * sizeof ( SEG ));
+    return key1->index - key2->index;
+}
 
-    for ( int i = 0; i < noSplits; i++ ) {
-        DivideSeg ( segs, segs + noSplits );
-        segs++;
+static void SortKeys ( sSegKey *keys, int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( NULL, "SortKeys", true );
+
+    qsort ( keys, noSegs, sizeof ( sSegKey ), SortByKey );
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        segs [i] = keys [i].seg;
     }
 }
 
-static void SortSegs ( SEG *pSeg, SEG *seg, int noSegs, int *noLeft, int *noRight )
+//----------------------------------------------------------------------------
+//  Sort a list of SEGS so that the one with the lowest numbered LINEDEF is
+//    first.
+//----------------------------------------------------------------------------
+
+void BSPBuilder::SortByLineDef ( int *segs, int noSegs )
 {
-    FUNCTION_ENTRY ( NULL, "SortSegs", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::SortByLineDef", true );
 
-    int count [3];
+    sSegKey *keys = new sSegKey [ noSegs ];
 
-    if ( pSeg == NULL ) {
-#if defined ( DEBUG )
-        for ( int x = 0; x < noSegs; x++ ) {
-            // Make sure that all SEGs are actually on the right side of each other
-            ComputeStaticVariables ( &seg [x] );
-            if (( fabs ( DX ) < EPSILON ) && ( fabs ( DY ) < EPSILON )) continue;
+    for ( int i = 0; i < noSegs; i++ ) {
+        const wSegs *data = &Seg ( segs [i] )->Data;
+        keys [i].key [0] = Info ( segs [i] )->Sector;
+        keys [i].key [1] = data->lineDef;
+        keys [i].key [2] = data->flip;
+        keys [i].index   = i;
+        keys [i].seg     = segs [i];
+    }
 
-            count [0] = count [1] = count [2] = 0;
-            for ( int i = 0; i < noSegs; i++ ) {
-                count [( seg [i].Side = _WhichSide ( &seg [i] )) + 1 ]++;
-            }
+    SortKeys ( keys, segs, noSegs );
 
-            if (( count [0] * count [2] ) || count [1] ) {
-                DumpSegs ( seg, noSegs );
-                ERROR ( "Something weird is going on! (" << count [0] << "|" << count [1] << "|" << count [2] << ") " << noSegs );
-                break;
+    delete [] keys;
+}
+
+//----------------------------------------------------------------------------
+//  Sort a list of SEGS so that the most promising partition lines come first:
+//    horizontal and vertical lines, longest first, followed by the rest.
+//----------------------------------------------------------------------------
+
+void BSPBuilder::SortByPriority ( int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::SortByPriority", true );
+
+    sSegKey *keys = new sSegKey [ noSegs ];
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        const sSegCoords *coords = Coords ( segs [i] );
+        double dx = coords->endX - coords->startX;
+        double dy = coords->endY - coords->startY;
+        keys [i].key [0] = ( Seg ( segs [i] )->Data.angle & 0x3FFF ) ? 1 : 0;
+        keys [i].key [1] = -( int ) lrint ( sqrt ( dx * dx + dy * dy ));
+        keys [i].key [2] = 0;
+        keys [i].index   = i;
+        keys [i].seg     = segs [i];
+    }
+
+    SortKeys ( keys, segs, noSegs );
+
+    delete [] keys;
+}
+
+//----------------------------------------------------------------------------
+//  Create a SSECTOR from a copy of the given SEGs.  The SSECTOR isn't given
+//    a number (and the SEGs don't get their vertices) until StoreSSector.
+//----------------------------------------------------------------------------
+
+sBSPNode *BSPBuilder::CreateSSector ( int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::CreateSSector", true );
+
+    sBSPNode *ssector = new sBSPNode;
+    ssector->child [0] = NULL;
+    ssector->child [1] = NULL;
+    ssector->segs      = new int [ noSegs ];
+    ssector->noSegs    = noSegs;
+
+    memcpy ( ssector->segs, segs, sizeof ( int ) * noSegs );
+
+    // Splits may have 'upset' the lineDef ordering - some special effects
+    //   assume the SEGS appear in the same order as the LINEDEFS
+    if ( noSegs > 1 ) {
+        SortByLineDef ( ssector->segs, noSegs );
+    }
+
+    return ssector;
+}
+
+//----------------------------------------------------------------------------
+//  Store a SSECTOR and record the index of the 1st SEG and the total number
+//  of SEGs.
+//----------------------------------------------------------------------------
+
+UINT32 BSPBuilder::StoreSSector ( sBSPNode *ssector )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::StoreSSector", true );
+
+    int noSegs = ssector->noSegs;
+    int count  = 0;
+    int first  = m_SegCount;
+
+    int *segs = ssector->segs;
+
+#if defined ( DIAGNOSTIC )
+    bool errors = false;
+    for ( int i = 0; i < noSegs; i++ ) {
+        const sSegCoords *ci = Coords ( segs [i] );
+        double dx = ci->endX - ci->startX;
+        double dy = ci->endY - ci->startY;
+        double h = ( dx * dx ) + ( dy * dy );
+        for ( int j = 0; j < noSegs; j++ ) {
+            const sSegCoords *cj = Coords ( segs [j] );
+            double y1 = ( dx * ( cj->startY - ci->startY ) - dy * ( cj->startX - ci->startX )) / h;
+            double y2 = ( dx * ( cj->endY - ci->startY ) - dy * ( cj->endX - ci->startX )) / h;
+            if (( y1 > 0.5 ) || ( y2 > 0.5 )) errors = true;
+        }
+    }
+    if ( errors == true ) {
+        fprintf ( stdout, "SSECTOR [%d]:\n", m_SSectorCount );
+        double minx = Coords ( segs [0] )->startX;
+        double miny = Coords ( segs [0] )->startY;
+        for ( int i = 0; i < noSegs; i++ ) {
+            const sSegCoords *ci = Coords ( segs [i] );
+            if ( ci->startX < minx ) minx = ci->startX;
+            if ( ci->startY < miny ) miny = ci->startY;
+            if ( ci->endX < minx ) minx = ci->endX;
+            if ( ci->endY < miny ) miny = ci->endY;
+        }
+        for ( int i = 0; i < noSegs; i++ ) {
+            const sSegCoords *ci = Coords ( segs [i] );
+            fprintf ( stdout, "  [%d] (%8.1f,%8.1f)-(%8.1f,%8.1f)  S:%5d  LD:%5d\n", i, ci->startX - minx, ci->startY - miny, ci->endX - minx, ci->endY - miny, Info ( segs [i] )->Sector, Info ( segs [i] )->LineDef );
+        }
+        for ( int i = 0; i < noSegs; i++ ) {
+            const sSegCoords *ci = Coords ( segs [i] );
+            double dx = ci->endX - ci->startX;
+            double dy = ci->endY - ci->startY;
+            double h = ( dx * dx ) + ( dy * dy );
+            for ( int j = 0; j < noSegs; j++ ) {
+                const sSegCoords *cj = Coords ( segs [j] );
+                double y1 = ( dx * ( cj->startY - ci->startY ) - dy * ( cj->startX - ci->startX )) / h;
+                double y2 = ( dx * ( cj->endY - ci->startY ) - dy * ( cj->endX - ci->startX )) / h;
+                if (( y1 > 0.5 ) || ( y2 > 0.5 )) fprintf ( stdout, "<< ERROR - seg[%d] is not to the right of seg[%d] (%9.2f,%9.2f) >>\n", j, i, y1, y2 );
             }
         }
+        fprintf ( stdout, "\n" );
+    }
 #endif
-        *noRight  = noSegs;
-        *noLeft   = 0;
+
+    // Eliminate zero length SEGs and assign vertices
+    wSegsEx *out = &m_FinalSegs [ first ];
+    for ( int i = 0; i < noSegs; i++ ) {
+        const sSegCoords *coords = Coords ( segs [i] );
+#if defined ( DEBUG ) 
+        if (( fabs ( coords->startX - coords->endX ) < EPSILON ) && ( fabs ( coords->startY - coords->endY ) < EPSILON )) {
+            fprintf ( stderr, "Eliminating 0 length SEG from list\n" );
+            continue;
+        }
+#endif
+        const wSegs *data = &Seg ( segs [i] )->Data;
+        out->start   = AddSegVertex ( coords->startX, coords->startY );
+        out->end     = AddSegVertex ( coords->endX,   coords->endY );
+        out->angle   = data->angle;
+        out->lineDef = data->lineDef;
+        out->flip    = data->flip;
+        out->offset  = data->offset;
+        out++;
+        count++;
+    }
+    if ( count == 0 ) {
+        WARNING ( "No valid SEGS left in list!" );
+    }
+
+    m_SegCount += count;
+
+    wSSectorEx *ssec = &m_SSectorPool [m_SSectorCount];
+    ssec->num   = count;
+    ssec->first = first;
+
+    if ( m_GLNodes == true ) StoreGLSSector ( segs, noSegs );
+
+    return m_SSectorCount++;
+}
+
+//----------------------------------------------------------------------------
+//  GL nodes are built from the same tree as the NODES.  Each GL SSECTOR is
+//    the convex region left after clipping the level's bounding box by the
+//    partition lines above it and by its own SEGs.  Its SEGs are listed in
+//    clockwise order, with minisegs along the edge of the region closing the
+//    gaps between them.  A SSECTOR whose region has no area (a SEG squeezed
+//    between two partition lines, or rounded off the edge of its region) is
+//    left empty - DropGLSegs and PruneGLNodes take it out again.
+//----------------------------------------------------------------------------
+
+#define GL_EPSILON              0.001
+#define GL_TOLERANCE            1.5             // rounded SEGs & NODES can leave SEGs this far off the region's edge
+#define GL_MARGIN               64
+
+struct sGLPoint {
+    double    x, y;
+};
+
+struct sGLSeg {
+    sGLPoint  start;
+    sGLPoint  end;
+    int       seg;                      // SEG pool index, -1 for a miniseg
+};
+
+struct sGLWalk {
+    sGLSeg   *list;                     // SEGs & minisegs added so far
+    int       count;
+    sGLPoint  current;                  // where the last one ended
+    bool      started;
+};
+
+struct sGLKey {
+    int       edge;
+    double    offset;
+    int       index;
+};
+
+static int SortByEdge ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "SortByEdge", true );
+
+    const sGLKey *key1 = ( const sGLKey * ) ptr1;
+    const sGLKey *key2 = ( const sGLKey * ) ptr2;
+
+    if ( key1->edge != key2->edge ) return key1->edge - key2->edge;
+    if ( key1->offset != key2->offset ) return ( key1->offset < key2->offset ) ? -1 : 1;
+
+    return key1->index - key2->index;
+}
+
+static inline double GLDistance ( const sGLPoint *p1, const sGLPoint *p2 )
+{
+    return sqrt (( p2->x - p1->x ) * ( p2->x - p1->x ) + ( p2->y - p1->y ) * ( p2->y - p1->y ));
+}
+
+// Distance of a point from the line - positive on the left side
+static inline double GLSide ( const sGLLine *line, const sGLPoint *point )
+{
+    return line->dx * ( point->y - line->y ) - line->dy * ( point->x - line->x );
+}
+
+static bool MakeGLLine ( sGLLine *line, const sGLPoint *start, const sGLPoint *end )
+{
+    double length = GLDistance ( start, end );
+    if ( length < GL_EPSILON ) return false;
+
+    line->x  = start->x;
+    line->y  = start->y;
+    line->dx = ( end->x - start->x ) / length;
+    line->dy = ( end->y - start->y ) / length;
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//  Clip a convex polygon to the right side of a line (Sutherland-Hodgman) and
+//    drop any points that end up on top of each other.  Returns 0 if the
+//    polygon doesn't fit in out.
+//----------------------------------------------------------------------------
+
+static int ClipGLPolygon ( const sGLLine *line, const sGLPoint *in, int noIn, sGLPoint *out, int maxOut )
+{
+    FUNCTION_ENTRY ( NULL, "ClipGLPolygon", true );
+
+    int noOut = 0;
+
+    for ( int i = 0; i < noIn; i++ ) {
+        const sGLPoint *p = &in [i];
+        const sGLPoint *q = &in [ ( i + 1 ) % noIn ];
+        double dp = GLSide ( line, p );
+        double dq = GLSide ( line, q );
+        if ( noOut + 2 > maxOut ) return 0;
+        if ( dp <= GL_EPSILON ) out [noOut++] = *p;
+        if ((( dp < 0.0 ) && ( dq > GL_EPSILON )) || (( dp > GL_EPSILON ) && ( dq < 0.0 ))) {
+            double t = dp / ( dp - dq );
+            out [noOut].x = p->x + t * ( q->x - p->x );
+            out [noOut].y = p->y + t * ( q->y - p->y );
+            noOut++;
+        }
+    }
+
+    int count = 0;
+    for ( int i = 0; i < noOut; i++ ) {
+        if (( count > 0 ) && ( GLDistance ( &out [count-1], &out [i] ) < GL_EPSILON )) continue;
+        out [count++] = out [i];
+    }
+    while (( count > 1 ) && ( GLDistance ( &out [count-1], &out [0] ) < GL_EPSILON )) count--;
+
+    return count;
+}
+
+static void AddGLSeg ( sGLWalk *walk, const sGLPoint *start, const sGLPoint *end, int seg )
+{
+    sGLSeg *glSeg = &walk->list [ walk->count++ ];
+    glSeg->start  = *start;
+    glSeg->end    = *end;
+    glSeg->seg    = seg;
+
+    walk->current = *end;
+    walk->started = true;
+}
+
+static inline bool SamePoint ( const sGLPoint *p1, const sGLPoint *p2 )
+{
+    return ( p1->x == p2->x ) && ( p1->y == p2->y );
+}
+
+// Move on to a corner of the region, unless the last SEG already went past it
+static void WalkToPoint ( sGLWalk *walk, const sGLPoint *point )
+{
+    if ( walk->started == false ) {
+        walk->current = *point;
+        walk->started = true;
         return;
     }
 
-    ComputeStaticVariables ( pSeg );
+    if ( GLDistance ( &walk->current, point ) <= GL_TOLERANCE ) return;
 
-    count [0] = count [1] = count [2] = 0;
-    int i;
-    for ( i = 0; i < noSegs; i++ ) {
-        count [( seg [i].Side = WhichSide ( &seg [i] )) + 1 ]++;
+    if (( walk->count > 0 ) && ( walk->list [ walk->count - 1 ].seg != -1 )) {
+        const sGLSeg *last = &walk->list [ walk->count - 1 ];
+        sGLLine line;
+        if (( MakeGLLine ( &line, &last->start, &last->end ) == true ) &&
+            ( fabs ( GLSide ( &line, point )) <= GL_TOLERANCE ) &&
+            (( point->x - last->end.x ) * line.dx + ( point->y - last->end.y ) * line.dy < 0.0 )) {
+            return;
+        }
+    }
+
+    AddGLSeg ( walk, &walk->current, point, -1 );
+}
+
+// Add a SEG, joining it to the last one with a miniseg if they don't meet
+static void WalkToSeg ( sGLWalk *walk, const sGLSeg *seg )
+{
+    if (( walk->started == true ) && ( SamePoint ( &walk->current, &seg->start ) == false )) {
+        bool close = ( GLDistance ( &walk->current, &seg->start ) <= GL_TOLERANCE ) ? true : false;
+        if (( close == true ) && ( walk->count > 0 ) && ( walk->list [ walk->count - 1 ].seg == -1 )) {
+            walk->list [ walk->count - 1 ].end = seg->start;
+        } else if (( close == false ) || ( walk->count > 0 )) {
+            AddGLSeg ( walk, &walk->current, &seg->start, -1 );
+        }
+    }
+
+    AddGLSeg ( walk, &seg->start, &seg->end, seg->seg );
+}
+
+static void CloseWalk ( sGLWalk *walk )
+{
+    if ( walk->count == 0 ) return;
+
+    const sGLPoint *first = &walk->list [0].start;
+    if ( SamePoint ( &walk->current, first ) == true ) return;
+
+    if (( GLDistance ( &walk->current, first ) <= GL_TOLERANCE ) && ( walk->count > 1 )) {
+        if ( walk->list [ walk->count - 1 ].seg == -1 ) {
+            walk->list [ walk->count - 1 ].end = *first;
+            return;
+        }
+        if ( walk->list [0].seg == -1 ) {
+            walk->list [0].start = walk->current;
+            return;
+        }
+    }
+
+    AddGLSeg ( walk, &walk->current, first, -1 );
+}
+
+// A miniseg that runs back along one of the SEGs only adds a spike to the region
+static bool OnGLSeg ( const sGLWalk *walk, const sGLSeg *mini )
+{
+    for ( int i = 0; i < walk->count; i++ ) {
+        const sGLSeg *seg = &walk->list [i];
+        sGLLine line;
+        if (( seg->seg == -1 ) || ( MakeGLLine ( &line, &seg->start, &seg->end ) == false )) continue;
+        if (( mini->end.x - mini->start.x ) * line.dx + ( mini->end.y - mini->start.y ) * line.dy >= 0.0 ) continue;
+        if ( fabs ( GLSide ( &line, &mini->start )) > GL_TOLERANCE ) continue;
+        if ( fabs ( GLSide ( &line, &mini->end )) > GL_TOLERANCE ) continue;
+        double length = GLDistance ( &seg->start, &seg->end );
+        double t1 = ( mini->start.x - line.x ) * line.dx + ( mini->start.y - line.y ) * line.dy;
+        double t2 = ( mini->end.x - line.x ) * line.dx + ( mini->end.y - line.y ) * line.dy;
+        if (( t1 > GL_EPSILON ) && ( t2 < length - GL_EPSILON )) return true;
+    }
+
+    return false;
+}
+
+// Fold any minisegs like that into the miniseg next to them
+static void RemoveGLSpikes ( sGLWalk *walk )
+{
+    for ( int i = 0; ( i < walk->count ) && ( walk->count > 3 ); i++ ) {
+        sGLSeg *mini = &walk->list [i];
+        if (( mini->seg != -1 ) || ( OnGLSeg ( walk, mini ) == false )) continue;
+        sGLSeg *prev = &walk->list [ ( i + walk->count - 1 ) % walk->count ];
+        sGLSeg *next = &walk->list [ ( i + 1 ) % walk->count ];
+        if ( prev->seg == -1 ) prev->end = mini->end;
+        else if ( next->seg == -1 ) next->start = mini->start;
+        else continue;
+        memmove ( mini, mini + 1, sizeof ( sGLSeg ) * ( walk->count - i - 1 ));
+        walk->count--;
+        i--;
+    }
+}
+
+void BSPBuilder::PushGLClip ( const wNode *node, int side )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::PushGLClip", true );
+
+    if ( m_GLDepth == m_MaxGLDepth ) {
+        m_MaxGLDepth = 2 * m_MaxGLDepth + 64;
+        m_GLClip     = ( sGLLine * ) realloc ( m_GLClip, sizeof ( sGLLine ) * m_MaxGLDepth );
+    }
+
+    sGLPoint start, end;
+    start.x = node->x;
+    start.y = node->y;
+    end.x   = node->x + node->dx;
+    end.y   = node->y + node->dy;
+
+    // The left side of the partition is kept by reversing it
+    sGLLine *line = &m_GLClip [ m_GLDepth++ ];
+    if ( side == 0 ) MakeGLLine ( line, &start, &end );
+    else MakeGLLine ( line, &end, &start );
+}
+
+void BSPBuilder::StoreGLSSector ( int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::StoreGLSSector", true );
+
+    size_t mark = m_Arena->Mark ();
+
+    // Use the same end points as the SEGs stored by StoreSSector
+    sGLSeg *seg = ( sGLSeg * ) m_Arena->Allocate ( sizeof ( sGLSeg ) * ( noSegs + 1 ));
+    int count = 0;
+    for ( int i = 0; i < noSegs; i++ ) {
+        const sSegCoords *coords = Coords ( segs [i] );
+        sGLSeg *glSeg = &seg [count];
+        glSeg->start.x = coords->startX;
+        glSeg->start.y = coords->startY;
+        glSeg->end.x   = coords->endX;
+        glSeg->end.y   = coords->endY;
+        glSeg->seg     = segs [i];
+        if ( m_FixedPoint == false ) {
+            glSeg->start.x = lrint ( glSeg->start.x );
+            glSeg->start.y = lrint ( glSeg->start.y );
+            glSeg->end.x   = lrint ( glSeg->end.x );
+            glSeg->end.y   = lrint ( glSeg->end.y );
+        }
+        if ( GLDistance ( &glSeg->start, &glSeg->end ) >= GL_EPSILON ) count++;
+    }
+
+    // Clip the level's bounding box down to the region covered by this SSECTOR
+    int maxPoints = 2 * ( 4 + m_GLDepth + count ) + 8;
+    sGLPoint *poly = ( sGLPoint * ) m_Arena->Allocate ( sizeof ( sGLPoint ) * maxPoints );
+    sGLPoint *temp = ( sGLPoint * ) m_Arena->Allocate ( sizeof ( sGLPoint ) * maxPoints );
+
+    poly [0].x = m_GLBound [0];    poly [0].y = m_GLBound [3];
+    poly [1].x = m_GLBound [2];    poly [1].y = m_GLBound [3];
+    poly [2].x = m_GLBound [2];    poly [2].y = m_GLBound [1];
+    poly [3].x = m_GLBound [0];    poly [3].y = m_GLBound [1];
+
+    int noPoints = 4;
+    for ( int i = 0; ( i < m_GLDepth + count ) && ( noPoints >= 3 ); i++ ) {
+        sGLLine segLine, *line = &m_GLClip [i];
+        if ( i >= m_GLDepth ) {
+            line = &segLine;
+            MakeGLLine ( line, &seg [ i - m_GLDepth ].start, &seg [ i - m_GLDepth ].end );
+        }
+        noPoints = ClipGLPolygon ( line, poly, noPoints, temp, maxPoints );
+        sGLPoint *swap = poly;
+        poly = temp;
+        temp = swap;
+    }
+
+    // Find the edge of the region that each SEG lies on
+    sGLKey *key = ( sGLKey * ) m_Arena->Allocate ( sizeof ( sGLKey ) * ( count + 1 ));
+    bool matched = ( noPoints >= 3 ) ? true : false;
+    for ( int i = 0; ( i < count ) && ( matched == true ); i++ ) {
+        const sGLSeg *glSeg = &seg [i];
+        double best = 0.0;
+        key [i].edge  = -1;
+        key [i].index = i;
+        for ( int j = 0; j < noPoints; j++ ) {
+            const sGLPoint *start = &poly [j];
+            const sGLPoint *end   = &poly [ ( j + 1 ) % noPoints ];
+            sGLLine line;
+            if ( MakeGLLine ( &line, start, end ) == false ) continue;
+            double dx = glSeg->end.x - glSeg->start.x;
+            double dy = glSeg->end.y - glSeg->start.y;
+            if ( dx * line.dx + dy * line.dy <= 0.0 ) continue;
+            if ( fabs ( GLSide ( &line, &glSeg->start )) > GL_TOLERANCE ) continue;
+            if ( fabs ( GLSide ( &line, &glSeg->end )) > GL_TOLERANCE ) continue;
+            double length = GLDistance ( start, end );
+            double offset = ( glSeg->start.x - line.x ) * line.dx + ( glSeg->start.y - line.y ) * line.dy;
+            double outside = ( offset < 0.0 ) ? -offset : ( offset > length ) ? offset - length : 0.0;
+            if (( key [i].edge == -1 ) || ( outside < best )) {
+                key [i].edge   = j;
+                key [i].offset = offset;
+                best = outside;
+            }
+        }
+        if ( key [i].edge == -1 ) matched = false;
+    }
+
+    sGLWalk walk;
+    walk.list    = ( sGLSeg * ) m_Arena->Allocate ( sizeof ( sGLSeg ) * ( 2 * ( count + noPoints ) + 1 ));
+    walk.count   = 0;
+    walk.started = false;
+
+    if ( matched == true ) {
+        // Start with a SEG - a corner of the region may be hidden under the last one
+        qsort ( key, count, sizeof ( sGLKey ), SortByEdge );
+        int first = ( count > 0 ) ? key [0].edge : 0;
+        int k = 0;
+        for ( int j = 0; j < noPoints; j++ ) {
+            int edge = ( first + j ) % noPoints;
+            if (( j > 0 ) || ( count == 0 )) WalkToPoint ( &walk, &poly [edge] );
+            for ( ; ( k < count ) && ( key [k].edge == edge ); k++ ) {
+                WalkToSeg ( &walk, &seg [ key [k].index ] );
+            }
+        }
+        WalkToPoint ( &walk, &poly [first] );
+    } else if ( count > 0 ) {
+        // Rounding left a SEG off the edge of the region - just join them up in
+        //   clockwise order around their centre
+        double x = 0.0, y = 0.0;
+        for ( int i = 0; i < count; i++ ) {
+            x += seg [i].start.x + seg [i].end.x;
+            y += seg [i].start.y + seg [i].end.y;
+        }
+        x /= 2 * count;
+        y /= 2 * count;
+        for ( int i = 0; i < count; i++ ) {
+            key [i].edge   = 0;
+            key [i].offset = -atan2 (( seg [i].start.y + seg [i].end.y ) / 2 - y, ( seg [i].start.x + seg [i].end.x ) / 2 - x );
+            key [i].index  = i;
+        }
+        qsort ( key, count, sizeof ( sGLKey ), SortByEdge );
+        for ( int i = 0; i < count; i++ ) {
+            WalkToSeg ( &walk, &seg [ key [i].index ] );
+        }
+    }
+
+    CloseWalk ( &walk );
+    RemoveGLSpikes ( &walk );
+
+    // Anything less than a triangle only runs back over its own SEGs
+    double area = 0.0;
+    for ( int i = 0; i < walk.count; i++ ) {
+        const sGLSeg *glSeg = &walk.list [i];
+        area += glSeg->start.x * glSeg->end.y - glSeg->end.x * glSeg->start.y;
+    }
+    bool empty = (( walk.count < 3 ) || ( -area / 2.0 < GL_EPSILON )) ? true : false;
+
+    if ( m_GLSegCount + walk.count > m_MaxGLSegs ) {
+        m_MaxGLSegs = ( 110 * ( m_GLSegCount + walk.count )) / 100 + 256;
+        m_GLSegs    = ( wGLSegsEx * ) realloc ( m_GLSegs, sizeof ( wGLSegsEx ) * m_MaxGLSegs );
+    }
+
+    wSSectorEx *ssec = &m_GLSSectorPool [m_SSectorCount];
+    ssec->num   = ( empty == true ) ? 0 : walk.count;
+    ssec->first = m_GLSegCount;
+
+    for ( int i = 0; i < walk.count; i++ ) {
+        const sGLSeg *glSeg = &walk.list [i];
+        wGLSegsEx *out = &m_GLSegs [ m_GLSegCount++ ];
+        out->start   = AddGLVertex ( glSeg->start.x, glSeg->start.y );
+        out->end     = AddGLVertex ( glSeg->end.x, glSeg->end.y );
+        out->lineDef = ( UINT16 ) (( glSeg->seg != -1 ) ? Seg ( glSeg->seg )->Data.lineDef : GL_MINISEG );
+        out->flip    = ( UINT16 ) (( glSeg->seg != -1 ) ? Seg ( glSeg->seg )->Data.flip : 0 );
+        out->partner = GL_NO_PARTNER;
+    }
+
+    m_Arena->Release ( mark );
+}
+
+struct sGLSegKey {
+    UINT32    start;
+    UINT32    end;
+    int       index;
+};
+
+static int SortByVertices ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "SortByVertices", true );
+
+    const sGLSegKey *key1 = ( const sGLSegKey * ) ptr1;
+    const sGLSegKey *key2 = ( const sGLSegKey * ) ptr2;
+
+    if ( key1->start != key2->start ) return ( key1->start < key2->start ) ? -1 : 1;
+    if ( key1->end != key2->end ) return ( key1->end < key2->end ) ? -1 : 1;
+
+    return key1->index - key2->index;
+}
+
+// Find the first key for a SEG from start to end (or where it would be)
+static int FindGLSeg ( const sGLSegKey *keys, int noKeys, UINT32 start, UINT32 end )
+{
+    FUNCTION_ENTRY ( NULL, "FindGLSeg", true );
+
+    sGLSegKey key;
+    key.start = start;
+    key.end   = end;
+    key.index = -1;
+
+    int lo = 0, hi = noKeys;
+    while ( lo < hi ) {
+        int mid = ( lo + hi ) / 2;
+        if ( SortByVertices ( &keys [mid], &key ) < 0 ) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+//----------------------------------------------------------------------------
+//  Remove the SEGs of the empty GL SSECTORs, and any GL vertices only they
+//    used.  A SEG squeezed into a region with no area lies along the edge of
+//    a neighbouring region, where that GL SSECTOR has a miniseg going the
+//    same way - the miniseg is turned into the SEG so the wall isn't lost.
+//----------------------------------------------------------------------------
+
+void BSPBuilder::DropGLSegs ()
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::DropGLSegs", true );
+
+    size_t mark = m_Arena->Mark ();
+
+    bool *kept = ( bool * ) m_Arena->Allocate ( sizeof ( bool ) * ( m_GLSegCount + 1 ));
+    memset ( kept, false, sizeof ( bool ) * m_GLSegCount );
+    for ( int i = 0; i < m_SSectorCount; i++ ) {
+        const wSSectorEx *ssec = &m_GLSSectorPool [i];
+        for ( UINT32 j = 0; j < ssec->num; j++ ) {
+            kept [ ssec->first + j ] = true;
+        }
+    }
+
+    sGLSegKey *keys = ( sGLSegKey * ) m_Arena->Allocate ( sizeof ( sGLSegKey ) * ( m_GLSegCount + 1 ));
+    int noKeys = 0, noDropped = 0;
+    for ( int i = 0; i < m_GLSegCount; i++ ) {
+        if ( kept [i] == true ) continue;
+        noDropped++;
+        if ( m_GLSegs [i].lineDef == GL_MINISEG ) continue;
+        keys [noKeys].start = m_GLSegs [i].start;
+        keys [noKeys].end   = m_GLSegs [i].end;
+        keys [noKeys].index = i;
+        noKeys++;
+    }
+
+    if ( noDropped == 0 ) {
+        m_Arena->Release ( mark );
+        return;
+    }
+
+    qsort ( keys, noKeys, sizeof ( sGLSegKey ), SortByVertices );
+
+    for ( int i = 0; ( i < m_GLSegCount ) && ( noKeys > 0 ); i++ ) {
+        wGLSegsEx *seg = &m_GLSegs [i];
+        if (( kept [i] == false ) || ( seg->lineDef != GL_MINISEG )) continue;
+        for ( int k = FindGLSeg ( keys, noKeys, seg->start, seg->end ); ( k < noKeys ) && ( keys [k].start == seg->start ) && ( keys [k].end == seg->end ); k++ ) {
+            wGLSegsEx *lost = &m_GLSegs [ keys [k].index ];
+            if ( lost->lineDef == GL_MINISEG ) continue;
+            seg->lineDef  = lost->lineDef;
+            seg->flip     = lost->flip;
+            lost->lineDef = GL_MINISEG;
+            break;
+        }
+    }
+
+    int *number = ( int * ) m_Arena->Allocate ( sizeof ( int ) * ( m_GLSegCount + 1 ));
+    int noSegs = 0;
+    for ( int i = 0; i < m_GLSegCount; i++ ) {
+        number [i] = noSegs;
+        if ( kept [i] == true ) m_GLSegs [ noSegs++ ] = m_GLSegs [i];
+    }
+    for ( int i = 0; i < m_SSectorCount; i++ ) {
+        if ( m_GLSSectorPool [i].num > 0 ) m_GLSSectorPool [i].first = number [ m_GLSSectorPool [i].first ];
+    }
+    m_GLSegCount = noSegs;
+
+    int *vertex = ( int * ) m_Arena->Allocate ( sizeof ( int ) * ( m_NoGLVertices + 1 ));
+    memset ( vertex, -1, sizeof ( int ) * m_NoGLVertices );
+    for ( int i = 0; i < m_GLSegCount; i++ ) {
+        if ( m_GLSegs [i].start & GL_VERTEX ) vertex [ m_GLSegs [i].start & ~GL_VERTEX ] = 0;
+        if ( m_GLSegs [i].end & GL_VERTEX ) vertex [ m_GLSegs [i].end & ~GL_VERTEX ] = 0;
+    }
+    int noVertices = 0;
+    for ( int i = 0; i < m_NoGLVertices; i++ ) {
+        if ( vertex [i] == -1 ) continue;
+        vertex [i] = noVertices;
+        m_GLVertex [ noVertices++ ] = m_GLVertex [i];
+    }
+    for ( int i = 0; i < m_GLSegCount; i++ ) {
+        if ( m_GLSegs [i].start & GL_VERTEX ) m_GLSegs [i].start = GL_VERTEX | vertex [ m_GLSegs [i].start & ~GL_VERTEX ];
+        if ( m_GLSegs [i].end & GL_VERTEX ) m_GLSegs [i].end = GL_VERTEX | vertex [ m_GLSegs [i].end & ~GL_VERTEX ];
+    }
+    m_NoGLVertices = noVertices;
+
+    m_Arena->Release ( mark );
+}
+
+//----------------------------------------------------------------------------
+//  A GL SEG's partner runs between the same two vertices in the other
+//    direction (on the other side of a two-sided LINEDEF or a miniseg) in a
+//    different GL SSECTOR.  Each SEG has at most one partner, and partners
+//    always point at each other.  A SEG is paired with the other side of its
+//    LINEDEF rather than a miniseg if there is a choice.
+//----------------------------------------------------------------------------
+
+void BSPBuilder::FindGLPartners ()
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::FindGLPartners", true );
+
+    size_t mark = m_Arena->Mark ();
+
+    int *ssector = ( int * ) m_Arena->Allocate ( sizeof ( int ) * ( m_GLSegCount + 1 ));
+    for ( int i = 0; i < m_SSectorCount; i++ ) {
+        const wSSectorEx *ssec = &m_GLSSectorPool [i];
+        for ( UINT32 j = 0; j < ssec->num; j++ ) {
+            ssector [ ssec->first + j ] = i;
+        }
+    }
+
+    sGLSegKey *keys = ( sGLSegKey * ) m_Arena->Allocate ( sizeof ( sGLSegKey ) * m_GLSegCount );
+    for ( int i = 0; i < m_GLSegCount; i++ ) {
+        keys [i].start = m_GLSegs [i].start;
+        keys [i].end   = m_GLSegs [i].end;
+        keys [i].index = i;
+    }
+
+    qsort ( keys, m_GLSegCount, sizeof ( sGLSegKey ), SortByVertices );
+
+    // Both sides of a LINEDEF are paired up first, then the minisegs
+    for ( int pass = 0; pass < 2; pass++ ) {
+        for ( int i = 0; i < m_GLSegCount; i++ ) {
+            if ( m_GLSegs [i].partner != GL_NO_PARTNER ) continue;
+            if (( pass == 0 ) && ( m_GLSegs [i].lineDef == GL_MINISEG )) continue;
+            UINT32 start = m_GLSegs [i].end;
+            UINT32 end   = m_GLSegs [i].start;
+            // Take the first SEG going the other way that is still free
+            for ( int k = FindGLSeg ( keys, m_GLSegCount, start, end ); ( k < m_GLSegCount ) && ( keys [k].start == start ) && ( keys [k].end == end ); k++ ) {
+                int other = keys [k].index;
+                if (( ssector [other] == ssector [i] ) || ( m_GLSegs [other].partner != GL_NO_PARTNER )) continue;
+                if (( pass == 0 ) && ( m_GLSegs [other].lineDef == GL_MINISEG )) continue;
+                m_GLSegs [i].partner     = other;
+                m_GLSegs [other].partner = i;
+                break;
+            }
+        }
+    }
+
+    m_Arena->Release ( mark );
+}
+
+void BSPBuilder::SortByAngle ( int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::SortByAngle", true );
+
+    sSegKey *keys = new sSegKey [ noSegs ];
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        const wSegs *data = &Seg ( segs [i] )->Data;
+        keys [i].key [0] = ANGLE_MASK & data->angle;
+        keys [i].key [1] = data->lineDef;
+        keys [i].key [2] = data->flip;
+        keys [i].index   = i;
+        keys [i].seg     = segs [i];
     }
 
-    ASSERT (( count [0] * count [2] != 0 ) || ( count [1] != 0 ));
+    SortKeys ( keys, segs, noSegs );
+
+    delete [] keys;
+}
+
+//----------------------------------------------------------------------------
+//  The exact line a SEG lies on: the reduced direction (A,B) together with
+//    C = Ay - Bx, which is the same for every point on the line.
+//----------------------------------------------------------------------------
+
+struct sLineKey {
+    int   angle;
+    int   A;
+    int   B;
+    INT64 C;
+};
+
+static int GCD ( int a, int b )
+{
+    while ( b != 0 ) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static bool GetLineKey ( sLineKey *key, const sPartition *part )
+{
+    int X  = lrint ( part->X );
+    int Y  = lrint ( part->Y );
+    int DX = lrint ( part->DX );
+    int DY = lrint ( part->DY );
+
+    if (( DX == 0 ) && ( DY == 0 )) return false;
+
+    int g = GCD ( abs ( DX ), abs ( DY ));
+    DX /= g;
+    DY /= g;
+
+    // Lines running in opposite directions share the same key
+    if (( DX < 0 ) || (( DX == 0 ) && ( DY < 0 ))) {
+        DX = -DX;
+        DY = -DY;
+    }
+
+    key->angle = part->ANGLE & ANGLE_MASK;
+    key->A     = DX;
+    key->B     = DY;
+    key->C     = ( INT64 ) DX * Y - ( INT64 ) DY * X;
+
+    return true;
+}
+
+static inline UINT32 HashLineKey ( const sLineKey *key, int bits )
+{
+    UINT64 hash = ( UINT64 ) key->C * 0x9E3779B97F4A7C15ULL;
+    hash ^= (( UINT64 ) key->angle << 32 ) ^ (( UINT64 )( UINT32 ) key->A << 16 ) ^ ( UINT32 ) key->B;
+    hash *= 0x9E3779B97F4A7C15ULL;
+    return ( UINT32 ) ( hash >> ( 64 - bits ));
+}
+
+static inline bool SameLine ( const sLineKey *key1, const sLineKey *key2 )
+{
+    return ( key1->angle == key2->angle ) && ( key1->A == key2->A ) && ( key1->B == key2->B ) && ( key1->C == key2->C );
+}
+
+//----------------------------------------------------------------------------
+//  Create a list of aliases.  These are all the unique lines within the map.
+//    Each linedef is assigned an alias.  All subsequent calculations are
+//    based on the aliases rather than the linedefs, since there are usually
+//    significantly fewer aliases than linedefs.
+//
+//  Aliases are looked up by the exact equation of their line.  As long as
+//    every alias at a given angle shares the same reduced direction, two
+//    lines are co-linear exactly when their equations match.  Lines whose
+//    slopes differ but still round to the same BAM angle can pass the
+//    CoLinear test without being the same line, so once an angle picks up
+//    one of those we fall back to checking each alias at that angle.
+//----------------------------------------------------------------------------
+
+int BSPBuilder::GetLineDefAliases ( DoomLevel *level, int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::GetLineDefAliases", true );
+
+    // Reserve alias 0
+    int noAliases = 1;
+
+    m_LineDefAlias = new int [ level->LineDefCount () ];
+    memset ( m_LineDefAlias, -1, sizeof ( int ) * ( level->LineDefCount ()));
+
+    int *segAlias = new int [ level->LineDefCount () + 2 ];
+    sLineKey *aliasKey = new sLineKey [ level->LineDefCount () + 2 ];
+
+    int bits = 4;
+    while (( 1 << bits ) < 2 * level->LineDefCount ()) bits++;
+    int *table = new int [ 1 << bits ];
+    memset ( table, -1, sizeof ( int ) * ( 1 << bits ));
+    UINT32 mask = ( 1 << bits ) - 1;
+
+    SortByAngle ( segs, noSegs );
+
+    int lowIndex  = 1;
+    int lastAngle = -1;
+    bool mixed    = false;
+
+    sPartition part;
+    sLineKey key;
+
+    for ( int i = 0; i < noSegs; i++ ) {
+
+        sSegInfo *info = Info ( segs [i] );
+
+        // If the LINEDEF has been covered, skip this SEG
+        int *alias = &m_LineDefAlias [ info->LineDef ];
+
+        if ( *alias == -1 ) {
+
+            ComputeStaticVariables ( &part, segs [i] );
+
+            bool valid = GetLineKey ( &key, &part );
+            bool sameAngle = ( lastAngle == ( part.ANGLE & ANGLE_MASK ));
+
+            int x = noAliases;
+            UINT32 slot = valid ? HashLineKey ( &key, bits ) : 0;
+
+            if ( sameAngle == false ) {
+                // No alias has this angle yet
+            } else if ( valid && ! mixed && ( key.A == aliasKey [lowIndex].A ) && ( key.B == aliasKey [lowIndex].B )) {
+                while ( table [slot] != -1 ) {
+                    if ( SameLine ( &key, &aliasKey [ table [slot]] )) {
+                        x = table [slot];
+                        break;
+                    }
+                    slot = ( slot + 1 ) & mask;
+                }
+            } else {
+                // Compare against existing aliases with the same angle
+                x = lowIndex;
+                while ( x < noAliases ) {
+                    if ( CoLinear ( &part, segAlias [x] )) break;
+                    x++;
+                }
+            }
+
+            if ( x >= noAliases ) {
+                segAlias [ x = noAliases++ ] = segs [i];
+                if ( sameAngle == false ) {
+                    lowIndex = x;
+                    lastAngle = part.ANGLE & ANGLE_MASK;
+                    mixed = false;
+                }
+                if ( valid == false ) {
+                    memset ( &aliasKey [x], 0, sizeof ( sLineKey ));
+                    mixed = true;
+                } else {
+                    aliasKey [x] = key;
+                    if (( key.A != aliasKey [lowIndex].A ) || ( key.B != aliasKey [lowIndex].B )) mixed = true;
+                    while ( table [slot] != -1 ) slot = ( slot + 1 ) & mask;
+                    table [slot] = x;
+                }
+            }
+
+            *alias = x;
+        }
+
+        info->Alias     = *alias;
+        info->AliasFlip = ( Seg ( segs [i] )->Data.angle == Seg ( segAlias [*alias] )->Data.angle ) ? 0 : SIDE_FLIPPED;
+    }
+
+    delete [] table;
+    delete [] aliasKey;
+    delete [] segAlias;
+
+    SortByLineDef ( segs, noSegs );
+
+    return noAliases;
+}
+
+//----------------------------------------------------------------------------
+//  Move the SEGs around in the pool so that the given list of SEGs runs
+//    through the pool in order.  Lists taken from it then tend to visit the
+//    pool in order too.
+//----------------------------------------------------------------------------
+
+void BSPBuilder::RenumberSegs ( int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::RenumberSegs", true );
+
+    int noChunks = m_NoSegChunks;
+    sSegChunk **oldChunk = new sSegChunk * [ noChunks ];
+    memcpy ( oldChunk, m_SegChunk, sizeof ( sSegChunk * ) * noChunks );
+
+    for ( int i = 0; i < noChunks; i++ ) {
+        m_SegChunk [i] = new sSegChunk;
+    }
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        sSegChunk *chunk = oldChunk [ segs [i] >> SEG_CHUNK_BITS ];
+        int index = segs [i] & SEG_CHUNK_MASK;
+        *Coords ( i ) = chunk->coords [ index ];
+        *Info ( i )   = chunk->info [ index ];
+        *Seg ( i )    = chunk->data [ index ];
+        segs [i] = i;
+    }
+
+    for ( int i = 0; i < noChunks; i++ ) {
+        delete oldChunk [i];
+    }
+    delete [] oldChunk;
+}
+
+#if defined ( DEBUG )
+
+    void BSPBuilder::DumpSegs ( sBSPTask *task, int *segs, int noSegs )
+    {
+        FUNCTION_ENTRY ( this, "BSPBuilder::DumpSegs", true );
+
+        for ( int i = 0; i < noSegs; i++ ) {
+            const sSegCoords *coords = Coords ( segs [i] );
+            const sSegInfo *info = Info ( segs [i] );
+            WARNING (( task->lineUsed [ info->Alias ] ? "*" : " " ) <<
+                      " lineDef: " << info->LineDef <<
+                      " (" << coords->startX << "," << coords->startY << ") -" <<
+                      " (" << coords->endX << "," << coords->endY << ")" );
+        }
+    }
+
+#endif
+
+//----------------------------------------------------------------------------
+//
+//  Partition line:
+//    DXx - DYy + C = 0                DX  -DY  -C
+//  rSeg line:                                   =  
+//    dxx - dyy + c = 0                dx  -dy  -c
+//
+//----------------------------------------------------------------------------
+
+void BSPBuilder::DivideSeg ( const sPartition *part, int rSeg, int lSeg )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::DivideSeg", true );
+
+    double X = part->X, Y = part->Y, DX = part->DX, DY = part->DY;
+
+    SEG *rData = Seg ( rSeg ), *lData = Seg ( lSeg );
+    sSegCoords *rCoords = Coords ( rSeg ), *lCoords = Coords ( lSeg );
+
+    const wLineDef *lineDef = rData->LineDef;
+    wVertex *vertS = &m_NewVertices [ lineDef->start ];
+    wVertex *vertE = &m_NewVertices [ lineDef->end ];
+
+    // Minimum precision required to avoid overflow/underflow:
+    //   dx, dy  - 16 bits required
+    //   c       - 33 bits required
+    //   det     - 32 bits required
+    //   x, y    - 50 bits required
+
+    double dx  = vertE->x - vertS->x;
+    double dy  = vertE->y - vertS->y;
+    double num, det;
+
+    if ( part->exact == true ) {
+        INT64 iNum = part->intDX * ( vertS->y - part->intY ) - part->intDY * ( vertS->x - part->intX );
+        INT64 iDet = ( INT64 ) ( vertE->x - vertS->x ) * part->intDY - ( INT64 ) ( vertE->y - vertS->y ) * part->intDX;
+        num = ( double ) iNum;
+        det = ( double ) iDet;
+    } else {
+        num = DX * ( vertS->y - Y ) - DY * ( vertS->x - X );
+        det = dx * DY - dy * DX;
+    }
+
+    if ( det == 0.0 ) {
+        ERROR ( "SEG is parallel to partition line" );
+    }
+
+    double l = num / det;
+    double x = vertS->x + num * dx / det;
+    double y = vertS->y + num * dy / det;
+
+    if ( Info ( rSeg )->final == true ) {
+        x = lrint ( x );
+        y = lrint ( y );
+#if defined ( DEBUG )
+        if ((( rCoords->startX == x ) && ( rCoords->startY == y )) ||
+            (( lCoords->startX == x ) && ( lCoords->startY == y ))) {
+            fprintf ( stderr, "\nNODES: End point duplicated in DivideSeg: LineDef #%d", rData->Data.lineDef );
+            fprintf ( stderr, "\n       Partition: from (%f,%f) to (%f,%f)", X, Y, X + DX, Y + DY );
+            fprintf ( stderr, "\n       LineDef: from (%d,%d) to (%d,%d) split at (%f,%f)", vertS->x, vertS->y, vertE->x, vertE->y, x, y );
+            fprintf ( stderr, "\n       SEG: from (%f,%f) to (%f,%f)", rCoords->startX, rCoords->startY, rCoords->endX, rCoords->endY );
+            fprintf ( stderr, "\n       dif: (%f,%f)  (%f,%f)", rCoords->startX - x, rCoords->startY - y, rCoords->endX - x, rCoords->endY - y );
+        }
+#endif
+    }
+
+    // Determine which sided of the partition line the start point is on
+    double sideS = DX * ( rCoords->startY - Y ) - DY * ( rCoords->startX - X );
+
+    // Get the correct endpoint of the base LINEDEF for the offset calculation
+    if ( rData->Data.flip ) vertS = vertE;
+    if ( rData->Data.flip ) l = 1.0 - l;
+
+    Info ( rSeg )->Split = true;
+    Info ( lSeg )->Split = true;
+
+    // Fill in the parts of lSeg & rSeg that have changed
+    if ( sideS < 0.0 ) {
+#if defined ( DEBUG )
+        if (( lrint ( x ) == lrint ( lCoords->startX )) && ( lrint ( y ) == lrint ( lCoords->startY ))) {
+            fprintf ( stderr, "DivideSeg: split didn't work (%10.3f,%10.3f) == L(%10.3f,%10.3f) - %d\n", x, y, lCoords->startX, lCoords->startY, part->currentAlias );
+        } else if (( l < lData->startL ) || ( l > lData->endL )) {
+            fprintf ( stderr, "DivideSeg: warning - split is outside line segment (%7.5f-%7.5f) %7.5f\n", lData->startL, lData->endL, l );
+        }
+#endif
+        rCoords->endX      = x;
+        rCoords->endY      = y;
+        rData->endL        = l;
+        lCoords->startX    = x;
+        lCoords->startY    = y;
+        lData->startL      = l;
+        lData->Data.offset = ( UINT16 ) ( hypot (( double ) ( x - vertS->x ), ( double ) ( y - vertS->y )) + 0.5 );
+    } else {
+#if defined ( DEBUG )
+        if (( lrint ( x ) == lrint ( rCoords->startX )) && ( lrint ( y ) == lrint ( rCoords->startY ))) {
+            fprintf ( stderr, "DivideSeg: split didn't work (%10.3f,%10.3f) == R(%10.3f,%10.3f) - %d\n", x, y, rCoords->startX, rCoords->startY, part->currentAlias  );
+        } else if (( l < lData->startL ) || ( l > lData->endL )) {
+            fprintf ( stderr, "DivideSeg: warning - split is outside line segment (%7.5f-%7.5f) %7.5f\n", lData->startL, lData->endL, l );
+        }
+#endif
+        lCoords->endX      = x;
+        lCoords->endY      = y;
+        lData->endL        = l;
+        rCoords->startX    = x;
+        rCoords->startY    = y;
+        rData->startL      = l;
+        rData->Data.offset = ( UINT16 ) ( hypot (( double ) ( x - vertS->x ), ( double ) ( y - vertS->y )) + 0.5 );
+    }
+
+#if defined ( DEBUG )
+    if ( _WhichSide ( part, rSeg ) != SIDE_RIGHT ) {
+        fprintf ( stderr, "DivideSeg: %s split invalid\n", "right" );
+    }
+    if ( _WhichSide ( part, lSeg ) != SIDE_LEFT ) {
+        fprintf ( stderr, "DivideSeg: %s split invalid\n", "left" );
+    }
+#endif
+}
+
+//----------------------------------------------------------------------------
+//  Split each of the SEGs in lSegs in two.  The original SEG becomes the left
+//    half and a new SEG is created for the right half.
+//----------------------------------------------------------------------------
+
+void BSPBuilder::SplitSegs ( sBSPTask *task, const sPartition *part, int *lSegs, int *rSegs, int noSplits )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::SplitSegs", true );
+
+    for ( int i = 0; i < noSplits; i++ ) {
+        int seg = NewSeg ( task );
+        *Coords ( seg ) = *Coords ( lSegs [i] );
+        *Info ( seg )   = *Info ( lSegs [i] );
+        *Seg ( seg )    = *Seg ( lSegs [i] );
+        rSegs [i] = seg;
+        DivideSeg ( part, seg, lSegs [i] );
+    }
+}
+
+//----------------------------------------------------------------------------
+//  Divide the list of SEGs into a list of the SEGs to the right of the
+//    partition (followed by the right half of the split SEGs), and a list of
+//    the left half of the split SEGs followed by the SEGs to the left of the
+//    partition.  Only the indices of the SEGs are moved around.  The bounding
+//    rectangle of each list is collected along the way.
+//----------------------------------------------------------------------------
+
+void BSPBuilder::PartitionSegs ( sBSPTask *task, sPartition *part, int *segs, int noSegs, int **left, int *noLeft, int **right, int *noRight, wBound *bound )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::PartitionSegs", true );
+
+    int count [3];
+
+    AcquireSideInfo ( part );
+
+    // Neither list can be longer than the original one
+    int *rSegs = new int [ noSegs ];
+    int *lSegs = new int [ noSegs ];
+
+    ClearBounds ( &bound [0] );
+    ClearBounds ( &bound [1] );
+
+    // The SEGs to be split are collected at the end of the right list
+    int *rPtr = rSegs, *lPtr = lSegs, *sPtr = rSegs + noSegs;
+
+    count [0] = count [1] = count [2] = 0;
+    signed char side [ SIDE_BLOCK ];
+    for ( int i = 0; i < noSegs; i += SIDE_BLOCK ) {
+        int size = ( noSegs - i < SIDE_BLOCK ) ? noSegs - i : SIDE_BLOCK;
+        ClassifySegs ( part, &segs [i], size, side, count );
+        for ( int j = 0; j < size; j++ ) {
+            int seg = segs [i+j];
+            switch ( side [j] ) {
+                case SIDE_LEFT  : AddBounds ( &bound [1], Coords ( seg ));
+                                  *lPtr++ = seg;		break;
+                case SIDE_SPLIT : *--sPtr = seg;		break;
+                case SIDE_RIGHT : AddBounds ( &bound [0], Coords ( seg ));
+                                  *rPtr++ = seg;		break;
+            }
+        }
+    }
+
+    ReleaseSideInfo ( part );
+
+    *noLeft  = count [0] + count [1];
+    *noRight = count [2] + count [1];
+
+    int noSplits = count [1];
+    if ( noSplits != 0 ) {
+        memmove ( lSegs + noSplits, lSegs, sizeof ( int ) * count [0] );
+        for ( int i = 0; i < noSplits; i++ ) {
+            lSegs [i] = rSegs [ noSegs - 1 - i ];
+        }
+        SplitSegs ( task, part, lSegs, rSegs + count [2], noSplits );
+        for ( int i = 0; i < noSplits; i++ ) {
+            AddBounds ( &bound [0], Coords ( rSegs [ count [2] + i ] ));
+            AddBounds ( &bound [1], Coords ( lSegs [i] ));
+        }
+    }
+
+    *left  = lSegs;
+    *right = rSegs;
+}
+
+//----------------------------------------------------------------------------
+//  Sort the SEGs by the partition chosen by ChoosePartition.  If there isn't
+//    one (pSeg is NO_SEG), all the SEGs are left on the right side.
+//----------------------------------------------------------------------------
+
+void BSPBuilder::SortSegs ( sBSPTask *task, sPartition *part, int pSeg, int *segs, int noSegs, int **left, int *noLeft, int **right, int *noRight, wBound *bound )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::SortSegs", true );
+
+    *left  = NULL;
+    *right = NULL;
+
+    if ( pSeg == NO_SEG ) {
+#if defined ( DEBUG )
+        int count [3];
+        for ( int x = 0; x < noSegs; x++ ) {
+            // Make sure that all SEGs are actually on the right side of each other
+            ComputeStaticVariables ( part, segs [x] );
+            if (( fabs ( part->DX ) < EPSILON ) && ( fabs ( part->DY ) < EPSILON )) continue;
+
+            count [0] = count [1] = count [2] = 0;
+            for ( int i = 0; i < noSegs; i++ ) {
+                count [ _WhichSide ( part, segs [i] ) + 1 ]++;
+            }
+
+            if (( count [0] * count [2] ) || count [1] ) {
+                DumpSegs ( task, segs, noSegs );
+                ERROR ( "Something weird is going on! (" << count [0] << "|" << count [1] << "|" << count [2] << ") " << noSegs );
+                break;
+            }
+        }
+#endif
+        *noRight  = noSegs;
+        *noLeft   = 0;
+        return;
+    }
+
+    ComputeStaticVariables ( part, pSeg );
+    PartitionSegs ( task, part, segs, noSegs, left, noLeft, right, noRight, bound );
+
+    ASSERT (( *noLeft != 0 ) && ( *noRight != 0 ));
+}
+
+//----------------------------------------------------------------------------
+//  Use the requested algorithm to select a partition for the list of SEGs.
+//    After a valid partition is selected, the SEGs are copied to a list for
+//    each side of the partition.  SEGs that are split end up in both lists.
+//----------------------------------------------------------------------------
+
+bool BSPBuilder::ChoosePartition ( sBSPTask *task, sPartition *part, int *segs, int noSegs, int **left, int *noLeft, int **right, int *noRight, wBound *bound )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::ChoosePartition", true );
+
+    bool check = true;
+
+    // With a time limit the most promising lines are looked at first
+    int *order = segs;
+    if ( task->timeLimited == true ) {
+        order = new int [ noSegs ];
+        memcpy ( order, segs, sizeof ( int ) * noSegs );
+        SortByPriority ( order, noSegs );
+    }
+
+retry:
+
+    if ( Info ( segs [0] )->final == false ) {
+        memcpy ( task->lineChecked, task->lineUsed, sizeof ( char ) * m_NoAliases );
+    } else {
+        memset ( task->lineChecked, 0, sizeof ( char ) * m_NoAliases );
+    }
+
+    // Find the best SEG to be used as a partition
+    task->groups = (( m_GroupSegs == true ) && ( noSegs >= MIN_GROUP_SEGS )) ? GroupSegs ( segs, noSegs ) : NULL;
+    int pSeg = ( this->*m_PartitionFunction ) ( task, order, noSegs );
+    if (( pSeg != NO_SEG ) && ( m_BeamWidth > 1 )) pSeg = BeamSearch ( task, segs, noSegs, pSeg );
+    if ( task->groups != NULL ) FreeGroups ( task->groups );
+    task->groups = NULL;
+
+    // Resort the SEGS (right followed by left) and do the splits as necessary
+    SortSegs ( task, part, pSeg, segs, noSegs, left, noLeft, right, noRight, bound );
+
+    // Make sure the set of SEGs is still convex after we convert to integer coordinates
+    //   (not needed when the split points are written in fixed point)
+    if (( pSeg == NO_SEG ) && ( check == true ) && ( m_FixedPoint == false )) {
+        check = false;
+        double error = 0.0;
+        for ( int i = 0; i < noSegs; i++ ) {
+
+            sSegCoords *coords = Coords ( segs [i] );
+
+            int startX = lrint ( coords->startX );
+            int startY = lrint ( coords->startY );
+            int endX   = lrint ( coords->endX );
+            int endY   = lrint ( coords->endY );
+                          
+            error += fabs ( coords->startX - startX );
+            error += fabs ( coords->startY - startY );
+            error += fabs ( coords->endX - endX );
+            error += fabs ( coords->endY - endY );
+
+            coords->startX = startX;
+            coords->startY = startY;
+            coords->endX   = endX;
+            coords->endY   = endY;
+            Info ( segs [i] )->final = true;
+        }
+        if ( error > EPSILON ) {
+            // Force a check of each line
+            goto retry;
+        }
+    }
+
+    if ( order != segs ) delete [] order;
+
+    return ( pSeg != NO_SEG ) ? true : false;
+}
+
+//----------------------------------------------------------------------------
+//  Quick check for a list of SEGs that can't be divided any further.  The
+//    SEGs are sorted by direction (clockwise) and joined up, end to start,
+//    into a closed polygon.  If the polygon never turns left and goes around
+//    exactly once it is convex, so every SEG lies on the right of (or on)
+//    every other SEG's line and ChoosePartition would find nothing but
+//    boundary lines.  SEGs left with fractional coordinates by a split must
+//    pass both before and after rounding, just as ChoosePartition checks
+//    them twice.  Anything in doubt is left for ChoosePartition.
+//----------------------------------------------------------------------------
+
+struct sConvexKey {
+    double    angle;
+    double    offset;			// distance along the direction (orders co-linear SEGs)
+    int       index;
+};
+
+static int SortByDirection ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "SortByDirection", true );
+
+    const sConvexKey *key1 = ( const sConvexKey * ) ptr1;
+    const sConvexKey *key2 = ( const sConvexKey * ) ptr2;
+
+    if ( key1->angle != key2->angle ) return ( key1->angle > key2->angle ) ? -1 : 1;
+    if ( key1->offset != key2->offset ) return ( key1->offset < key2->offset ) ? -1 : 1;
+
+    return key1->index - key2->index;
+}
+
+static bool IsConvexPolygon ( const sSegCoords *list, int noSegs )
+{
+    FUNCTION_ENTRY ( NULL, "IsConvexPolygon", true );
+
+    sConvexKey *keys = new sConvexKey [ noSegs ];
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        double dx = list [i].endX - list [i].startX;
+        double dy = list [i].endY - list [i].startY;
+        keys [i].angle  = atan2 ( dy, dx );
+        keys [i].offset = dx * list [i].startX + dy * list [i].startY;
+        keys [i].index  = i;
+    }
+
+    qsort ( keys, noSegs, sizeof ( sConvexKey ), SortByDirection );
+
+    // The corners of the polygon - a gap between SEGs adds an extra edge
+    double *x = new double [ 2 * noSegs ];
+    double *y = new double [ 2 * noSegs ];
+    int noPoints = 0;
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        const sSegCoords *coords = &list [ keys [i].index ];
+        if (( noPoints == 0 ) || ( x [ noPoints - 1 ] != coords->startX ) || ( y [ noPoints - 1 ] != coords->startY )) {
+            x [ noPoints ] = coords->startX;
+            y [ noPoints ] = coords->startY;
+            noPoints++;
+        }
+        x [ noPoints ] = coords->endX;
+        y [ noPoints ] = coords->endY;
+        noPoints++;
+    }
+    if (( x [ noPoints - 1 ] == x [0] ) && ( y [ noPoints - 1 ] == y [0] )) noPoints--;
+
+    delete [] keys;
+
+    bool convex = ( noPoints >= 3 ) ? true : false;
+    double turn = 0.0;
+
+    for ( int i = 0; ( convex == true ) && ( i < noPoints ); i++ ) {
+        int prev = ( i + noPoints - 1 ) % noPoints, next = ( i + 1 ) % noPoints;
+        double inX  = x [i] - x [prev], inY  = y [i] - y [prev];
+        double outX = x [next] - x [i], outY = y [next] - y [i];
+        double cross = inX * outY - inY * outX;
+        double dot   = inX * outX + inY * outY;
+        // Right turns only - going straight on is fine, turning back isn't
+        if (( cross > 0.0 ) || (( cross == 0.0 ) && ( dot <= 0.0 ))) convex = false;
+        turn += atan2 ( cross, dot );
+    }
+
+    delete [] x;
+    delete [] y;
+
+    // A closed polygon turns a whole number of times - only once if it is simple
+    return ( convex == true ) && ( fabs ( turn + 2.0 * M_PI ) < 1.0 );
+}
+
+bool BSPBuilder::IsConvex ( int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::IsConvex", true );
+
+    // Most lists aren't convex and one of a few SEGs usually shows it straight away
+    int probe [3] = { 0, noSegs / 2, noSegs - 1 };
+    for ( int j = 0; j < 3; j++ ) {
+        const sSegCoords *line = Coords ( segs [ probe [j]] );
+        double dx = line->endX - line->startX;
+        double dy = line->endY - line->startY;
+        for ( int i = 0; i < noSegs; i++ ) {
+            const sSegCoords *coords = Coords ( segs [i] );
+            if (( dx * ( coords->startY - line->startY ) - dy * ( coords->startX - line->startX ) > 0.0 ) ||
+                ( dx * ( coords->endY - line->startY ) - dy * ( coords->endX - line->startX ) > 0.0 )) {
+                return false;
+            }
+        }
+    }
+
+    sSegCoords *list = new sSegCoords [ noSegs ];
+    bool exact = true;
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        list [i] = *Coords ( segs [i] );
+        // WhichSide treats a SEG this short as if it lay on the partition
+        if (( lrint ( list [i].startX ) == lrint ( list [i].endX )) && ( lrint ( list [i].startY ) == lrint ( list [i].endY ))) {
+            delete [] list;
+            return false;
+        }
+        if (( list [i].startX != lrint ( list [i].startX )) || ( list [i].startY != lrint ( list [i].startY )) ||
+            ( list [i].endX != lrint ( list [i].endX )) || ( list [i].endY != lrint ( list [i].endY ))) {
+            exact = false;
+        }
+    }
+
+    bool convex = IsConvexPolygon ( list, noSegs );
+
+    if (( convex == true ) && ( exact == false ) && ( m_FixedPoint == false )) {
+        for ( int i = 0; i < noSegs; i++ ) {
+            list [i].startX = lrint ( list [i].startX );
+            list [i].startY = lrint ( list [i].startY );
+            list [i].endX   = lrint ( list [i].endX );
+            list [i].endY   = lrint ( list [i].endY );
+        }
+        convex = IsConvexPolygon ( list, noSegs );
+    }
+
+    // Do what ChoosePartition does with the SEGs of a new SSECTOR
+    if (( convex == true ) && ( m_FixedPoint == false )) {
+        for ( int i = 0; i < noSegs; i++ ) {
+            *Coords ( segs [i] ) = list [i];
+            Info ( segs [i] )->final = true;
+        }
+    }
+
+    delete [] list;
+
+    return convex;
+}
+
+//----------------------------------------------------------------------------
+//  Returns true once a time limited search has used up the share of time
+//    given to the current NODE.
+//----------------------------------------------------------------------------
+
+static inline bool TimeUp ( const sBSPTask *task )
+{
+    return ( task->timeLimited == true ) && (( INT32 ) ( CurrentTime () - task->deadline ) >= 0 );
+}
+
+//----------------------------------------------------------------------------
+//  Make sure that an alias previously marked as used/convex doesn't split
+//    or straddle any of the SEGs in the list.
+//----------------------------------------------------------------------------
+
+#if defined ( DEBUG )
+
+void BSPBuilder::CheckConvexAlias ( int testSeg, int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::CheckConvexAlias", true );
+
+    sPartition part;
+    ComputeStaticVariables ( &part, testSeg );
+    int side = WhichSide ( &part, testSeg );
+    if (( fabs ( part.DX ) < EPSILON ) && ( fabs ( part.DY ) < EPSILON )) return;
+    AcquireSideInfo ( &part );
+    for ( int j = 0; j < noSegs; j++ ) {
+        switch ( WhichSide ( &part, segs [j] )) {
+            case SIDE_LEFT :
+                if ( side == SIDE_RIGHT ) {
+                    WARNING ( "lineDef " << Info ( segs [j] )->LineDef << " should not to the left of lineDef " << Info ( testSeg )->LineDef );
+                }
+                break;
+            case SIDE_SPLIT :
+                WARNING ( "lineDef " << Info ( segs [j] )->LineDef << " should not be split by lineDef " << Info ( testSeg )->LineDef );
+                break;
+            case SIDE_RIGHT :
+                if ( side == SIDE_LEFT ) {
+                    WARNING ( "lineDef " << Info ( segs [j] )->LineDef << " should not to the right of lineDef " << Info ( testSeg )->LineDef );
+                }
+                break;
+            default :
+                break;
+        }
+    }
+    ReleaseSideInfo ( &part );
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+//  Collect the next group of SEGs (from first up to last) that need to be
+//    evaluated as a partition line.  Only the first SEG of each alias is
+//    used.  Large lists are collected in groups so that the candidates can
+//    be evaluated by several threads at once.  Returns the index of the next
+//    SEG to be examined.
+//----------------------------------------------------------------------------
+
+int BSPBuilder::GetCandidates ( sBSPTask *task, int *segs, int noSegs, int first, int last, int *noCandidates )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::GetCandidates", true );
+
+    int max = ( noSegs < MIN_PARALLEL_SEGS ) ? 1 : m_MaxCandidates;
+    int count = 0;
+
+    int i = first;
+    for ( ; ( i < last ) && ( count < max ); i++ ) {
+        if ( task->showProgress && (( i & 15 ) == 0 )) ShowProgress ();
+        int testSeg = segs [i];
+        const sSegInfo *info = Info ( testSeg );
+        int alias = info->Split ? 0 : info->Alias;
+        if (( alias == 0 ) || ( task->lineChecked [ alias ] == false )) {
+            task->lineChecked [ alias ] = -1;
+            task->candidateList [ count ].index = i;
+            task->candidateList [ count ].alias = alias;
+            count++;
+        }
+#if defined ( DEBUG )
+        else if ( task->lineChecked [alias] > 0 ) {
+            CheckConvexAlias ( testSeg, segs, noSegs );
+        }
+#endif
+    }
+
+    *noCandidates = count;
+
+    return i;
+}
+
+//----------------------------------------------------------------------------
+//  Collect the SEGs being partitioned into a tree of groups.  Each group is
+//    split in half along the longer side of its bounding box (by the middle
+//    of its SEGs) until it holds no more than GROUP_SIZE SEGs.  A candidate
+//    partition can then take care of a whole group at once when its box is
+//    well clear of the partition line, and only look at the SEGs in the
+//    groups that straddle it.
+//----------------------------------------------------------------------------
+
+void BSPBuilder::AddGroup ( sSegGroups *groups, int first, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::AddGroup", true );
+
+    sSegGroup *group = &groups->group [ groups->noGroups++ ];
+    int *segs = &groups->segs [ first ];
+
+    FindBounds ( &group->bound, segs, noSegs );
+    group->first       = first;
+    group->noSegs      = noSegs;
+    group->firstSector = 0;
+    group->noSectors   = 0;
+    group->noInside    = 0;
+
+    if ( noSegs > GROUP_SIZE ) {
+        bool useX = ( group->bound.maxx - group->bound.minx >= group->bound.maxy - group->bound.miny ) ? true : false;
+        sSegKey *keys = new sSegKey [ noSegs ];
+        for ( int i = 0; i < noSegs; i++ ) {
+            const sSegCoords *coords = Coords ( segs [i] );
+            int midX = lrint ( coords->startX + coords->endX );
+            int midY = lrint ( coords->startY + coords->endY );
+            keys [i].key [0] = useX ? midX : midY;
+            keys [i].key [1] = useX ? midY : midX;
+            keys [i].key [2] = 0;
+            keys [i].index   = i;
+            keys [i].seg     = segs [i];
+        }
+        SortKeys ( keys, segs, noSegs );
+        delete [] keys;
+        AddGroup ( groups, first, noSegs / 2 );
+        AddGroup ( groups, first + noSegs / 2, noSegs - noSegs / 2 );
+    }
+
+    group->next = groups->noGroups;
+}
+
+sSegGroups *BSPBuilder::GroupSegs ( int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::GroupSegs", true );
+
+    // Every group without children holds at least GROUP_SIZE / 2 SEGs
+    int maxGroups = 2 * ( noSegs / ( GROUP_SIZE / 2 ) + 1 );
+
+    sSegGroups *groups = new sSegGroups;
+    groups->segs      = new int [ noSegs ];
+    groups->sectors   = NULL;
+    groups->group     = new sSegGroup [ maxGroups ];
+    groups->noGroups  = 0;
+    groups->noSectors = 0;
+
+    memcpy ( groups->segs, segs, sizeof ( int ) * noSegs );
+    AddGroup ( groups, 0, noSegs );
+
+    return groups;
+}
+
+//----------------------------------------------------------------------------
+//  List the sectors of each group for ALGORITHM 2.  A sector with all of its
+//    SEGs in a group ends up on the same side as the group, so it is only
+//    counted (in noInside).  The rest are listed by their dense number in
+//    sectorMap.  Children come after their parent, so working backwards
+//    each group is made from the lists of its two children.
+//----------------------------------------------------------------------------
+
+void BSPBuilder::GroupSectors ( sSegGroups *groups, const int *sectorMap, int noSectors )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::GroupSectors", true );
+
+    // A group lists no more sectors than it has SEGs
+    int maxEntries = 0;
+    for ( int g = 0; g < groups->noGroups; g++ ) maxEntries += groups->group [g].noSegs;
+
+    groups->sectors = new int [ maxEntries ];
+    int *segCount   = new int [ maxEntries ];	// SEGs each entry has in its group
+    int *total      = new int [ noSectors ];	// SEGs each sector has in the list
+    int *entry      = new int [ noSectors ];	// where a sector is in the current list
+
+    memset ( total, 0, sizeof ( int ) * noSectors );
+    memset ( entry, -1, sizeof ( int ) * noSectors );
+
+    const sSegGroup *root = &groups->group [0];
+    for ( int i = 0; i < root->noSegs; i++ ) {
+        total [ sectorMap [ Info ( groups->segs [ root->first + i ] )->Sector ]]++;
+    }
+
+    int noEntries = 0;
+
+    for ( int g = groups->noGroups - 1; g >= 0; g-- ) {
+        sSegGroup *group = &groups->group [g];
+        int first = noEntries;
+
+        if ( group->next == g + 1 ) {
+            for ( int i = 0; i < group->noSegs; i++ ) {
+                int sector = sectorMap [ Info ( groups->segs [ group->first + i ] )->Sector ];
+                if ( entry [ sector ] == -1 ) {
+                    entry [ sector ] = noEntries;
+                    groups->sectors [ noEntries ] = sector;
+                    segCount [ noEntries++ ] = 0;
+                }
+                segCount [ entry [ sector ]]++;
+            }
+        } else {
+            const sSegGroup *child [2] = { &groups->group [ g + 1 ], &groups->group [ groups->group [ g + 1 ].next ] };
+            for ( int c = 0; c < 2; c++ ) {
+                group->noInside += child [c]->noInside;
+                for ( int i = child [c]->firstSector; i < child [c]->firstSector + child [c]->noSectors; i++ ) {
+                    int sector = groups->sectors [i];
+                    if ( entry [ sector ] == -1 ) {
+                        entry [ sector ] = noEntries;
+                        groups->sectors [ noEntries ] = sector;
+                        segCount [ noEntries++ ] = 0;
+                    }
+                    segCount [ entry [ sector ]] += segCount [i];
+                }
+            }
+        }
+
+        // Keep the sectors that have SEGs outside the group
+        int last = first;
+        for ( int i = first; i < noEntries; i++ ) {
+            int sector = groups->sectors [i];
+            entry [ sector ] = -1;
+            if ( segCount [i] == total [ sector ] ) {
+                group->noInside++;
+            } else {
+                groups->sectors [ last ] = sector;
+                segCount [ last++ ] = segCount [i];
+            }
+        }
+        noEntries = last;
+
+        group->firstSector = first;
+        group->noSectors   = last - first;
+    }
+
+    groups->noSectors = noEntries;
+
+    delete [] entry;
+    delete [] total;
+    delete [] segCount;
+}
+
+void BSPBuilder::FreeGroups ( sSegGroups *groups )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::FreeGroups", true );
+
+    delete [] groups->segs;
+    delete [] groups->sectors;
+    delete [] groups->group;
+    delete groups;
+}
+
+//----------------------------------------------------------------------------
+//  Return the side of the partition a whole group of SEGs lies on, or
+//    SIDE_UNKNOWN if its box comes close to the partition line.  The box is
+//    grown by a unit to cover the rounding in its bounds, and margin has to
+//    keep every SEG more than 2 units from the line so none of the checks
+//    _WhichSide makes for rounding can change its answer.
+//----------------------------------------------------------------------------
+
+static inline int GroupSide ( const sPartition *part, const wBound *bound, double margin )
+{
+    double loX = bound->minx - 1.0 - part->X, hiX = bound->maxx + 1.0 - part->X;
+    double loY = bound->miny - 1.0 - part->Y, hiY = bound->maxy + 1.0 - part->Y;
+
+    // Distance (times the length of the partition) to the nearest and farthest corners
+    double minY = part->DX * (( part->DX > 0.0 ) ? loY : hiY ) - part->DY * (( part->DY > 0.0 ) ? hiX : loX );
+    double maxY = part->DX * (( part->DX > 0.0 ) ? hiY : loY ) - part->DY * (( part->DY > 0.0 ) ? loX : hiX );
+
+    if ( minY > margin ) return SIDE_LEFT;
+    if ( maxY < -margin ) return SIDE_RIGHT;
+
+    return SIDE_UNKNOWN;
+}
+
+//----------------------------------------------------------------------------
+//  Count the SEGs (and for ALGORITHM 2, the sectors) on each side of a
+//    candidate partition line.  This is called from multiple threads, so
+//    everything that changes belongs to the candidate itself.  When the
+//    SEGs have been grouped, groups that lie on one side are counted whole
+//    and the SEGs in the rest are gathered up and classified a block at a
+//    time.  Sectors are numbered densely for each NODE, so a candidate only
+//    clears the sectors that are there, and the sectors on each side are
+//    counted as each one is marked.
+//----------------------------------------------------------------------------
+
+// Sectors are marked 0xF0 (left), 0xFF (both sides) or 0x0F (right)
+static inline int SectorSide ( UINT8 used )
+{
+    return ( used == 0xF0 ) ? 0 : ( used == 0xFF ) ? 1 : 2;
+}
+
+static inline void MarkSector ( UINT8 *used, int *sectors, int sector, UINT8 mask )
+{
+    UINT8 old = used [ sector ];
+    if (( UINT8 ) ( old | mask ) == old ) return;
+    used [ sector ] = ( UINT8 ) ( old | mask );
+    if ( old != 0 ) sectors [ SectorSide ( old )]--;
+    sectors [ SectorSide ( used [ sector ] )]++;
+}
+
+struct sCandidateBatch {
+    BSPBuilder *builder;
+    sCandidate *list;
+    UINT8      *usedSector;			// one list of sectors for each candidate
+    int        *segs;
+    int         noSegs;
+    const int  *sectorMap;			// dense number of each sector used (NULL if sectors aren't counted)
+    int         noSectors;
+    bool        findBounds;			// also find the bounding box of each side
+    sSegGroups *groups;				// SEGs grouped by position (may be NULL)
+};
+
+void BSPBuilder::EvaluateCandidate ( void *data, int index, int )
+{
+    FUNCTION_ENTRY ( NULL, "BSPBuilder::EvaluateCandidate", true );
+
+    sCandidateBatch *batch = ( sCandidateBatch * ) data;
+    BSPBuilder *builder = batch->builder;
+    sCandidate *candidate = &batch->list [ index ];
+    int *segs = batch->segs;
+    int noSegs = batch->noSegs;
+    const sSegGroups *groups = batch->groups;
+
+    sPartition part;
+    builder->ComputeStaticVariables ( &part, segs [ candidate->index ] );
+
+    candidate->angle  = part.ANGLE;
+    candidate->pruned = false;
+    candidate->valid  = (( fabs ( part.DX ) < EPSILON ) && ( fabs ( part.DY ) < EPSILON )) ? false : true;
+    if ( candidate->valid == false ) return;
+
+    int *count = candidate->count;
+    count [0] = count [1] = count [2] = 0;
+
+    const int *sectorMap = batch->sectorMap;
+    int *sectors = candidate->sectors;
+
+    UINT8 *used = NULL;
+    if ( sectorMap != NULL ) {
+        used = &batch->usedSector [ index * batch->noSectors ];
+        memset ( used, 0, sizeof ( UINT8 ) * batch->noSectors );
+        sectors [0] = sectors [1] = sectors [2] = 0;
+        candidate->invalid = 0;
+    }
+
+    if ( batch->findBounds == true ) {
+        ClearBounds ( &candidate->bound [0] );
+        ClearBounds ( &candidate->bound [1] );
+    }
+
+    builder->AcquireSideInfo ( &part );
+
+    // Most candidates are rejected early on, so start with a small block
+    long maxSplits = ( sectorMap == NULL ) ? candidate->maxSplits : LONG_MAX;
+    int block = GROUP_SIZE;
+
+    double margin = 2.0 * sqrt ( part.H ) + 1.0;
+    int nextSeg = 0, nextGroup = 0;
+
+    int pending [ SIDE_BLOCK ];
+    signed char side [ SIDE_BLOCK ];
+
+    for ( ; ; ) {
+
+        // Gather up the next block of SEGs that have to be looked at one at a time
+        int noPending = 0;
+        if ( groups == NULL ) {
+            noPending = ( noSegs - nextSeg < block ) ? noSegs - nextSeg : block;
+            memcpy ( pending, &segs [ nextSeg ], sizeof ( int ) * noPending );
+            nextSeg += noPending;
+        }
+        while (( groups != NULL ) && ( nextGroup < groups->noGroups )) {
+            const sSegGroup *group = &groups->group [ nextGroup ];
+            int groupSide = GroupSide ( &part, &group->bound, margin );
+            if ( groupSide != SIDE_UNKNOWN ) {
+                count [ groupSide + 1 ] += group->noSegs;
+                if ( batch->findBounds == true ) {
+                    AddBound ( &candidate->bound [ ( groupSide == SIDE_LEFT ) ? 0 : 1 ], &group->bound );
+                }
+                if ( used != NULL ) {
+                    UINT8 mask = ( UINT8 ) (( groupSide == SIDE_LEFT ) ? 0xF0 : 0x0F );
+                    const int *sector = &groups->sectors [ group->firstSector ];
+                    sectors [ groupSide + 1 ] += group->noInside;
+                    for ( int k = 0; k < group->noSectors; k++ ) MarkSector ( used, sectors, sector [k], mask );
+                }
+#if defined ( DEBUG )
+                for ( int k = 0; k < group->noSegs; k++ ) {
+                    if ( builder->_WhichSide ( &part, groups->segs [ group->first + k ] ) != groupSide ) {
+                        ERROR ( "GroupSide is wigging out!" );
+                    }
+                }
+#endif
+                nextGroup = group->next;
+            } else if ( group->next == nextGroup + 1 ) {
+                if ( noPending + group->noSegs > block ) break;
+                memcpy ( &pending [ noPending ], &groups->segs [ group->first ], sizeof ( int ) * group->noSegs );
+                noPending += group->noSegs;
+                nextGroup++;
+            } else {
+                nextGroup++;
+            }
+        }
+
+        if ( noPending == 0 ) break;
+
+        builder->ClassifySegs ( &part, pending, noPending, side, count );
+        if ( count [1] > maxSplits ) {
+            candidate->pruned = true;
+            break;
+        }
+
+        for ( int k = 0; ( batch->findBounds == true ) && ( k < noPending ); k++ ) {
+            const sSegCoords *coords = builder->Coords ( pending [k] );
+            if ( side [k] != SIDE_RIGHT ) AddBounds ( &candidate->bound [0], coords );
+            if ( side [k] != SIDE_LEFT ) AddBounds ( &candidate->bound [1], coords );
+        }
+
+        for ( int k = 0; ( used != NULL ) && ( k < noPending ); k++ ) {
+            const sSegInfo *info = builder->Info ( pending [k] );
+            int sector = sectorMap [ info->Sector ];
+            switch ( side [k] ) {
+                case SIDE_LEFT  : MarkSector ( used, sectors, sector, 0xF0 );	break;
+                case SIDE_SPLIT : if ( info->DontSplit ) candidate->invalid++;
+                                  MarkSector ( used, sectors, sector, 0xFF );	break;
+                case SIDE_RIGHT : MarkSector ( used, sectors, sector, 0x0F );	break;
+            }
+        }
+
+        block = ( 2 * block < SIDE_BLOCK ) ? 2 * block : SIDE_BLOCK;
+    }
+
+    builder->ReleaseSideInfo ( &part );
+}
+
+//----------------------------------------------------------------------------
+//  ALGORITHM 1: 'ZenNode Classic'
+//    This is the original algorithm used by ZenNode.  It simply attempts
+//    to minimize the number of SEGs that are split.  This actually yields
+//    very small BSP trees, but usually results in trees that are not well
+//    balanced and run deep.
+//
+//    Candidates are evaluated a group at a time, but the results are
+//    examined in order so the same partition is picked no matter how many
+//    threads are used.
+//----------------------------------------------------------------------------
+
+int BSPBuilder::Algorithm1 ( sBSPTask *task, int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::Algorithm1", true );
+
+    int pSeg = NO_SEG;
+    // Compute the maximum value maxMetric can possibly reach
+    long maxMetric = ( noSegs / 2 ) * ( noSegs - noSegs / 2 );
+    long bestMetric = LONG_MIN, bestSplits = LONG_MAX;
+
+    sCandidateBatch batch = { this, task->candidateList, task->usedSector, segs, noSegs, NULL, 0, false, task->groups };
+
+    int next = 0, noCandidates;
+    while ( next < noSegs ) {
+
+        next = GetCandidates ( task, segs, noSegs, next, noSegs, &noCandidates );
+
+        // Each earlier candidate in the group can raise bestSplits by at most 2
+        for ( int c = 0; c < noCandidates; c++ ) {
+            task->candidateList [c].maxSplits = ( bestMetric < 0 ) ? LONG_MAX : bestSplits + 2 * c;
+        }
+
+        RunParallel ( EvaluateCandidate, &batch, noCandidates );
+
+        for ( int c = 0; c < noCandidates; c++ ) {
+            sCandidate *candidate = &task->candidateList [c];
+            if (( candidate->valid == false ) || ( candidate->pruned == true )) continue;
+
+            int lCount = candidate->count [0], sCount = candidate->count [1], rCount = candidate->count [2];
+            if (( bestMetric >= 0 ) && ( sCount > bestSplits )) continue;
+
+            // Only consider SEG if it is not a boundary line
+            if ( lCount * rCount + sCount != 0 ) {
+                long metric = ( long ) lCount * ( long ) rCount;
+                if ( sCount ) {
+                    long temp = m_X1 * sCount;
+                    if ( m_X2 < temp ) metric = m_X2 * metric / temp;
+                    metric -= ( m_X3 * sCount + m_X4 ) * sCount;
+                }
+                if ( candidate->angle & 0x3FFF ) metric--;
+                if ( metric == maxMetric ) return segs [ candidate->index ];
+                if ( metric > bestMetric ) {
+                    pSeg       = segs [ candidate->index ];
+                    bestSplits = sCount + 2;
+                    bestMetric = metric;
+                }
+            } else if ( candidate->alias != 0 ) {
+                // Eliminate outer edges of the map from here & down
+                *task->convexPtr++ = candidate->alias;
+            }
+        }
+
+        // Settle for the best partition so far once time runs out
+        if (( pSeg != NO_SEG ) && TimeUp ( task )) break;
+    }
+
+    return pSeg;
+}
+
+//----------------------------------------------------------------------------
+//  ALGORITHM 2: 'ZenNode Quality'
+//    This is the 2nd algorithm used by ZenNode.  It attempts to keep the
+//    resulting BSP tree balanced based on the number of sectors on each side of
+//    the partition line in addition to the number of SEGs.  This seems more
+//    reasonable since a given SECTOR is usually made up of one or more SSECTORS.
+//----------------------------------------------------------------------------
+
+int sortTotalMetric ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "sortTotalMetric", true );
+
+    int dif;
+    dif = (( sScoreInfo * ) ptr1)->invalid - (( sScoreInfo * ) ptr2)->invalid;
+    if ( dif ) return dif;
+    dif = (( sScoreInfo * ) ptr1)->total - (( sScoreInfo * ) ptr2)->total;
+    if ( dif ) return dif;
+    dif = (( sScoreInfo * ) ptr1)->index - (( sScoreInfo * ) ptr2)->index;
+    return dif;
+}
+
+int sortMetric1 ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "sortMetric1", true );
+
+    if ((( sScoreInfo * ) ptr2)->metric1 < (( sScoreInfo * ) ptr1)->metric1 ) return -1;
+    if ((( sScoreInfo * ) ptr2)->metric1 > (( sScoreInfo * ) ptr1)->metric1 ) return  1;
+    if ((( sScoreInfo * ) ptr2)->metric2 < (( sScoreInfo * ) ptr1)->metric2 ) return -1;
+    if ((( sScoreInfo * ) ptr2)->metric2 > (( sScoreInfo * ) ptr1)->metric2 ) return  1;
+    return (( sScoreInfo * ) ptr1)->index - (( sScoreInfo * ) ptr2)->index;
+}
+
+int sortMetric2 ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "sortMetric2", true );
+
+    if ((( sScoreInfo * ) ptr2)->metric2 < (( sScoreInfo * ) ptr1)->metric2 ) return -1;
+    if ((( sScoreInfo * ) ptr2)->metric2 > (( sScoreInfo * ) ptr1)->metric2 ) return  1;
+    if ((( sScoreInfo * ) ptr2)->metric1 < (( sScoreInfo * ) ptr1)->metric1 ) return -1;
+    if ((( sScoreInfo * ) ptr2)->metric1 > (( sScoreInfo * ) ptr1)->metric1 ) return  1;
+    return (( sScoreInfo * ) ptr1)->index - (( sScoreInfo * ) ptr2)->index;
+}
+
+int BSPBuilder::Algorithm2 ( sBSPTask *task, int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::Algorithm2", true );
+
+    sScoreInfo *score = task->score;
+    int noScores = 0, rank, i;
+
+    // Number the sectors used by these SEGs
+    int noSectors = 0;
+    for ( i = 0; i < noSegs; i++ ) {
+        int sector = Info ( segs [i] )->Sector;
+        if ( task->sectorMap [ sector ] == -1 ) task->sectorMap [ sector ] = noSectors++;
+    }
+    if ( task->groups != NULL ) GroupSectors ( task->groups, task->sectorMap, noSectors );
+
+    sCandidateBatch batch = { this, task->candidateList, task->usedSector, segs, noSegs, task->sectorMap, noSectors, false, task->groups };
+
+    int next = 0, noCandidates;
+    while ( next < noSegs ) {
+
+        next = GetCandidates ( task, segs, noSegs, next, noSegs, &noCandidates );
+
+        RunParallel ( EvaluateCandidate, &batch, noCandidates );
+
+        for ( int c = 0; c < noCandidates; c++ ) {
+            sCandidate *candidate = &task->candidateList [c];
+            if ( candidate->valid == false ) continue;
+
+            int lCount = candidate->count [0], sCount = candidate->count [1], rCount = candidate->count [2];
+
+            sScoreInfo *curScore = &score [noScores];
+            curScore->invalid = candidate->invalid;
+
+            // Only consider SEG if it is not a boundary line
+            if ( lCount * rCount + sCount ) {
+                int lsCount = candidate->sectors [0], ssCount = candidate->sectors [1], rsCount = candidate->sectors [2];
+
+                curScore->index = candidate->index;
+                curScore->metric1 = ( long ) ( lCount + sCount ) * ( long ) ( rCount + sCount );
+                curScore->metric2 = ( long ) ( lsCount + ssCount ) * ( long ) ( rsCount + ssCount );
+
+                if ( sCount ) {
+                    long temp = m_X1 * sCount;
+                    if ( m_X2 < temp ) curScore->metric1 = m_X2 * curScore->metric1 / temp;
+                    curScore->metric1 -= ( m_X3 * sCount + m_X4 ) * sCount;
+                }
+                if ( ssCount ) {
+                    long temp = m_X1 * ssCount;
+                    if ( m_X2 < temp ) curScore->metric2 = m_X2 * curScore->metric2 / temp;
+                    curScore->metric2 -= ( m_X3 * ssCount + m_X4 ) * sCount;
+                }
+
+                noScores++;
+            } else if ( candidate->alias != 0 ) {
+                // Eliminate outer edges of the map
+                *task->convexPtr++ = candidate->alias;
+            }
+        }
+
+        // Settle for the best partition so far once time runs out
+        if (( noScores > 0 ) && TimeUp ( task )) break;
+    }
+
+    if ( noScores > 1 ) {
+        qsort ( score, noScores, sizeof ( sScoreInfo ), sortMetric1 );
+        for ( rank = i = 0; i < noScores; i++ ) {
+            score [i].total = rank;
+            if (( i + 1 < noScores ) && ( score [i].metric1 != score [i+1].metric1 )) rank++;
+        }
+        qsort ( score, noScores, sizeof ( sScoreInfo ), sortMetric2 );
+        for ( rank = i = 0; i < noScores; i++ ) {
+            score [i].total += rank;
+            if (( i + 1 < noScores ) && ( score [i].metric2 != score [i+1].metric2 )) rank++;
+        }
+        qsort ( score, noScores, sizeof ( sScoreInfo ), sortTotalMetric );
+    }
+
+    if ( noScores && score [0].invalid ) {
+        int noBad = 0;
+        for ( int i = 0; i < noScores; i++ ) if ( score [i].invalid ) noBad++;
+        WARNING ( "Non-splittable linedefs have been split! ("<< noBad << "/" << noScores << ")" );
+    }
+
+    for ( i = 0; i < noSegs; i++ ) {
+        task->sectorMap [ Info ( segs [i] )->Sector ] = -1;
+    }
+
+    int pSeg = noScores ? segs [ score [0].index ] : NO_SEG;
+    return pSeg;
+}
+
+//----------------------------------------------------------------------------
+//  ALGORITHM 3: 'ZenNode Lite'
+//    This is a modified version of the original algorithm used by ZenNode.
+//    It uses the same logic for picking the partition, but only looks at the
+//    first 30 segs for a valid partition.  If none is found, the search is
+//    continued until one is found or all segs have been searched.
+//----------------------------------------------------------------------------
+
+int BSPBuilder::Algorithm3 ( sBSPTask *task, int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::Algorithm3", true );
+
+    int pSeg = NO_SEG;
+    // Compute the maximum value maxMetric can possibly reach
+    long maxMetric = ( long ) ( noSegs / 2 ) * ( long ) ( noSegs - noSegs / 2 );
+    long bestMetric = LONG_MIN, bestSplits = LONG_MAX;
+
+    sCandidateBatch batch = { this, task->candidateList, task->usedSector, segs, noSegs, NULL, 0, false, task->groups };
+
+    int next = 0, noCandidates, max = ( noSegs < 30 ) ? noSegs : 30;
+
+retry:
+
+    while ( next < max ) {
+
+        next = GetCandidates ( task, segs, noSegs, next, max, &noCandidates );
+
+        // A new best partition never has more splits than the previous one
+        for ( int c = 0; c < noCandidates; c++ ) {
+            task->candidateList [c].maxSplits = ( bestMetric < 0 ) ? LONG_MAX : bestSplits;
+        }
+
+        RunParallel ( EvaluateCandidate, &batch, noCandidates );
+
+        for ( int c = 0; c < noCandidates; c++ ) {
+            sCandidate *candidate = &task->candidateList [c];
+            if (( candidate->valid == false ) || ( candidate->pruned == true )) continue;
+
+            int lCount = candidate->count [0], sCount = candidate->count [1], rCount = candidate->count [2];
+            if (( bestMetric >= 0 ) && ( sCount > bestSplits )) continue;
+
+            if ( lCount * rCount + sCount ) {
+                long metric = ( long ) lCount * ( long ) rCount;
+                if ( sCount ) {
+                    long temp = m_X1 * sCount;
+                    if ( m_X2 < temp ) metric = m_X2 * metric / temp;
+                    metric -= ( m_X3 * sCount + m_X4 ) * sCount;
+                }
+                if ( candidate->angle & 0x3FFF ) metric--;
+                if ( metric == maxMetric ) return segs [ candidate->index ];
+                if ( metric > bestMetric ) {
+                    pSeg = segs [ candidate->index ];
+                    bestSplits = sCount;
+                    bestMetric = metric;
+                }
+            } else if ( candidate->alias != 0 ) {
+                // Eliminate outer edges of the map from here & down
+                *task->convexPtr++ = candidate->alias;
+            }
+        }
+
+        // Settle for the best partition so far once time runs out
+        if (( pSeg != NO_SEG ) && TimeUp ( task )) break;
+    }
+
+    if (( pSeg == NO_SEG ) && ( max < noSegs )) {
+        max += 5;
+        if ( max > noSegs ) max = noSegs;
+        goto retry;
+    }
+
+    return pSeg;
+}
+
+//----------------------------------------------------------------------------
+//  ALGORITHM 4: 'ZenNode Fast'
+//    Intended for very large maps.  Only horizontal and vertical lines close
+//    to the median of the SEGs are considered.  The extents of the SEGs are
+//    sorted once, after which the number of SEGs on either side of (and
+//    crossing) a horizontal or vertical line can be found with a binary
+//    search rather than a pass over all the SEGs.  The best of these is then
+//    checked for real before it is used.  If none of them divides the SEGs,
+//    ALGORITHM 3 is used instead.
+//----------------------------------------------------------------------------
+
+struct sFastCandidate {
+    double      offset;			// distance from the median
+    double      position;		// x (vertical) or y (horizontal) of the line
+    int         index;			// index of the SEG within the current list
+    long        metric;
+};
+
+static int SortByOffset ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "SortByOffset", false );
+
+    const sFastCandidate *c1 = ( const sFastCandidate * ) ptr1;
+    const sFastCandidate *c2 = ( const sFastCandidate * ) ptr2;
+
+    if ( c1->offset != c2->offset ) return ( c1->offset < c2->offset ) ? -1 : 1;
+
+    return c1->index - c2->index;
+}
+
+static int SortByMetric ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "SortByMetric", false );
+
+    const sFastCandidate *c1 = ( const sFastCandidate * ) ptr1;
+    const sFastCandidate *c2 = ( const sFastCandidate * ) ptr2;
+
+    if ( c1->metric != c2->metric ) return ( c1->metric > c2->metric ) ? -1 : 1;
+
+    return c1->index - c2->index;
+}
+
+static int SortByValue ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "SortByValue", false );
+
+    double dif = *( const double * ) ptr1 - *( const double * ) ptr2;
+
+    return ( dif < 0.0 ) ? -1 : ( dif > 0.0 ) ? 1 : 0;
+}
+
+// Returns the number of entries in the sorted list that are < value (or <= value)
+static int CountBelow ( const double *list, int count, double value, bool inclusive )
+{
+    int low = 0, high = count;
+    while ( low < high ) {
+        int mid = ( low + high ) / 2;
+        if (( list [mid] < value ) || ( inclusive && ( list [mid] == value ))) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+int BSPBuilder::Algorithm4 ( sBSPTask *task, int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::Algorithm4", true );
+
+    if ( noSegs < MIN_FAST_SEGS ) return Algorithm3 ( task, segs, noSegs );
+
+    // [0] is used for vertical lines (x) and [1] for horizontal lines (y)
+    double *buffer = new double [ 6 * noSegs ];
+    double *low [2], *high [2], *line [2];
+    low [0]  = buffer;
+    low [1]  = buffer + noSegs;
+    high [0] = buffer + 2 * noSegs;
+    high [1] = buffer + 3 * noSegs;
+    line [0] = buffer + 4 * noSegs;
+    line [1] = buffer + 5 * noSegs;
+
+    sFastCandidate *list [2];
+    list [0] = new sFastCandidate [ 2 * noSegs ];
+    list [1] = list [0] + noSegs;
+
+    int noLines [2] = { 0, 0 }, noCandidates [2] = { 0, 0 };
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        const sSegCoords *coords = Coords ( segs [i] );
+        const sSegInfo *info = Info ( segs [i] );
+        double start [2] = { coords->startX, coords->startY };
+        double end [2]   = { coords->endX, coords->endY };
+        for ( int d = 0; d < 2; d++ ) {
+            low [d][i]  = ( start [d] < end [d] ) ? start [d] : end [d];
+            high [d][i] = ( start [d] < end [d] ) ? end [d] : start [d];
+        }
+        for ( int d = 0; d < 2; d++ ) {
+            if (( start [d] != end [d] ) || ( start [1-d] == end [1-d] )) continue;
+            line [d][ noLines [d]++ ] = start [d];
+            // Skip aliases that have already been used or found to be convex
+            if (( info->Split == false ) && ( task->lineChecked [ info->Alias ] != false )) continue;
+            sFastCandidate *candidate = &list [d][ noCandidates [d]++ ];
+            candidate->position = start [d];
+            candidate->index    = i;
+        }
+    }
+
+    int total = 0;
+    sFastCandidate *best = list [0];
+
+    for ( int d = 0; d < 2; d++ ) {
+
+        qsort ( low [d], noSegs, sizeof ( double ), SortByValue );
+        qsort ( high [d], noSegs, sizeof ( double ), SortByValue );
+        qsort ( line [d], noLines [d], sizeof ( double ), SortByValue );
+
+        double median = ( low [d][ noSegs / 2 ] + high [d][ noSegs / 2 ] ) / 2.0;
+
+        for ( int c = 0; c < noCandidates [d]; c++ ) {
+            list [d][c].offset = fabs ( list [d][c].position - median );
+        }
+        qsort ( list [d], noCandidates [d], sizeof ( sFastCandidate ), SortByOffset );
+
+        int count = 0;
+        for ( int c = 0; ( c < noCandidates [d] ) && ( count < FAST_CANDIDATES ); c++ ) {
+
+            sFastCandidate *candidate = &list [d][c];
+
+            // SEGs on the same line give the same answer
+            bool duplicate = false;
+            for ( int j = 0; j < count; j++ ) {
+                if ( list [d][j].position == candidate->position ) duplicate = true;
+            }
+            if ( duplicate == true ) continue;
+
+            double x = candidate->position;
+            int onLine = CountBelow ( line [d], noLines [d], x, true ) - CountBelow ( line [d], noLines [d], x, false );
+            int below  = CountBelow ( high [d], noSegs, x, true ) - onLine;
+            int above  = noSegs - CountBelow ( low [d], noSegs, x, false ) - onLine;
+
+            long lCount = below, rCount = above + onLine, sCount = noSegs - below - above - onLine;
+
+            // Boundary lines are left for the real count (in ALGORITHM 3) to find
+            if ( lCount * rCount + sCount == 0 ) continue;
+
+            long metric = lCount * rCount;
+            if ( sCount ) {
+                long temp = m_X1 * sCount;
+                if ( m_X2 < temp ) metric = m_X2 * metric / temp;
+                metric -= ( m_X3 * sCount + m_X4 ) * sCount;
+            }
+
+            candidate->metric = metric;
+            list [d][ count++ ] = *candidate;
+        }
+
+        // Gather the survivors from both directions at the front of the list
+        memmove ( best + total, list [d], sizeof ( sFastCandidate ) * count );
+        total += count;
+    }
+
+    qsort ( best, total, sizeof ( sFastCandidate ), SortByMetric );
+
+    // The estimates ignore rounding, so make sure the partition really divides the SEGs
+    int pSeg = NO_SEG;
+
+    sCandidateBatch batch = { this, task->candidateList, task->usedSector, segs, noSegs, NULL, 0, false, task->groups };
+
+    for ( int c = 0; c < total; c++ ) {
+        sCandidate *candidate = &task->candidateList [0];
+        candidate->index     = best [c].index;
+        candidate->maxSplits = LONG_MAX;
+        EvaluateCandidate ( &batch, 0, 0 );
+        if ( candidate->valid == false ) continue;
+        if ( candidate->count [0] * candidate->count [2] + candidate->count [1] != 0 ) {
+            pSeg = segs [ best [c].index ];
+            break;
+        }
+    }
+
+    delete [] list [0];
+    delete [] buffer;
+
+    return ( pSeg != NO_SEG ) ? pSeg : Algorithm3 ( task, segs, noSegs );
+}
+
+//----------------------------------------------------------------------------
+//  ALGORITHM 5: 'ZenNode Area'
+//    The engine walks the tree from wherever the player happens to be, so a
+//    deep branch costs little if it only covers a small part of the map.
+//    Each candidate is scored by the expected depth of the tree below it:
+//    the depth of each side (estimated from the SEGs it gets) weighted by
+//    its share of the area covered by the bounding boxes of both sides'
+//    SEGs, plus a penalty for the fraction of the SEGs that are split.  The
+//    lowest score wins.
+//----------------------------------------------------------------------------
+
+#define AREA_SPLIT_COST         4.0             // expected depth added if every SEG were split
+
+static inline double BoundArea ( const wBound *bound )
+{
+    return ( double ) ( bound->maxx - bound->minx ) * ( double ) ( bound->maxy - bound->miny );
+}
+
+int BSPBuilder::Algorithm5 ( sBSPTask *task, int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::Algorithm5", true );
+
+    int pSeg = NO_SEG;
+    double bestCost = 0.0;
+
+    sCandidateBatch batch = { this, task->candidateList, task->usedSector, segs, noSegs, NULL, 0, true, task->groups };
+
+    int next = 0, noCandidates;
+    while ( next < noSegs ) {
+
+        next = GetCandidates ( task, segs, noSegs, next, noSegs, &noCandidates );
+
+        // The penalty alone rules out candidates with too many splits
+        for ( int c = 0; c < noCandidates; c++ ) {
+            task->candidateList [c].maxSplits = ( pSeg == NO_SEG ) ? LONG_MAX : ( long ) ( bestCost * noSegs / AREA_SPLIT_COST );
+        }
+
+        RunParallel ( EvaluateCandidate, &batch, noCandidates );
+
+        for ( int c = 0; c < noCandidates; c++ ) {
+            sCandidate *candidate = &task->candidateList [c];
+            if (( candidate->valid == false ) || ( candidate->pruned == true )) continue;
+
+            int lCount = candidate->count [0], sCount = candidate->count [1], rCount = candidate->count [2];
+
+            // Only consider SEG if it is not a boundary line
+            if ( lCount * rCount + sCount != 0 ) {
+                double size [2] = { ( double ) ( lCount + sCount ), ( double ) ( rCount + sCount ) };
+                double area [2] = { BoundArea ( &candidate->bound [0] ), BoundArea ( &candidate->bound [1] ) };
+                double cost = AREA_SPLIT_COST * sCount / noSegs;
+                for ( int s = 0; s < 2; s++ ) {
+                    double weight = ( area [0] + area [1] > 0.0 ) ? area [s] / ( area [0] + area [1] ) : size [s] / ( size [0] + size [1] );
+                    if ( size [s] > 1.0 ) cost += weight * log ( size [s] ) / log ( 2.0 );
+                }
+                if ( candidate->angle & 0x3FFF ) cost += EPSILON;
+                if (( pSeg == NO_SEG ) || ( cost < bestCost )) {
+                    pSeg     = segs [ candidate->index ];
+                    bestCost = cost;
+                }
+            } else if ( candidate->alias != 0 ) {
+                // Eliminate outer edges of the map from here & down
+                *task->convexPtr++ = candidate->alias;
+            }
+        }
+
+        // Settle for the best partition so far once time runs out
+        if (( pSeg != NO_SEG ) && TimeUp ( task )) break;
+    }
+
+    return pSeg;
+}
+
+//----------------------------------------------------------------------------
+//  LOOKAHEAD: 'Beam search'
+//    The partition functions are greedy - they pick the best line for this
+//    NODE without looking at what it does to the NODEs below it.  With a
+//    beam width K > 1 the K best lines by the ALGORITHM 1 metric (plus the
+//    line the partition function picked) are each looked ahead D levels:
+//    the SEGs are divided without being split (split SEGs go to both
+//    sides) and each side is divided again by its own best line, down to
+//    D levels.  A line is rated by the total depth of the SEGs below it -
+//    a side that can't be divided is a leaf, and one that is left after D
+//    levels is assumed to need log2(n) more.  The lowest total wins, and
+//    the partition function's choice is kept on a tie.
+//
+//    Each line is looked ahead on its own thread, one SEG list at a time,
+//    so the lines chosen don't depend on the number of threads.
+//----------------------------------------------------------------------------
+
+long BSPBuilder::SplitMetric ( const sCandidate *candidate )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::SplitMetric", true );
+
+    long lCount = candidate->count [0], sCount = candidate->count [1], rCount = candidate->count [2];
+
+    long metric = lCount * rCount;
+    if ( sCount ) {
+        long temp = m_X1 * sCount;
+        if ( m_X2 < temp ) metric = m_X2 * metric / temp;
+        metric -= ( m_X3 * sCount + m_X4 ) * sCount;
+    }
+    if ( candidate->angle & 0x3FFF ) metric--;
+
+    return metric;
+}
+
+// Returns the line ALGORITHM 3 would pick if it looked at every SEG (NO_SEG for a leaf)
+int BSPBuilder::CheapPartition ( const char *lineUsed, int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::CheapPartition", true );
+
+    char *lineChecked = new char [ m_NoAliases ];
+    memcpy ( lineChecked, lineUsed, sizeof ( char ) * m_NoAliases );
+
+    sSegGroups *groups = (( m_GroupSegs == true ) && ( noSegs >= MIN_GROUP_SEGS )) ? GroupSegs ( segs, noSegs ) : NULL;
+
+    sCandidate candidate;
+    sCandidateBatch batch = { this, &candidate, NULL, segs, noSegs, NULL, 0, false, groups };
+
+    int pSeg = NO_SEG;
+    long bestMetric = LONG_MIN, bestSplits = LONG_MAX;
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        const sSegInfo *info = Info ( segs [i] );
+        int alias = info->Split ? 0 : info->Alias;
+        if ( alias != 0 ) {
+            if ( lineChecked [ alias ] ) continue;
+            lineChecked [ alias ] = true;
+        }
+
+        candidate.index     = i;
+        candidate.maxSplits = bestSplits;
+        EvaluateCandidate ( &batch, 0, 0 );
+        if (( candidate.valid == false ) || ( candidate.pruned == true )) continue;
+        if ( candidate.count [0] * candidate.count [2] + candidate.count [1] == 0 ) continue;
+
+        long metric = SplitMetric ( &candidate );
+        if ( metric > bestMetric ) {
+            pSeg       = segs [i];
+            bestSplits = candidate.count [1];
+            bestMetric = metric;
+        }
+    }
+
+    if ( groups != NULL ) FreeGroups ( groups );
+    delete [] lineChecked;
+
+    return pSeg;
+}
+
+// Returns the total depth of the SEGs below a NODE at the given level partitioned by pSeg
+double BSPBuilder::LookAhead ( const char *lineUsed, int *segs, int noSegs, int pSeg, int depth, int level )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::LookAhead", true );
+
+    sPartition part;
+    ComputeStaticVariables ( &part, pSeg );
+
+    signed char *side = new signed char [ noSegs ];
+    int count [3] = { 0, 0, 0 };
+
+    AcquireSideInfo ( &part );
+    for ( int j = 0; j < noSegs; j += SIDE_BLOCK ) {
+        int size = ( noSegs - j < SIDE_BLOCK ) ? noSegs - j : SIDE_BLOCK;
+        ClassifySegs ( &part, &segs [j], size, &side [j], count );
+    }
+    ReleaseSideInfo ( &part );
+
+    int *list [2], noList [2] = { 0, 0 };
+    list [0] = new int [ count [0] + count [1] ];
+    list [1] = new int [ count [2] + count [1] ];
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        if ( side [i] != SIDE_RIGHT ) list [0][ noList [0]++ ] = segs [i];
+        if ( side [i] != SIDE_LEFT ) list [1][ noList [1]++ ] = segs [i];
+    }
+
+    delete [] side;
+
+    double cost = 0.0;
+
+    for ( int s = 0; s < 2; s++ ) {
+        int size = noList [s];
+        if ( depth > 1 ) {
+            int next = ( size > 1 ) ? CheapPartition ( lineUsed, list [s], size ) : NO_SEG;
+            cost += ( next != NO_SEG ) ? LookAhead ( lineUsed, list [s], size, next, depth - 1, level + 1 ) : size * ( level + 1.0 );
+        } else {
+            cost += size * ( level + 1.0 + (( size > 1 ) ? log2 (( double ) size ) : 0.0 ));
+        }
+        delete [] list [s];
+    }
+
+    return cost;
+}
+
+struct sBeamEntry {
+    int         index;			// index of the SEG within the current list
+    int         seg;
+    long        metric;
+    double      cost;
+};
+
+struct sBeamBatch {
+    BSPBuilder *builder;
+    const char *lineUsed;
+    int        *segs;
+    int         noSegs;
+    sBeamEntry *entry;
+    int         depth;
+};
+
+void BSPBuilder::EvaluateBeam ( void *data, int index, int )
+{
+    FUNCTION_ENTRY ( NULL, "BSPBuilder::EvaluateBeam", true );
+
+    sBeamBatch *batch = ( sBeamBatch * ) data;
+    sBeamEntry *entry = &batch->entry [ index ];
+
+    entry->cost = batch->builder->LookAhead ( batch->lineUsed, batch->segs, batch->noSegs, entry->seg, batch->depth, 0 );
+}
+
+int BSPBuilder::BeamSearch ( sBSPTask *task, int *segs, int noSegs, int pSeg )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::BeamSearch", true );
+
+    if ( TimeUp ( task )) return pSeg;
+
+    sBeamEntry *beam = new sBeamEntry [ m_BeamWidth ];
+    int noBeam = 0;
+
+    if ( Info ( segs [0] )->final == false ) {
+        memcpy ( task->lineChecked, task->lineUsed, sizeof ( char ) * m_NoAliases );
+    } else {
+        memset ( task->lineChecked, 0, sizeof ( char ) * m_NoAliases );
+    }
+
+    sCandidateBatch batch = { this, task->candidateList, task->usedSector, segs, noSegs, NULL, 0, false, task->groups };
+
+    int next = 0, noCandidates;
+    while ( next < noSegs ) {
+
+        next = GetCandidates ( task, segs, noSegs, next, noSegs, &noCandidates );
+
+        for ( int c = 0; c < noCandidates; c++ ) {
+            task->candidateList [c].maxSplits = LONG_MAX;
+        }
+
+        RunParallel ( EvaluateCandidate, &batch, noCandidates );
+
+        // Keep the best lines in order - earlier ones win a tie
+        for ( int c = 0; c < noCandidates; c++ ) {
+            sCandidate *candidate = &task->candidateList [c];
+            if ( candidate->valid == false ) continue;
+            if ( candidate->count [0] * candidate->count [2] + candidate->count [1] == 0 ) continue;
+            long metric = SplitMetric ( candidate );
+            int i = noBeam;
+            while (( i > 0 ) && ( beam [ i - 1 ].metric < metric )) i--;
+            if ( i == m_BeamWidth ) continue;
+            if ( noBeam < m_BeamWidth ) noBeam++;
+            memmove ( &beam [ i + 1 ], &beam [i], sizeof ( sBeamEntry ) * ( noBeam - i - 1 ));
+            beam [i].index  = candidate->index;
+            beam [i].seg    = segs [ candidate->index ];
+            beam [i].metric = metric;
+        }
+    }
+
+    // Make sure the line picked by the partition function is looked at too
+    const sSegInfo *info = Info ( pSeg );
+    int alias = info->Split ? 0 : info->Alias;
+    int choice = -1;
+    for ( int i = 0; i < noBeam; i++ ) {
+        const sSegInfo *other = Info ( beam [i].seg );
+        if (( beam [i].seg == pSeg ) || (( alias != 0 ) && ( other->Split == false ) && ( other->Alias == alias ))) choice = i;
+    }
+    if ( choice == -1 ) {
+        choice = ( noBeam < m_BeamWidth ) ? noBeam++ : noBeam - 1;
+        beam [ choice ].index = -1;
+        beam [ choice ].seg   = pSeg;
+    }
+
+    if ( noBeam > 1 ) {
+        sBeamBatch lookAhead = { this, task->lineUsed, segs, noSegs, beam, m_BeamDepth };
+        RunParallel ( EvaluateBeam, &lookAhead, noBeam );
+        int best = choice;
+        for ( int i = 0; i < noBeam; i++ ) {
+            if ( beam [i].cost < beam [ best ].cost - EPSILON ) best = i;
+        }
+        pSeg = beam [ best ].seg;
+    }
+
+    delete [] beam;
+
+    return pSeg;
+}
+
+//----------------------------------------------------------------------------
+//  Check to see if the list of segs contains more than one sector and at least
+//    one of them requires "unique subsectors".
+//----------------------------------------------------------------------------
+
+bool BSPBuilder::KeepUniqueSubsectors ( int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::KeepUniqueSubsectors", true );
+
+    if (( m_UniqueSubsectors == true ) && ( noSegs > 0 )) {
+        bool requireUnique = false;
+        int lastSector  = Info ( segs [0] )->Sector;
+        for ( int i = 0; i < noSegs; i++ ) {
+            int sector = Info ( segs [i] )->Sector;
+            if ( m_KeepUnique [ sector ] == true ) requireUnique = true;
+            if ( sector != lastSector ) {
+                if ( requireUnique == true ) return true;
+                lastSector = sector;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool overlappingSegs;
+
+struct sOrientationKey {
+    int         angle;
+    int         lineDef;
+    int         seg;
+    sSegCoords  coords;
+};
+
+static int SortByOrientation ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "SortByOrientation", false );
+
+    const sOrientationKey *seg1 = ( const sOrientationKey * ) ptr1;
+    const sOrientationKey *seg2 = ( const sOrientationKey * ) ptr2;
+
+    // If they're at different angles it's easy...
+    int dif1 = seg2->angle - seg1->angle;
+    if ( dif1 != 0 ) return dif1;
+
+    // They're colinear, sort them in a clockwise direction
+    double dif2 = 0.0;
+    double dx = seg1->coords.endX - seg1->coords.startX;
+    if ( dx > 0.0 ) {
+        dif2 = seg1->coords.startX - seg2->coords.startX;
+    } else if ( dx < 0.0 ) {
+        dif2 = seg2->coords.startX - seg1->coords.startX;
+    } else {
+        double dy = seg1->coords.endY - seg1->coords.startY;
+        if ( dy > 0.0 ) {
+            dif2 = seg1->coords.startY - seg2->coords.startY;
+        } else if ( dy < 0.0 ) {
+            dif2 = seg2->coords.startY - seg1->coords.startY;
+        }
+    }
+
+    if ( dif2 != 0.0 ) return ( dif2 < 0.0 ) ? -1 : 1;
+
+    // Mark these SEGs as overlapping
+    overlappingSegs = true;
+
+    // OK, we have overlapping lines!
+    return ( seg1->lineDef < seg2->lineDef ) ? -1 : 1;
+}
+
+#if defined ( DIAGNOSTIC )
+
+void BSPBuilder::PrintKeepUniqueSegs ( int *segs, int noSegs, const char *msg )
+{
+    fprintf ( stdout, "keep-unique SEGS:\n" );
+
+    if ( msg != NULL ) fprintf ( stdout, "  << ERROR - %s >>\n", msg );
+
+    int lastAngle = 0x10000;
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        const sSegCoords *ci = Coords ( segs [i] );
+        const sSegInfo *info = Info ( segs [i] );
+        int angle = Seg ( segs [i] )->Data.angle;
+        double dx = ci->endX - ci->startX;
+        double dy = ci->endY - ci->startY;
+        fprintf ( stdout, "  [%d] (%8.1f,%8.1f)-(%8.1f,%8.1f) S:%5d  dx:%8.1f  dy:%8.1f  %04X LD: %5d alias: %5d\n", i, ci->startX, ci->startY, ci->endX, ci->endY, info->Sector, dx, dy, angle, info->LineDef, info->Alias );
+        if ( angle == lastAngle ) {
+            const sSegCoords *cp = Coords ( segs [i-1] );
+            double dx = cp->endX - cp->startX;
+            double dy = cp->endY - cp->startY;
+            double y1 = dx * ( ci->startY - cp->startY ) - dy * ( ci->startX - cp->startX );
+            if ( y1 != 0.0 ) fprintf ( stdout, "<< ERROR - seg[%d] is not colinear with seg[%d] - %f!!! >>\n", i, i-1, y1 );
+        }
+        lastAngle = angle;
+    }
+    fprintf ( stdout, "\n" );
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+//  Reorder the SEGs so that they are in order around the enclosing subsector
+//----------------------------------------------------------------------------
+void BSPBuilder::ArrangeSegs ( int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::ArrangeSegs", true );
+
+overlappingSegs = false;
+
+    sOrientationKey *keys = new sOrientationKey [ noSegs ];
+    for ( int i = 0; i < noSegs; i++ ) {
+        const SEG *data = Seg ( segs [i] );
+        keys [i].angle   = data->Data.angle;
+        keys [i].lineDef = data->Data.lineDef;
+        keys [i].seg     = segs [i];
+        keys [i].coords  = *Coords ( segs [i] );
+    }
+
+    // Sort the around the center of the polygon
+    qsort ( keys, noSegs, sizeof ( sOrientationKey ), SortByOrientation );
+
+    for ( int i = 0; i < noSegs; i++ ) {
+        segs [i] = keys [i].seg;
+    }
+    delete [] keys;
+
+#if defined ( DIAGNOSTIC )
+    bool badSegs = false;
+
+    int lastAngle = 0x10000;
+    for ( int i = 0; i < noSegs; i++ ) {
+    int angle = Seg ( segs [i] )->Data.angle;
+    if ( angle == lastAngle ) {
+        const sSegCoords *ci = Coords ( segs [i] ), *cp = Coords ( segs [i-1] );
+        double dx = cp->endX - cp->startX;
+        double dy = cp->endY - cp->startY;
+        double y1 = dx * ( ci->startY - cp->startY ) - dy * ( ci->startX - cp->startX );
+        if ( y1 != 0.0 ) { badSegs = true; }
+    }
+    lastAngle = angle;
+    }
+    if (badSegs||overlappingSegs) PrintKeepUniqueSegs (segs, noSegs, overlappingSegs ? "Overlapping SEGs were detected" : NULL );
+#endif
+
+    // See if the 1st sector wraps at the end of the list
+    int sector = Info ( segs [0] )->Sector;
+    int j = noSegs;
+    while (( j > 0 ) && ( Info ( segs [j-1] )->Sector == sector )) j--;
+
+    if ( j != noSegs ) {
+        int *tempSeg = new int [ noSegs - j ];
+        memcpy ( tempSeg, segs + j, sizeof ( int ) * ( noSegs - j ));
+        memmove ( segs + ( noSegs - j ), segs, sizeof ( int ) * j );
+        memcpy ( segs, tempSeg, sizeof ( int ) * ( noSegs - j ));
+        delete [] tempSeg;
+    }
+}
+
+void BSPBuilder::MakePartition ( sPartition *part, int *segs, int noSegs, int *noLeft, int *noRight )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::MakePartition", true );
+
+    // Find the end of the first run of SEGs that are unique (or at don't require
+    //   unique subsectors). These will form the right SSECTOR.
+    int  lastSector = Info ( segs [0] )->Sector;
+    bool uniqueFlag = m_KeepUnique [ lastSector ];
+
+    int right = 0;
+    while ( right + 1 < noSegs ) {
+        int thisSector = Info ( segs [right+1] )->Sector;
+        if (( thisSector != lastSector ) && 
+            (( uniqueFlag == true ) || ( m_KeepUnique [ thisSector ] == true ))) {
+            break;
+        }
+        lastSector = thisSector;
+        right++;
+    }
+
+    // Now we need to find a partition line that will isolate the 'right' SEGs
+    const sSegCoords *first = Coords ( segs [0] );
+
+    part->X  = Coords ( segs [right] )->endX;
+    part->Y  = Coords ( segs [right] )->endY;
+
+    // Look for the easy case first
+    if ( Seg ( segs [0] )->Data.angle != Seg ( segs [right] )->Data.angle ) {
+
+        *noRight = right + 1;
+        part->DX = first->startX - part->X;
+        part->DY = first->startY - part->Y;
+
+    } else {
+
+        // There are three potential sets of SEGs:
+        //  'target' - the SEGs at the start of the list
+        //  'head'   - the SEGs immediately following the 'target' SEGs up to the first
+        //             SEG in the 'tail' list
+        //  'tail'   - SEGs at the end of the list that have at least one endpoint on the same
+        //             line as the first 'target' SEG
+
+        // Find the last point not on the target SEGs line
+        int split  = noSegs;
+        double dx = first->endX - first->startX;
+        double dy = first->endY - first->startY;
+        while ( split > right ) {
+            double y2 = dx * ( Coords ( segs [split-1] )->endY - first->startY ) - dy * ( Coords ( segs [split-1] )->endX - first->startX );
+            if ( y2 < 0.0 ) break;
+            split--;
+            double y1 = dx * ( Coords ( segs [split] )->startY - first->startY ) - dy * ( Coords ( segs [split] )->startX - first->startX );
+            if ( y1 < 0.0 ) break;
+        }
+
+        // See if we found a candidate ending point (the dividing line between 'head' and 'tail' segments
+        if ( split > right ) {
+            int tail = noSegs - split;
+            if ( tail != 0 ) {
+                // We're going to split off the 'target'+'head' SEGs (right) from the 'tail' SEGs (left)
+                *noRight = split;
+                part->X  = ( Coords ( segs [split-1] )->endX + Coords ( segs [split] )->startX ) / 2.0;
+                part->Y  = ( Coords ( segs [split-1] )->endY + Coords ( segs [split] )->startY ) / 2.0;
+                part->DX = first->startX - part->X;
+                part->DY = first->startY - part->Y;
+            } else {
+                // No 'tail' SEGS - split the 'target' (right) and 'head' (left) SEGs
+                *noRight = right + 1;
+                part->DX = Coords ( segs [noSegs-1] )->endX - part->X;
+                part->DY = Coords ( segs [noSegs-1] )->endY - part->Y;
+            }
+        } else {
+            // All the line segments are colinear
+            int split = noSegs;
+            double dx = first->endX - first->startX;
+            if ( dx != 0.0 ) {
+                while (( Coords ( segs [split-1] )->endX - first->startX ) / dx <= 0.0 ) split--;
+            } else {
+                double dy = first->endY - first->startY;
+                while (( Coords ( segs [split-1] )->endY - first->startY ) / dy <= 0.0 ) split--;
+            }
+
+            int tail = noSegs - split;
+            if ( tail != 0 ) {
+                // We're going to split off the 'target'+'head' SEGs (right) from the 'tail' SEGs (left)
+                *noRight = split;
+                part->X  = first->startX;
+                part->Y  = first->startY;
+                part->DX  = first->startY - first->endY;
+                part->DY  = first->endX - first->startX;
+            } else {
+                // No 'tail' SEGS - split the 'target' (right) and 'head' (left) SEGs
+                *noRight = right + 1;
+                part->DX  = first->endY - first->startY;
+                part->DY  = first->startX - first->endX;
+            }
+        }
+    }
+
+    *noLeft  = noSegs - *noRight;
+}
+
+#if defined ( DIAGNOSTIC )
+
+void BSPBuilder::VerifyNode ( int *segs, int noSegs, double x1, double y1, double x2, double y2 )
+{
+    bool errors = false;
+    double dx = x2 - x1;
+    double dy = y2 - y1;
+    double h = ( dx * dx ) + ( dy * dy );
+    for ( int j = 0; j < noSegs; j++ ) {
+        const sSegCoords *coords = Coords ( segs [j] );
+        double p1 = ( dx * ( coords->startY - y1 ) - dy * ( coords->startX - x1 )) / h;
+        double p2 = ( dx * ( coords->endY - y1 ) - dy * ( coords->endX - x1 )) / h;
+        if (( p1 > 0.25 ) || ( p2 > 0.25 )) errors = true;
+    }
+    if ( errors == true ) {
+        fprintf ( stdout, "Partition line (%8.1f,%8.1f)-(%8.1f,%8.1f) is not correct!\n", x1, y1, x2, y2 );
+        for ( int j = 0; j < noSegs; j++ ) {
+            const sSegCoords *coords = Coords ( segs [j] );
+            double p1 = ( dx * ( coords->startY - y1 ) - dy * ( coords->startX - x1 )) / h;
+            double p2 = ( dx * ( coords->endY - y1 ) - dy * ( coords->endX - x1 )) / h;
+            fprintf ( stdout, " [%d] (%8.1f,%8.1f)-(%8.1f,%8.1f)  S:%5d  LD:%5d  y1:%10.3f  y2:%10.3f %s\n", j, coords->startX, coords->startY, coords->endX, coords->endY, Info ( segs [j] )->Sector, Info ( segs [j] )->LineDef, p1, p2, (( p1 > 0.25 ) || ( p2 > 0.25 )) ? "<---" : "" );
+        }
+    }
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+//  Recursively create the actual NODEs.  This procedure is very similar to 
+//    CreateNode except that we know up front that the SEGs form a convex
+//    polygon and only need to be broken up by unique sectors. The main difference
+//    here is that the partition line is not taken from the SEGs but is an
+//    arbitrary line chosen to break up the SEGs properly to create unique SSECTORs.
+//----------------------------------------------------------------------------
+sBSPNode *BSPBuilder::GenerateUniqueSectors ( sBSPTask *task, int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::GenerateUniqueSectors", true );
+
+    if ( KeepUniqueSubsectors ( segs, noSegs ) == false ) {
+        if ( task->showProgress ) ShowDone ();
+        return CreateSSector ( segs, noSegs );
+    }
+
+    int noLeft, noRight;
+
+    sPartition part;
+    MakePartition ( &part, segs, noSegs, &noLeft, &noRight );
+
+    sBSPNode *node = new sBSPNode;
+    wNode *tempNode = &node->data;
+
+    // Store the NODE info set in ComputeStaticVariables
+    tempNode->x  = ( INT16 ) lrint ( part.X );
+    tempNode->y  = ( INT16 ) lrint ( part.Y );
+    tempNode->dx = ( INT16 ) lrint ( part.DX );
+    tempNode->dy = ( INT16 ) lrint ( part.DY );
+
+#if defined ( DIAGNOSTIC )
+    double x1 = part.X;
+    double y1 = part.Y;
+    double x2 = part.X + part.DX;
+    double y2 = part.Y + part.DY;
+#endif
+
+    FindBounds ( &tempNode->side [0], segs, noRight );
+    FindBounds ( &tempNode->side [1], segs + noRight, noLeft );
+
+    if ( task->showProgress ) GoRight ();
+
+    node->child [0] = GenerateUniqueSectors ( task, segs, noRight );
+
+    if ( task->showProgress ) GoLeft ();
+
+    node->child [1] = GenerateUniqueSectors ( task, segs + noRight, noLeft );
+
+#if defined ( DIAGNOSTIC )
+    VerifyNode ( segs, noRight, x1, y1, x2, y2 );
+    VerifyNode ( segs+noRight, noLeft, x2, y2, x1, y1 );
+#endif
+
+    if ( task->showProgress ) Backup ();
+
+    if ( task->showProgress ) ShowDone ();
+
+    return node;
+}
+
+//----------------------------------------------------------------------------
+//  Allocate the working storage for a new subtree.  The subtree starts out
+//    with the same lines marked as used/convex as its parent.
+//----------------------------------------------------------------------------
+
+sBSPTask *BSPBuilder::NewTask ( const char *lineUsed, bool progress )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::NewTask", true );
+
+    sBSPTask *task = new sBSPTask;
+
+    task->lineUsed      = new char [ m_NoAliases ];
+    task->lineChecked   = new char [ m_NoAliases ];
+    task->convexList    = new int [ m_NoAliases ];
+    task->convexPtr     = task->convexList;
+    task->candidateList = new sCandidate [ m_MaxCandidates ];
+    task->score         = NULL;
+    task->usedSector    = NULL;
+    task->sectorMap     = NULL;
+    task->groups        = NULL;
+    task->nextSeg       = 0;
+    task->lastSeg       = 0;
+    task->showProgress  = progress;
+    task->timeLimited   = false;
+    task->deadline      = 0;
+
+    if ( m_PartitionFunction == &BSPBuilder::Algorithm2 ) {
+        task->score      = new sScoreInfo [ m_NoAliases ];
+        task->usedSector = new UINT8 [ m_MaxCandidates * m_SectorCount ];
+        task->sectorMap  = new int [ m_SectorCount ];
+        memset ( task->sectorMap, -1, sizeof ( int ) * m_SectorCount );
+    }
+
+    if ( lineUsed ) {
+        memcpy ( task->lineUsed, lineUsed, sizeof ( char ) * m_NoAliases );
+    } else {
+        memset ( task->lineUsed, false, sizeof ( char ) * m_NoAliases );
+    }
+
+    return task;
+}
+
+void BSPBuilder::FreeTask ( sBSPTask *task )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::FreeTask", true );
+
+    delete [] task->lineUsed;
+    delete [] task->lineChecked;
+    delete [] task->convexList;
+    delete [] task->candidateList;
+    delete [] task->score;
+    delete [] task->usedSector;
+    delete [] task->sectorMap;
+
+    delete task;
+}
+
+//----------------------------------------------------------------------------
+//  The left half of a NODE that has been handed off to another thread
+//----------------------------------------------------------------------------
+
+struct sSubtree {
+    sTask       task;
+    BSPBuilder *builder;
+    char       *lineUsed;			// lineUsed when the subtree was queued
+    int        *segs;
+    int         noSegs;
+    double      budget;
+    sBSPNode   *node;
+};
+
+void BSPBuilder::BuildSubtree ( void *data, int, int )
+{
+    FUNCTION_ENTRY ( NULL, "BSPBuilder::BuildSubtree", true );
+
+    sSubtree *subtree = ( sSubtree * ) data;
+    BSPBuilder *builder = subtree->builder;
+
+    sBSPTask *task = builder->NewTask ( subtree->lineUsed, false );
+    subtree->node = builder->CreateNode ( task, subtree->segs, subtree->noSegs, subtree->budget );
+    builder->FreeTask ( task );
+}
+
+//----------------------------------------------------------------------------
+//  Recursively create the actual NODEs.  The given list of SEGs is analyzed
+//    and a partition is chosen.  If no partition can be found, a leaf node
+//    is created.  Otherwise, the right and left SEGs are analyzed.  Features:
+//    - A list of 'convex' aliases is maintained.  These are lines that border
+//      the list of SEGs and can never be partitions.  A line is marked as
+//      convex for this and all children, and unmarked before returing.
+//    - Similarly, the alias chosen as the partition is marked as convex
+//      since it will be convex for all children.
+//    - Large left halves are queued so that an idle thread can build them
+//      while this one works on the right half.
+//    - If there is a time limit, budget is the number of ms left for this
+//      subtree (0 means no limit).  Building a subtree of n SEGs takes
+//      roughly nlog2(n) steps, n of which are spent choosing the partition
+//      for this NODE, so that is the share it gets.  Whatever is left is
+//      split between the two halves in the same way.
+//  The list of SEGs is deleted once it is no longer needed.
+//----------------------------------------------------------------------------
+
+static double SubtreeCost ( int noSegs )
+{
+    return ( noSegs > 2 ) ? noSegs * log2 (( double ) noSegs ) : noSegs;
+}
+
+static double TimeLeft ( double budget, UINT32 start )
+{
+    double left = budget - ( double ) ( CurrentTime () - start );
+
+    // Anything at all marks the subtree as being time limited
+    return ( left > 0.001 ) ? left : 0.001;
+}
+
+sBSPNode *BSPBuilder::CreateNode ( sBSPTask *task, int *segs, int noSegs, double budget )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::CreateNode", true );
+
+    sPartition part;
+    int noLeft, noRight;
+    int *lSegs, *rSegs;
+    wBound bound [2];
+    int *cptr = task->convexPtr;
+
+    UINT32 start = CurrentTime ();
+    task->timeLimited = ( budget > 0.0 ) ? true : false;
+    if ( task->timeLimited ) {
+        task->deadline = start + ( UINT32 ) ( budget * noSegs / SubtreeCost ( noSegs ));
+    }
+    
+    if (( noSegs <= 1 ) || ( IsConvex ( segs, noSegs ) == true ) ||
+        ( ChoosePartition ( task, &part, segs, noSegs, &lSegs, &noLeft, &rSegs, &noRight, bound ) == false )) {
+        task->convexPtr = cptr;
+        sBSPNode *leaf;
+        if ( KeepUniqueSubsectors ( segs, noSegs ) == true ) {
+            ArrangeSegs ( segs, noSegs );
+            leaf = GenerateUniqueSectors ( task, segs, noSegs );
+        } else {
+            if ( task->showProgress ) ShowDone ();
+            leaf = CreateSSector ( segs, noSegs );
+        }
+        delete [] segs;
+        return leaf;
+    }
+
+    delete [] segs;
+
+    sBSPNode *node = new sBSPNode;
+    wNode *tempNode = &node->data;
+
+    // Store the NODE info set in ComputeStaticVariables
+    tempNode->x  = ( INT16 ) lrint ( part.X );
+    tempNode->y  = ( INT16 ) lrint ( part.Y );
+    tempNode->dx = ( INT16 ) lrint ( part.DX );
+    tempNode->dy = ( INT16 ) lrint ( part.DY );
+
+    // The bounding boxes were found while sorting the SEGs
+    tempNode->side [0] = bound [0];
+    tempNode->side [1] = bound [1];
+
+#if defined ( DIAGNOSTIC )
+    double x1 = part.X;
+    double y1 = part.Y;
+    double x2 = part.X + part.DX;
+    double y2 = part.Y + part.DY;
+    VerifyNode ( rSegs, noRight, x1, y1, x2, y2 );
+    VerifyNode ( lSegs, noLeft, x2, y2, x1, y1 );
+#endif
+
+    // Only mark the lines that aren't already marked - they are unmarked on the way out
+    int alias = part.currentAlias;
+    char aliasUsed = task->lineUsed [ alias ];
+
+    int *convexPtr = cptr;
+    for ( int *tempPtr = cptr; tempPtr != task->convexPtr; tempPtr++ ) {
+        if ( task->lineUsed [ *tempPtr ] == false ) {
+            task->lineUsed [ *tempPtr ] = 2;
+            *convexPtr++ = *tempPtr;
+        }
+    }
+    task->convexPtr = convexPtr;
+    task->lineUsed [ alias ] = 1;
+
+    double rBudget = 0.0, lBudget = 0.0;
+    if ( budget > 0.0 ) {
+        double timeLeft = TimeLeft ( budget, start );
+        rBudget = timeLeft * SubtreeCost ( noRight ) / ( SubtreeCost ( noRight ) + SubtreeCost ( noLeft ));
+        lBudget = timeLeft - rBudget;
+    }
+
+    sSubtree left;
+    bool queued = false;
+
+    if (( ThreadCount () > 1 ) && ( noLeft >= MIN_SUBTREE_SEGS )) {
+        left.task.function = BuildSubtree;
+        left.task.data     = &left;
+        left.task.index    = 0;
+        left.builder       = this;
+        left.lineUsed      = new char [ m_NoAliases ];
+        left.segs          = lSegs;
+        left.noSegs        = noLeft;
+        left.budget        = lBudget;
+        memcpy ( left.lineUsed, task->lineUsed, sizeof ( char ) * m_NoAliases );
+        QueueTask ( &left.task );
+        queued = true;
+    }
+
+    if ( task->showProgress ) GoRight ();
+
+    node->child [0] = CreateNode ( task, rSegs, noRight, rBudget );
+
+    if ( task->showProgress ) GoLeft ();
+
+    // Time the right half didn't use is passed on to the left half
+    if ( budget > 0.0 ) lBudget = TimeLeft ( budget, start );
+
+    if ( queued == false ) {
+        node->child [1] = CreateNode ( task, lSegs, noLeft, lBudget );
+    } else {
+        if ( ClaimTask ( &left.task ) == true ) {
+            // Nobody else got to it - the lines marked are the same as when it was queued
+            node->child [1] = CreateNode ( task, lSegs, noLeft, lBudget );
+        } else {
+            WaitTask ( &left.task );
+            node->child [1] = left.node;
+        }
+        delete [] left.lineUsed;
+    }
+
+    if ( task->showProgress ) Backup ();
+
+    while ( task->convexPtr != cptr ) task->lineUsed [ *--task->convexPtr ] = false;
+    task->lineUsed [ alias ] = aliasUsed;
+
+    if ( task->showProgress ) ShowDone ();
+
+    return node;
+}
+
+//----------------------------------------------------------------------------
+//  Incremental builds.  The NODES the level already has are read before the
+//    old SEGS are thrown away.  The new SEGs are compared with the old ones a
+//    side of a LINEDEF at a time - a side hasn't changed if its old SEGs all
+//    still lie along it and cover it from one end to the other.  The sides
+//    that are gone (or have moved) leave their old SEGs behind as 'ghosts',
+//    so that removing lines is noticed as well.
+//
+//  The old partition lines are then used again from the root down, sorting
+//    the new SEGs (and the ghosts) the same way the old ones were sorted.
+//    A subtree is built from scratch by CreateNode once enough of the SEGs
+//    that reach it have changed.  The SSECTORs at the bottom of the old tree
+//    are always handed to CreateNode, which usually finds them convex and
+//    leaves them alone, so the tree is valid even if the level was edited
+//    in a way the comparison didn't catch.
+//----------------------------------------------------------------------------
+
+#define REBUILD_SHARE           4               // rebuild a subtree once 1/REBUILD_SHARE of its SEGs have changed
+#define REUSE_TOLERANCE         1.0             // split points were rounded to the nearest vertex
+
+static sOldTree *ReadOldTree ( const DoomLevel *level )
+{
+    FUNCTION_ENTRY ( NULL, "ReadOldTree", true );
+
+    // Only the original format is decoded by DoomLevel
+    if (( level->NodeFormat () != NODES_VANILLA ) || ( level->NodeCount () == 0 ) || ( level->SegCount () == 0 )) {
+        return NULL;
+    }
+
+    const wVertex  *vertex = level->GetVertices ();
+    const wSegs    *segs   = level->GetSegs ();
+    const wNode    *nodes  = level->GetNodes ();
+    int noNodes = level->NodeCount ();
+
+    // Make sure every NODE can be reached from the root exactly once
+    bool valid = true;
+    char *seen = new char [ noNodes ];
+    int  *stack = new int [ noNodes ];
+    memset ( seen, 0, sizeof ( char ) * noNodes );
+
+    int depth = 0;
+    stack [ depth++ ] = noNodes - 1;
+    seen [ noNodes - 1 ] = 1;
+    while (( depth > 0 ) && ( valid == true )) {
+        const wNode *node = &nodes [ stack [ --depth ]];
+        if (( node->dx == 0 ) && ( node->dy == 0 )) valid = false;
+        for ( int i = 0; ( i < 2 ) && ( valid == true ); i++ ) {
+            int child = node->child [i];
+            if ( child & 0x8000 ) {
+                if (( child & 0x7FFF ) >= level->SubSectorCount ()) valid = false;
+            } else if (( child >= noNodes ) || seen [child] ) {
+                valid = false;
+            } else {
+                seen [child] = 1;
+                stack [ depth++ ] = child;
+            }
+        }
+    }
+
+    delete [] stack;
+    delete [] seen;
+
+    for ( int i = 0; ( i < level->SegCount ()) && ( valid == true ); i++ ) {
+        if (( segs [i].start >= level->VertexCount ()) || ( segs [i].end >= level->VertexCount ())) valid = false;
+    }
+
+    if ( valid == false ) return NULL;
+
+    sOldTree *tree = new sOldTree;
+    tree->noNodes = noNodes;
+    tree->node    = new wNode [ noNodes ];
+    tree->noSegs  = level->SegCount ();
+    tree->seg     = new sOldSeg [ tree->noSegs ];
+    memcpy ( tree->node, nodes, sizeof ( wNode ) * noNodes );
+
+    // The split points are only in VERTEXES until the level is trimmed
+    for ( int i = 0; i < tree->noSegs; i++ ) {
+        sOldSeg *seg = &tree->seg [i];
+        seg->coords.startX = vertex [ segs [i].start ].x;
+        seg->coords.startY = vertex [ segs [i].start ].y;
+        seg->coords.endX   = vertex [ segs [i].end ].x;
+        seg->coords.endY   = vertex [ segs [i].end ].y;
+        seg->lineDef       = segs [i].lineDef;
+        seg->flip          = segs [i].flip ? 1 : 0;
+        seg->angle         = segs [i].angle;
+        seg->offset        = segs [i].offset;
+    }
+
+    return tree;
+}
+
+static void FreeOldTree ( sOldTree *tree )
+{
+    FUNCTION_ENTRY ( NULL, "FreeOldTree", true );
+
+    if ( tree == NULL ) return;
+
+    delete [] tree->node;
+    delete [] tree->seg;
+    delete tree;
+}
+
+//----------------------------------------------------------------------------
+//  Returns true if the old SEGs (order [first] up to order [last]) cover the
+//    given SEG from one end to the other.  The old SEGs share vertices with
+//    the LINEDEFs, so a vertex that has been moved moves them as well - the
+//    angle and offset they were given when they were built are checked too.
+//----------------------------------------------------------------------------
+
+static bool SameSide ( const SEG *data, const sSegCoords *side, const sOldSeg *seg, const int *order, int first, int last )
+{
+    FUNCTION_ENTRY ( NULL, "SameSide", true );
+
+    if ( first == last ) return false;
+
+    double dx  = side->endX - side->startX;
+    double dy  = side->endY - side->startY;
+    double len = hypot ( dx, dy );
+
+    double covered = 0.0;
+    for ( int i = first; i < last; i++ ) {
+        const sSegCoords *coords = &seg [ order [i]].coords;
+        double y1 = ( dx * ( coords->startY - side->startY ) - dy * ( coords->startX - side->startX )) / len;
+        double y2 = ( dx * ( coords->endY - side->startY ) - dy * ( coords->endX - side->startX )) / len;
+        if (( fabs ( y1 ) > REUSE_TOLERANCE ) || ( fabs ( y2 ) > REUSE_TOLERANCE )) return false;
+        double x1 = ( dx * ( coords->startX - side->startX ) + dy * ( coords->startY - side->startY )) / len;
+        double x2 = ( dx * ( coords->endX - side->startX ) + dy * ( coords->endY - side->startY )) / len;
+        if (( x1 < -REUSE_TOLERANCE ) || ( x2 > len + REUSE_TOLERANCE ) || ( x2 <= x1 )) return false;
+        if ((( BAM ) ( seg [ order [i]].angle - data->Data.angle + 1 )) > 2 ) return false;
+        if ( fabs ( x1 - seg [ order [i]].offset ) > REUSE_TOLERANCE + 0.5 ) return false;
+        covered += x2 - x1;
+    }
+
+    return ( fabs ( covered - len ) <= REUSE_TOLERANCE ) ? true : false;
+}
+
+//----------------------------------------------------------------------------
+//  Mark the new SEGs that don't match the old ones and return a list of the
+//    old SEGs that have been removed (ghosts).  LINEDEFs are often renumbered
+//    when one is deleted, so the old and new sides are matched up by their
+//    end points rather than by their LINEDEF numbers.  The number of new SEGs
+//    that have been added or changed and old sides that are gone are returned
+//    in noChanged & noRemoved.
+//----------------------------------------------------------------------------
+
+struct sSideKey {
+    int       x1, y1;
+    int       x2, y2;
+    int       seg;
+};
+
+static int SortBySide ( const void *ptr1, const void *ptr2 )
+{
+    FUNCTION_ENTRY ( NULL, "SortBySide", true );
+
+    const sSideKey *key1 = ( const sSideKey * ) ptr1;
+    const sSideKey *key2 = ( const sSideKey * ) ptr2;
+
+    if ( key1->x1 != key2->x1 ) return key1->x1 - key2->x1;
+    if ( key1->y1 != key2->y1 ) return key1->y1 - key2->y1;
+    if ( key1->x2 != key2->x2 ) return key1->x2 - key2->x2;
+
+    return key1->y2 - key2->y2;
+}
+
+sSegCoords *BSPBuilder::FindChanges ( int *segs, int noSegs, int *noGhosts, int *noChanged, int *noRemoved )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::FindChanges", true );
+
+    const sOldTree *old = m_OldTree;
+
+    // Sort the old SEGs by the side of the LINEDEF they were on
+    int noSides = 0;
+    for ( int i = 0; i < old->noSegs; i++ ) {
+        int key = 2 * old->seg [i].lineDef + old->seg [i].flip;
+        if ( key >= noSides ) noSides = key + 1;
+    }
+
+    int *first = new int [ noSides + 1 ];
+    int *next  = new int [ noSides ];
+    int *order = new int [ old->noSegs ];
+    memset ( first, 0, sizeof ( int ) * ( noSides + 1 ));
+
+    for ( int i = 0; i < old->noSegs; i++ ) {
+        first [ 2 * old->seg [i].lineDef + old->seg [i].flip + 1 ]++;
+    }
+    for ( int i = 0; i < noSides; i++ ) {
+        first [ i + 1 ] += first [i];
+    }
+    memcpy ( next, first, sizeof ( int ) * noSides );
+    for ( int i = 0; i < old->noSegs; i++ ) {
+        order [ next [ 2 * old->seg [i].lineDef + old->seg [i].flip ]++ ] = i;
+    }
+
+    // The new SEGs haven't been split yet, so they run from one end of a side to the other
+    sSideKey *keys = new sSideKey [ noSegs ];
+    for ( int i = 0; i < noSegs; i++ ) {
+        const sSegCoords *coords = Coords ( segs [i] );
+        keys [i].x1  = ( int ) coords->startX;
+        keys [i].y1  = ( int ) coords->startY;
+        keys [i].x2  = ( int ) coords->endX;
+        keys [i].y2  = ( int ) coords->endY;
+        keys [i].seg = segs [i];
+        Info ( segs [i] )->changed = true;
+    }
+    qsort ( keys, noSegs, sizeof ( sSideKey ), SortBySide );
+
+    sSegCoords *ghosts = new sSegCoords [ old->noSegs ];
+    int count = 0, removed = 0;
+
+    for ( int key = 0; key < noSides; key++ ) {
+
+        if ( first [key] == first [ key + 1 ] ) continue;
+
+        // The ends of an old side are the start of its first SEG & the end of its last one
+        const sOldSeg *start = &old->seg [ order [ first [key]]];
+        const sOldSeg *end   = start;
+        for ( int i = first [key] + 1; i < first [ key + 1 ]; i++ ) {
+            const sOldSeg *seg = &old->seg [ order [i]];
+            if ( seg->offset < start->offset ) start = seg;
+            if ( seg->offset > end->offset ) end = seg;
+        }
+
+        sSideKey side;
+        side.x1 = ( int ) start->coords.startX;
+        side.y1 = ( int ) start->coords.startY;
+        side.x2 = ( int ) end->coords.endX;
+        side.y2 = ( int ) end->coords.endY;
+
+        const sSideKey *match = ( const sSideKey * ) bsearch ( &side, keys, noSegs, sizeof ( sSideKey ), SortBySide );
+        if ( match != NULL ) {
+            int seg = match->seg;
+            if (( Info ( seg )->changed == true ) &&
+                ( SameSide ( Seg ( seg ), Coords ( seg ), old->seg, order, first [key], first [ key + 1 ] ) == true )) {
+                Info ( seg )->changed = false;
+                continue;
+            }
+        }
+
+        removed++;
+        for ( int i = first [key]; i < first [ key + 1 ]; i++ ) {
+            ghosts [ count++ ] = old->seg [ order [i]].coords;
+        }
+    }
+
+    int changed = 0;
+    for ( int i = 0; i < noSegs; i++ ) {
+        if ( Info ( segs [i] )->changed == true ) changed++;
+    }
+
+    delete [] keys;
+    delete [] order;
+    delete [] next;
+    delete [] first;
+
+    *noGhosts  = count;
+    *noChanged = changed;
+    *noRemoved = removed;
+
+    return ghosts;
+}
+
+//----------------------------------------------------------------------------
+//  Divide a list of ghosts by a partition line.  The old SEGs were never
+//    split by it, so any that seem to cross it belong to both sides.
+//----------------------------------------------------------------------------
+
+static void SortGhosts ( const sPartition *part, const sSegCoords *ghosts, int noGhosts, sSegCoords *left, int *noLeft, sSegCoords *right, int *noRight )
+{
+    FUNCTION_ENTRY ( NULL, "SortGhosts", true );
+
+    *noLeft  = 0;
+    *noRight = 0;
+
+    for ( int i = 0; i < noGhosts; i++ ) {
+        const sSegCoords *coords = &ghosts [i];
+        double y1 = part->DX * ( coords->startY - part->Y ) - part->DY * ( coords->startX - part->X );
+        double y2 = part->DX * ( coords->endY - part->Y ) - part->DY * ( coords->endX - part->X );
+        if (( y1 == 0.0 ) && ( y2 == 0.0 )) {
+            double x1 = part->DX * ( coords->startX - part->X ) + part->DY * ( coords->startY - part->Y );
+            double x2 = part->DX * ( coords->endX - part->X ) + part->DY * ( coords->endY - part->Y );
+            y1 = y2 = ( x1 <= x2 ) ? -1.0 : 1.0;
+        }
+        if (( y1 < 0.0 ) || ( y2 < 0.0 )) right [ (*noRight)++ ] = *coords;
+        if (( y1 > 0.0 ) || ( y2 > 0.0 )) left [ (*noLeft)++ ] = *coords;
+    }
+}
+
+//----------------------------------------------------------------------------
+//  Recursively create the NODEs below an old NODE (or SSECTOR if the high
+//    bit of oldNode is set).  Sides of the partition that end up with no SEGs
+//    at all are dropped, along with the NODE itself.  Returns NULL if there
+//    are no SEGs left.  The lists of SEGs and ghosts are deleted once they are
+//    no longer needed.
+//----------------------------------------------------------------------------
+
+sBSPNode *BSPBuilder::ReuseNode ( sBSPTask *task, int oldNode, int *segs, int noSegs, sSegCoords *ghosts, int noGhosts )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::ReuseNode", true );
+
+    if ( noSegs == 0 ) {
+        delete [] segs;
+        delete [] ghosts;
+        return NULL;
+    }
+
+    int noChanged = noGhosts;
+    for ( int i = 0; i < noSegs; i++ ) {
+        if ( Info ( segs [i] )->changed == true ) noChanged++;
+    }
+
+    if (( oldNode & 0x8000 ) || ( noChanged * REBUILD_SHARE >= noSegs )) {
+        delete [] ghosts;
+        return CreateNode ( task, segs, noSegs, 0.0 );
+    }
+
+    const wNode *old = &m_OldTree->node [ oldNode ];
+
+    sPartition part;
+    part.X            = old->x;
+    part.Y            = old->y;
+    part.DX           = old->dx;
+    part.DY           = old->dy;
+    part.H            = part.DX * part.DX + part.DY * part.DY;
+    part.exact        = true;
+    part.intX         = old->x;
+    part.intY         = old->y;
+    part.intDX        = old->dx;
+    part.intDY        = old->dy;
+    part.ANGLE        = 0;
+    part.currentAlias = 0;
+    part.currentSide  = NULL;
+
+    int noLeft, noRight;
+    int *lSegs, *rSegs;
+    wBound bound [2];
+    PartitionSegs ( task, &part, segs, noSegs, &lSegs, &noLeft, &rSegs, &noRight, bound );
+    delete [] segs;
+
+    int noLeftGhosts, noRightGhosts;
+    sSegCoords *lGhosts = new sSegCoords [ noGhosts ];
+    sSegCoords *rGhosts = new sSegCoords [ noGhosts ];
+    SortGhosts ( &part, ghosts, noGhosts, lGhosts, &noLeftGhosts, rGhosts, &noRightGhosts );
+    delete [] ghosts;
+
+    if ( task->showProgress ) GoRight ();
+
+    sBSPNode *right = ReuseNode ( task, old->child [0], rSegs, noRight, rGhosts, noRightGhosts );
+
+    if ( task->showProgress ) GoLeft ();
+
+    sBSPNode *left = ReuseNode ( task, old->child [1], lSegs, noLeft, lGhosts, noLeftGhosts );
+
+    if ( task->showProgress ) Backup ();
+
+    if (( right == NULL ) || ( left == NULL )) {
+        return ( right != NULL ) ? right : left;
+    }
+
+    m_ReusedNodes++;
+
+    sBSPNode *node = new sBSPNode;
+    node->data.x        = old->x;
+    node->data.y        = old->y;
+    node->data.dx       = old->dx;
+    node->data.dy       = old->dy;
+    node->data.side [0] = bound [0];
+    node->data.side [1] = bound [1];
+    node->child [0]     = right;
+    node->child [1]     = left;
+
+    if ( task->showProgress ) ShowDone ();
+
+    return node;
+}
+
+//----------------------------------------------------------------------------
+//  Join two fragments of the same side of a LINEDEF if one ends where the
+//    other starts.  The first SEG grows to cover both and keeps the offset of
+//    whichever one starts the combined SEG.
+//----------------------------------------------------------------------------
+
+bool BSPBuilder::JoinSegs ( int seg, int other )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::JoinSegs", true );
+
+    sSegCoords *first  = Coords ( seg );
+    sSegCoords *second = Coords ( other );
+
+    if (( first->endX == second->startX ) && ( first->endY == second->startY )) {
+        first->endX = second->endX;
+        first->endY = second->endY;
+        Seg ( seg )->endL = Seg ( other )->endL;
+        return true;
+    }
+
+    if (( first->startX == second->endX ) && ( first->startY == second->endY )) {
+        first->startX = second->startX;
+        first->startY = second->startY;
+        Seg ( seg )->startL      = Seg ( other )->startL;
+        Seg ( seg )->Data.offset = Seg ( other )->Data.offset;
+        return true;
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------
+//  Join the fragments of any LINEDEF that was split more often than it had to
+//    be.  The list must be sorted by SortByLineDef so that the fragments of
+//    each side are next to each other.  Returns the number of SEGs left.
+//----------------------------------------------------------------------------
+
+int BSPBuilder::MergeSegs ( int *segs, int noSegs )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::MergeSegs", true );
+
+    int count;
+
+    // Fragments can be listed in any order, so keep going until none are left
+    do {
+        count = 0;
+        for ( int i = 0; i < noSegs; i++ ) {
+            const wSegs *data = &Seg ( segs [i] )->Data;
+            bool joined = false;
+            for ( int j = count - 1; ( j >= 0 ) && ( joined == false ); j-- ) {
+                const wSegs *prev = &Seg ( segs [j] )->Data;
+                if (( prev->lineDef != data->lineDef ) || ( prev->flip != data->flip )) break;
+                joined = JoinSegs ( segs [j], segs [i] );
+            }
+            if ( joined == false ) segs [ count++ ] = segs [i];
+        }
+        if ( count == noSegs ) break;
+        noSegs = count;
+    } while ( count > 1 );
+
+    return count;
+}
+
+//----------------------------------------------------------------------------
+//  Replace any NODE whose children are both SSECTORs with a single SSECTOR if
+//    the SEGs of both are still convex together.  A normal build never leaves
+//    one of these, but the NODEs kept by ReuseNode can.  Any fragments of the
+//    same LINEDEF that end up side by side are joined again, so the vertices
+//    between them are never created.
+//----------------------------------------------------------------------------
+
+sBSPNode *BSPBuilder::MergeSSectors ( sBSPNode *node )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::MergeSSectors", true );
+
+    if ( node->child [0] == NULL ) return node;
+
+    sBSPNode *right = node->child [0] = MergeSSectors ( node->child [0] );
+    sBSPNode *left  = node->child [1] = MergeSSectors ( node->child [1] );
+
+    if (( right->child [0] != NULL ) || ( left->child [0] != NULL )) return node;
+
+    int noSegs = right->noSegs + left->noSegs;
+    int *segs  = new int [ noSegs ];
+
+    memcpy ( segs, right->segs, sizeof ( int ) * right->noSegs );
+    memcpy ( segs + right->noSegs, left->segs, sizeof ( int ) * left->noSegs );
+
+    SortByLineDef ( segs, noSegs );
+
+    if (( KeepUniqueSubsectors ( segs, noSegs ) == true ) || ( IsConvex ( segs, noSegs ) == false )) {
+        delete [] segs;
+        return node;
+    }
+
+    noSegs = MergeSegs ( segs, noSegs );
+
+    sBSPNode *ssector = CreateSSector ( segs, noSegs );
+
+    delete [] segs;
+    delete [] right->segs;
+    delete [] left->segs;
+    delete right;
+    delete left;
+    delete node;
+
+    return ssector;
+}
+
+//----------------------------------------------------------------------------
+//  Number the NODEs, SSECTORs, and new vertices in the same order they would
+//    have been created by a single recursive pass: right half first, with
+//    each NODE following both of its children.
+//----------------------------------------------------------------------------
+
+static int CountSegs ( const sBSPNode *node )
+{
+    FUNCTION_ENTRY ( NULL, "CountSegs", true );
+
+    if ( node->child [0] == NULL ) return node->noSegs;
+
+    return CountSegs ( node->child [0] ) + CountSegs ( node->child [1] );
+}
+
+static int CountSSectors ( const sBSPNode *node )
+{
+    FUNCTION_ENTRY ( NULL, "CountSSectors", true );
+
+    if ( node->child [0] == NULL ) return 1;
+
+    return CountSSectors ( node->child [0] ) + CountSSectors ( node->child [1] );
+}
+
+UINT32 BSPBuilder::StoreNode ( sBSPNode *node )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::StoreNode", true );
+
+    if ( node->child [0] == NULL ) {
+        UINT32 ssector = StoreSSector ( node );
+        delete [] node->segs;
+        delete node;
+        return NF_SUBSECTOR_EX | ssector;
+    }
+
+    if ( m_GLNodes == true ) PushGLClip ( &node->data, 0 );
+    UINT32 rNode = StoreNode ( node->child [0] );
+    if ( m_GLNodes == true ) {
+        m_GLDepth--;
+        PushGLClip ( &node->data, 1 );
+    }
+    UINT32 lNode = StoreNode ( node->child [1] );
+    if ( m_GLNodes == true ) m_GLDepth--;
+
+    wNodeEx *wnode = &m_NodePool [m_NodeCount];
+    wnode->x         = node->data.x;
+    wnode->y         = node->data.y;
+    wnode->dx        = node->data.dx;
+    wnode->dy        = node->data.dy;
+    wnode->side [0]  = node->data.side [0];
+    wnode->side [1]  = node->data.side [1];
+    wnode->child [0] = rNode;
+    wnode->child [1] = lNode;
+
+    delete node;
+
+    return m_NodeCount++;
+}
+
+//----------------------------------------------------------------------------
+//  The original lumps use 16-bit indices, and the high bit of a NODE's child
+//    marks a SSECTOR.
+//----------------------------------------------------------------------------
+
+bool BSPBuilder::FitsVanilla () const
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::FitsVanilla", true );
+
+    if ( m_NoFixedVertices != 0 ) return false;
+
+    return ( m_NodeCount <= 0x7FFF ) && ( m_SSectorCount <= 0x7FFF ) && ( m_SegCount <= 0xFFFF ) && ( m_NoVertices <= 0xFFFF );
+}
 
-    *noLeft  = count [0];
-    *noRight = count [2];
+wNode *BSPBuilder::GetNodes ( wNodeEx *nodeList, int noNodes )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::GetNodes", true );
 
-    SEG *rSeg = seg;
-    for ( i = 0; seg [i].Side == SIDE_RIGHT; i++ ) rSeg++;
+    wNode *nodes = new wNode [ noNodes ];
 
-    if (( i < count [2] ) || count [1] ) {
-        SEG *sSeg = tempSeg;
-        SEG *lSeg = sSeg + count [1];
-        for ( ; i < noSegs; i++ ) {
-            switch ( seg [i].Side ) {
-                case SIDE_LEFT  : *lSeg++ = seg [i];		break;
-                case SIDE_SPLIT : *sSeg++ = seg [i];		break;
-                case SIDE_RIGHT : *rSeg++ = seg [i];		break;
-            }
+    for ( int i = 0; i < noNodes; i++ ) {
+        nodes [i].x        = nodeList [i].x;
+        nodes [i].y        = nodeList [i].y;
+        nodes [i].dx       = nodeList [i].dx;
+        nodes [i].dy       = nodeList [i].dy;
+        nodes [i].side [0] = nodeList [i].side [0];
+        nodes [i].side [1] = nodeList [i].side [1];
+        for ( int j = 0; j < 2; j++ ) {
+            UINT32 child = nodeList [i].child [j];
+            nodes [i].child [j] = ( UINT16 ) (( child & NF_SUBSECTOR_EX ) ? 0x8000 | ( child & ~NF_SUBSECTOR_EX ) : child );
         }
-        memcpy ( rSeg, tempSeg, ( noSegs - count [2] ) * sizeof ( SEG ));
     }
 
-    if ( count [1] != 0 ) {
-        SplitSegs ( &seg [ *noRight ], count [1] );
-        *noLeft  += count [1];
-        *noRight += count [1];
-    }
-
-    return;
+    return nodes;
 }
 
-//----------------------------------------------------------------------------
-//  Use the requested algorithm to select a partition for the list of SEGs.
-//    After a valid partition is selected, the SEGs are re-ordered.  All SEGs
-//    to the right of the partition are placed first, then those that will
-//    be split, followed by those that are to the left.
-//----------------------------------------------------------------------------
-
-static bool ChoosePartition ( SEG *seg, int noSegs, int *noLeft, int *noRight )
+wSSector *BSPBuilder::GetSSectors ( wSSectorEx *ssectorList, int noSSectors )
 {
-    FUNCTION_ENTRY ( NULL, "ChoosePartition", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::GetSSectors", true );
 
-    bool check = true;
+    // The SEGs were copied to m_FinalSegs as each SSECTOR was stored
 
-retry:
+    wSSector *ssector = new wSSector [ noSSectors ];
 
-    if ( seg->final == false ) {
-        memcpy ( lineChecked, lineUsed, sizeof ( char ) * noAliases );
-    } else {
-        memset ( lineChecked, 0, sizeof ( char ) * noAliases );
+    for ( int i = 0; i < noSSectors; i++ ) {
+        ssector [i].num   = ( UINT16 ) ssectorList [i].num;
+        ssector [i].first = ( UINT16 ) ssectorList [i].first;
     }
 
-    // Find the best SEG to be used as a partition
-    SEG *pSeg = PartitionFunction ( seg, noSegs );
+    return ssector;
+}
 
-    // Resort the SEGS (right followed by left) and do the splits as necessary
-    SortSegs ( pSeg, seg, noSegs, noLeft, noRight );
+wSegs *BSPBuilder::GetSegs ()
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::GetSegs", true );
 
-    // Make sure the set of SEGs is still convex after we convert to integer coordinates
-    if (( pSeg == NULL ) && ( check == true )) {
-        check = false;
-        double error = 0.0;
-        for ( int i = 0; i < noSegs; i++ ) {
+    // The list of wSegsEx is filled in by StoreSSector
 
-            int startX = lrint ( seg [i].start.x );
-            int startY = lrint ( seg [i].start.y );
-            int endX   = lrint ( seg [i].end.x );
-            int endY   = lrint ( seg [i].end.y );
-                          
-            error += fabs ( seg [i].start.x - startX );
-            error += fabs ( seg [i].start.y - startY );
-            error += fabs ( seg [i].end.x - endX );
-            error += fabs ( seg [i].end.y - endY );
+    wSegs *segs = new wSegs [ m_SegCount ];
 
-            seg [i].start.x = startX;
-            seg [i].start.y = startY;
-            seg [i].end.x   = endX;
-            seg [i].end.y   = endY;
-            seg [i].final   = true;
-        }
-        if ( error > EPSILON ) {
-            // Force a check of each line
-            goto retry;
-        }
+    for ( int i = 0; i < m_SegCount; i++ ) {
+        segs [i].start   = ( UINT16 ) m_FinalSegs [i].start;
+        segs [i].end     = ( UINT16 ) m_FinalSegs [i].end;
+        segs [i].angle   = m_FinalSegs [i].angle;
+        segs [i].lineDef = m_FinalSegs [i].lineDef;
+        segs [i].flip    = m_FinalSegs [i].flip;
+        segs [i].offset  = m_FinalSegs [i].offset;
     }
 
-    return pSeg ? true : false;
+    return segs;
 }
 
-//----------------------------------------------------------------------------
-//  ALGORITHM 1: 'ZenNode Classic'
-//    This is the original algorithm used by ZenNode.  It simply attempts
-//    to minimize the number of SEGs that are split.  This actually yields
-//    very small BSP trees, but usually results in trees that are not well
-//    balanced and run deep.
-//----------------------------------------------------------------------------
-
-static SEG *Algorithm1 ( SEG *segs, int noSegs )
+static inline void AddGLBounds ( wBound *bound, const wVertex *vertex, const wVertexEx *glVertex, UINT32 index )
 {
-    FUNCTION_ENTRY ( NULL, "Algorithm1", true );
+    int loX, hiX, loY, hiY;
+    if ( index & GL_VERTEX ) {
+        const wVertexEx *v = &glVertex [ index & ~GL_VERTEX ];
+        loX = ( int ) floor ( v->x / 65536.0 );
+        hiX = ( int ) ceil ( v->x / 65536.0 );
+        loY = ( int ) floor ( v->y / 65536.0 );
+        hiY = ( int ) ceil ( v->y / 65536.0 );
+    } else {
+        loX = hiX = vertex [index].x;
+        loY = hiY = vertex [index].y;
+    }
 
-    SEG *pSeg = NULL, *testSeg = segs;
-    int count [3];
-    int &lCount = count [0], &sCount = count [1], &rCount = count [2];
-    // Compute the maximum value maxMetric can possibly reach
-    long maxMetric = ( noSegs / 2 ) * ( noSegs - noSegs / 2 );
-    long bestMetric = LONG_MIN, bestSplits = LONG_MAX;
+    if ( loX < bound->minx ) bound->minx = ( INT16 ) loX;
+    if ( hiX > bound->maxx ) bound->maxx = ( INT16 ) hiX;
+    if ( loY < bound->miny ) bound->miny = ( INT16 ) loY;
+    if ( hiY > bound->maxy ) bound->maxy = ( INT16 ) hiY;
+}
 
-    for ( int i = 0; i < noSegs; i++ ) {
-        if ( showProgress && (( i & 15 ) == 0 )) ShowProgress ();
-        int alias = testSeg->Split ? 0 : lineDefAlias [ testSeg->Data.lineDef ];
-        if (( alias == 0 ) || ( lineChecked [ alias ] == false )) {
-            lineChecked [ alias ] = -1;
-            count [0] = count [1] = count [2] = 0;
-            ComputeStaticVariables ( testSeg );
-            if (( fabs ( DX ) < EPSILON ) && ( fabs ( DY ) < EPSILON )) goto next;
-            if ( bestMetric < 0 ) for ( int j = 0; j < noSegs; j++ ) {
-                count [ WhichSide ( &segs [j] ) + 1 ]++;
-            } else for ( int j = 0; j < noSegs; j++ ) {
-                count [ WhichSide ( &segs [j] ) + 1 ]++;
-                if ( sCount > bestSplits ) goto next;
-            }
+//----------------------------------------------------------------------------
+//  The GL NODES are the same as the NODES, but minisegs can reach past the
+//    SEGs so the bounding boxes have to be found again.  The children of each
+//    NODE are stored before it.  The NODES returned are in the arena.
+//----------------------------------------------------------------------------
 
-            // Only consider SEG if it is not a boundary line
-            if ( lCount * rCount + sCount != 0 ) {
-                long metric = ( long ) lCount * ( long ) rCount;
-                if ( sCount ) {
-                    long temp = X1 * sCount;
-                    if ( X2 < temp ) metric = X2 * metric / temp;
-                    metric -= ( X3 * sCount + X4 ) * sCount;
-                }
-                if ( ANGLE & 0x3FFF ) metric--;
-                if ( metric == maxMetric ) return testSeg;
-                if ( metric > bestMetric ) {
-                    pSeg       = testSeg;
-                    bestSplits = sCount + 2;
-                    bestMetric = metric;
-                }
-            } else if ( alias != 0 ) {
-                // Eliminate outer edges of the map from here & down
-                *convexPtr++ = alias;
-            }
-        }
-#if defined ( DEBUG )
-        else if ( lineChecked [alias] > 0 ) {
-            count [0] = count [1] = count [2] = 0;
-            ComputeStaticVariables ( testSeg );
-            int side = WhichSide ( testSeg );
-            if (( fabs ( DX ) < EPSILON ) && ( fabs ( DY ) < EPSILON )) continue;
-            for ( int j = 0; j < noSegs; j++ ) {
-                switch ( WhichSide ( &segs [j] )) {
-                    case SIDE_LEFT :
-                        if ( side == SIDE_RIGHT ) {
-                            WARNING ( "lineDef " << segs [j].Data.lineDef << " should not to the left of lineDef " << testSeg->Data.lineDef );
-                        }
-                        break;
-                    case SIDE_SPLIT :
-                        WARNING ( "lineDef " << segs [j].Data.lineDef << " should not be split by lineDef " << testSeg->Data.lineDef );
-                        break;
-                    case SIDE_RIGHT :
-                        if ( side == SIDE_LEFT ) {
-                            WARNING ( "lineDef " << segs [j].Data.lineDef << " should not to the right of lineDef " << testSeg->Data.lineDef );
-                        }
-                        break;
-                    default :
-                        break;
-                }
-            }
+wNodeEx *BSPBuilder::GetGLNodes ()
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::GetGLNodes", true );
+
+    wNodeEx *nodes = ( wNodeEx * ) m_Arena->Allocate ( sizeof ( wNodeEx ) * ( m_NodeCount + 1 ));
+
+    size_t mark = m_Arena->Mark ();
+    wBound *ssectorBound = ( wBound * ) m_Arena->Allocate ( sizeof ( wBound ) * ( m_SSectorCount + 1 ));
+    for ( int i = 0; i < m_SSectorCount; i++ ) {
+        ClearBounds ( &ssectorBound [i] );
+        const wGLSegsEx *seg = &m_GLSegs [ m_GLSSectorPool [i].first ];
+        for ( UINT32 j = 0; j < m_GLSSectorPool [i].num; j++ ) {
+            AddGLBounds ( &ssectorBound [i], m_NewVertices, m_GLVertex, seg [j].start );
+            AddGLBounds ( &ssectorBound [i], m_NewVertices, m_GLVertex, seg [j].end );
         }
-#endif
+    }
 
-next:
-        testSeg++;
+    wBound *nodeBound = ( wBound * ) m_Arena->Allocate ( sizeof ( wBound ) * ( m_NodeCount + 1 ));
+    for ( int i = 0; i < m_NodeCount; i++ ) {
+        nodes [i] = m_NodePool [i];
+        ClearBounds ( &nodeBound [i] );
+        for ( int j = 0; j < 2; j++ ) {
+            UINT32 child = nodes [i].child [j];
+            wBound *bound = ( child & NF_SUBSECTOR_EX ) ? &ssectorBound [ child & ~NF_SUBSECTOR_EX ] : &nodeBound [child];
+            nodes [i].side [j] = *bound;
+            if ( bound->minx < nodeBound [i].minx ) nodeBound [i].minx = bound->minx;
+            if ( bound->maxx > nodeBound [i].maxx ) nodeBound [i].maxx = bound->maxx;
+            if ( bound->miny < nodeBound [i].miny ) nodeBound [i].miny = bound->miny;
+            if ( bound->maxy > nodeBound [i].maxy ) nodeBound [i].maxy = bound->maxy;
+        }
     }
 
-    return pSeg;
+    m_Arena->Release ( mark );
+
+    return nodes;
 }
 
 //----------------------------------------------------------------------------
-//  ALGORITHM 2: 'ZenNode Quality'
-//    This is the 2nd algorithm used by ZenNode.  It attempts to keep the
-//    resulting BSP tree balanced based on the number of sectors on each side of
-//    the partition line in addition to the number of SEGs.  This seems more
-//    reasonable since a given SECTOR is usually made up of one or more SSECTORS.
+//  Drop the empty GL SSECTORs left by StoreGLSSector.  A GL NODE with one as
+//    a child is replaced by its other child.  The GL NODEs & SSECTORs that are
+//    left keep their order, except that the root is moved to the end if it
+//    changed.  Returns the number of GL NODEs left.
 //----------------------------------------------------------------------------
 
-int sortTotalMetric ( const void *ptr1, const void *ptr2 )
+#define GL_NO_CHILD             0xFFFFFFFFUL
+
+static UINT32 PruneGLNode ( wNodeEx *nodes, const wSSectorEx *ssector, bool *keep, UINT32 child )
 {
-    FUNCTION_ENTRY ( NULL, "sortTotalMetric", true );
+    FUNCTION_ENTRY ( NULL, "PruneGLNode", true );
 
-    int dif;
-    dif = (( sScoreInfo * ) ptr1)->invalid - (( sScoreInfo * ) ptr2)->invalid;
-    if ( dif ) return dif;
-    dif = (( sScoreInfo * ) ptr1)->total - (( sScoreInfo * ) ptr2)->total;
-    if ( dif ) return dif;
-    dif = (( sScoreInfo * ) ptr1)->index - (( sScoreInfo * ) ptr2)->index;
-    return dif;
-}
+    if ( child & NF_SUBSECTOR_EX ) {
+        return ( ssector [ child & ~NF_SUBSECTOR_EX ].num > 0 ) ? child : GL_NO_CHILD;
+    }
 
-int sortMetric1 ( const void *ptr1, const void *ptr2 )
-{
-    FUNCTION_ENTRY ( NULL, "sortMetric1", true );
+    wNodeEx *node = &nodes [child];
+    UINT32 right = PruneGLNode ( nodes, ssector, keep, node->child [0] );
+    UINT32 left  = PruneGLNode ( nodes, ssector, keep, node->child [1] );
 
-    if ((( sScoreInfo * ) ptr2)->metric1 < (( sScoreInfo * ) ptr1)->metric1 ) return -1;
-    if ((( sScoreInfo * ) ptr2)->metric1 > (( sScoreInfo * ) ptr1)->metric1 ) return  1;
-    if ((( sScoreInfo * ) ptr2)->metric2 < (( sScoreInfo * ) ptr1)->metric2 ) return -1;
-    if ((( sScoreInfo * ) ptr2)->metric2 > (( sScoreInfo * ) ptr1)->metric2 ) return  1;
-    return (( sScoreInfo * ) ptr1)->index - (( sScoreInfo * ) ptr2)->index;
-}
+    if ( right == GL_NO_CHILD ) return left;
+    if ( left == GL_NO_CHILD ) return right;
 
-int sortMetric2 ( const void *ptr1, const void *ptr2 )
-{
-    FUNCTION_ENTRY ( NULL, "sortMetric2", true );
+    node->child [0] = right;
+    node->child [1] = left;
+    keep [child] = true;
 
-    if ((( sScoreInfo * ) ptr2)->metric2 < (( sScoreInfo * ) ptr1)->metric2 ) return -1;
-    if ((( sScoreInfo * ) ptr2)->metric2 > (( sScoreInfo * ) ptr1)->metric2 ) return  1;
-    if ((( sScoreInfo * ) ptr2)->metric1 < (( sScoreInfo * ) ptr1)->metric1 ) return -1;
-    if ((( sScoreInfo * ) ptr2)->metric1 > (( sScoreInfo * ) ptr1)->metric1 ) return  1;
-    return (( sScoreInfo * ) ptr1)->index - (( sScoreInfo * ) ptr2)->index;
+    return child;
 }
 
-static SEG *Algorithm2 ( SEG *segs, int noSegs )
+int BSPBuilder::PruneGLNodes ( wNodeEx *nodes, int *noSSectors )
 {
-    FUNCTION_ENTRY ( NULL, "Algorithm2", true );
-
-    SEG *testSeg = segs;
-    int count [3], noScores = 0, rank, i;
-    int &lCount = count [0], &sCount = count [1], &rCount = count [2];
+    FUNCTION_ENTRY ( this, "BSPBuilder::PruneGLNodes", true );
 
-    memset ( score, -1, sizeof ( sScoreInfo ) * noAliases );
-    score [0].index = 0;
-
-    for ( i = 0; i < noSegs; i++ ) {
-        if ( showProgress && (( i & 15 ) == 0 )) ShowProgress ();
-        int alias = testSeg->Split ? 0 : lineDefAlias [ testSeg->Data.lineDef ];
-        if (( alias == 0 ) || ( lineChecked [ alias ] == false )) {
-            lineChecked [ alias ] = -1;
-            count [0] = count [1] = count [2] = 0;
-            ComputeStaticVariables ( testSeg );
-            if (( fabs ( DX ) < EPSILON ) && ( fabs ( DY ) < EPSILON )) goto next;
-            sScoreInfo *curScore = &score [noScores];
-            curScore->invalid = 0;
-            memset ( usedSector, 0, sizeof ( UINT8 ) * sectorCount );
-            SEG *destSeg = segs;
-            for ( int j = 0; j < noSegs; j++, destSeg++ ) {
-                switch ( WhichSide ( destSeg )) {
-                    case SIDE_LEFT  : lCount++; usedSector [ destSeg->Sector ] |= 0xF0;	break;
-                    case SIDE_SPLIT : if ( destSeg->DontSplit ) curScore->invalid++;
-                                      sCount++; usedSector [ destSeg->Sector ] |= 0xFF;	break;
-                    case SIDE_RIGHT : rCount++; usedSector [ destSeg->Sector ] |= 0x0F;	break;
-                }
-            }
-            // Only consider SEG if it is not a boundary line
-            if ( lCount * rCount + sCount ) {
-                int lsCount = 0, rsCount = 0, ssCount = 0;
-                for ( int j = 0; j < sectorCount; j++ ) {
-                    switch ( usedSector [j] ) {
-                        case 0xF0 : lsCount++;	break;
-                        case 0xFF : ssCount++;	break;
-                        case 0x0F : rsCount++;	break;
-                    }
-                }
+    *noSSectors = m_SSectorCount;
+    if ( m_NodeCount == 0 ) return 0;
 
-                curScore->index = i;
-                curScore->metric1 = ( long ) ( lCount + sCount ) * ( long ) ( rCount + sCount );
-                curScore->metric2 = ( long ) ( lsCount + ssCount ) * ( long ) ( rsCount + ssCount );
+    size_t mark = m_Arena->Mark ();
 
-                if ( sCount ) {
-                    long temp = X1 * sCount;
-                    if ( X2 < temp ) curScore->metric1 = X2 * curScore->metric1 / temp;
-                    curScore->metric1 -= ( X3 * sCount + X4 ) * sCount;
-                }
-                if ( ssCount ) {
-                    long temp = X1 * ssCount;
-                    if ( X2 < temp ) curScore->metric2 = X2 * curScore->metric2 / temp;
-                    curScore->metric2 -= ( X3 * ssCount + X4 ) * sCount;
-                }
+    bool *keep = ( bool * ) m_Arena->Allocate ( sizeof ( bool ) * m_NodeCount );
+    memset ( keep, false, sizeof ( bool ) * m_NodeCount );
 
-                noScores++;
-            } else if ( alias != 0 ) {
-                // Eliminate outer edges of the map
-                *convexPtr++ = alias;
-            }
-        }
-#if defined ( DEBUG )
-        else if ( lineChecked [alias] > 0 ) {
-            count [0] = count [1] = count [2] = 0;
-            ComputeStaticVariables ( testSeg );
-            int side = WhichSide ( testSeg );
-            if (( fabs ( DX ) < EPSILON ) && ( fabs ( DY ) < EPSILON )) continue;
-            for ( int j = 0; j < noSegs; j++ ) {
-                switch ( WhichSide ( &segs [j] )) {
-                    case SIDE_LEFT :
-                        if ( side == SIDE_RIGHT ) {
-                            WARNING ( "lineDef " << segs [j].Data.lineDef << " should not to the left of lineDef " << testSeg->Data.lineDef );
-                        }
-                        break;
-                    case SIDE_SPLIT :
-                        WARNING ( "lineDef " << segs [j].Data.lineDef << " should not be split by lineDef " << testSeg->Data.lineDef );
-                        break;
-                    case SIDE_RIGHT :
-                        if ( side == SIDE_LEFT ) {
-                            WARNING ( "lineDef " << segs [j].Data.lineDef << " should not to the right of lineDef " << testSeg->Data.lineDef );
-                        }
-                        break;
-                    default :
-                        break;
-                }
-            }
-        }
-#endif
+    UINT32 root = PruneGLNode ( nodes, m_GLSSectorPool, keep, m_NodeCount - 1 );
 
-next:
-        testSeg++;
+    int *ssectorNumber = ( int * ) m_Arena->Allocate ( sizeof ( int ) * m_SSectorCount );
+    int noLeft = 0;
+    for ( int i = 0; i < m_SSectorCount; i++ ) {
+        ssectorNumber [i] = noLeft;
+        if ( m_GLSSectorPool [i].num > 0 ) m_GLSSectorPool [ noLeft++ ] = m_GLSSectorPool [i];
     }
+    *noSSectors = noLeft;
 
-    if ( noScores > 1 ) {
-        qsort ( score, noScores, sizeof ( sScoreInfo ), sortMetric1 );
-        for ( rank = i = 0; i < noScores; i++ ) {
-            score [i].total = rank;
-            if ( score [i].metric1 != score [i+1].metric1 ) rank++;
-        }
-        qsort ( score, noScores, sizeof ( sScoreInfo ), sortMetric2 );
-        for ( rank = i = 0; i < noScores; i++ ) {
-            score [i].total += rank;
-            if ( score [i].metric2 != score [i+1].metric2 ) rank++;
+    int *nodeNumber = ( int * ) m_Arena->Allocate ( sizeof ( int ) * m_NodeCount );
+    int noNodes = 0;
+    for ( int i = 0; i < m_NodeCount; i++ ) {
+        if (( keep [i] == true ) && (( UINT32 ) i != root )) nodeNumber [i] = noNodes++;
+    }
+    if (( root & NF_SUBSECTOR_EX ) == 0 ) nodeNumber [root] = noNodes++;
+
+    wNodeEx *temp = ( wNodeEx * ) m_Arena->Allocate ( sizeof ( wNodeEx ) * m_NodeCount );
+    memcpy ( temp, nodes, sizeof ( wNodeEx ) * m_NodeCount );
+
+    for ( int i = 0; i < m_NodeCount; i++ ) {
+        if ( keep [i] == false ) continue;
+        wNodeEx *node = &nodes [ nodeNumber [i]];
+        *node = temp [i];
+        for ( int j = 0; j < 2; j++ ) {
+            UINT32 child = node->child [j];
+            node->child [j] = ( child & NF_SUBSECTOR_EX ) ? NF_SUBSECTOR_EX | ssectorNumber [ child & ~NF_SUBSECTOR_EX ] : nodeNumber [child];
         }
-        qsort ( score, noScores, sizeof ( sScoreInfo ), sortTotalMetric );
     }
 
-    if ( noScores && score [0].invalid ) {
-        int noBad = 0;
-        for ( int i = 0; i < noScores; i++ ) if ( score [i].invalid ) noBad++;
-        WARNING ( "Non-splittable linedefs have been split! ("<< noBad << "/" << noScores << ")" );
-    }
+    m_Arena->Release ( mark );
 
-    SEG *pSeg = noScores ? &segs [ score [0].index ] : NULL;
-    return pSeg;
+    return noNodes;
 }
 
 //----------------------------------------------------------------------------
-//  ALGORITHM 3: 'ZenNode Lite'
-//    This is a modified version of the original algorithm used by ZenNode.
-//    It uses the same logic for picking the partition, but only looks at the
-//    first 30 segs for a valid partition.  If none is found, the search is
-//    continued until one is found or all segs have been searched.
+//  StoreNode leaves each NODE after both of its children, so the NODEs on
+//    the way down to a SSECTOR can be far apart.  Engines only need the root
+//    to be last, so the NODES can be renumbered to keep the NODEs that are
+//    read together close to each other.  The layouts below are built root
+//    first and reversed when the NODES are renumbered.
+//
+//    NODE_ORDER_HOT - depth first, following the child with the most NODEs
+//                     first, so the longest paths are contiguous
+//    NODE_ORDER_VEB - van Emde Boas: the NODEs at the top of the tree (those
+//                     with more than sqrt(N) NODEs below them), then each
+//                     of the subtrees left below them, all laid out the
+//                     same way
 //----------------------------------------------------------------------------
 
-static SEG *Algorithm3 ( SEG *segs, int noSegs )
+#define CACHE_LINE_SIZE         64
+
+static int LayoutHot ( const wNodeEx *nodes, const int *size, int root, int *order, int *stack )
 {
-    FUNCTION_ENTRY ( NULL, "Algorithm3", true );
+    FUNCTION_ENTRY ( NULL, "LayoutHot", true );
+
+    int count = 0;
+    int depth = 0;
+    stack [depth++] = root;
+
+    while ( depth > 0 ) {
+        int node = stack [--depth];
+        order [count++] = node;
+        UINT32 child0 = nodes [node].child [0];
+        UINT32 child1 = nodes [node].child [1];
+        int size0 = ( child0 & NF_SUBSECTOR_EX ) ? 0 : size [child0];
+        int size1 = ( child1 & NF_SUBSECTOR_EX ) ? 0 : size [child1];
+        // The bigger child goes on the stack last so it comes off first
+        if ( size0 < size1 ) {
+            if ( size0 != 0 ) stack [depth++] = child0;
+            stack [depth++] = child1;
+        } else {
+            if ( size1 != 0 ) stack [depth++] = child1;
+            if ( size0 != 0 ) stack [depth++] = child0;
+        }
+    }
 
-    SEG *pSeg = NULL, *testSeg = segs;
-    int count [3];
-    int &lCount = count [0], &sCount = count [1], &rCount = count [2];
-    // Compute the maximum value maxMetric can possibly reach
-    long maxMetric = ( long ) ( noSegs / 2 ) * ( long ) ( noSegs - noSegs / 2 );
-    long bestMetric = LONG_MIN, bestSplits = LONG_MAX;
+    return count;
+}
 
-    int i = 0, max = ( noSegs < 30 ) ? noSegs : 30;
+struct sVEBLayout {
+    BSPArena       *arena;
+    const wNodeEx  *nodes;
+    int            *piece;			// the piece of the tree each NODE is in
+    int            *member;			// scratch list of the NODEs in a piece
+    int            *size;			// scratch NODE counts
+    int            *order;
+    int             count;
+    int             noPieces;
+};
 
-retry:
+//----------------------------------------------------------------------------
+//  Lay out the NODEs below root that are in the same piece of the tree.  The
+//    top of the piece is moved to a new piece, and the subtrees left below it
+//    stay in the old one.
+//----------------------------------------------------------------------------
 
-    for ( ; i < max; i++ ) {
-        if ( showProgress && (( i & 15 ) == 0 )) ShowProgress ();
-        int alias = testSeg->Split ? 0 : lineDefAlias [ testSeg->Data.lineDef ];
-        if (( alias == 0 ) || ( lineChecked [ alias ] == false )) {
-            lineChecked [ alias ] = -1;
-            count [0] = count [1] = count [2] = 0;
-            ComputeStaticVariables ( testSeg );
-            if (( fabs ( DX ) < EPSILON ) && ( fabs ( DY ) < EPSILON )) goto next;
-            if ( bestMetric < 0 ) for ( int j = 0; j < noSegs; j++ ) {
-                count [ WhichSide ( &segs [j] ) + 1 ]++;
-            } else for ( int j = 0; j < noSegs; j++ ) {
-                count [ WhichSide ( &segs [j] ) + 1 ]++;
-                if ( sCount > bestSplits ) goto next;
-            }
-            if ( lCount * rCount + sCount ) {
-                long metric = ( long ) lCount * ( long ) rCount;
-                if ( sCount ) {
-                    long temp = X1 * sCount;
-                    if ( X2 < temp ) metric = X2 * metric / temp;
-                    metric -= ( X3 * sCount + X4 ) * sCount;
-                }
-                if ( ANGLE & 0x3FFF ) metric--;
-                if ( metric == maxMetric ) return testSeg;
-                if ( metric > bestMetric ) {
-                    pSeg = testSeg;
-                    bestSplits = sCount;
-                    bestMetric = metric;
-                }
-            } else if ( alias != 0 ) {
-                // Eliminate outer edges of the map from here & down
-                *convexPtr++ = alias;
-            }
+static void LayoutVEB ( sVEBLayout *layout, int root )
+{
+    FUNCTION_ENTRY ( NULL, "LayoutVEB", true );
+
+    const wNodeEx *nodes = layout->nodes;
+    int *piece  = layout->piece;
+    int *member = layout->member;
+    int *size   = layout->size;
+    int id      = piece [root];
+
+    // Parents are listed before their children
+    int noMembers = 0;
+    member [noMembers++] = root;
+    for ( int i = 0; i < noMembers; i++ ) {
+        for ( int j = 0; j < 2; j++ ) {
+            UINT32 child = nodes [ member [i]].child [j];
+            if ((( child & NF_SUBSECTOR_EX ) == 0 ) && ( piece [child] == id )) member [noMembers++] = child;
         }
-#if defined ( DEBUG )
-        else if ( lineChecked [alias] > 0 ) {
-            count [0] = count [1] = count [2] = 0;
-            ComputeStaticVariables ( testSeg );
-            int side = WhichSide ( testSeg );
-            if (( fabs ( DX ) < EPSILON ) && ( fabs ( DY ) < EPSILON )) continue;
-            for ( int j = 0; j < noSegs; j++ ) {
-                switch ( WhichSide ( &segs [j] )) {
-                    case SIDE_LEFT :
-                        if ( side == SIDE_RIGHT ) {
-                            WARNING ( "lineDef " << segs [j].Data.lineDef << " should not to the left of lineDef " << testSeg->Data.lineDef );
-                        }
-                        break;
-                    case SIDE_SPLIT :
-                        WARNING ( "lineDef " << segs [j].Data.lineDef << " should not be split by lineDef " << testSeg->Data.lineDef );
-                        break;
-                    case SIDE_RIGHT :
-                        if ( side == SIDE_LEFT ) {
-                            WARNING ( "lineDef " << segs [j].Data.lineDef << " should not to the right of lineDef " << testSeg->Data.lineDef );
-                        }
-                        break;
-                    default :
-                        break;
-                }
-            }
+    }
+
+    if ( noMembers <= 3 ) {
+        for ( int i = 0; i < noMembers; i++ ) {
+            layout->order [ layout->count++ ] = member [i];
         }
-#endif
+        return;
+    }
 
-next:
-        testSeg++;
+    for ( int i = noMembers - 1; i >= 0; i-- ) {
+        size [ member [i]] = 1;
+        for ( int j = 0; j < 2; j++ ) {
+            UINT32 child = nodes [ member [i]].child [j];
+            if ((( child & NF_SUBSECTOR_EX ) == 0 ) && ( piece [child] == id )) size [ member [i]] += size [child];
+        }
     }
 
-    if (( pSeg == NULL ) && ( max < noSegs )) {
-        max += 5;
-        if ( max > noSegs ) max = noSegs;
-        goto retry;
+    // The root is always at the top since sqrt(N) < N
+    double limit = sqrt (( double ) noMembers );
+    int top = layout->noPieces++;
+
+    size_t mark = layout->arena->Mark ();
+    int *bottom = ( int * ) layout->arena->Allocate ( sizeof ( int ) * noMembers );
+    int noBottoms = 0;
+
+    for ( int i = 0; i < noMembers; i++ ) {
+        int node = member [i];
+        if ( size [node] <= limit ) continue;
+        for ( int j = 0; j < 2; j++ ) {
+            UINT32 child = nodes [node].child [j];
+            if ((( child & NF_SUBSECTOR_EX ) == 0 ) && ( piece [child] == id ) && ( size [child] <= limit )) bottom [noBottoms++] = child;
+        }
+    }
+    for ( int i = 0; i < noMembers; i++ ) {
+        if ( size [ member [i]] > limit ) piece [ member [i]] = top;
     }
 
-    return pSeg;
-}
+    LayoutVEB ( layout, root );
+    for ( int i = 0; i < noBottoms; i++ ) {
+        LayoutVEB ( layout, bottom [i] );
+    }
 
-//----------------------------------------------------------------------------
-//  Check to see if the list of segs contains more than one sector and at least
-//    one of them requires "unique subsectors".
-//----------------------------------------------------------------------------
+    layout->arena->Release ( mark );
+}
 
-static bool KeepUniqueSubsectors ( SEG *segs, int noSegs )
+// Add up the cache lines read on the way from a NODE to each of its SSECTORs
+static void CountCacheLines ( const wNodeEx *nodes, UINT32 index, int size, int *line, int noLines, double *total, int *noSSectors )
 {
-    FUNCTION_ENTRY ( NULL, "KeepUniqueSubsectors", true );
+    FUNCTION_ENTRY ( NULL, "CountCacheLines", true );
 
-    if ( uniqueSubsectors == true ) {
-        bool requireUnique = false;
-        int lastSector  = segs->Sector;
-        for ( int i = 0; i < noSegs; i++ ) {
-            if ( keepUnique [ segs [i].Sector ] == true ) requireUnique = true;
-            if ( segs [i].Sector != lastSector ) {
-                if ( requireUnique == true ) return true;
-                lastSector = segs [i].Sector;
-            }
-        }
+    if ( index & NF_SUBSECTOR_EX ) {
+        *total += noLines;
+        *noSSectors += 1;
+        return;
     }
 
-    return false;
+    int first = ( index * size ) / CACHE_LINE_SIZE;
+    int last  = ( index * size + size - 1 ) / CACHE_LINE_SIZE;
+    for ( int i = first; i <= last; i++ ) {
+        int j = 0;
+        while (( j < noLines ) && ( line [j] != i )) j++;
+        if ( j == noLines ) line [noLines++] = i;
+    }
+
+    CountCacheLines ( nodes, nodes [index].child [0], size, line, noLines, total, noSSectors );
+    CountCacheLines ( nodes, nodes [index].child [1], size, line, noLines, total, noSSectors );
 }
 
-bool overlappingSegs;
+static double CacheLines ( const wNodeEx *nodes, int noNodes, int size, int *line )
+{
+    FUNCTION_ENTRY ( NULL, "CacheLines", true );
 
-static int SortByOrientation ( const void *ptr1, const void *ptr2 )
+    double total = 0.0;
+    int noSSectors = 0;
+    CountCacheLines ( nodes, noNodes - 1, size, line, 0, &total, &noSSectors );
+
+    return total / noSSectors;
+}
+
+static void RenumberNodes ( wNodeEx *nodes, wNodeEx *temp, const int *order, const int *number, int noNodes )
 {
-    FUNCTION_ENTRY ( NULL, "SortByOrientation", false );
+    FUNCTION_ENTRY ( NULL, "RenumberNodes", true );
 
-    SEG *seg1 = ( SEG * ) ptr1;
-    SEG *seg2 = ( SEG * ) ptr2;
+    memcpy ( temp, nodes, sizeof ( wNodeEx ) * noNodes );
 
-    // If they're at different angles it's easy...
-    int dif1 = seg2->Data.angle - seg1->Data.angle;
-    if ( dif1 != 0 ) return dif1;
+    for ( int i = 0; i < noNodes; i++ ) {
+        wNodeEx *node = &nodes [ noNodes - 1 - i ];
+        *node = temp [ order [i]];
+        for ( int j = 0; j < 2; j++ ) {
+            if (( node->child [j] & NF_SUBSECTOR_EX ) == 0 ) node->child [j] = number [ node->child [j]];
+        }
+    }
+}
 
-    // They're colinear, sort them in a clockwise direction
-    double dif2 = 0.0;
-    double dx = seg1->end.x - seg1->start.x;
-    if ( dx > 0.0 ) {
-        dif2 = seg1->start.x - seg2->start.x;
-    } else if ( dx < 0.0 ) {
-        dif2 = seg2->start.x - seg1->start.x;
+//----------------------------------------------------------------------------
+//  Renumber the NODES (and the GL NODES, which share the same tree) in the
+//    given order.  cacheLines is set to the average number of cache lines
+//    read to find a SSECTOR, before and after, for NODEs size bytes long.
+//----------------------------------------------------------------------------
+
+void BSPBuilder::ArrangeNodes ( int nodeOrder, int size, wNodeEx *glNodes, double *cacheLines )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::ArrangeNodes", true );
+
+    if ( m_NodeCount == 0 ) return;
+
+    size_t mark = m_Arena->Mark ();
+
+    int root     = m_NodeCount - 1;
+    int *order   = ( int * ) m_Arena->Allocate ( sizeof ( int ) * m_NodeCount );
+    int *scratch = ( int * ) m_Arena->Allocate ( sizeof ( int ) * 2 * ( m_NodeCount + 1 ));
+    int *count   = ( int * ) m_Arena->Allocate ( sizeof ( int ) * m_NodeCount );
+
+    if ( nodeOrder == NODE_ORDER_VEB ) {
+        sVEBLayout layout;
+        layout.arena    = m_Arena;
+        layout.nodes    = m_NodePool;
+        layout.piece    = scratch;
+        layout.member   = scratch + m_NodeCount;
+        layout.size     = count;
+        layout.order    = order;
+        layout.count    = 0;
+        layout.noPieces = 1;
+        memset ( layout.piece, 0, sizeof ( int ) * m_NodeCount );
+        LayoutVEB ( &layout, root );
     } else {
-        double dy = seg1->end.y - seg1->start.y;
-        if ( dy > 0.0 ) {
-            dif2 = seg1->start.y - seg2->start.y;
-        } else if ( dy < 0.0 ) {
-            dif2 = seg2->start.y - seg1->start.y;
+        // Children are stored before their parents
+        for ( int i = 0; i < m_NodeCount; i++ ) {
+            count [i] = 1;
+            for ( int j = 0; j < 2; j++ ) {
+                UINT32 child = m_NodePool [i].child [j];
+                if (( child & NF_SUBSECTOR_EX ) == 0 ) count [i] += count [child];
+            }
         }
+        LayoutHot ( m_NodePool, count, root, order, scratch );
+    }
+
+    // The root ends up last
+    int *number = count;
+    for ( int i = 0; i < m_NodeCount; i++ ) {
+        number [ order [i]] = m_NodeCount - 1 - i;
     }
 
-    if ( dif2 != 0.0 ) return ( dif2 < 0.0 ) ? -1 : 1;
+    cacheLines [0] = CacheLines ( m_NodePool, m_NodeCount, size, scratch );
 
-    // Mark these SEGs as overlapping
-    overlappingSegs = true;
+    wNodeEx *temp = ( wNodeEx * ) m_Arena->Allocate ( sizeof ( wNodeEx ) * m_NodeCount );
+    RenumberNodes ( m_NodePool, temp, order, number, m_NodeCount );
+    if ( glNodes != NULL ) RenumberNodes ( glNodes, temp, order, number, m_NodeCount );
 
-    // OK, we have overlapping lines!
-    return ( seg1->Data.lineDef < seg2->Data.lineDef ) ? -1 : 1;
-}
+    cacheLines [1] = CacheLines ( m_NodePool, m_NodeCount, size, scratch );
 
-#if defined ( DIAGNOSTIC )
+    m_Arena->Release ( mark );
+}
 
-static void PrintKeepUniqueSegs ( SEG *segs, int noSegs, const char *msg = NULL )
+static double VertexLines ( const wSSectorEx *ssector, int noSSectors, const wSegsEx *segs, int noVertices, int *line, int noLines )
 {
-    fprintf ( stdout, "keep-unique SEGS:\n" );
-
-    if ( msg != NULL ) fprintf ( stdout, "  << ERROR - %s >>\n", msg );
+    FUNCTION_ENTRY ( NULL, "VertexLines", true );
 
-    int lastAngle = 0x10000;
+    memset ( line, -1, sizeof ( int ) * noLines );
 
-    for ( int i = 0; i < noSegs; i++ ) {
-        double dx = segs[i].end.x - segs [i].start.x;
-        double dy = segs[i].end.y - segs [i].start.y;
-        fprintf ( stdout, "  [%d] (%8.1f,%8.1f)-(%8.1f,%8.1f) S:%5d  dx:%8.1f  dy:%8.1f  %04X LD: %5d alias: %5d\n", i, segs [i].start.x, segs [i].start.y, segs [i].end.x, segs [i].end.y, segs[i].Sector, dx, dy, segs [i].Data.angle, segs[i].Data.lineDef, lineDefAlias [ segs[i].Data.lineDef ] );
-        if ( segs [i].Data.angle == lastAngle ) {
-            double dx = segs[i-1].end.x - segs[i-1].start.x;
-            double dy = segs[i-1].end.y - segs[i-1].start.y;
-            double y1 = dx * ( segs[i].start.y - segs[i-1].start.y ) - dy * ( segs[i].start.x - segs[i-1].start.x );
-            if ( y1 != 0.0 ) fprintf ( stdout, "<< ERROR - seg[%d] is not colinear with seg[%d] - %f!!! >>\n", i, i-1, y1 );
+    int total = 0;
+    for ( int i = 0; i < noSSectors; i++ ) {
+        const wSegsEx *seg = &segs [ ssector [i].first ];
+        for ( UINT32 j = 0; j < 2 * ssector [i].num; j++ ) {
+            UINT32 vertex = ( j & 1 ) ? seg [j/2].end : seg [j/2].start;
+            if ( vertex >= ( UINT32 ) noVertices ) continue;
+            int index = ( int ) (( vertex * sizeof ( wVertex )) / CACHE_LINE_SIZE );
+            if ( line [index] != i ) {
+                line [index] = i;
+                total++;
+            }
         }
-        lastAngle = segs [i].Data.angle;
     }
-    fprintf ( stdout, "\n" );
-}
 
-#endif
+    return ( noSSectors > 0 ) ? ( double ) total / noSSectors : 0.0;
+}
 
 //----------------------------------------------------------------------------
-//  Reorder the SEGs so that they are in order around the enclosing subsector
+//  Renumber the VERTEXES in the order the SEGS first use them, so that the
+//    vertices of a SSECTOR are close together.  The SSECTORS, and the SEGS
+//    in them, are already stored in the order a walk of the tree reaches
+//    them.  Vertices that only LINEDEFS use go last, and the fixed point
+//    vertices are numbered the same way after the rest.  vertexLines is set
+//    to the average number of cache lines of VERTEXES read for a SSECTOR,
+//    before and after.
 //----------------------------------------------------------------------------
-static void ArrangeSegs ( SEG *segs, int noSegs )
+
+void BSPBuilder::SortVertices ( DoomLevel *level, double *vertexLines )
 {
-    FUNCTION_ENTRY ( NULL, "ArrangeSegs", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::SortVertices", true );
 
-overlappingSegs = false;
+    size_t mark = m_Arena->Mark ();
 
-    // Sort the around the center of the polygon
-    qsort ( segs, noSegs, sizeof ( SEG ), SortByOrientation );
+    int noLines = ( int ) (( m_NoVertices * sizeof ( wVertex )) / CACHE_LINE_SIZE ) + 1;
+    int *line   = ( int * ) m_Arena->Allocate ( sizeof ( int ) * noLines );
 
-#if defined ( DIAGNOSTIC )
-    bool badSegs = false;
+    vertexLines [0] = VertexLines ( m_SSectorPool, m_SSectorCount, m_FinalSegs, m_NoVertices, line, noLines );
 
-    int lastAngle = 0x10000;
-    for ( int i = 0; i < noSegs; i++ ) {
-    if ( segs [i].Data.angle == lastAngle ) {
-        double dx = segs[i-1].end.x - segs[i-1].start.x;
-        double dy = segs[i-1].end.y - segs[i-1].start.y;
-        double y1 = dx * ( segs[i].start.y - segs[i-1].start.y ) - dy * ( segs[i].start.x - segs[i-1].start.x );
-        if ( y1 != 0.0 ) { badSegs = true; }
+    int noTotal = m_NoVertices + m_NoFixedVertices;
+    int *number = ( int * ) m_Arena->Allocate ( sizeof ( int ) * noTotal );
+    memset ( number, -1, sizeof ( int ) * noTotal );
+
+    // Integer vertices are numbered from 0, fixed point ones from m_NoVertices
+    int count [2] = { 0, m_NoVertices };
+    for ( int i = 0; i < m_SegCount; i++ ) {
+        UINT32 vertex [2] = { m_FinalSegs [i].start, m_FinalSegs [i].end };
+        for ( int j = 0; j < 2; j++ ) {
+            if ( number [ vertex [j]] == -1 ) number [ vertex [j]] = count [ ( vertex [j] < ( UINT32 ) m_NoVertices ) ? 0 : 1 ]++;
+        }
     }
-    lastAngle = segs [i].Data.angle;
+    for ( int i = 0; i < noTotal; i++ ) {
+        if ( number [i] == -1 ) number [i] = count [ ( i < m_NoVertices ) ? 0 : 1 ]++;
     }
-    if (badSegs||overlappingSegs) PrintKeepUniqueSegs (segs, noSegs, overlappingSegs ? "Overlapping SEGs were detected" : NULL );
-#endif
-
-    // See if the 1st sector wraps at the end of the list
-    int j = noSegs;
-    while (( j > 0 ) && ( segs [j-1].Sector == segs [0].Sector )) j--;
 
-    if ( j != noSegs ) {
-        memcpy ( tempSeg, segs + j, sizeof ( SEG ) * ( noSegs - j ));
-        memmove ( segs + ( noSegs - j ), segs, sizeof ( SEG ) * j );
-        memcpy ( segs, tempSeg, sizeof ( SEG ) * ( noSegs - j ));
+    for ( int i = 0; i < m_SegCount; i++ ) {
+        m_FinalSegs [i].start = number [ m_FinalSegs [i].start ];
+        m_FinalSegs [i].end   = number [ m_FinalSegs [i].end ];
     }
-}
-
-static void MakePartition ( SEG *segs, int noSegs, int *noLeft, int *noRight )
-{
-    FUNCTION_ENTRY ( NULL, "MakePartition", true );
 
-    // Find the end of the first run of SEGs that are unique (or at don't require
-    //   unique subsectors). These will form the right SSECTOR.
-    int  lastSector = segs [0].Sector;
-    bool uniqueFlag = keepUnique [ lastSector ];
+    for ( int i = 0; i < m_GLSegCount; i++ ) {
+        if (( m_GLSegs [i].start & GL_VERTEX ) == 0 ) m_GLSegs [i].start = number [ m_GLSegs [i].start ];
+        if (( m_GLSegs [i].end & GL_VERTEX ) == 0 ) m_GLSegs [i].end = number [ m_GLSegs [i].end ];
+    }
 
-    int right = 0;
-    while ( right < noSegs ) {
-        int thisSector = segs [right+1].Sector;
-        if (( thisSector != lastSector ) && 
-            (( uniqueFlag == true ) || ( keepUnique [ thisSector ] == true ))) {
-            break;
+    if ( m_NoFixedVertices > 0 ) {
+        wVertexEx *temp = ( wVertexEx * ) m_Arena->Allocate ( sizeof ( wVertexEx ) * m_NoFixedVertices );
+        memcpy ( temp, m_FixedVertex, sizeof ( wVertexEx ) * m_NoFixedVertices );
+        for ( int i = 0; i < m_NoFixedVertices; i++ ) {
+            m_FixedVertex [ number [ m_NoVertices + i ] - m_NoVertices ] = temp [i];
         }
-        lastSector = thisSector;
-        right++;
     }
 
-    // Now we need to find a partition line that will isolate the 'right' SEGs
+    vertexLines [1] = VertexLines ( m_SSectorPool, m_SSectorCount, m_FinalSegs, m_NoVertices, line, noLines );
 
-    X  = segs [right].end.x;
-    Y  = segs [right].end.y;
+    // The level takes over map & newVertices, and renumbers the LINEDEFS
+    const wVertex *vertex = level->GetVertices ();
+    wVertex *newVertices = new wVertex [ m_NoVertices ];
+    int *map = new int [ m_NoVertices ];
+    for ( int i = 0; i < m_NoVertices; i++ ) {
+        newVertices [ number [i]] = vertex [i];
+        map [i] = number [i];
+    }
 
-    // Look for the easy case first
-    if ( segs [0].Data.angle != segs [right].Data.angle ) {
+    level->ReplaceVertices ( map, newVertices, m_NoVertices );
 
-        *noRight = right + 1;
-        DX = segs [0].start.x - X;
-        DY = segs [0].start.y - Y;
+    m_Arena->Release ( mark );
+}
 
-    } else {
+//----------------------------------------------------------------------------
+//  Measure the tree the way bspinfo does: the root is at depth 1, and each
+//    SSECTOR counts as 1 deeper than its parent.  maxDepth is the depth of
+//    the deepest NODE.
+//----------------------------------------------------------------------------
 
-        // There are three potential sets of SEGs:
-        //  'target' - the SEGs at the start of the list
-        //  'head'   - the SEGs immediately following the 'target' SEGs up to the first
-        //             SEG in the 'tail' list
-        //  'tail'   - SEGs at the end of the list that have at least one endpoint on the same
-        //             line as the first 'target' SEG
+void BSPBuilder::TreeDepth ( int *maxDepth, double *avgDepth )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder::TreeDepth", true );
 
-        // Find the last point not on the target SEGs line
-        int split  = noSegs;
-        double dx = segs [0].end.x - segs [0].start.x;
-        double dy = segs [0].end.y - segs [0].start.y;
-        while ( split > right ) {
-            double y2 = dx * ( segs [split-1].end.y - segs [0].start.y ) - dy * ( segs [split-1].end.x - segs [0].start.x );
-            if ( y2 < 0.0 ) break;
-            split--;
-            double y1 = dx * ( segs [split].start.y - segs [0].start.y ) - dy * ( segs [split].start.x - segs [0].start.x );
-            if ( y1 < 0.0 ) break;
-        }
+    *maxDepth = 0;
+    *avgDepth = 0.0;
 
-        // See if we found a candidate ending point (the dividing line between 'head' and 'tail' segments
-        if ( split > right ) {
-            int tail = noSegs - split;
-            if ( tail != 0 ) {
-                // We're going to split off the 'target'+'head' SEGs (right) from the 'tail' SEGs (left)
-                *noRight = split;
-                X  = ( segs [split-1].end.x + segs [split].start.x ) / 2.0;
-                Y  = ( segs [split-1].end.y + segs [split].start.y ) / 2.0;
-                DX = segs [0].start.x - X;
-                DY = segs [0].start.y - Y;
-            } else {
-                // No 'tail' SEGS - split the 'target' (right) and 'head' (left) SEGs
-                *noRight = right + 1;
-                DX = segs [noSegs-1].end.x - X;
-                DY = segs [noSegs-1].end.y - Y;
-            }
-        } else {
-            // All the line segments are colinear
-            int split = noSegs;
-            double dx = segs [0].end.x - segs [0].start.x;
-            if ( dx != 0.0 ) {
-                while (( segs [split-1].end.x - segs [0].start.x ) / dx <= 0.0 ) split--;
-            } else {
-                double dy = segs [0].end.y - segs [0].start.y;
-                while (( segs [split-1].end.y - segs [0].start.y ) / dy <= 0.0 ) split--;
-            }
+    if ( m_NodeCount == 0 ) return;
 
-            int tail = noSegs - split;
-            if ( tail != 0 ) {
-                // We're going to split off the 'target'+'head' SEGs (right) from the 'tail' SEGs (left)
-                *noRight = split;
-                X  = segs [0].start.x;
-                Y  = segs [0].start.y;
-                DX  = segs [0].start.y - segs [0].end.y;
-                DY  = segs [0].end.x - segs [0].start.x;
+    size_t mark = m_Arena->Mark ();
+    int *depth = ( int * ) m_Arena->Allocate ( sizeof ( int ) * m_NodeCount );
+
+    // Children are stored before their parents
+    double total = 0.0;
+    depth [ m_NodeCount - 1 ] = 1;
+    for ( int i = m_NodeCount - 1; i >= 0; i-- ) {
+        if ( depth [i] > *maxDepth ) *maxDepth = depth [i];
+        for ( int j = 0; j < 2; j++ ) {
+            UINT32 child = m_NodePool [i].child [j];
+            if ( child & NF_SUBSECTOR_EX ) {
+                total += depth [i] + 1;
             } else {
-                // No 'tail' SEGS - split the 'target' (right) and 'head' (left) SEGs
-                *noRight = right + 1;
-                DX  = segs [0].end.y - segs [0].start.y;
-                DY  = segs [0].start.x - segs [0].end.x;
+                depth [child] = depth [i] + 1;
             }
         }
     }
 
-    *noLeft  = noSegs - *noRight;
+    *avgDepth = total / m_SSectorCount;
+
+    m_Arena->Release ( mark );
 }
 
-#if defined ( DIAGNOSTIC )
+//----------------------------------------------------------------------------
+//  BSPArena: each block is a header followed by its data.  A new block is
+//    only needed when the current one is full, and Reset swaps several blocks
+//    for a single one big enough to hold everything that was in use.
+//----------------------------------------------------------------------------
+
+#define ARENA_ALIGN             16
+#define ARENA_MIN_BLOCK         ( 256 * 1024 )
+
+struct sArenaBlock {
+    sArenaBlock  *next;
+    size_t        base;			// offset of the 1st byte in the arena
+    size_t        size;
+    size_t        used;
+};
 
-static void VerifyNode ( SEG *segs, int noSegs, double x1, double y1, double x2, double y2 )
+#define ARENA_HEADER            (( sizeof ( sArenaBlock ) + ARENA_ALIGN - 1 ) & ~( ARENA_ALIGN - 1 ))
+
+static sArenaBlock *NewArenaBlock ( sArenaBlock *next, size_t base, size_t size )
 {
-    bool errors = false;
-    double dx = x2 - x1;
-    double dy = y2 - y1;
-    double h = ( dx * dx ) + ( dy * dy );
-    for ( int j = 0; j < noSegs; j++ ) {
-        double p1 = ( dx * ( segs [j].start.y - y1 ) - dy * ( segs [j].start.x - x1 )) / h;
-        double p2 = ( dx * ( segs [j].end.y - y1 ) - dy * ( segs [j].end.x - x1 )) / h;
-        if (( p1 > 0.25 ) || ( p2 > 0.25 )) errors = true;
-    }
-    if ( errors == true ) {
-        fprintf ( stdout, "Partition line (%8.1f,%8.1f)-(%8.1f,%8.1f) is not correct!\n", x1, y1, x2, y2 );
-        for ( int j = 0; j < noSegs; j++ ) {
-            double p1 = ( dx * ( segs [j].start.y - y1 ) - dy * ( segs [j].start.x - x1 )) / h;
-            double p2 = ( dx * ( segs [j].end.y - y1 ) - dy * ( segs [j].end.x - x1 )) / h;
-            fprintf ( stdout, " [%d] (%8.1f,%8.1f)-(%8.1f,%8.1f)  S:%5d  LD:%5d  y1:%10.3f  y2:%10.3f %s\n", j, segs[j].start.x, segs[j].start.y, segs[j].end.x, segs[j].end.y, segs[j].Sector, segs[j].Data.lineDef, p1, p2, (( p1 > 0.25 ) || ( p2 > 0.25 )) ? "<---" : "" );
-        }
+    FUNCTION_ENTRY ( NULL, "NewArenaBlock", true );
+
+    sArenaBlock *block = ( sArenaBlock * ) malloc ( ARENA_HEADER + size );
+    block->next = next;
+    block->base = base;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+static void FreeArenaBlocks ( sArenaBlock *block, const sArenaBlock *last )
+{
+    FUNCTION_ENTRY ( NULL, "FreeArenaBlocks", true );
+
+    while ( block != last ) {
+        sArenaBlock *next = block->next;
+        free ( block );
+        block = next;
     }
 }
 
-#endif
+BSPArena::BSPArena () :
+    m_Block ( NULL ),
+    m_Peak ( 0 )
+{
+    FUNCTION_ENTRY ( this, "BSPArena ctor", true );
+}
 
-//----------------------------------------------------------------------------
-//  Recursively create the actual NODEs.  This procedure is very similar to 
-//    CreateNode except that we know up front that the SEGs form a convex
-//    polygon and only need to be broken up by unique sectors. The main difference
-//    here is that the partition line is not taken from the SEGs but is an
-//    arbitrary line chosen to break up the SEGs properly to create unique SSECTORs.
-//----------------------------------------------------------------------------
-static UINT16 GenerateUniqueSectors ( SEG *segs, int noSegs )
+BSPArena::~BSPArena ()
 {
-    FUNCTION_ENTRY ( NULL, "GenerateUniqueSectors", true );
+    FUNCTION_ENTRY ( this, "BSPArena dtor", true );
 
-    if ( KeepUniqueSubsectors ( segs, noSegs ) == false ) {
-        if ( showProgress ) ShowDone ();
-        return ( UINT16 ) ( 0x8000 | CreateSSector ( segs, noSegs ));
-    }
+    FreeArenaBlocks ( m_Block, NULL );
+}
 
-    int noLeft, noRight;
+void *BSPArena::Allocate ( size_t size )
+{
+    FUNCTION_ENTRY ( this, "BSPArena::Allocate", true );
 
-    MakePartition ( segs, noSegs, &noLeft, &noRight );
+    size = ( size + ARENA_ALIGN - 1 ) & ~( ARENA_ALIGN - 1 );
 
-    wNode tempNode;
+    if (( m_Block == NULL ) || ( m_Block->used + size > m_Block->size )) {
+        size_t blockSize = ( m_Block != NULL ) ? 2 * m_Block->size : ARENA_MIN_BLOCK;
+        if ( blockSize < size ) blockSize = size;
+        m_Block = NewArenaBlock ( m_Block, Mark (), blockSize );
+    }
 
-    // Store the NODE info set in ComputeStaticVariables
-    tempNode.x  = ( INT16 ) lrint ( X );
-    tempNode.y  = ( INT16 ) lrint ( Y );
-    tempNode.dx = ( INT16 ) lrint ( DX );
-    tempNode.dy = ( INT16 ) lrint ( DY );
+    void *ptr = ( char * ) m_Block + ARENA_HEADER + m_Block->used;
+    m_Block->used += size;
 
-#if defined ( DIAGNOSTIC )
-    double x1 = X;
-    double y1 = Y;
-    double x2 = X + DX;
-    double y2 = Y + DY;
-#endif
+    if ( Mark () > m_Peak ) m_Peak = Mark ();
 
-    FindBounds ( &tempNode.side [0], segs, noRight );
-    FindBounds ( &tempNode.side [1], segs + noRight, noLeft );
+    return ptr;
+}
 
-    if ( showProgress ) GoRight ();
+size_t BSPArena::Mark () const
+{
+    FUNCTION_ENTRY ( this, "BSPArena::Mark", true );
 
-    UINT16 rNode = GenerateUniqueSectors ( segs, noRight );
+    return ( m_Block != NULL ) ? m_Block->base + m_Block->used : 0;
+}
 
-    if ( showProgress ) GoLeft ();
+//----------------------------------------------------------------------------
+//  Free everything allocated since Mark returned mark.
+//----------------------------------------------------------------------------
 
-    UINT16 lNode = GenerateUniqueSectors ( segs + noRight, noLeft );
+void BSPArena::Release ( size_t mark )
+{
+    FUNCTION_ENTRY ( this, "BSPArena::Release", true );
 
-#if defined ( DIAGNOSTIC )
-    VerifyNode ( segs, noRight, x1, y1, x2, y2 );
-    VerifyNode ( segs+noRight, noLeft, x2, y2, x1, y1 );
-#endif
+    if ( m_Block == NULL ) return;
+
+    sArenaBlock *block = m_Block;
+    while (( block->next != NULL ) && ( block->base >= mark )) {
+        block = block->next;
+    }
+    FreeArenaBlocks ( m_Block, block );
+
+    m_Block = block;
+    m_Block->used = mark - m_Block->base;
+}
 
-    if ( showProgress ) Backup ();
+void BSPArena::Reset ()
+{
+    FUNCTION_ENTRY ( this, "BSPArena::Reset", true );
 
-    if ( nodesLeft-- == 0 ) {
-        int delta  = ( 10 * nodeCount ) / 100 + 1;
-        nodePool   = ( wNode * ) realloc ( nodePool, sizeof ( wNode ) * ( nodeCount + delta ));
-        nodesLeft += delta;
+    if (( m_Block != NULL ) && ( m_Block->next != NULL )) {
+        size_t size = ( m_Peak > m_Block->size ) ? m_Peak : m_Block->size;
+        FreeArenaBlocks ( m_Block, NULL );
+        m_Block = NewArenaBlock ( NULL, 0, size );
     }
 
-    wNode *node = &nodePool [nodeCount];
-    *node           = tempNode;
-    node->child [0] = rNode;
-    node->child [1] = lNode;
+    if ( m_Block != NULL ) m_Block->used = 0;
+}
+
+//----------------------------------------------------------------------------
+//  A BSPBuilder holds everything needed to build the NODES for one level, so
+//    several levels can be built at the same time as long as they don't share
+//    an arena.
+//----------------------------------------------------------------------------
 
-    if ( showProgress ) ShowDone ();
+BSPBuilder::BSPBuilder ( DoomLevel *level, sBSPOptions *options, BSPArena *arena ) :
+    m_Level ( level ),
+    m_Options ( options ),
+    m_Arena ( arena ),
+    m_MaxVertices ( 0 ),
+    m_NodePool ( NULL ),
+    m_NodeCount ( 0 ),
+    m_SegChunk ( NULL ),
+    m_NoSegChunks ( 0 ),
+    m_SegCount ( 0 ),
+    m_FinalSegs ( NULL ),
+    m_SSectorPool ( NULL ),
+    m_SSectorCount ( 0 ),
+    m_NewVertices ( NULL ),
+    m_NoVertices ( 0 ),
+    m_VertexHash ( NULL ),
+    m_FixedPoint ( false ),
+    m_FixedVertex ( NULL ),
+    m_NoFixedVertices ( 0 ),
+    m_MaxFixedVertices ( 0 ),
+    m_GLNodes ( false ),
+    m_GLClip ( NULL ),
+    m_GLDepth ( 0 ),
+    m_MaxGLDepth ( 0 ),
+    m_GLVertex ( NULL ),
+    m_NoGLVertices ( 0 ),
+    m_MaxGLVertices ( 0 ),
+    m_GLSegs ( NULL ),
+    m_GLSegCount ( 0 ),
+    m_MaxGLSegs ( 0 ),
+    m_GLSSectorPool ( NULL ),
+    m_SectorCount ( 0 ),
+    m_ShowProgress ( false ),
+    m_KeepUnique ( NULL ),
+    m_UniqueSubsectors ( false ),
+    m_NoAliases ( 0 ),
+    m_LineDefAlias ( NULL ),
+    m_SideInfo ( NULL ),
+    m_SideUsers ( NULL ),
+    m_SideRecent ( NULL ),
+    m_SideSlot ( NULL ),
+    m_SideWords ( 0 ),
+    m_SideRows ( 0 ),
+    m_MaxSideRows ( 0 ),
+    m_SideClock ( 0 ),
+    m_SideLock ( NULL ),
+    m_MaxCandidates ( 1 ),
+    m_GroupSegs ( false ),
+    m_BeamWidth ( 1 ),
+    m_BeamDepth ( 1 ),
+    m_OldTree ( NULL ),
+    m_ReusedNodes ( 0 ),
+    m_PartitionFunction ( &BSPBuilder::Algorithm1 )
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder ctor", true );
+
+    // metric = S ? ( L * R ) / ( X1 ? X1 * S / X2 : 1 ) - ( X3 * S + X4 ) * S : ( L * R );
+    m_X1 = options->weightX [0];
+    m_X2 = options->weightX [1];
+    m_X3 = options->weightX [2];
+    m_X4 = options->weightX [3];
+
+    m_Y1 = options->weightY [0];
+    m_Y2 = options->weightY [1];
+    m_Y3 = options->weightY [2];
+    m_Y4 = options->weightY [3];
+
+    // Sanity check on the weights
+    if ( m_X2 <= 0 ) m_X2 = 1;
+    if ( m_Y2 <= 0 ) m_Y2 = 1;
+}
 
-    return ( UINT16 ) nodeCount++;
+BSPBuilder::~BSPBuilder ()
+{
+    FUNCTION_ENTRY ( this, "BSPBuilder dtor", true );
 }
 
 //----------------------------------------------------------------------------
-//  Recursively create the actual NODEs.  The given list of SEGs is analyzed
-//    and a partition is chosen.  If no partition can be found, a leaf node
-//    is created.  Otherwise, the right and left SEGs are analyzed.  Features:
-//    - A list of 'convex' aliases is maintained.  These are lines that border
-//      the list of SEGs and can never be partitions.  A line is marked as
-//      convex for this and all children, and unmarked before returing.
-//    - Similarly, the alias chosen as the partition is marked as convex
-//      since it will be convex for all children.
+//  Call all the necessary functions to prepare the BSP tree and insert the
+//    new data into the level.
 //----------------------------------------------------------------------------
-static UINT16 CreateNode ( SEG *segs, int *noSegs )
+
+void BSPBuilder::Build ()
 {
-    FUNCTION_ENTRY ( NULL, "CreateNode", true );
+    FUNCTION_ENTRY ( this, "BSPBuilder::Build", true );
 
-    int noLeft, noRight;
-    int *cptr = convexPtr;
-    
-    if (( *noSegs <= 1 ) || ( ChoosePartition ( segs, *noSegs, &noLeft, &noRight ) == false )) {
-        convexPtr = cptr;
-        if ( KeepUniqueSubsectors ( segs, *noSegs ) == true ) {
-            ArrangeSegs ( segs, *noSegs );
-            return GenerateUniqueSectors ( segs, *noSegs );
-        }
-        if ( showProgress ) ShowDone ();
-        return ( UINT16 ) ( 0x8000 | CreateSSector ( segs, *noSegs ));
-    }
+    DoomLevel *level = m_Level;
+    sBSPOptions *options = m_Options;
 
-    wNode tempNode;
+    UINT32 buildStart = CurrentTime ();
 
-    // Store the NODE info set in ComputeStaticVariables
-    tempNode.x  = ( INT16 ) lrint ( X );
-    tempNode.y  = ( INT16 ) lrint ( Y );
-    tempNode.dx = ( INT16 ) lrint ( DX );
-    tempNode.dy = ( INT16 ) lrint ( DY );
+    TRACE ( "Processing " << level->Name ());
 
-#if defined ( DIAGNOSTIC )
-    double x1 = X;
-    double y1 = Y;
-    double x2 = X + DX;
-    double y2 = Y + DY;
-#endif
+    bool quiet = options->quiet;
 
-    FindBounds ( &tempNode.side [0], segs, noRight );
-    FindBounds ( &tempNode.side [1], segs + noRight, noLeft );
+    m_ShowProgress     = options->showProgress;
+    m_UniqueSubsectors = options->keepUnique ? true : false;
 
-    int alias = currentAlias;
+    m_PartitionFunction = &BSPBuilder::Algorithm1;
+    if ( options->algorithm == 2 ) m_PartitionFunction = &BSPBuilder::Algorithm2;
+    if ( options->algorithm == 3 ) m_PartitionFunction = &BSPBuilder::Algorithm3;
+    if ( options->algorithm == 4 ) m_PartitionFunction = &BSPBuilder::Algorithm4;
+    if ( options->algorithm == 5 ) m_PartitionFunction = &BSPBuilder::Algorithm5;
 
-    lineUsed [ alias ] = 1;
-    for ( int *tempPtr = cptr; tempPtr != convexPtr; tempPtr++ ) {
-        lineUsed [ *tempPtr ] = 2;
-    }
+    // ALGORITHMS 3 & 4 only look at a few lines for each NODE, so grouping wouldn't pay for itself
+    m_GroupSegs = (( options->algorithm != 3 ) && ( options->algorithm != 4 )) ? true : false;
 
-    if ( showProgress ) GoRight ();
+    m_BeamWidth = ( options->beamWidth > 1 ) ? options->beamWidth : 1;
+    m_BeamDepth = ( options->beamDepth > 1 ) ? options->beamDepth : 1;
 
-    UINT16 rNode = CreateNode ( segs, &noRight );
+    m_NodeCount    = 0;
+    m_SSectorCount = 0;
 
-    if ( showProgress ) GoLeft ();
+    // Only the ZDoom formats can store split points that aren't on integer coordinates
+    m_FixedPoint = (( options->nodeFormat == NODES_XNOD ) || ( options->nodeFormat == NODES_ZNOD )) ? true : false;
+    m_NoFixedVertices = 0;
 
-    UINT16 lNode = CreateNode ( segs + noRight, &noLeft );
+    m_GLNodes      = options->glNodes;
+    m_GLDepth      = 0;
+    m_NoGLVertices = 0;
+    m_GLSegCount   = 0;
 
-    if ( showProgress ) Backup ();
+    // The old NODES have to be read before their vertices are thrown away
+    m_OldTree     = options->reuseNodes ? ReadOldTree ( level ) : NULL;
+    m_ReusedNodes = 0;
 
-    *noSegs = noLeft + noRight;
+    // Get rid of old SEGS and associated vertices
+    level->NewSegs ( 0, NULL );
+    level->TrimVertices ();
+    level->PackVertices ();
 
-#if defined ( DIAGNOSTIC )
-    VerifyNode ( segs, noRight, x1, y1, x2, y2 );
-    VerifyNode ( segs+noRight, noLeft, x2, y2, x1, y1 );
-#endif
+    m_NoVertices  = level->VertexCount ();
+    m_SectorCount = level->SectorCount ();
 
-    while ( convexPtr != cptr ) lineUsed [ *--convexPtr ] = false;
-    lineUsed [ alias ] = false;
+    m_MaxCandidates = ( ThreadCount () > 1 ) ? ThreadCount () * CANDIDATES_PER_THREAD : 1;
 
-    if ( nodesLeft-- == 0 ) {
-        int delta  = ( 10 * nodeCount ) / 100 + 1;
-        nodePool   = ( wNode * ) realloc ( nodePool, sizeof ( wNode ) * ( nodeCount + delta ));
-        nodesLeft += delta;
+    m_KeepUnique  = new bool [ m_SectorCount ];
+    if ( options->keepUnique ) {
+        m_UniqueSubsectors = true;
+        memcpy ( m_KeepUnique, options->keepUnique, sizeof ( bool ) * m_SectorCount );
+    } else {
+        memset ( m_KeepUnique, true, sizeof ( bool ) * m_SectorCount );
     }
+    m_MaxVertices = ( int ) ( m_NoVertices * FACTOR_VERTEX );
+    m_NewVertices = new wVertex [ m_MaxVertices ];
+    memcpy ( m_NewVertices, level->GetVertices (), sizeof ( wVertex ) * m_NoVertices );
 
-    wNode *node = &nodePool [nodeCount];
-    *node           = tempNode;
-    node->child [0] = rNode;
-    node->child [1] = lNode;
+    m_VertexHash = new VertexHash ( m_MaxVertices );
+    for ( int i = 0; i < m_NoVertices; i++ ) {
+        m_VertexHash->Insert ( m_NewVertices, i );
+    }
 
-    if ( showProgress ) ShowDone ();
+    if ( quiet == false ) Status ( "Creating SEGS ... " );
+    int *segs = CreateSegs ( level, options );
 
-    return ( UINT16 ) nodeCount++;
-}
+    if ( quiet == false ) Status ( "Getting LineDef Aliases ... " );
+    m_NoAliases = GetLineDefAliases ( level, segs, m_SegCount );
+    RenumberSegs ( segs, m_SegCount );
 
-wVertex  *GetVertices ()
-{
-    FUNCTION_ENTRY ( NULL, "GetVertices", true );
+    if ( quiet == false ) Status ( "Creating Side Info ... " );
+    CreateSideInfo ( level );
 
-    wVertex *vert = new wVertex [ noVertices ];
-    memcpy ( vert, newVertices, sizeof ( wVertex ) * noVertices );
+    if ( quiet == false ) Status ( "Creating NODES ... " );
 
-    return vert;
-}
+    // CreateNode takes ownership of the initial list of SEGs
+    double budget = 0.0;
+    if ( options->timeLimit > 0 ) budget = TimeLeft ( options->timeLimit, buildStart );
 
-wNode *GetNodes ( wNode *nodeList, int noNodes )
-{
-    FUNCTION_ENTRY ( NULL, "GetNodes", true );
+    if ( m_ShowProgress ) StartProgress ();
 
-    wNode *nodes = new wNode [ noNodes ];
+    sBSPTask *task = NewTask ( NULL, m_ShowProgress );
+    sBSPNode *root;
+    if (( m_OldTree != NULL ) && ( m_SegCount > 0 )) {
+        int noGhosts;
+        sSegCoords *ghosts = FindChanges ( segs, m_SegCount, &noGhosts, &options->changedSegs, &options->removedSegs );
+        root = ReuseNode ( task, m_OldTree->noNodes - 1, segs, m_SegCount, ghosts, noGhosts );
+        options->reusedNodes = m_ReusedNodes;
+    } else {
+        root = CreateNode ( task, segs, m_SegCount, budget );
+        options->reusedNodes = -1;
+        options->changedSegs = m_SegCount;
+        options->removedSegs = 0;
+    }
+    FreeTask ( task );
 
-    for ( int i = 0; i < noNodes; i++ ) {
-        nodes [i] = nodeList [i];
+    FreeOldTree ( m_OldTree );
+    m_OldTree = NULL;
+
+    if ( m_ShowProgress ) StopProgress ();
+
+    root = MergeSSectors ( root );
+
+    // The tree is complete, so the exact sizes of the lists are known
+    int noSSectors = CountSSectors ( root );
+
+    m_NodePool    = ( wNodeEx * ) m_Arena->Allocate ( sizeof ( wNodeEx ) * ( noSSectors - 1 ));
+    m_SSectorPool = ( wSSectorEx * ) m_Arena->Allocate ( sizeof ( wSSectorEx ) * noSSectors );
+    m_FinalSegs   = ( wSegsEx * ) m_Arena->Allocate ( sizeof ( wSegsEx ) * CountSegs ( root ));
+    m_SegCount    = 0;
+
+    if ( m_GLNodes == true ) {
+        m_GLSSectorPool = ( wSSectorEx * ) m_Arena->Allocate ( sizeof ( wSSectorEx ) * noSSectors );
+        m_GLBound [0] = m_GLBound [2] = m_NewVertices [0].x;
+        m_GLBound [1] = m_GLBound [3] = m_NewVertices [0].y;
+        for ( int i = 1; i < m_NoVertices; i++ ) {
+            if ( m_NewVertices [i].x < m_GLBound [0] ) m_GLBound [0] = m_NewVertices [i].x;
+            if ( m_NewVertices [i].y < m_GLBound [1] ) m_GLBound [1] = m_NewVertices [i].y;
+            if ( m_NewVertices [i].x > m_GLBound [2] ) m_GLBound [2] = m_NewVertices [i].x;
+            if ( m_NewVertices [i].y > m_GLBound [3] ) m_GLBound [3] = m_NewVertices [i].y;
+        }
+        m_GLBound [0] -= GL_MARGIN;
+        m_GLBound [1] -= GL_MARGIN;
+        m_GLBound [2] += GL_MARGIN;
+        m_GLBound [3] += GL_MARGIN;
     }
 
-    return nodes;
-}
+    StoreNode ( root );
+    NumberFixedVertices ();
 
-static wSegs *finalSegs;
+    TreeDepth ( &options->maxDepth, &options->avgDepth );
+    options->segCount = m_SegCount;
 
-wSSector *GetSSectors ( wSSector *ssectorList, int noSSectors )
-{
-    FUNCTION_ENTRY ( NULL, "GetSSectors", true );
+    if ( m_GLNodes == true ) {
+        NumberGLVertices ();
+        DropGLSegs ();
+        FindGLPartners ();
+    }
+
+    // Clean up temporary buffers
+    if ( quiet == false ) Status ( "Cleaning up ... " );
+    for ( int i = 0; i < m_NoSegChunks; i++ ) {
+        delete m_SegChunk [i];
+    }
+    delete [] m_SegChunk;
 
-    wSegs *segs = finalSegs = new wSegs [ segCount ];
+    m_SegChunk    = NULL;
+    m_NoSegChunks = 0;
 
-    for ( int i = 0; i < noSSectors; i++ ) {
+    FreeSideInfo ();
+    delete [] m_LineDefAlias;
+    delete [] m_KeepUnique;
 
-        int start = ssectorList[i].first;
-        ssectorList[i].first = ( UINT16 ) ( segs - finalSegs );
+    m_LineDefAlias = NULL;
+    m_KeepUnique   = NULL;
 
-        // Copy the used SEGs to the final SEGs list
-        for ( int x = 0; x < ssectorList [i].num; x++ ) {
-            segs [x] = segStart [start+x].Data;
+    // Switch to an extended format if the level is too big for the original one
+    int format = options->nodeFormat;
+    if (( format == NODES_VANILLA ) && ( FitsVanilla () == false )) {
+        if ( options->extendNodes == true ) {
+            format = NODES_ZNOD;
+        } else {
+            if ( quiet == false ) fprintf ( stderr, "\nNODES for %s exceed the limits of the original format and will be truncated\n", level->Name ());
         }
-
-        segs += ssectorList [i].num;
     }
 
-    delete [] segStart;
-    segCount = segs - finalSegs;
+    // The GL NODES need the vertices, so get them before the level takes them over
+    wNodeEx *glNodes = ( m_GLNodes == true ) ? GetGLNodes () : NULL;
 
-    wSSector *ssector = new wSSector [ noSSectors ];
-    memcpy ( ssector, ssectorList, sizeof ( wSSector ) * noSSectors );
+    options->cacheLines [0] = 0.0;
+    options->cacheLines [1] = 0.0;
+    if ( options->nodeOrder != NODE_ORDER_POST ) {
+        // The extended NODEs take up the same 32 bytes as a wNodeEx
+        ArrangeNodes ( options->nodeOrder, ( format == NODES_VANILLA ) ? sizeof ( wNode ) : sizeof ( wNodeEx ), glNodes, options->cacheLines );
+    }
 
-    return ssector;
-}
+    level->NewVertices ( m_NoVertices, m_NewVertices );
+    m_NewVertices = NULL;
 
-wSegs *GetSegs ()
-{
-    FUNCTION_ENTRY ( NULL, "GetSegs", true );
+    options->vertexLines [0] = 0.0;
+    options->vertexLines [1] = 0.0;
+    if ( options->sortVertices == true ) SortVertices ( level, options->vertexLines );
+
+    if ( format == NODES_VANILLA ) {
+        level->NewNodes ( m_NodeCount, GetNodes ( m_NodePool, m_NodeCount ));
+        level->NewSubSectors ( m_SSectorCount, GetSSectors ( m_SSectorPool, m_SSectorCount ));
+        level->NewSegs ( m_SegCount, GetSegs ());
+    } else {
+        level->NewExtendedNodes ( format, m_NoFixedVertices, m_FixedVertex, m_SegCount, m_FinalSegs, m_SSectorCount, m_SSectorPool, m_NodeCount, m_NodePool );
+    }
 
-    // The list of wSegs is generated in GetSSectors
+    if ( m_GLNodes == true ) {
+        int noGLSSectors;
+        int noGLNodes = PruneGLNodes ( glNodes, &noGLSSectors );
+        level->NewGLNodes ( m_NoGLVertices, m_GLVertex, m_GLSegCount, m_GLSegs, noGLSSectors, m_GLSSectorPool, noGLNodes, glNodes );
+    }
 
-    return finalSegs;
+    delete m_VertexHash;
+
+    free ( m_FixedVertex );
+    free ( m_GLClip );
+    free ( m_GLVertex );
+    free ( m_GLSegs );
+
+    m_Arena->Reset ();
+
+    m_VertexHash    = NULL;
+    m_FinalSegs     = NULL;
+    m_FixedVertex   = NULL;
+    m_SSectorPool   = NULL;
+    m_NodePool      = NULL;
+    m_GLClip        = NULL;
+    m_GLVertex      = NULL;
+    m_GLSegs        = NULL;
+    m_GLSSectorPool = NULL;
+
+    m_NoFixedVertices  = 0;
+    m_MaxFixedVertices = 0;
+    m_MaxGLDepth       = 0;
+    m_NoGLVertices     = 0;
+    m_MaxGLVertices    = 0;
+    m_GLSegCount       = 0;
+    m_MaxGLSegs        = 0;
 }
 
 //----------------------------------------------------------------------------
 //  Wrapper function that calls all the necessary functions to prepare the
 //    BSP tree and insert the new data into the level.  All screen I/O is
 //    done in this routine (with the exception of progress indication).
+//    The caller can pass in an arena to be used again for the next level,
+//    as long as no other build is using it at the same time.
 //----------------------------------------------------------------------------
 
-void CreateNODES ( DoomLevel *level, sBSPOptions *options )
+void CreateNODES ( DoomLevel *level, sBSPOptions *options, BSPArena *arena )
 {
     FUNCTION_ENTRY ( NULL, "CreateNODES", true );
 
-    TRACE ( "Processing " << level->Name ());
+    BSPArena local;
 
-    // Sanity check on environment variables
-    if ( X2 <= 0 ) X2 = 1;
-    if ( Y2 <= 0 ) Y2 = 1;
+    BSPBuilder builder ( level, options, ( arena != NULL ) ? arena : &local );
 
-    // Copy options to global variables
-    showProgress     = options->showProgress;
-    uniqueSubsectors = options->keepUnique ? true : false;
+    builder.Build ();
+}
 
-    PartitionFunction = Algorithm1;
-    if ( options->algorithm == 2 ) PartitionFunction = Algorithm2;
-    if ( options->algorithm == 3 ) PartitionFunction = Algorithm3;
+//----------------------------------------------------------------------------
+//  Fill in the weights used by the partition metric - the defaults can be
+//    changed with the ZEN_X1-ZEN_X4 & ZEN_Y1-ZEN_Y4 environment variables.
+//----------------------------------------------------------------------------
 
-    nodeCount    = 0;
-    ssectorCount = 0;
+void GetMetricWeights ( sBSPOptions *options )
+{
+    FUNCTION_ENTRY ( NULL, "GetMetricWeights", true );
 
-    // Get rid of old SEGS and associated vertices
-    level->NewSegs ( 0, NULL );
-    level->TrimVertices ();
-    level->PackVertices ();
+    static const long defaultX [4] = { 20, 10, 1, 25 };
+    static const long defaultY [4] = { 1, 7, 1, 0 };
 
-    noVertices  = level->VertexCount ();
-    sectorCount = level->SectorCount ();
-    usedSector  = new UINT8 [ sectorCount ];
-    keepUnique  = new bool [ sectorCount ];
-    if ( options->keepUnique ) {
-        uniqueSubsectors = true;
-        memcpy ( keepUnique, options->keepUnique, sizeof ( bool ) * sectorCount );
-    } else {
-        memset ( keepUnique, true, sizeof ( bool ) * sectorCount );
+    for ( int i = 0; i < 4; i++ ) {
+        char name [8];
+        sprintf ( name, "ZEN_X%d", i + 1 );
+        options->weightX [i] = getenv ( name ) ? atol ( getenv ( name )) : defaultX [i];
+        sprintf ( name, "ZEN_Y%d", i + 1 );
+        options->weightY [i] = getenv ( name ) ? atol ( getenv ( name )) : defaultY [i];
     }
-    maxVertices = ( int ) ( noVertices * FACTOR_VERTEX );
-    newVertices = ( wVertex * ) malloc ( sizeof ( wVertex ) * maxVertices );
-    memcpy ( newVertices, level->GetVertices (), sizeof ( wVertex ) * noVertices );
+}
 
-    Status ( "Creating SEGS ... " );
-    segStart = CreateSegs ( level, options );
+//----------------------------------------------------------------------------
+//  Tune the partition metric for a level.  The level is built once for each
+//    combination of X1, X3 & X4 at half, the same as and twice their current
+//    values.  The builds run in parallel, each from its own copy of the level
+//    read from the WAD.  The tree with the lowest average depth times number
+//    of SEGS wins (ties go to the current weights).  The level is then built
+//    with the winning weights, which are returned in options.  With a time
+//    limit, the trials share half of it (trials that haven't started by then
+//    are skipped) and the final build gets the rest.
+//----------------------------------------------------------------------------
 
-    Status ( "Getting LineDef Aliases ... " );
-    noAliases = GetLineDefAliases ( level, segStart, segCount );
+#define TUNE_STEPS              3
 
-    lineChecked = new char [ noAliases ];
-    lineUsed    = new char [ noAliases ];
-    memset ( lineUsed, false, sizeof ( char ) * noAliases );
+static const double tuneScale [ TUNE_STEPS ] = { 0.5, 1.0, 2.0 };
 
-    Status ( "Creating Side Info ... " );
-    CreateSideInfo ( level );
+struct sTuneTrial {
+    const DoomLevel  *source;
+    sLock            *lock;			// only one copy is read from the WAD at a time
+    sBSPOptions       options;
+    bool              timeLimited;
+    UINT32            deadline;			// trials aren't started after this
+    bool              built;
+    double            score;
+};
 
-    score = ( options->algorithm == 2 ) ? new sScoreInfo [ noAliases ] : NULL;
+static void BuildTrial ( void *data, int index, int )
+{
+    FUNCTION_ENTRY ( NULL, "BuildTrial", true );
 
-    convexList = new int [ noAliases ];
-    convexPtr  = convexList;
+    sTuneTrial *trial = &(( sTuneTrial * ) data ) [ index ];
 
-    Status ( "Creating NODES ... " );
+    if (( index > 0 ) && ( trial->timeLimited == true ) && (( INT32 ) ( CurrentTime () - trial->deadline ) >= 0 )) return;
 
-    nodesLeft   = ( int ) ( FACTOR_NODE * level->SideDefCount ());
-    nodePool    = ( wNode * ) malloc( sizeof ( wNode ) * nodesLeft );
+    Lock ( trial->lock );
+    DoomLevel *level = new DoomLevel ( trial->source->Name (), ( WAD * ) trial->source->GetWAD ());
+    Unlock ( trial->lock );
 
-    ssectorsLeft = ( int ) ( FACTOR_NODE * level->SideDefCount ());
-    ssectorPool  = ( wSSector * ) malloc ( sizeof ( wSSector ) * ssectorsLeft );
+    BSPArena arena;
+    BSPBuilder builder ( level, &trial->options, &arena );
+    builder.Build ();
 
-    int noSegs = segCount;
-    CreateNode ( segStart, &noSegs );
+    trial->score = trial->options.avgDepth * trial->options.segCount;
+    trial->built = true;
 
-    delete [] convexList;
-    if ( score ) delete [] score;
+    delete level;
+}
 
-    // Clean up temporary buffers
-    Status ( "Cleaning up ... " );
-    delete [] sideInfo;
-    delete [] lineDefAlias;
-    delete [] lineChecked;
-    delete [] lineUsed;
-    delete [] keepUnique;
-    delete [] usedSector;
+void TuneNODES ( DoomLevel *level, sBSPOptions *options, BSPArena *arena )
+{
+    FUNCTION_ENTRY ( NULL, "TuneNODES", true );
+
+    // ALGORITHM 5 doesn't use the weights
+    if ( options->algorithm == 5 ) {
+        CreateNODES ( level, options, arena );
+        return;
+    }
+
+    UINT32 tuneStart = CurrentTime ();
+
+    int noTrials = TUNE_STEPS * TUNE_STEPS * TUNE_STEPS;
+    sTuneTrial *trial = new sTuneTrial [ noTrials ];
+    sLock *lock = NewLock ();
+
+    // The trials run a few at a time, so each batch gets an equal share
+    int trialLimit = 0;
+    if ( options->timeLimit > 0 ) {
+        int batches = ( noTrials + ThreadCount () - 1 ) / ThreadCount ();
+        trialLimit = ( options->timeLimit / 2 ) / batches;
+        if ( trialLimit < 1 ) trialLimit = 1;
+    }
+
+    for ( int i = 0; i < noTrials; i++ ) {
+        trial [i].source  = level;
+        trial [i].lock    = lock;
+        trial [i].options = *options;
+        trial [i].built   = false;
+        trial [i].score   = 0.0;
+
+        trial [i].timeLimited = ( options->timeLimit > 0 ) ? true : false;
+        trial [i].deadline    = tuneStart + options->timeLimit / 2;
+
+        // Only the tree itself is scored
+        sBSPOptions *trialOptions = &trial [i].options;
+        trialOptions->showProgress = false;
+        trialOptions->quiet        = true;
+        trialOptions->timeLimit    = trialLimit;
+        trialOptions->glNodes      = false;
+        trialOptions->nodeOrder    = NODE_ORDER_POST;
+        trialOptions->sortVertices = false;
+
+        // Start from the middle so the first trial, which is always built, uses the current weights
+        int step = ( i + noTrials / 2 ) % noTrials;
+        trialOptions->weightX [0] = lrint ( options->weightX [0] * tuneScale [ step % TUNE_STEPS ] );
+        trialOptions->weightX [2] = lrint ( options->weightX [2] * tuneScale [ ( step / TUNE_STEPS ) % TUNE_STEPS ] );
+        trialOptions->weightX [3] = lrint ( options->weightX [3] * tuneScale [ step / ( TUNE_STEPS * TUNE_STEPS ) ] );
+    }
+
+    Status ( "Tuning NODES ... " );
+    RunParallel ( BuildTrial, trial, noTrials );
 
-    sideInfo = NULL;
+    int best = 0;
+    for ( int i = 1; i < noTrials; i++ ) {
+        if (( trial [i].built == true ) && ( trial [i].score < trial [best].score )) best = i;
+    }
+
+    memcpy ( options->weightX, trial [best].options.weightX, sizeof ( options->weightX ));
 
-    level->NewVertices ( noVertices, GetVertices ());
-    level->NewNodes ( nodeCount, GetNodes ( nodePool, nodeCount ));
-    level->NewSubSectors ( ssectorCount, GetSSectors ( ssectorPool, ssectorCount ));
-    level->NewSegs ( segCount, GetSegs ());
+    FreeLock ( lock );
+    delete [] trial;
+
+    int timeLimit = options->timeLimit;
+    if ( timeLimit > 0 ) {
+        int left = ( int ) TimeLeft ( timeLimit, tuneStart );
+        options->timeLimit = ( left > 0 ) ? left : 1;
+    }
 
-    free ( newVertices );
-    free ( ssectorPool );
-    free ( nodePool );
+    CreateNODES ( level, options, arena );
 
-    delete [] tempSeg;
+    options->timeLimit = timeLimit;
 }
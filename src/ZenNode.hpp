@@ -22,6 +22,8 @@
   #include "level.hpp"
 #endif
 
+struct sLock;
+
 struct sBlockMapOptions {
     bool  Rebuild;
     bool  Compress;
@@ -33,6 +35,18 @@ struct sNodeOptions {
     bool  Quiet;
     bool  Unique;
     bool  ReduceLineDefs;
+    int   Threads;
+    int   SideCache;
+    int   TimeLimit;
+    int   Format;
+    bool  Extend;
+    bool  GLNodes;
+    int   Order;
+    bool  SortVertices;
+    bool  Tune;
+    int   BeamWidth;
+    int   BeamDepth;
+    bool  Reuse;
 };
 
 struct sBlockList {
@@ -53,32 +67,79 @@ struct sBlockMap {
 typedef unsigned short BAM;
 typedef long double REAL;		// Must have at least 50 significant bits
 
-struct sVertex {
-    double x;
-    double y;
-    double l;
+// SEGs are kept in a pool and referred to by index.  The parts looked at
+//   while choosing a partition are stored apart from the rest of the SEG.
+struct sSegCoords {
+    double          startX, startY;
+    double          endX, endY;
 };
 
-struct SEG {
-    wSegs           Data;
-    const wLineDef *LineDef;
+struct sSegInfo {
+    int             LineDef;
+    int             Alias;
     int             Sector;
-    int             Side;
     int             AliasFlip;
     bool            Split;
     bool            DontSplit;
     bool            final;
-    sVertex         start;
-    sVertex         end;
+    bool            changed;			// not the same as the old SEGS (see FindChanges)
+};
+
+struct SEG {
+    wSegs           Data;
+    const wLineDef *LineDef;
+    double          startL;			// position of the endpoints along the LINEDEF
+    double          endL;
+};
+
+#define SEG_CHUNK_BITS		8
+#define SEG_CHUNK_SIZE		( 1 << SEG_CHUNK_BITS )
+#define SEG_CHUNK_MASK		( SEG_CHUNK_SIZE - 1 )
+#define MAX_SEG_CHUNKS		65536
+
+// Marks a SEG vertex as an index into m_FixedVertex until they are numbered
+#define FIXED_VERTEX		0x80000000UL
+
+// Order of the NODES - the root is always last
+#define NODE_ORDER_POST		0		// each NODE follows its children
+#define NODE_ORDER_HOT		1		// depth first, biggest child first
+#define NODE_ORDER_VEB		2		// van Emde Boas
+
+// SEGs are allocated a chunk at a time so they never move once created
+struct sSegChunk {
+    sSegCoords      coords [ SEG_CHUNK_SIZE ];
+    sSegInfo        info [ SEG_CHUNK_SIZE ];
+    SEG             data [ SEG_CHUNK_SIZE ];
 };
 
 struct sBSPOptions {
     int       algorithm;
     bool      showProgress;
+    bool      quiet;			// don't report each step of the build
     bool      reduceLineDefs;		// global flag for invisible linedefs
     bool     *ignoreLineDef;		// linedefs that can be left out
     bool     *dontSplit;		// linedefs that can't be split
     bool     *keepUnique;		// unique sector requirements
+    int       sideCacheSize;		// MB of side info to keep (0 = no limit)
+    int       timeLimit;		// ms allowed for the NODES of each level (0 = no limit)
+    int       nodeFormat;		// NODES_xxx to be written
+    bool      extendNodes;		// switch to ZNOD if the level doesn't fit NODES_VANILLA
+    bool      glNodes;			// also write GL nodes (v5) for the same tree
+    int       nodeOrder;		// NODE_ORDER_xxx used to number the NODES
+    double    cacheLines [2];		// returned: cache lines read per lookup before & after ordering
+    bool      sortVertices;		// number VERTEXES in the order the SEGS use them
+    double    vertexLines [2];		// returned: cache lines of VERTEXES read per SSECTOR before & after sorting
+    long      weightX [4];		// X1-X4 - penalty for splits in the partition metric
+    long      weightY [4];		// Y1-Y4
+    int       beamWidth;		// partitions looked ahead at each NODE (1 = none)
+    int       beamDepth;		// levels each of them is looked ahead
+    bool      reuseNodes;		// keep the parts of the existing NODES that haven't changed
+    int       reusedNodes;		// returned: old NODES kept (-1 if there were none that could be used)
+    int       changedSegs;		// returned: new SEGs that were added or changed
+    int       removedSegs;		// returned: sides of LINEDEFs in the old NODES that are gone
+    int       maxDepth;			// returned: depth of the tree (counted the same way as bspinfo)
+    double    avgDepth;			// returned: average depth of a SSECTOR
+    int       segCount;			// returned: number of SEGS
 };
 
 struct sScoreInfo {
@@ -89,6 +150,307 @@ struct sScoreInfo {
     int       total;
 };
 
+// The partition line currently being evaluated - each thread has its own copy
+struct sPartition {
+    double    X, Y;			// starting point
+    double    DX, DY;			// offset to ending point
+    double    H;			// DX*DX + DY*DY
+    bool      exact;			// X, Y, DX & DY are all integers
+    INT64     intX, intY;		// ... and their exact values (if exact)
+    INT64     intDX, intDY;
+    long      ANGLE;
+    int       currentAlias;
+    UINT32   *currentSide;		// side info row for currentAlias (may be NULL)
+};
+
+struct sCandidate {
+    int       index;			// index of the SEG within the current list
+    int       alias;
+    bool      valid;			// false if the SEG is too short to be used
+    bool      pruned;			// true if more than maxSplits SEGs were split
+    long      maxSplits;
+    long      angle;
+    int       count [3];		// SEGs to the left/split/right of the partition
+    int       sectors [3];		// sectors to the left/split/right of the partition
+    int       invalid;			// non-splittable SEGs that would be split
+    wBound    bound [2];		// SEGs to the left/right (split SEGs are in both)
+};
+
+// A box around SEGs that lie close together.  Groups are stored in preorder:
+//   the children of a group follow it, and next is the first group after
+//   the last of them (next == index + 1 for a group with no children).
+struct sSegGroup {
+    wBound      bound;			// bounding box of the SEGs
+    int         first;			// first SEG in sSegGroups::segs
+    int         noSegs;
+    int         firstSector;		// sectors that also have SEGs outside the group (see GroupSectors)
+    int         noSectors;
+    int         noInside;		// sectors with all of their SEGs in the group
+    int         next;
+};
+
+struct sSegGroups {
+    int        *segs;			// SEGs ordered so each group is contiguous
+    int        *sectors;		// dense sector numbers (NULL until GroupSectors is called)
+    sSegGroup  *group;
+    int         noGroups;
+    int         noSectors;
+};
+
+// State used while building a subtree - each task has its own copy
+struct sBSPTask {
+    char       *lineUsed;		// aliases used/convex in this part of the tree
+    char       *lineChecked;
+    int        *convexList;
+    int        *convexPtr;
+    sCandidate *candidateList;
+    sScoreInfo *score;
+    UINT8      *usedSector;		// one list of sectors for each candidate
+    int        *sectorMap;		// dense number of each sector used by the current NODE (-1 if unused)
+    sSegGroups *groups;			// SEGs being partitioned (NULL for short lists)
+    int         nextSeg;		// SEGs reserved for the splits made by this task
+    int         lastSeg;
+    bool        showProgress;
+    bool        timeLimited;
+    UINT32      deadline;		// when the search for the current partition has to stop
+};
+
+// A NODE or SSECTOR - these are numbered once the whole tree has been built
+struct sBSPNode {
+    wNode       data;			// partition line & bounding boxes
+    sBSPNode   *child [2];		// NULL for an SSECTOR
+    int        *segs;			// SEGs in the SSECTOR
+    int         noSegs;
+};
+
+// A SEG from the NODES the level had before it was rebuilt
+struct sOldSeg {
+    sSegCoords  coords;
+    int         lineDef;
+    int         flip;
+    BAM         angle;			// direction & distance along the LINEDEF when it was built
+    int         offset;
+};
+
+struct sOldTree {
+    wNode      *node;			// the root is the last NODE
+    int         noNodes;
+    sOldSeg    *seg;
+    int         noSegs;
+};
+
+// A partition line above the SSECTOR being stored - the right side is kept
+struct sGLLine {
+    double      x, y;
+    double      dx, dy;			// unit vector
+};
+
+//----------------------------------------------------------------------------
+//  A bump allocator for the arrays used while the BSP tree is stored.  The
+//    memory is kept when the arena is reset, so the next level can use it
+//    again.  It is not thread safe.
+//----------------------------------------------------------------------------
+
+struct sArenaBlock;
+
+class BSPArena {
+
+    sArenaBlock  *m_Block;			// the current block, older ones follow it
+    size_t        m_Peak;			// most bytes in use at once
+
+public:
+
+    BSPArena ();
+    ~BSPArena ();
+
+    void   *Allocate ( size_t );
+    size_t  Mark () const;
+    void    Release ( size_t );
+    void    Reset ();
+};
+
+class BSPBuilder {
+
+    DoomLevel    *m_Level;
+    sBSPOptions  *m_Options;
+    BSPArena     *m_Arena;
+
+    int           m_MaxVertices;
+
+    wNodeEx      *m_NodePool;
+    int           m_NodeCount;			// Number of NODES stored
+
+    sSegChunk   **m_SegChunk;
+    volatile int  m_NoSegChunks;
+    int           m_SegCount;			// Number of SEGS stored
+    wSegsEx      *m_FinalSegs;
+
+    wSSectorEx   *m_SSectorPool;
+    int           m_SSectorCount;		// Number of SSECTORS stored
+
+    wVertex      *m_NewVertices;
+    int           m_NoVertices;
+    VertexHash   *m_VertexHash;			// finds existing entries in m_NewVertices
+
+    bool          m_FixedPoint;			// split points are kept in 16.16 fixed point
+    wVertexEx    *m_FixedVertex;
+    int           m_NoFixedVertices;
+    int           m_MaxFixedVertices;
+
+    bool          m_GLNodes;			// build GL nodes while storing the tree
+    double        m_GLBound [4];		// minX, minY, maxX & maxY of the level plus a margin
+    sGLLine      *m_GLClip;			// partition lines from the root to the current NODE
+    int           m_GLDepth;
+    int           m_MaxGLDepth;
+    wVertexEx    *m_GLVertex;
+    int           m_NoGLVertices;
+    int           m_MaxGLVertices;
+    wGLSegsEx    *m_GLSegs;
+    int           m_GLSegCount;
+    int           m_MaxGLSegs;
+    wSSectorEx   *m_GLSSectorPool;		// one for each SSECTOR
+
+    int           m_SectorCount;
+
+    bool          m_ShowProgress;
+    bool         *m_KeepUnique;
+    bool          m_UniqueSubsectors;
+    int           m_NoAliases;
+    int          *m_LineDefAlias;
+
+    UINT32      **m_SideInfo;			// 2 bits per LINEDEF for each alias, allocated as needed
+    int          *m_SideUsers;			// partitions currently using each row
+    UINT8        *m_SideRecent;			// set when a row is used, cleared by the eviction clock
+    int          *m_SideSlot;			// alias owning each row when there is a limit
+    int           m_SideWords;			// UINT32s in each row
+    int           m_SideRows;			// rows allocated so far
+    int           m_MaxSideRows;		// 0 = no limit
+    int           m_SideClock;			// next slot examined for eviction
+    sLock        *m_SideLock;
+
+    int           m_MaxCandidates;		// candidate partitions evaluated in parallel
+    bool          m_GroupSegs;			// group long lists of SEGs by position (see GroupSegs)
+    int           m_BeamWidth;			// partitions looked ahead at each NODE (see BeamSearch)
+    int           m_BeamDepth;
+
+    sOldTree     *m_OldTree;			// NODES the level had before (see ReuseNode)
+    int           m_ReusedNodes;
+
+    long          m_X1, m_X2, m_X3, m_X4;
+    long          m_Y1, m_Y2, m_Y3, m_Y4;
+
+    int ( BSPBuilder::*m_PartitionFunction ) ( sBSPTask *, int *, int );
+
+    sSegCoords *Coords ( int seg )	{ return &m_SegChunk [ seg >> SEG_CHUNK_BITS ]->coords [ seg & SEG_CHUNK_MASK ]; }
+    sSegInfo   *Info ( int seg )	{ return &m_SegChunk [ seg >> SEG_CHUNK_BITS ]->info [ seg & SEG_CHUNK_MASK ]; }
+    SEG        *Seg ( int seg )		{ return &m_SegChunk [ seg >> SEG_CHUNK_BITS ]->data [ seg & SEG_CHUNK_MASK ]; }
+
+    int  NewSeg ( sBSPTask * );
+    int *CreateSegs ( DoomLevel *, sBSPOptions * );
+    void ComputeStaticVariables ( sPartition *, int );
+    bool CoLinear ( const sPartition *, int );
+    void FindBounds ( wBound *, int *, int );
+    int  _WhichSide ( const sPartition *, int );
+    int  KnownSide ( const sPartition *, int );
+    int  WhichSide ( const sPartition *, int );
+#if defined ( DEBUG )
+    int  dbgWhichSide ( const sPartition *, int );
+    void DumpSegs ( sBSPTask *, int *, int );
+    void CheckConvexAlias ( int, int *, int );
+#endif
+    void ClassifySegs ( const sPartition *, const int *, int, signed char *, int * );
+    void AddGroup ( sSegGroups *, int, int );
+    sSegGroups *GroupSegs ( int *, int );
+    void GroupSectors ( sSegGroups *, const int *, int );
+    void FreeGroups ( sSegGroups * );
+    void CreateSideInfo ( DoomLevel * );
+    void FreeSideInfo ();
+    UINT32 *EvictSideInfo ( int );
+    void AcquireSideInfo ( sPartition * );
+    void ReleaseSideInfo ( sPartition * );
+    int  AddVertex ( int, int );
+    int  GetLineDefAliases ( DoomLevel *, int *, int );
+    void SortByAngle ( int *, int );
+    void SortByLineDef ( int *, int );
+    void SortByPriority ( int *, int );
+    void RenumberSegs ( int *, int );
+
+    void DivideSeg ( const sPartition *, int, int );
+    void SplitSegs ( sBSPTask *, const sPartition *, int *, int *, int );
+    void PartitionSegs ( sBSPTask *, sPartition *, int *, int, int **, int *, int **, int *, wBound * );
+    void SortSegs ( sBSPTask *, sPartition *, int, int *, int, int **, int *, int **, int *, wBound * );
+    bool ChoosePartition ( sBSPTask *, sPartition *, int *, int, int **, int *, int **, int *, wBound * );
+    bool IsConvex ( int *, int );
+
+    int  GetCandidates ( sBSPTask *, int *, int, int, int, int * );
+    static void EvaluateCandidate ( void *, int, int );
+
+    int  Algorithm1 ( sBSPTask *, int *, int );
+    int  Algorithm2 ( sBSPTask *, int *, int );
+    int  Algorithm3 ( sBSPTask *, int *, int );
+    int  Algorithm4 ( sBSPTask *, int *, int );
+    int  Algorithm5 ( sBSPTask *, int *, int );
+
+    long   SplitMetric ( const sCandidate * );
+    int    CheapPartition ( const char *, int *, int );
+    double LookAhead ( const char *, int *, int, int, int, int );
+    static void EvaluateBeam ( void *, int, int );
+    int    BeamSearch ( sBSPTask *, int *, int, int );
+
+    bool KeepUniqueSubsectors ( int *, int );
+#if defined ( DIAGNOSTIC )
+    void PrintKeepUniqueSegs ( int *, int, const char * = NULL );
+    void VerifyNode ( int *, int, double, double, double, double );
+#endif
+    void ArrangeSegs ( int *, int );
+    void MakePartition ( sPartition *, int *, int, int *, int * );
+    sBSPNode *GenerateUniqueSectors ( sBSPTask *, int *, int );
+
+    sBSPTask *NewTask ( const char *, bool );
+    void FreeTask ( sBSPTask * );
+
+    static void BuildSubtree ( void *, int, int );
+    sBSPNode *CreateSSector ( int *, int );
+    sBSPNode *CreateNode ( sBSPTask *, int *, int, double );
+
+    sSegCoords *FindChanges ( int *, int, int *, int *, int * );
+    sBSPNode   *ReuseNode ( sBSPTask *, int, int *, int, sSegCoords *, int );
+
+    bool      JoinSegs ( int, int );
+    int       MergeSegs ( int *, int );
+    sBSPNode *MergeSSectors ( sBSPNode * );
+
+    UINT32 AddSegVertex ( double, double );
+    void   NumberFixedVertices ();
+
+    UINT32 AddGLVertex ( double, double );
+    void   StoreGLSSector ( int *, int );
+    void   NumberGLVertices ();
+    void   DropGLSegs ();
+    void   FindGLPartners ();
+    void   PushGLClip ( const wNode *, int );
+
+    UINT32 StoreSSector ( sBSPNode * );
+    UINT32 StoreNode ( sBSPNode * );
+
+    bool      FitsVanilla () const;
+    wNode    *GetNodes ( wNodeEx *, int );
+    wSSector *GetSSectors ( wSSectorEx *, int );
+    wSegs    *GetSegs ();
+    wNodeEx  *GetGLNodes ();
+    int       PruneGLNodes ( wNodeEx *, int * );
+    void      ArrangeNodes ( int, int, wNodeEx *, double * );
+    void      SortVertices ( DoomLevel *, double * );
+    void      TreeDepth ( int *, double * );
+
+public:
+
+    BSPBuilder ( DoomLevel *, sBSPOptions *, BSPArena * );
+    ~BSPBuilder ();
+
+    void Build ();
+};
+
 #define sgn(a)		((0<(a))-((a)<0))
 
 #define BAM90		(( BAM ) 0x4000 )	// BAM:  90 ( )
@@ -101,6 +463,8 @@ struct sScoreInfo {
 #define SIDE_SPLIT		 0
 #define SIDE_RIGHT		 1
 
+#define NO_SEG			-1
+
 #define SIDE_FLIPPED		0xFFFFFFFE
 #define SIDE_NORMAL		0
 
@@ -109,6 +473,13 @@ struct sScoreInfo {
 #define RIGHT			2
 
 #define IS_LEFT_RIGHT(s)	( s & 1 )
+
+// Side info rows hold ( side + 2 ) in 2 bits per LINEDEF, so 0 is SIDE_UNKNOWN.
+//   Several threads fill in entries of the same row, so each word is read and
+//   updated atomically.  An entry is only ever set once, so no ordering is needed.
+#define SIDES_PER_WORD		16
+#define GET_SIDE(r,l)		(( int )(( __atomic_load_n ( &r [ (l) >> 4 ], __ATOMIC_RELAXED ) >> ((( l ) & 15 ) << 1 )) & 3 ) - 2 )
+#define PUT_SIDE(r,l,s)		( __atomic_fetch_or ( &r [ (l) >> 4 ], ( UINT32 )( (s) + 2 ) << ((( l ) & 15 ) << 1 ), __ATOMIC_RELAXED ))
 #define FLIP(c,s)		( c ^ s )
 
 // ---- ZenReject structures to support RMB options ----
@@ -216,7 +587,9 @@ bool ParseOptionRMB ( int, const char *, sRejectOptionRMB * );
 
 extern sBlockMap *GenerateBLOCKMAP ( DoomLevel *level );
 extern int  CreateBLOCKMAP ( DoomLevel *level, const sBlockMapOptions &options );
-extern void CreateNODES ( DoomLevel *level, sBSPOptions *options );
+extern void GetMetricWeights ( sBSPOptions *options );
+extern void CreateNODES ( DoomLevel *level, sBSPOptions *options, BSPArena *arena = NULL );
+extern void TuneNODES ( DoomLevel *level, sBSPOptions *options, BSPArena *arena = NULL );
 extern bool CreateREJECT ( DoomLevel *level, const sRejectOptions &options );
 
 #endif
@@ -375,6 +375,12 @@ int ProcessLevel ( char *name, wadList *myList1, wadList *myList2 )
         goto done;
     }
 
+    if (( srcLevel->NodeFormat () != NODES_VANILLA ) || ( tgtLevel->NodeFormat () != NODES_VANILLA )) {
+        Status ( "Extended NODES can't be compared... " );
+        mismatches = -1;
+        goto done;
+    }
+
     {
         NormalizeNODES (( wNode * ) srcLevel->GetNodes (), srcLevel->NodeCount ());
         NormalizeNODES (( wNode * ) tgtLevel->GetNodes (), tgtLevel->NodeCount ());
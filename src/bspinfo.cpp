@@ -307,6 +307,101 @@ int Traverse ( int index, int depth, int &diagonals, int &balance, int &lChildre
     return (( lDepth > rDepth ) ? lDepth : rDepth );
 }
 
+struct sPoint {
+    double x, y;
+};
+
+// Clip a convex polygon to the part where a * x + b * y + c >= 0
+int ClipPolygon ( double a, double b, double c, const sPoint *in, int noIn, sPoint *out )
+{
+    FUNCTION_ENTRY ( NULL, "ClipPolygon", false );
+
+    int noOut = 0;
+
+    for ( int i = 0; i < noIn; i++ ) {
+        const sPoint *p = &in [i];
+        const sPoint *q = &in [ ( i + 1 ) % noIn ];
+        double dp = a * p->x + b * p->y + c;
+        double dq = a * q->x + b * q->y + c;
+        if ( dp >= 0.0 ) out [noOut++] = *p;
+        if ((( dp < 0.0 ) && ( dq > 0.0 )) || (( dp > 0.0 ) && ( dq < 0.0 ))) {
+            double t = dp / ( dp - dq );
+            out [noOut].x = p->x + t * ( q->x - p->x );
+            out [noOut].y = p->y + t * ( q->y - p->y );
+            noOut++;
+        }
+    }
+
+    return noOut;
+}
+
+double PolygonArea ( const sPoint *point, int noPoints )
+{
+    FUNCTION_ENTRY ( NULL, "PolygonArea", false );
+
+    double sum = 0.0;
+    for ( int i = 0; i < noPoints; i++ ) {
+        const sPoint *p = &point [i];
+        const sPoint *q = &point [ ( i + 1 ) % noPoints ];
+        sum += p->x * q->y - q->x * p->y;
+    }
+
+    return fabs ( sum ) / 2.0;
+}
+
+//----------------------------------------------------------------------------
+//  The region of each SSECTOR is what's left of its parent's region on its
+//    side of the partition line, cut down to the bounding box stored in the
+//    parent NODE.  Returns the sum of each SSECTOR's depth times its area,
+//    and adds the areas to area.
+//----------------------------------------------------------------------------
+
+double AreaDepth ( int index, int depth, const sPoint *region, int noPoints, double &area )
+{
+    FUNCTION_ENTRY ( NULL, "AreaDepth", false );
+
+    const wNode *node = &nodes [ index ];
+
+    depth++;
+
+    double total = 0.0;
+    sPoint *child = new sPoint [ noPoints + 5 ];
+    sPoint *temp  = new sPoint [ noPoints + 5 ];
+
+    for ( int i = 0; i < 2; i++ ) {
+
+        // child [0] is on the right side of the partition line
+        double sign = ( i == 0 ) ? 1.0 : -1.0;
+        double a = sign * node->dy;
+        double b = sign * -node->dx;
+        double c = sign * (( double ) node->dx * node->y - ( double ) node->dy * node->x );
+        int count = ClipPolygon ( a, b, c, region, noPoints, child );
+        if ( count < 3 ) continue;
+
+        if (( node->child [i] & 0x8000 ) == 0 ) {
+            total += AreaDepth ( node->child [i], depth, child, count, area );
+            continue;
+        }
+
+        const wBound *bound = &node->side [i];
+        count = ClipPolygon (  1.0,  0.0, -bound->minx, child, count, temp );
+        count = ClipPolygon ( -1.0,  0.0,  bound->maxx, temp, count, child );
+        count = ClipPolygon (  0.0,  1.0, -bound->miny, child, count, temp );
+        count = ClipPolygon (  0.0, -1.0,  bound->maxy, temp, count, child );
+        if ( count < 3 ) continue;
+
+        // Same depth as Traverse uses for a SSECTOR
+        double size = PolygonArea ( child, count );
+        total += size * ( depth + 1 );
+        area  += size;
+    }
+
+    delete [] temp;
+    delete [] child;
+
+    return total;
+}
+
 void AnalyzeBSP ( DoomLevel *curLevel )
 {
     FUNCTION_ENTRY ( NULL, "AnalyzeBSP", true );
@@ -316,6 +411,11 @@ void AnalyzeBSP ( DoomLevel *curLevel )
         return;
     }
 
+    if ( curLevel->NodeFormat () != NODES_VANILLA ) {
+        printf ( "******** Extended NODES are not supported ********" );
+        return;
+    }
+
     totalDepth = 0;
 
     nodes = curLevel->GetNodes ();
@@ -326,6 +426,17 @@ void AnalyzeBSP ( DoomLevel *curLevel )
     int right = 0;
     int depth = Traverse ( curLevel->NodeCount () - 1, 0, diagonals, balance, left, right );
 
+    // Start with the bounding box of the whole level
+    const wNode *root = &nodes [ curLevel->NodeCount () - 1 ];
+    sPoint box [4];
+    box [0].x = box [3].x = ( root->side [0].minx < root->side [1].minx ) ? root->side [0].minx : root->side [1].minx;
+    box [1].x = box [2].x = ( root->side [0].maxx > root->side [1].maxx ) ? root->side [0].maxx : root->side [1].maxx;
+    box [0].y = box [1].y = ( root->side [0].miny < root->side [1].miny ) ? root->side [0].miny : root->side [1].miny;
+    box [2].y = box [3].y = ( root->side [0].maxy > root->side [1].maxy ) ? root->side [0].maxy : root->side [1].maxy;
+
+    double area = 0.0;
+    double areaDepth = AreaDepth ( curLevel->NodeCount () - 1, 0, box, 4, area );
+
     const wSegs *seg = curLevel->GetSegs ();
     const wLineDef *lineDef = curLevel->GetLineDefs ();
 
@@ -358,6 +469,7 @@ void AnalyzeBSP ( DoomLevel *curLevel )
         float avgDepth = noLeafs ? ( float ) totalDepth / ( float ) noLeafs : 0;
         printf ( "%2d  ", depth );
         printf ( "%4.1f   ", avgDepth );
+        printf ( "%4.1f   ", ( area > 0.0 ) ? areaDepth / area : 0.0 );
         printf ( "%5.3f   ", score );
         printf ( "%5.3f ", ( left < right ) ? ( double ) left / ( double ) right : ( double ) right / ( double ) left );
         printf ( "%5d - %4.1f%% ", splits, 100.0 * splits / sideDefs );
@@ -404,8 +516,8 @@ int main ( int argc, const char *argv[] )
         }
 
         if ( ! flags.Tree ) {
-            printf ( "          Max   Avg\n" );
-            printf ( "         Depth Depth   FOM   Balance    Splits       Diagonals  Nodes  Segs\n" );
+            printf ( "          Max   Avg   Area\n" );
+            printf ( "         Depth Depth  Depth   FOM   Balance    Splits       Diagonals  Nodes  Segs\n" );
         }
 
         int noLevels = 0;
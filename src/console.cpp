@@ -31,7 +31,9 @@
     #include <stdarg.h>
     #include <stdio.h>
     #include <stdlib.h>
+    #include <pthread.h>
     #include <signal.h>
+    #include <string.h>
     #include <sys/time.h>
     #include <termios.h>
     #include <unistd.h>
@@ -123,6 +125,15 @@ void ShowProgress ()
     VioWrtNChar (( BYTE * ) &progress [ progressIndex++ % SIZE ( progress )], 1, curY, curX, hVio );
 }
 
+// Progress is drawn as it is made
+void StartProgress ()
+{
+}
+
+void StopProgress ()
+{
+}
+
 void MoveUp ( int delta )
 {
     curY -= delta;
@@ -326,6 +337,15 @@ void ShowProgress ()
     WriteConsoleOutputCharacter ( hOutput, &progress [ progressIndex++ % SIZE ( progress )], 1, currentPos, &count );
 }
 
+// Progress is drawn as it is made
+void StartProgress ()
+{
+}
+
+void StopProgress ()
+{
+}
+
 #elif defined ( __GNUC__ ) || defined ( __INTEL_COMPILER )
 
 static FILE *console;
@@ -504,40 +524,153 @@ void GotoXY ( UINT32 x, UINT32 y )
     curY = y;
 }
 
+//----------------------------------------------------------------------------
+//  While the NODES are being built, the trail of R's & L's leading to the
+//    current NODE and the progress spinner are only recorded here.  Each
+//    call costs no more than a store or a relaxed atomic increment, and a
+//    reporter thread redraws the line at most PROGRESS_RATE times a second.
+//    If the console isn't a terminal, the reporter prints a line of
+//    key=value pairs every PROGRESS_LINE_SECS seconds instead: the status
+//    message, the current depth, the number of NODEs & SSECTORs finished
+//    and the number of calls to ShowProgress so far.
+//----------------------------------------------------------------------------
+
+#define PROGRESS_RATE           10
+#define PROGRESS_LINE_SECS      1
+#define MAX_PROGRESS_DEPTH      256
+
+static char             statusMessage [ 80 ];
+static volatile char    progressPath [ MAX_PROGRESS_DEPTH ];
+static volatile int     progressDepth;
+static volatile int     progressCount;		// calls to ShowProgress
+static volatile int     progressDone;		// calls to ShowDone
+static volatile int     progressDoneAt;		// progressCount at the last call to ShowDone
+
+static pthread_mutex_t  progressMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   progressCond  = PTHREAD_COND_INITIALIZER;
+static pthread_t        progressThread;
+static bool             progressRunning;
+static bool             progressLines;		// print lines instead of redrawing
+
+static void DrawProgress ()
+{
+    char path [ MAX_PROGRESS_DEPTH ];
+
+    int depth  = __atomic_load_n ( &progressDepth, __ATOMIC_ACQUIRE );
+    int count  = __atomic_load_n ( &progressCount, __ATOMIC_RELAXED );
+    int done   = __atomic_load_n ( &progressDone, __ATOMIC_RELAXED );
+    int doneAt = __atomic_load_n ( &progressDoneAt, __ATOMIC_RELAXED );
+
+    if ( progressLines == true ) {
+        // Leave off any trailing " ... "
+        int length = strlen ( statusMessage );
+        while (( length > 0 ) && (( statusMessage [ length - 1 ] == ' ' ) || ( statusMessage [ length - 1 ] == '.' ))) length--;
+        fprintf ( console, "progress status=\"%.*s\" depth=%d done=%d steps=%d\n", length, statusMessage, depth, done, count );
+        fflush ( console );
+        return;
+    }
+
+    int length = ( depth < MAX_PROGRESS_DEPTH ) ? depth : MAX_PROGRESS_DEPTH;
+    for ( int i = 0; i < length; i++ ) path [i] = progressPath [i];
+    char spinner = ( doneAt == count ) ? '*' : progress [ count % SIZE ( progress )];
+
+    fprintf ( console, "\033[%dG%s%.*s%c\033[K\033[D", startX, statusMessage, length, path, spinner );
+    fflush ( console );
+}
+
+static void *ProgressThread ( void * )
+{
+    UINT32 interval = ( progressLines == true ) ? 1000 * PROGRESS_LINE_SECS : 1000 / PROGRESS_RATE;
+
+    pthread_mutex_lock ( &progressMutex );
+
+    while ( progressRunning == true ) {
+        timeval now;
+        gettimeofday ( &now, NULL );
+        long usec = now.tv_usec + 1000 * interval;
+        timespec wake;
+        wake.tv_sec  = now.tv_sec + usec / 1000000;
+        wake.tv_nsec = ( usec % 1000000 ) * 1000;
+        pthread_cond_timedwait ( &progressCond, &progressMutex, &wake );
+        if ( progressRunning == true ) DrawProgress ();
+    }
+
+    pthread_mutex_unlock ( &progressMutex );
+
+    return NULL;
+}
+
+void StartProgress ()
+{
+    progressDepth  = 0;
+    progressCount  = 0;
+    progressDone   = 0;
+    progressDoneAt = -1;
+    progressLines  = isatty ( fileno ( console )) ? false : true;
+
+    progressRunning = true;
+    if ( pthread_create ( &progressThread, NULL, ProgressThread, NULL ) != 0 ) {
+        progressRunning = false;
+    }
+}
+
+void StopProgress ()
+{
+    if ( progressRunning == false ) return;
+
+    pthread_mutex_lock ( &progressMutex );
+    progressRunning = false;
+    pthread_cond_signal ( &progressCond );
+    pthread_mutex_unlock ( &progressMutex );
+
+    pthread_join ( progressThread, NULL );
+
+    if ( progressLines == false ) DrawProgress ();
+}
+
 void Status ( const char *message )
 {
+    pthread_mutex_lock ( &progressMutex );
+
+    // DrawProgress starts by redrawing the message
+    int length = strlen ( message );
+    if ( length >= ( int ) sizeof ( statusMessage )) length = sizeof ( statusMessage ) - 1;
+    memcpy ( statusMessage, message, length );
+    statusMessage [ length ] = '\0';
+
     fprintf ( console, "\033[%dG%s\033[K", startX, message );
     fflush ( console );
+
+    pthread_mutex_unlock ( &progressMutex );
 }
 
 void GoRight ()
 {
-    fprintf ( console, "R" );
-    fflush ( console );
+    int depth = progressDepth;
+    if ( depth < MAX_PROGRESS_DEPTH ) progressPath [ depth ] = 'R';
+    __atomic_store_n ( &progressDepth, depth + 1, __ATOMIC_RELEASE );
 }
 
 void GoLeft ()
 {
-    fprintf ( console, "\033[DL" );
-    fflush ( console );
+    int depth = progressDepth;
+    if ( depth <= MAX_PROGRESS_DEPTH ) progressPath [ depth - 1 ] = 'L';
 }
 
 void Backup ()
 {
-    fprintf ( console, "\033[D" );
-    fflush ( console );
+    __atomic_store_n ( &progressDepth, progressDepth - 1, __ATOMIC_RELEASE );
 }
 
 void ShowDone ()
 {
-    fprintf ( console, "*\033[D" );
-    fflush ( console );
+    __atomic_fetch_add ( &progressDone, 1, __ATOMIC_RELAXED );
+    __atomic_store_n ( &progressDoneAt, __atomic_load_n ( &progressCount, __ATOMIC_RELAXED ), __ATOMIC_RELAXED );
 }
 
 void ShowProgress ()
 {
-    fprintf ( console, "%c\033[D", progress [ progressIndex++ % SIZE ( progress )] );
-    fflush ( console );
+    __atomic_fetch_add ( &progressCount, 1, __ATOMIC_RELAXED );
 }
 
 void MoveUp ( int delta )
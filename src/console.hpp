@@ -60,5 +60,10 @@ void Backup ();
 void ShowDone ();
 void ShowProgress ();
 
+// Between these calls GoRight/GoLeft/Backup/ShowDone/ShowProgress only record
+//   the progress made, and it is drawn a few times a second by another thread
+void StartProgress ();
+void StopProgress ();
+
 #endif
 
@@ -0,0 +1,383 @@
+//
+// Copyright (c) 2004 Marc Rousseau
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     Worker thread routines used to spread work across processors.  A
+//     fixed set of threads is started once and then handed tasks.  Idle
+//     threads steal tasks queued by busy ones, and a thread waiting for
+//     a task helps out with whatever else is queued, so tasks can safely
+//     queue more tasks.  A pool of one thread simply runs everything
+//     in-line.
+//
+
+#if defined ( __GNUC__ ) || defined ( __INTEL_COMPILER )
+    #include <pthread.h>
+    #include <unistd.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.hpp"
+#include "threads.hpp"
+
+#if defined ( __GNUC__ ) || defined ( __INTEL_COMPILER )
+
+// Each thread keeps its own list of tasks.  New tasks are added to (and
+//   taken from) the end of the list, idle threads steal from the front
+//   of the other threads' lists.
+struct sTaskQueue {
+    pthread_mutex_t  mutex;
+    sTask          **list;
+    int              first;
+    int              last;
+    int              size;
+};
+
+static pthread_mutex_t  idleMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   idleCond  = PTHREAD_COND_INITIALIZER;
+
+static pthread_t       *threadList;
+static sTaskQueue      *queueList;
+static int              noThreads = 1;
+static volatile int     queuedTasks;		// tasks waiting in all the queues
+static volatile bool    shutDown;
+
+static __thread int     threadIndex;
+
+int ProcessorCount ()
+{
+    long count = sysconf ( _SC_NPROCESSORS_ONLN );
+    return ( count > 0 ) ? ( int ) count : 1;
+}
+
+static void WakeThreads ()
+{
+    pthread_mutex_lock ( &idleMutex );
+    pthread_cond_broadcast ( &idleCond );
+    pthread_mutex_unlock ( &idleMutex );
+}
+
+static sTask *PopTask ( sTaskQueue *queue, bool steal )
+{
+    sTask *task = NULL;
+
+    pthread_mutex_lock ( &queue->mutex );
+    if ( queue->last > queue->first ) {
+        task = steal ? queue->list [ queue->first++ ] : queue->list [ --queue->last ];
+        if ( queue->first == queue->last ) queue->first = queue->last = 0;
+    }
+    pthread_mutex_unlock ( &queue->mutex );
+
+    return task;
+}
+
+static sTask *FindTask ()
+{
+    if ( queuedTasks == 0 ) return NULL;
+
+    sTask *task = PopTask ( &queueList [ threadIndex ], false );
+    for ( int i = 1; ( task == NULL ) && ( i < noThreads ); i++ ) {
+        task = PopTask ( &queueList [ ( threadIndex + i ) % noThreads ], true );
+    }
+
+    if ( task != NULL ) __sync_fetch_and_sub ( &queuedTasks, 1 );
+
+    return task;
+}
+
+static void RunTask ( sTask *task )
+{
+    task->function ( task->data, task->index, threadIndex );
+
+    __sync_synchronize ();
+    task->done = true;
+
+    WakeThreads ();
+}
+
+static void *WorkerThread ( void *arg )
+{
+    threadIndex = ( int ) ( long ) arg;
+
+    for ( EVER ) {
+        sTask *task = FindTask ();
+        if ( task != NULL ) {
+            RunTask ( task );
+            continue;
+        }
+        pthread_mutex_lock ( &idleMutex );
+        while (( queuedTasks == 0 ) && ( shutDown == false )) {
+            pthread_cond_wait ( &idleCond, &idleMutex );
+        }
+        pthread_mutex_unlock ( &idleMutex );
+        if ( shutDown == true ) break;
+    }
+
+    return NULL;
+}
+
+void StartThreads ( int count )
+{
+    if ( count <= 0 ) count = ProcessorCount ();
+    if ( count == noThreads ) return;
+
+    StopThreads ();
+
+    threadList = new pthread_t [ count ];
+    queueList  = new sTaskQueue [ count ];
+    memset ( queueList, 0, sizeof ( sTaskQueue ) * count );
+    for ( int i = 0; i < count; i++ ) {
+        pthread_mutex_init ( &queueList [i].mutex, NULL );
+    }
+
+    shutDown    = false;
+    noThreads   = 1;
+    threadIndex = 0;
+
+    // Thread 0 is the caller - only start the extra workers
+    for ( int i = 1; i < count; i++ ) {
+        if ( pthread_create ( &threadList [i], NULL, WorkerThread, ( void * ) ( long ) i ) != 0 ) break;
+        noThreads++;
+    }
+}
+
+void StopThreads ()
+{
+    if ( threadList == NULL ) return;
+
+    pthread_mutex_lock ( &idleMutex );
+    shutDown = true;
+    pthread_cond_broadcast ( &idleCond );
+    pthread_mutex_unlock ( &idleMutex );
+
+    for ( int i = 1; i < noThreads; i++ ) {
+        pthread_join ( threadList [i], NULL );
+    }
+
+    for ( int i = 0; i < noThreads; i++ ) {
+        pthread_mutex_destroy ( &queueList [i].mutex );
+        free ( queueList [i].list );
+    }
+
+    delete [] queueList;
+    delete [] threadList;
+
+    queueList  = NULL;
+    threadList = NULL;
+    noThreads  = 1;
+}
+
+int ThreadCount ()
+{
+    return noThreads;
+}
+
+void QueueTask ( sTask *task )
+{
+    task->done = false;
+
+    if ( noThreads == 1 ) return;
+
+    sTaskQueue *queue = &queueList [ threadIndex ];
+
+    pthread_mutex_lock ( &queue->mutex );
+    if ( queue->last == queue->size ) {
+        if ( queue->first > 0 ) {
+            memmove ( queue->list, queue->list + queue->first, sizeof ( sTask * ) * ( queue->last - queue->first ));
+            queue->last -= queue->first;
+            queue->first = 0;
+        } else {
+            queue->size = queue->size ? 2 * queue->size : 64;
+            queue->list = ( sTask ** ) realloc ( queue->list, sizeof ( sTask * ) * queue->size );
+        }
+    }
+    queue->list [ queue->last++ ] = task;
+    pthread_mutex_unlock ( &queue->mutex );
+
+    __sync_fetch_and_add ( &queuedTasks, 1 );
+
+    WakeThreads ();
+}
+
+bool ClaimTask ( sTask *task )
+{
+    if ( noThreads == 1 ) return true;
+
+    sTaskQueue *queue = &queueList [ threadIndex ];
+    bool claimed = false;
+
+    pthread_mutex_lock ( &queue->mutex );
+    if (( queue->last > queue->first ) && ( queue->list [ queue->last - 1 ] == task )) {
+        queue->last--;
+        if ( queue->first == queue->last ) queue->first = queue->last = 0;
+        claimed = true;
+    }
+    pthread_mutex_unlock ( &queue->mutex );
+
+    if ( claimed == true ) __sync_fetch_and_sub ( &queuedTasks, 1 );
+
+    return claimed;
+}
+
+void WaitTask ( sTask *task )
+{
+    // Help out with other tasks while we wait
+    while ( task->done == false ) {
+        sTask *other = FindTask ();
+        if ( other != NULL ) {
+            RunTask ( other );
+            continue;
+        }
+        pthread_mutex_lock ( &idleMutex );
+        while (( task->done == false ) && ( queuedTasks == 0 )) {
+            pthread_cond_wait ( &idleCond, &idleMutex );
+        }
+        pthread_mutex_unlock ( &idleMutex );
+    }
+
+    __sync_synchronize ();
+}
+
+void RunParallel ( THREAD_FUNCTION function, void *data, int count )
+{
+    if (( noThreads == 1 ) || ( count < 2 )) {
+        for ( int i = 0; i < count; i++ ) function ( data, i, threadIndex );
+        return;
+    }
+
+    sTask *task = new sTask [ count ];
+
+    for ( int i = count - 1; i > 0; i-- ) {
+        task [i].function = function;
+        task [i].data     = data;
+        task [i].index    = i;
+        QueueTask ( &task [i] );
+    }
+
+    function ( data, 0, threadIndex );
+
+    for ( int i = 1; i < count; i++ ) {
+        if ( ClaimTask ( &task [i] ) == true ) {
+            function ( data, i, threadIndex );
+        } else {
+            WaitTask ( &task [i] );
+        }
+    }
+
+    delete [] task;
+}
+
+int AtomicAdd ( volatile int *value, int delta )
+{
+    return __sync_fetch_and_add ( value, delta );
+}
+
+struct sLock {
+    pthread_mutex_t  mutex;
+};
+
+sLock *NewLock ()
+{
+    sLock *lock = new sLock;
+    pthread_mutex_init ( &lock->mutex, NULL );
+    return lock;
+}
+
+void FreeLock ( sLock *lock )
+{
+    pthread_mutex_destroy ( &lock->mutex );
+    delete lock;
+}
+
+void Lock ( sLock *lock )
+{
+    pthread_mutex_lock ( &lock->mutex );
+}
+
+void Unlock ( sLock *lock )
+{
+    pthread_mutex_unlock ( &lock->mutex );
+}
+
+#else
+
+// No thread support - everything is done by the calling thread
+
+int ProcessorCount ()
+{
+    return 1;
+}
+
+void StartThreads ( int )
+{
+}
+
+void StopThreads ()
+{
+}
+
+int ThreadCount ()
+{
+    return 1;
+}
+
+void QueueTask ( sTask *task )
+{
+    task->done = false;
+}
+
+bool ClaimTask ( sTask * )
+{
+    return true;
+}
+
+void WaitTask ( sTask * )
+{
+}
+
+void RunParallel ( THREAD_FUNCTION function, void *data, int count )
+{
+    for ( int i = 0; i < count; i++ ) function ( data, i, 0 );
+}
+
+int AtomicAdd ( volatile int *value, int delta )
+{
+    int old = *value;
+    *value += delta;
+    return old;
+}
+
+struct sLock {
+    int  dummy;
+};
+
+sLock *NewLock ()
+{
+    return new sLock;
+}
+
+void FreeLock ( sLock *lock )
+{
+    delete lock;
+}
+
+void Lock ( sLock * )
+{
+}
+
+void Unlock ( sLock * )
+{
+}
+
+#endif
@@ -0,0 +1,56 @@
+//
+// Copyright (c) 2004 Marc Rousseau
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     Worker thread routines used to spread work across processors
+//
+
+#ifndef THREADS_HPP_
+#define THREADS_HPP_
+
+// Called once for each work item: ( data, index, thread )
+typedef void (*THREAD_FUNCTION) ( void *, int, int );
+
+struct sTask {
+    THREAD_FUNCTION  function;
+    void            *data;
+    int              index;
+    volatile bool    done;
+};
+
+int  ProcessorCount ();
+
+void StartThreads ( int count );
+void StopThreads ();
+int  ThreadCount ();
+
+// Hand a task to the pool.  The owner must then either take it back with
+//   ClaimTask (and run it itself) or wait for another thread to finish it.
+void QueueTask ( sTask *task );
+bool ClaimTask ( sTask *task );
+void WaitTask ( sTask *task );
+
+void RunParallel ( THREAD_FUNCTION function, void *data, int count );
+
+// Add delta to *value and return the original value as a single step
+int  AtomicAdd ( volatile int *value, int delta );
+
+// A lock guarding data shared between threads
+struct sLock;
+
+sLock *NewLock ();
+void   FreeLock ( sLock * );
+void   Lock ( sLock * );
+void   Unlock ( sLock * );
+
+#endif
@@ -0,0 +1,219 @@
+//
+// Copyright (c) 2004 Marc Rousseau
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     Routines used to classify a block of SEGs against a partition line.
+//     The endpoints are handed over as separate lists of coordinates so a
+//     group of SEGs can be checked at once using SSE or AVX instructions.
+//     The routine used is picked at startup based on the processor.
+//
+//     These routines only take care of the easy cases, any SEG that comes
+//     close to the partition line is left for _WhichSide to look at.  They
+//     use the same calculations as _WhichSide (in the same order) so the
+//     answers are always the same.
+//
+
+#include <math.h>
+#include "common.hpp"
+#include "level.hpp"
+#include "ZenNode.hpp"
+#include "whichside.hpp"
+
+#if defined ( __GNUC__ ) && defined ( __x86_64__ )
+    #define SIMD_SIDES
+    #include <immintrin.h>
+#endif
+
+#define EPSILON                 0.0001
+
+typedef void (*SIDE_FUNCTION) ( const sPartition *, const double *, const double *, const double *, const double *, int, signed char * );
+
+// Indexed by: bit 0 - y1 < 0, bit 1 - y2 < 0, bit 2 - too close to call
+static const signed char sideTable [8] = {
+    SIDE_LEFT,    SIDE_SPLIT,   SIDE_SPLIT,   SIDE_RIGHT,
+    SIDE_UNKNOWN, SIDE_UNKNOWN, SIDE_UNKNOWN, SIDE_UNKNOWN
+};
+
+//----------------------------------------------------------------------------
+//  Work out the values needed by all of the routines.  For partitions that
+//    lie along the X or Y axis, _WhichSide rounds the coordinates and only
+//    looks at one of them.  Otherwise it uses the perpendicular distance
+//    (scaled by the length of the partition) from each end of the SEG and
+//    anything closer than H (the length squared) gets a closer look.  A
+//    little extra is allowed in case the compiler rounds differently.
+//----------------------------------------------------------------------------
+
+struct sSideSetup {
+    bool     axis;			// partition is horizontal or vertical
+    bool     useX;			// vertical partition - compare X coordinates
+    int      flip;			// 3 if y = origin - coordinate, 0 if y = coordinate - origin
+    double   origin;			// rounded X or Y coordinate of the partition
+    double   limit;			// SEGs with |y1| or |y2| <= limit are SIDE_UNKNOWN
+};
+
+static void SetupSides ( const sPartition *part, sSideSetup *setup )
+{
+    if ( part->DX == 0.0 ) {
+        setup->axis   = true;
+        setup->useX   = true;
+        setup->flip   = ( part->DY > 0.0 ) ? 3 : 0;
+        setup->origin = ( double ) lrint ( part->X );
+    } else if ( part->DY == 0.0 ) {
+        setup->axis   = true;
+        setup->useX   = false;
+        setup->flip   = ( part->DX > 0.0 ) ? 0 : 3;
+        setup->origin = ( double ) lrint ( part->Y );
+    } else {
+        setup->axis   = false;
+        setup->useX   = false;
+        setup->flip   = 0;
+        setup->origin = 0.0;
+    }
+    setup->limit = (( part->H > EPSILON ) ? part->H : EPSILON ) + EPSILON;
+}
+
+//----------------------------------------------------------------------------
+//  Store the sides for a group of SEGs given bit masks of their y1 & y2
+//    values.  When the partition is axis aligned the y values are exact, so
+//    a SEG that touches the partition goes to the side its other end is on.
+//    Only SEGs that lie on the partition need a closer look.
+//----------------------------------------------------------------------------
+
+static inline void StoreSides ( signed char *side, int count, int flip, int near, int neg1, int neg2, int zero1, int zero2 )
+{
+    int sign1 = ( neg1 & ~zero1 ) | ( neg2 & zero1 );
+    int sign2 = ( neg2 & ~zero2 ) | ( neg1 & zero2 );
+
+    for ( int j = 0; j < count; j++ ) {
+        side [j] = sideTable [ ((( sign1 >> j ) & 1 ) | ((( sign2 >> j ) & 1 ) << 1 ) | ((( near >> j ) & 1 ) << 2 )) ^ flip ];
+    }
+}
+
+static void ScalarSides ( const sPartition *part, const double *sx, const double *sy, const double *ex, const double *ey, int noSegs, signed char *side )
+{
+    sSideSetup setup;
+    SetupSides ( part, &setup );
+
+    double X = part->X, Y = part->Y, DX = part->DX, DY = part->DY;
+
+    if ( setup.axis == true ) {
+        const double *s = setup.useX ? sx : sy;
+        const double *e = setup.useX ? ex : ey;
+        for ( int i = 0; i < noSegs; i++ ) {
+            double y1 = ( double ) lrint ( s [i] ) - setup.origin;
+            double y2 = ( double ) lrint ( e [i] ) - setup.origin;
+            int zero1 = ( y1 == 0.0 ), zero2 = ( y2 == 0.0 );
+            StoreSides ( &side [i], 1, setup.flip, zero1 & zero2, y1 < 0.0, y2 < 0.0, zero1, zero2 );
+        }
+    } else {
+        for ( int i = 0; i < noSegs; i++ ) {
+            double y1 = DX * ( sy [i] - Y ) - DY * ( sx [i] - X );
+            double y2 = DX * ( ey [i] - Y ) - DY * ( ex [i] - X );
+            int near = ( fabs ( y1 ) <= setup.limit ) || ( fabs ( y2 ) <= setup.limit );
+            StoreSides ( &side [i], 1, 0, near, y1 < 0.0, y2 < 0.0, 0, 0 );
+        }
+    }
+}
+
+#if defined ( SIMD_SIDES )
+
+static void __attribute__ (( target ( "sse4.2" ))) SSE42Sides ( const sPartition *part, const double *sx, const double *sy, const double *ex, const double *ey, int noSegs, signed char *side )
+{
+    sSideSetup setup;
+    SetupSides ( part, &setup );
+
+    __m128d X  = _mm_set1_pd ( part->X ),  Y  = _mm_set1_pd ( part->Y );
+    __m128d DX = _mm_set1_pd ( part->DX ), DY = _mm_set1_pd ( part->DY );
+    __m128d zero   = _mm_setzero_pd ();
+    __m128d origin = _mm_set1_pd ( setup.origin );
+    __m128d limit  = _mm_set1_pd ( setup.limit );
+    __m128d absMask = _mm_castsi128_pd ( _mm_set1_epi64x ( 0x7FFFFFFFFFFFFFFFLL ));
+
+    int i = 0;
+    if ( setup.axis == true ) {
+        const double *s = setup.useX ? sx : sy;
+        const double *e = setup.useX ? ex : ey;
+        for ( ; i + 2 <= noSegs; i += 2 ) {
+            __m128d y1 = _mm_sub_pd ( _mm_round_pd ( _mm_loadu_pd ( s + i ), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ), origin );
+            __m128d y2 = _mm_sub_pd ( _mm_round_pd ( _mm_loadu_pd ( e + i ), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ), origin );
+            int zero1 = _mm_movemask_pd ( _mm_cmpeq_pd ( y1, zero ));
+            int zero2 = _mm_movemask_pd ( _mm_cmpeq_pd ( y2, zero ));
+            StoreSides ( &side [i], 2, setup.flip, zero1 & zero2, _mm_movemask_pd ( y1 ), _mm_movemask_pd ( y2 ), zero1, zero2 );
+        }
+    } else {
+        for ( ; i + 2 <= noSegs; i += 2 ) {
+            __m128d y1 = _mm_sub_pd ( _mm_mul_pd ( DX, _mm_sub_pd ( _mm_loadu_pd ( sy + i ), Y )), _mm_mul_pd ( DY, _mm_sub_pd ( _mm_loadu_pd ( sx + i ), X )));
+            __m128d y2 = _mm_sub_pd ( _mm_mul_pd ( DX, _mm_sub_pd ( _mm_loadu_pd ( ey + i ), Y )), _mm_mul_pd ( DY, _mm_sub_pd ( _mm_loadu_pd ( ex + i ), X )));
+            int near = _mm_movemask_pd ( _mm_or_pd ( _mm_cmple_pd ( _mm_and_pd ( y1, absMask ), limit ),
+                                                     _mm_cmple_pd ( _mm_and_pd ( y2, absMask ), limit )));
+            StoreSides ( &side [i], 2, 0, near, _mm_movemask_pd ( y1 ), _mm_movemask_pd ( y2 ), 0, 0 );
+        }
+    }
+
+    if ( i < noSegs ) ScalarSides ( part, sx + i, sy + i, ex + i, ey + i, noSegs - i, side + i );
+}
+
+static void __attribute__ (( target ( "avx2" ))) AVX2Sides ( const sPartition *part, const double *sx, const double *sy, const double *ex, const double *ey, int noSegs, signed char *side )
+{
+    sSideSetup setup;
+    SetupSides ( part, &setup );
+
+    __m256d X  = _mm256_set1_pd ( part->X ),  Y  = _mm256_set1_pd ( part->Y );
+    __m256d DX = _mm256_set1_pd ( part->DX ), DY = _mm256_set1_pd ( part->DY );
+    __m256d zero   = _mm256_setzero_pd ();
+    __m256d origin = _mm256_set1_pd ( setup.origin );
+    __m256d limit  = _mm256_set1_pd ( setup.limit );
+    __m256d absMask = _mm256_castsi256_pd ( _mm256_set1_epi64x ( 0x7FFFFFFFFFFFFFFFLL ));
+
+    int i = 0;
+    if ( setup.axis == true ) {
+        const double *s = setup.useX ? sx : sy;
+        const double *e = setup.useX ? ex : ey;
+        for ( ; i + 4 <= noSegs; i += 4 ) {
+            __m256d y1 = _mm256_sub_pd ( _mm256_round_pd ( _mm256_loadu_pd ( s + i ), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ), origin );
+            __m256d y2 = _mm256_sub_pd ( _mm256_round_pd ( _mm256_loadu_pd ( e + i ), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ), origin );
+            int zero1 = _mm256_movemask_pd ( _mm256_cmp_pd ( y1, zero, _CMP_EQ_OQ ));
+            int zero2 = _mm256_movemask_pd ( _mm256_cmp_pd ( y2, zero, _CMP_EQ_OQ ));
+            StoreSides ( &side [i], 4, setup.flip, zero1 & zero2, _mm256_movemask_pd ( y1 ), _mm256_movemask_pd ( y2 ), zero1, zero2 );
+        }
+    } else {
+        for ( ; i + 4 <= noSegs; i += 4 ) {
+            __m256d y1 = _mm256_sub_pd ( _mm256_mul_pd ( DX, _mm256_sub_pd ( _mm256_loadu_pd ( sy + i ), Y )), _mm256_mul_pd ( DY, _mm256_sub_pd ( _mm256_loadu_pd ( sx + i ), X )));
+            __m256d y2 = _mm256_sub_pd ( _mm256_mul_pd ( DX, _mm256_sub_pd ( _mm256_loadu_pd ( ey + i ), Y )), _mm256_mul_pd ( DY, _mm256_sub_pd ( _mm256_loadu_pd ( ex + i ), X )));
+            int near = _mm256_movemask_pd ( _mm256_or_pd ( _mm256_cmp_pd ( _mm256_and_pd ( y1, absMask ), limit, _CMP_LE_OQ ),
+                                                           _mm256_cmp_pd ( _mm256_and_pd ( y2, absMask ), limit, _CMP_LE_OQ )));
+            StoreSides ( &side [i], 4, 0, near, _mm256_movemask_pd ( y1 ), _mm256_movemask_pd ( y2 ), 0, 0 );
+        }
+    }
+
+    if ( i < noSegs ) ScalarSides ( part, sx + i, sy + i, ex + i, ey + i, noSegs - i, side + i );
+}
+
+#endif
+
+static SIDE_FUNCTION SelectSideFunction ()
+{
+#if defined ( SIMD_SIDES )
+    __builtin_cpu_init ();
+    if ( __builtin_cpu_supports ( "avx2" ))   return AVX2Sides;
+    if ( __builtin_cpu_supports ( "sse4.2" )) return SSE42Sides;
+#endif
+    return ScalarSides;
+}
+
+static SIDE_FUNCTION sideFunction = SelectSideFunction ();
+
+void ClassifySides ( const sPartition *part, const double *sx, const double *sy, const double *ex, const double *ey, int noSegs, signed char *side )
+{
+    sideFunction ( part, sx, sy, ex, ey, noSegs, side );
+}
@@ -0,0 +1,31 @@
+//
+// Copyright (c) 2004 Marc Rousseau
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     Routines used to classify a block of SEGs against a partition line
+//
+
+#ifndef WHICHSIDE_HPP_
+#define WHICHSIDE_HPP_
+
+// Largest number of SEGs handed to ClassifySides at once
+#define SIDE_BLOCK		256
+
+struct sPartition;
+
+// Sets side[i] to SIDE_LEFT/SPLIT/RIGHT for the SEG running from (sx,sy) to
+//   (ex,ey), or SIDE_UNKNOWN if it lies too close to the partition to be
+//   decided without a closer look by _WhichSide.
+void ClassifySides ( const sPartition *part, const double *sx, const double *sy, const double *ex, const double *ey, int noSegs, signed char *side );
+
+#endif